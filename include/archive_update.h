@@ -0,0 +1,60 @@
+/**
+ * @file archive_update.h
+ * @brief Reuse unchanged entries from a previous archive (--update)
+ *
+ * A resubmission usually changes a handful of files. The previous archive
+ * is opened with the miniz reader and each file in the new list is
+ * matched against it by name, size, modification time and CRC-32. Entries
+ * that match, and are stored or use the codec of the new archive, are
+ * copied into the new archive as raw compressed bytes; only the rest are
+ * compressed again.
+ */
+
+#ifndef ARCHIVE_UPDATE_H
+#define ARCHIVE_UPDATE_H
+
+#include "common.h"
+#include "codec.h"
+#include "file_list.h"
+#include "../lib/miniz/miniz.h"
+
+/**
+ * @brief Previous archive and which of its entries can be reused
+ */
+typedef struct {
+    mz_zip_archive reader;
+    int           *reuse;     /* Per file_list entry: index in reader, or -1 */
+    int            unchanged; /* Entries of reuse that are not -1 */
+    bool           same_names; /* Reader holds exactly these names, in order */
+} ArchiveUpdate_t;
+
+/**
+ * @brief Open the previous archive and compare it against a file list
+ *
+ * @param previous_path Archive produced by an earlier run
+ * @param file_list Files about to be archived
+ * @param method ZIP method the new archive compresses with
+ * @param use_mmap Map files when computing their CRC-32
+ * @param update Comparison result (output)
+ * @return SUCCESS on success, error code on failure
+ */
+int open_archive_update(const char *previous_path, const FileList_t *file_list,
+                        mz_uint16 method, bool use_mmap, ArchiveUpdate_t *update);
+
+/**
+ * @brief Whether archiving the list again would reproduce the old archive
+ *
+ * @param update Result of open_archive_update()
+ * @param file_count Number of files in the list
+ * @return true if every file is unchanged and nothing was added or removed
+ */
+bool archive_update_is_noop(const ArchiveUpdate_t *update, int file_count);
+
+/**
+ * @brief Close the previous archive and free the comparison
+ *
+ * @param update Update state (may already be closed)
+ */
+void close_archive_update(ArchiveUpdate_t *update);
+
+#endif // ARCHIVE_UPDATE_H
@@ -10,31 +10,101 @@
 #define ARCHIVER_H
 
 #include "common.h"
+#include "codec.h"
+#include "compress.h"
+#include "file_list.h"
+#include "memory_budget.h"
+#include "output_writer.h"
+#include "prefetch.h"
+#include "thread_pool.h"
+#include "time_budget.h"
 #include "../lib/miniz/miniz.h"
 
 /* Archive configuration */
 #define DEFAULT_COMPRESSION_LEVEL 6
 #define MAX_COMPRESSION_LEVEL     9
 
+/* Output path that streams the archive to standard output */
+#define STDOUT_OUTPUT_PATH "-"
+
+/* Entries kept in flight per worker when compressing in parallel */
+#define JOB_WINDOW_PER_WORKER 4
+
+/* Files at least this large are deflated into the archive as they are
+ * read, COMPRESS_BLOCK_SIZE at a time, instead of in memory first */
+#define STREAM_ENTRY_SIZE (16 * 1024 * 1024)
+
+/* ZIP bytes per entry besides its data and name: local header (30), data
+ * descriptor (24), central directory record (46) and zip64 extras (32) */
+#define ZIP_ENTRY_OVERHEAD 132
+#define ZIP_END_RECORD_SIZE 22
+
+/* With --max-memory, the output buffer gets this share of the cap, within
+ * MIN_OUTPUT_BUFFER and OUTPUT_BUFFER_SIZE */
+#define OUTPUT_BUFFER_SHARE 16
+#define MIN_OUTPUT_BUFFER   (64 * 1024)
+
 /**
  * @brief Archive options structure
  */
 typedef struct {
-    int  compression_level; /* Compression level (0-9) */
+    int  compression_level; /* Compression level (0 to codec->max_level) */
     bool verbose;           /* Verbose output */
     char *input_path; /* path to input folder */
     char *output_path; /* path to output ZIP file*/
+    int  jobs;              /* Worker threads for compression (1 = serial) */
+    size_t chunk_threshold; /* Split entries at least this large (0 = never) */
+    bool store_fallback;    /* Store files that do not compress */
+    bool use_mmap;          /* Map input files instead of reading them */
+    bool direct_io;         /* Write the archive with O_DIRECT */
+    char *store_path;       /* Cohort store to add to / export from */
+    char *student_id;       /* Manifest name in the store (NULL = input dir name) */
+    char *export_student;   /* Student whose ZIP to export from the store */
+    char *update_path;      /* Previous archive to reuse unchanged entries from */
+    char *batch_path;       /* Roster of submissions to archive in one run */
+    ThreadPool_t *pool;     /* Pool shared with other archives (NULL = own pool) */
+    const Codec_t *codec;   /* How entries are compressed (default: deflate) */
+    bool solid;             /* Pack small files into solid blocks (see solid.h) */
+    bool estimate;          /* Predict size and time instead of archiving */
+    double time_budget;     /* Seconds the archive may take (0 = fixed level) */
+    size_t max_memory;      /* Cap on the process's memory in bytes (0 = none) */
+    bool prefetch;          /* Read upcoming entries ahead (see prefetch.h) */
+    AsyncIoBackend_t io;    /* How entries are read ahead and output written behind */
+    char *manifest_cache;   /* Directory of compiled .LT_FILES (NULL = always parse) */
 } ArchiveOptions_t;
 
 typedef struct {
     char * LT_FILES_path;
-    char ** file_list;
-    int * file_count;
+    FileList_t * file_list;
 } ArchiverFILES;
 
+/**
+ * @brief Destination for archive bytes
+ *
+ * Called with the archive data in order, exactly once per byte; the sink
+ * never has to seek. Returns the number of bytes consumed, and anything
+ * short of n is treated as a write error.
+ */
+typedef size_t (*archive_write_fn)(void *opaque, const void *buf, size_t n);
+
 typedef struct {
     mz_zip_archive * zip;
     int compression_level;
+    const Codec_t *codec;             /* How entries are compressed */
+    bool store_fallback;              /* Store entries that do not compress */
+    bool use_mmap;                    /* Map input files instead of reading them */
+    int stored_fallback_files;        /* Entries that took the store path */
+    mz_uint64 stored_fallback_bytes;  /* Bytes in those entries */
+    int reused_files;                 /* Entries copied from a previous archive */
+    archive_write_fn write_fn;        /* Sink for archive bytes */
+    void *write_opaque;               /* Passed to write_fn */
+    mz_uint64 write_offset;           /* Bytes handed to write_fn so far */
+    FILE *log;                        /* Where progress messages go */
+    OutputWriter_t *output;           /* Owned output, NULL for caller sinks */
+    TimeBudget_t *budget;             /* Picks each entry's level (NULL = fixed) */
+    MemoryBudget_t *memory;           /* Counts working memory (NULL = not counted) */
+    size_t output_reserved;           /* Part of memory held by the output buffer */
+    Prefetch_t *prefetch;             /* Reads entries ahead (NULL = no accounting) */
 } archive_state;
 
 /**
@@ -68,12 +138,81 @@ int parse_archive_args(int argc, char **argv, ArchiveOptions_t *options);
 /**
  * @brief Create a new ZIP archive
  *
- * @param output_path Path where the ZIP file will be created
+ * @param output_path Path where the ZIP file will be created, or "-" for stdout
  * @param compression_level Compression level (0-9)
  * @return Pointer to archive state, or NULL on failure
  */
 archive_state *create_archive(const char *output_path, int compression_level);
 
+/**
+ * @brief Create a new ZIP archive with control over how the file is written
+ *
+ * With a memory budget, miniz allocates from it and the output buffer is
+ * sized to fit it.
+ *
+ * @param output_path Path where the ZIP file will be created, or "-" for stdout
+ * @param compression_level Compression level (0-9)
+ * @param size_estimate Expected archive size used to preallocate (0 = unknown)
+ * @param direct_io Write with O_DIRECT, bypassing the page cache
+ * @param memory Budget to count memory against (NULL = none)
+ * @return Pointer to archive state, or NULL on failure
+ */
+archive_state *create_archive_file(const char *output_path, int compression_level,
+                                   mz_uint64 size_estimate, bool direct_io,
+                                   MemoryBudget_t *memory);
+
+/**
+ * @brief Create a new ZIP archive that is written through a callback
+ *
+ * Every entry uses a data descriptor, so the archive is produced front to
+ * back without seeking and can be sent to a pipe, socket or upload stream.
+ *
+ * @param write_fn Sink that receives the archive bytes in order
+ * @param opaque Passed to write_fn unchanged
+ * @param compression_level Compression level (0-9)
+ * @return Pointer to archive state, or NULL on failure
+ */
+archive_state *create_archive_with_writer(archive_write_fn write_fn,
+                                          void *opaque, int compression_level);
+
+/**
+ * @brief Stream that progress messages should be printed to
+ *
+ * This is stdout, unless the archive itself is going to stdout.
+ *
+ * @param options Archive options
+ * @return stdout or stderr
+ */
+FILE *archive_log_stream(const ArchiveOptions_t *options);
+
+/**
+ * @brief Name a file is stored under inside the archive
+ *
+ * @param file_path Path to the file on disk
+ * @return The final path component of file_path
+ */
+const char *archive_name_for(const char *file_path);
+
+/**
+ * @brief Name of a submission: the last component of its directory
+ *
+ * @param input_path Submission directory (trailing slashes are ignored)
+ * @param name Buffer to store the name
+ * @param size Size of the name buffer
+ */
+void submission_name(const char *input_path, char *name, size_t size);
+
+/**
+ * @brief Memory compressing one entry holds: its input, a worst-case
+ *        output and the codec's state
+ *
+ * @param codec Codec the entry is compressed with
+ * @param level Compression level
+ * @param size Size of the entry
+ * @return Bytes to reserve from a memory budget
+ */
+size_t entry_working_memory(const Codec_t *codec, int level, size_t size);
+
 /**
  * @brief Add a single file to the archive
  *
@@ -86,6 +225,25 @@ archive_state *create_archive(const char *output_path, int compression_level);
 int add_file_to_archive(archive_state *archive, const char *file_path,
                         const char *archive_name, bool verbose);
 
+/**
+ * @brief Add an entry that has already been compressed
+ *
+ * Compressed entries are copied into the archive as-is, under the ZIP
+ * method the codec recorded; stored entries are written from input.
+ * Either way no compression happens here.
+ *
+ * @param archive Pointer to archive state
+ * @param archive_name Path/name of file inside the ZIP archive
+ * @param input Uncompressed contents (only read for stored entries)
+ * @param entry Compressed entry from compress_entry_data()
+ * @param modified Modification time to record, or NULL for now
+ * @return SUCCESS on success, error code on failure
+ */
+int add_compressed_entry_to_archive(archive_state *archive, const char *archive_name,
+                                    const unsigned char *input,
+                                    const CompressedEntry_t *entry,
+                                    MZ_TIME_T *modified);
+
 /**
  * @brief Finalize and close the archive
  *
@@ -98,22 +256,23 @@ int finalize_archive(archive_state *archive, bool verbose);
 /**
  * @brief Validate that all files in the list exist
  *
- * @param file_list Array of file paths to validate
- * @param file_count Number of files in the list
+ * @param file_list Files to validate
  * @return SUCCESS if all files exist, error code otherwise
  */
-int validate_file_list(char **file_list, int file_count);
+int validate_file_list(const FileList_t *file_list);
 
 /**
  * @brief Create a ZIP archive from a list of files
  *
- * @param file_list Array of file paths to archive
- * @param file_count Number of files to archive
+ * With options->store_path set, the files are added to that cohort store
+ * (see cohort_store.h) instead of being written to a ZIP.
+ *
+ * @param file_list Files to archive
  * @param output_path Path for the output ZIP file
  * @param options Archive options (compression level, verbose, etc.)
  * @return SUCCESS on success, error code on failure
  */
-int create_archive_from_file_list(char **file_list, int file_count,
+int create_archive_from_file_list(const FileList_t       *file_list,
                                   const char             *output_path,
                                   const ArchiveOptions_t *options);
 
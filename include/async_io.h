@@ -0,0 +1,154 @@
+/**
+ * @file async_io.h
+ * @brief Asynchronous positional reads and writes for the archive pipeline
+ *
+ * Requests are queued with async_io_submit() and handed to the kernel in
+ * batches, so reading upcoming entries and writing finished output overlap
+ * with compression instead of blocking it. On Linux the requests go
+ * through an io_uring set up with the raw system calls (no liburing
+ * needed). Where io_uring is unavailable (old kernels, seccomp filters,
+ * kernel.io_uring_disabled) a single I/O thread runs them with
+ * pread()/pwrite(), and failing that they run synchronously on submit.
+ *
+ * At most depth requests are in flight; submitting past that first waits
+ * for one to complete, which bounds the queues between pipeline stages.
+ * An AsyncIo_t belongs to one thread: only that thread may submit to it
+ * and wait on it.
+ */
+
+#ifndef ASYNC_IO_H
+#define ASYNC_IO_H
+
+#include "common.h"
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/**
+ * @brief How requests are carried out
+ */
+typedef enum {
+    ASYNC_IO_SYNC,    /* On submit, by the calling thread */
+    ASYNC_IO_THREADS, /* By an I/O thread */
+    ASYNC_IO_URING    /* By the kernel through an io_uring */
+} AsyncIoBackend_t;
+
+/**
+ * @brief One read or write, owned by the caller until it is done
+ */
+typedef struct AsyncIoRequest {
+    int                    fd;
+    bool                   write;  /* false = read */
+    struct iovec           iov;    /* Buffer and length */
+    off_t                  offset; /* Position in the file */
+    long                   result; /* Bytes transferred, or -errno */
+    bool                   done;
+    struct AsyncIoRequest *next;   /* Queue link for the I/O thread */
+} AsyncIoRequest_t;
+
+/**
+ * @brief Request queue state
+ */
+typedef struct {
+    AsyncIoBackend_t backend;
+    unsigned         depth;     /* Most requests in flight */
+    unsigned         in_flight; /* Submitted and not reaped yet */
+    long             requests;  /* Requests submitted */
+    long             enters;    /* io_uring_enter() calls */
+
+    /* io_uring: the ring descriptor and its mapped queues */
+    int       ring_fd;
+    void     *sq_ring;
+    size_t    sq_ring_size;
+    void     *cq_ring;
+    size_t    cq_ring_size;
+    void     *sqes;
+    size_t    sqes_size;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    void     *cqes;
+    unsigned  unsubmitted; /* Entries queued since the last enter */
+
+    /* I/O thread */
+    pthread_t         thread;
+    pthread_mutex_t   lock;
+    pthread_cond_t    work_ready; /* Signalled when a request is queued */
+    pthread_cond_t    work_done;  /* Broadcast when a request completes */
+    AsyncIoRequest_t *head;
+    AsyncIoRequest_t *tail;
+    bool              shutting_down;
+} AsyncIo_t;
+
+/**
+ * @brief Set up a request queue, falling back from io_uring to an I/O
+ *        thread to synchronous I/O as far as needed
+ *
+ * @param io Queue to initialize; io->backend says what was set up
+ * @param backend Preferred backend
+ * @param depth Most requests in flight (at least 1)
+ * @return SUCCESS on success, error code on failure
+ */
+int async_io_init(AsyncIo_t *io, AsyncIoBackend_t backend, unsigned depth);
+
+/**
+ * @brief Queue a request; it may not reach the kernel before
+ *        async_io_flush() or async_io_wait()
+ *
+ * Fills in request->fd, write, iov and offset from the arguments. Waits
+ * for an earlier request to complete if depth are already in flight.
+ *
+ * @param io Request queue
+ * @param request Request to fill in and queue (kept valid until done)
+ * @param fd Descriptor to read from or write to
+ * @param write Write buf to fd instead of reading into it
+ * @param buf Buffer
+ * @param length Bytes to transfer
+ * @param offset Position in the file
+ * @return SUCCESS on success, error code on failure
+ */
+int async_io_submit(AsyncIo_t *io, AsyncIoRequest_t *request, int fd, bool write,
+                    void *buf, size_t length, off_t offset);
+
+/**
+ * @brief Hand every queued request to the kernel in one call
+ *
+ * @param io Request queue
+ * @return SUCCESS on success, ERROR_IO on failure
+ */
+int async_io_flush(AsyncIo_t *io);
+
+/**
+ * @brief Wait until a request is done, completing a short transfer
+ *        synchronously
+ *
+ * A read stops short only at the end of the file.
+ *
+ * @param io Request queue
+ * @param request Request to wait for
+ * @return SUCCESS if the request succeeded, ERROR_IO otherwise
+ */
+int async_io_wait(AsyncIo_t *io, AsyncIoRequest_t *request);
+
+/**
+ * @brief Wait for every request in flight and release the queue
+ *
+ * @param io Request queue (may be all zeros, never initialized)
+ */
+void async_io_destroy(AsyncIo_t *io);
+
+/**
+ * @brief Name of a backend ("sync", "threads" or "io_uring")
+ */
+const char *async_io_backend_name(AsyncIoBackend_t backend);
+
+/**
+ * @brief Look up a backend by the name --io takes ("sync", "threads" or
+ *        "uring")
+ *
+ * @param name Name to look up
+ * @param backend Backend (output)
+ * @return SUCCESS on success, ERROR_INVALID_ARGS for an unknown name
+ */
+int async_io_backend_by_name(const char *name, AsyncIoBackend_t *backend);
+
+#endif // ASYNC_IO_H
@@ -0,0 +1,72 @@
+/**
+ * @file batch.h
+ * @brief Archive a whole roster of submissions in one run (--batch)
+ *
+ * The roster is either a directory whose subdirectories are submissions,
+ * or a text file naming one submission directory per line ('#' starts a
+ * comment). Each submission's .LT_FILES is parsed and archived as a task
+ * on a single worker pool, and each archive's entries are compressed on
+ * that same pool, so one student's file I/O overlaps another's
+ * compression. A submission that fails is recorded in the summary and
+ * does not stop the others.
+ *
+ * The summary (BATCH_SUMMARY_NAME, tab-separated, one line per student in
+ * roster order) goes next to the archives, or into the cohort store.
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "archiver.h"
+
+#define BATCH_SUMMARY_NAME      "batch-summary.tsv"
+#define BATCH_ARCHIVE_EXTENSION ".zip"
+
+/**
+ * @brief One submission in the roster and what archiving it did
+ */
+typedef struct {
+    char     *input_path;                   /* Submission directory */
+    char      student[MAX_FILENAME_LENGTH]; /* Last component of input_path */
+    int       status;       /* SUCCESS or the error code archiving returned */
+    int       files;        /* Files listed by the submission's .LT_FILES */
+    mz_uint64 input_bytes;  /* Size of those files */
+    mz_uint64 output_bytes; /* Archive size, or new blob bytes in a store */
+    double    seconds;      /* Wall time spent on the submission */
+} BatchEntry_t;
+
+/**
+ * @brief Read a roster into a list of submissions
+ *
+ * A directory roster is listed in name order, skipping hidden entries and
+ * skip_path (the output directory, if it lives inside the roster).
+ *
+ * @param roster_path Directory of submissions, or a file listing them
+ * @param skip_path Directory to leave out of a directory roster (may be NULL)
+ * @param entries Array of submissions (output, free with free_batch_roster())
+ * @param count Number of submissions (output)
+ * @return SUCCESS on success, error code on failure
+ */
+int load_batch_roster(const char *roster_path, const char *skip_path,
+                      BatchEntry_t **entries, int *count);
+
+/**
+ * @brief Free a roster from load_batch_roster()
+ *
+ * @param entries Array of submissions (may be NULL)
+ * @param count Number of submissions
+ */
+void free_batch_roster(BatchEntry_t *entries, int count);
+
+/**
+ * @brief Archive every submission in a roster and write the summary
+ *
+ * @param roster_path Directory of submissions, or a file listing them
+ * @param options Archive options; output_path is the directory for the
+ *                archives, or store_path the cohort store to add to
+ * @return SUCCESS if every submission was archived, otherwise the error
+ *         code of the first one that failed
+ */
+int run_batch(const char *roster_path, const ArchiveOptions_t *options);
+
+#endif // BATCH_H
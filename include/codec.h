@@ -0,0 +1,102 @@
+/**
+ * @file codec.h
+ * @brief Compression methods an archive's entries can be written with
+ *
+ * Every entry of an archive goes through one codec: deflate (miniz, ZIP
+ * method 8) by default, or Zstandard (the vendored lib/zstd, ZIP method
+ * 93), which compresses faster at high levels and inflates several times
+ * faster. Both codecs follow the same store rules as compress_entry_data()
+ * and produce a CompressedEntry_t the archive writer takes as-is.
+ */
+
+#ifndef CODEC_H
+#define CODEC_H
+
+#include "common.h"
+#include "compress.h"
+
+/* ZIP compression methods (APPNOTE 4.4.5) */
+#define ZIP_METHOD_STORE   0
+#define ZIP_METHOD_DEFLATE MZ_DEFLATED
+#define ZIP_METHOD_ZSTD    93
+
+#define DEFAULT_CODEC_NAME "deflate"
+
+/**
+ * @brief Compress a whole entry into memory
+ *
+ * Same contract as compress_entry_data(): level 0 and entries of 3 bytes
+ * or less are stored, and with allow_store set so is anything that does
+ * not shrink.
+ */
+typedef int (*codec_compress_fn)(const unsigned char *data, size_t size, int level,
+                                 bool allow_store, CompressedEntry_t *entry);
+
+/**
+ * @brief Compress a large entry in pieces on a thread pool
+ */
+typedef int (*codec_compress_parallel_fn)(const unsigned char *data, size_t size,
+                                          int level, bool allow_store,
+                                          ThreadPool_t *pool, CompressedEntry_t *entry);
+
+/**
+ * @brief Decompress an entry's payload into a buffer of its original size
+ *
+ * @return SUCCESS if exactly out_size bytes were produced, error code otherwise
+ */
+typedef int (*codec_decompress_fn)(const unsigned char *data, size_t size,
+                                   unsigned char *out, size_t out_size);
+
+/**
+ * @brief Working memory one compression needs besides its input and output
+ *
+ * @param level Compression level
+ * @param size Size of the entry
+ * @return Bytes of compressor state
+ */
+typedef size_t (*codec_memory_fn)(int level, size_t size);
+
+/**
+ * @brief One compression method
+ */
+typedef struct {
+    const char                *name;          /* --codec value */
+    mz_uint16                  method;        /* ZIP method of compressed entries */
+    int                        default_level; /* Level when -l is not given */
+    int                        max_level;     /* Highest accepted -l */
+    codec_compress_fn          compress;
+    codec_compress_parallel_fn compress_parallel; /* NULL = never split entries */
+    codec_decompress_fn        decompress;
+    codec_memory_fn            working_memory;
+} Codec_t;
+
+/**
+ * @brief List the available codecs, the default first
+ *
+ * @param codecs Set to the array of codecs (output)
+ * @return Number of codecs in the array
+ */
+int codec_list(const Codec_t **codecs);
+
+/**
+ * @brief Look up a codec by its --codec name
+ *
+ * @param name Codec name, e.g. "deflate" or "zstd"
+ * @return The codec, or NULL if there is none by that name
+ */
+const Codec_t *codec_by_name(const char *name);
+
+/**
+ * @brief Look up the codec that writes a ZIP compression method
+ *
+ * @param method ZIP compression method of an entry
+ * @return The codec, or NULL for stored and unknown methods
+ */
+const Codec_t *codec_for_method(mz_uint16 method);
+
+/**
+ * @brief The deflate codec archives use unless told otherwise
+ */
+const Codec_t *default_codec(void);
+
+#endif // CODEC_H
@@ -0,0 +1,83 @@
+/**
+ * @file cohort_store.h
+ * @brief Deduplicating, content-addressed store for a cohort's submissions
+ *
+ * Most of a section's submissions share files (starter Makefiles, test
+ * data, headers). Instead of a ZIP per student, the store keeps every
+ * distinct file body once, compressed, named by its SHA-256:
+ *
+ *   DIR/blobs/ab/cdef...      one compressed body (see COHORT_BLOB_*)
+ *   DIR/manifests/ID.manifest one line per file: sha256 mtime name
+ *
+ * A student's standard ZIP can be exported from the store at any time
+ * without recompressing anything.
+ */
+
+#ifndef COHORT_STORE_H
+#define COHORT_STORE_H
+
+#include "archiver.h"
+
+#define COHORT_BLOB_DIR           "blobs"
+#define COHORT_MANIFEST_DIR       "manifests"
+#define COHORT_MANIFEST_EXTENSION ".manifest"
+#define COHORT_MANIFEST_HEADER    "# labtest cohort manifest 1"
+
+/*
+ * Blob layout, little-endian:
+ *   0  magic COHORT_BLOB_MAGIC (8 bytes, NUL-padded)
+ *   8  ZIP method: 0 = stored, 8 = deflate, 93 = zstd
+ *   9  flags: COHORT_BLOB_STORE_FALLBACK
+ *   12 CRC-32 of the original data
+ *   16 original size
+ *   24 size of the payload that follows the header
+ */
+#define COHORT_BLOB_MAGIC          "LTBLOB1"
+#define COHORT_BLOB_HEADER_SIZE    32
+#define COHORT_BLOB_STORE_FALLBACK 1
+
+/**
+ * @brief What adding one submission to the store did
+ */
+typedef struct {
+    int       files;              /* Entries in the manifest */
+    int       new_blobs;          /* Bodies compressed and written */
+    int       reused_blobs;       /* Bodies that were already in the store */
+    mz_uint64 input_bytes;        /* Size of all files in the submission */
+    mz_uint64 written_bytes;      /* Blob bytes written for new bodies */
+    mz_uint64 deduplicated_bytes; /* Input bytes that were not stored again */
+} CohortStats_t;
+
+/**
+ * @brief Add one student's files to a cohort store
+ *
+ * Creates the store if needed and replaces any existing manifest for the
+ * student. Only bodies not already in the store are compressed.
+ *
+ * @param store_dir Root directory of the store
+ * @param student Manifest name, or NULL to use the last component of
+ *                options->input_path
+ * @param file_list Files to add
+ * @param options Archive options (compression level, verbose, etc.)
+ * @param stats What was done (output, may be NULL)
+ * @return SUCCESS on success, error code on failure
+ */
+int cohort_store_add(const char *store_dir, const char *student,
+                     const FileList_t *file_list, const ArchiveOptions_t *options,
+                     CohortStats_t *stats);
+
+/**
+ * @brief Write one student's submission from the store as a ZIP archive
+ *
+ * The compressed bodies are copied into the ZIP as they are.
+ *
+ * @param store_dir Root directory of the store
+ * @param student Manifest name
+ * @param output_path Path for the output ZIP file, or "-" for stdout
+ * @param options Archive options (verbose, direct_io, use_mmap)
+ * @return SUCCESS on success, error code on failure
+ */
+int cohort_store_export(const char *store_dir, const char *student,
+                        const char *output_path, const ArchiveOptions_t *options);
+
+#endif // COHORT_STORE_H
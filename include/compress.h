@@ -0,0 +1,124 @@
+/**
+ * @file compress.h
+ * @brief In-memory compression of single archive entries
+ *
+ * These helpers deflate a whole entry into memory so the work can be done
+ * away from the ZIP writer (e.g. on a worker thread) and the result
+ * appended to the archive later as pre-compressed data.
+ */
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include "common.h"
+#include "thread_pool.h"
+#include "../lib/miniz/miniz.h"
+
+/* Size of the pieces a large entry is split into for parallel deflate */
+#define PARALLEL_CHUNK_SIZE (1024 * 1024)
+
+/* Deflate window; each chunk is primed with this much preceding data */
+#define DEFLATE_WINDOW_SIZE 32768
+
+/* Default entry size above which deflate is split across threads */
+#define DEFAULT_CHUNK_THRESHOLD (16 * 1024 * 1024)
+
+/* Amount of data trial-compressed to spot incompressible entries */
+#define STORE_SAMPLE_SIZE (64 * 1024)
+
+/* Deflate output at or above this percentage of the input is not worth it */
+#define STORE_RATIO_PERCENT 95
+
+/* Input fed to the compressor between ratio checks */
+#define COMPRESS_BLOCK_SIZE (256 * 1024)
+
+/* Consecutive poor ratio checks before deflate is abandoned mid-stream */
+#define STORE_BAILOUT_BLOCKS 4
+
+/**
+ * @brief Result of compressing one entry
+ *
+ * When compressed is false the entry is stored and the payload is the
+ * original input buffer, which the caller still owns.
+ */
+typedef struct {
+    unsigned char *data;        /* Compressed stream (NULL when stored) */
+    size_t         comp_size;   /* Size of the payload written to the ZIP */
+    mz_uint64      uncomp_size; /* Size of the original data */
+    mz_uint32      crc32;       /* CRC-32 of the original data */
+    bool           compressed;  /* false = stored (method 0) */
+    mz_uint16      method;      /* ZIP method of data when compressed */
+    bool           store_fallback; /* Stored because compressing did not pay off */
+} CompressedEntry_t;
+
+/**
+ * @brief Guess whether deflating a buffer is a waste of time
+ *
+ * Trial-compresses the first STORE_SAMPLE_SIZE bytes at the fastest level
+ * and reports whether they failed to shrink below STORE_RATIO_PERCENT.
+ *
+ * @param data Input bytes
+ * @param size Number of input bytes
+ * @return true if the data looks incompressible, false otherwise
+ */
+bool looks_incompressible(const unsigned char *data, size_t size);
+
+/**
+ * @brief Compress a buffer the same way miniz's ZIP writer would
+ *
+ * Entries of 3 bytes or less, and all entries at level 0, are stored.
+ * With allow_store set, entries are also stored when a trial compression
+ * of their start looks incompressible, when the ratio stays above
+ * STORE_RATIO_PERCENT for STORE_BAILOUT_BLOCKS blocks in a row, or when
+ * the deflated result ends up no smaller than the input.
+ *
+ * @param data Input bytes
+ * @param size Number of input bytes
+ * @param level Compression level (0-9)
+ * @param allow_store Fall back to storing entries that do not compress
+ * @param entry Result (output)
+ * @return SUCCESS on success, error code on failure
+ */
+int compress_entry_data(const unsigned char *data, size_t size, int level,
+                        bool allow_store, CompressedEntry_t *entry);
+
+/**
+ * @brief Compress a large buffer by deflating chunks on a thread pool
+ *
+ * The buffer is split into PARALLEL_CHUNK_SIZE pieces. Each piece is
+ * deflated independently, primed with the preceding DEFLATE_WINDOW_SIZE
+ * bytes so matches can still reach back across the boundary, and ended
+ * with a sync flush. The pieces are then concatenated into one valid raw
+ * deflate stream and the per-chunk CRCs combined. The stream differs from
+ * what compress_entry_data() would produce but inflates to the same data.
+ *
+ * @param data Input bytes
+ * @param size Number of input bytes
+ * @param level Compression level (1-9)
+ * @param allow_store Fall back to storing entries that do not compress
+ * @param pool Pool to run the chunks on
+ * @param entry Result (output)
+ * @return SUCCESS on success, error code on failure
+ */
+int compress_entry_data_parallel(const unsigned char *data, size_t size,
+                                 int level, bool allow_store, ThreadPool_t *pool,
+                                 CompressedEntry_t *entry);
+
+/**
+ * @brief Combine the CRC-32 of two adjacent blocks of data
+ *
+ * @param crc1 CRC-32 of the first block
+ * @param crc2 CRC-32 of the second block
+ * @param len2 Length of the second block in bytes
+ * @return CRC-32 of the two blocks concatenated
+ */
+mz_uint32 crc32_combine(mz_uint32 crc1, mz_uint32 crc2, mz_uint64 len2);
+
+/**
+ * @brief Free the payload owned by a compressed entry
+ *
+ * @param entry Entry to release
+ */
+void free_compressed_entry(CompressedEntry_t *entry);
+
+#endif // COMPRESS_H
@@ -18,9 +18,8 @@
 #define CONFIG_H
 
 #include "common.h"
-
-/* Maximum number of files that can be specified in config */
-#define MAX_CONFIG_FILES 1000
+#include "file_list.h"
+#include "manifest.h"
 
 /**
  * TODO: Define own structs here to represent:
@@ -99,25 +98,21 @@ bool validate_required_path(const char *path);
  * @brief List all files in a directory recursively
  *
  * @param dir_path Directory path to traverse
- * @param file_list Array to store found file paths (output)
- * @param max_files Maximum number of files that can be stored
- * @param file_count Current count of files in the list (input/output)
+ * @param file_list List to add found files to (input/output)
  * @return SUCCESS on success, error code on failure
  */
-int list_directory_files(const char *dir_path, char **file_list, int max_files,
-                         int *file_count);
+int list_directory_files(const char *dir_path, FileList_t *file_list);
 
 /**
  * @brief Add a single file path to the file list
  *
- * @param file_list Array to store file paths
- * @param file_count Current count of files (input/output)
- * @param max_files Maximum number of files
+ * A path already in the list is skipped.
+ *
+ * @param file_list List to add the file to (input/output)
  * @param file_path File path to add
  * @return SUCCESS on success, error code on failure
  */
-int add_file_to_list(char **file_list, int *file_count, int max_files,
-                     const char *file_path);
+int add_file_to_list(FileList_t *file_list, const char *file_path);
 
 /**
  * @brief Check if a path contains a glob pattern (*, ?, etc.)
@@ -131,32 +126,71 @@ bool is_glob_pattern(const char *path);
  * @brief Expand a glob pattern and add matching files to the list
  *
  * @param pattern Glob pattern (e.g., "*.txt")
- * @param file_list Array to store matching file paths
- * @param max_files Maximum number of files
- * @param file_count Current count of files (input/output)
+ * @param file_list List to add matching files to (input/output)
  * @return SUCCESS on success, error code on failure
  */
-int expand_glob_pattern(const char *pattern, char **file_list, int max_files,
-                        int *file_count);
+int expand_glob_pattern(const char *pattern, FileList_t *file_list);
 
 /**
- * @brief Parse a .LT_FILES configuration file
+ * @brief Set the directory compiled configs are cached in
+ *
+ * With a cache directory, load_config_manifest() (and so
+ * parse_config_file()) loads a config's compiled form from there when the
+ * same text was compiled before, and saves it there otherwise.
+ *
+ * @param cache_dir Cache directory, created when first written (NULL = no
+ *                  cache, the default)
+ */
+void config_use_manifest_cache(const char *cache_dir);
+
+/**
+ * @brief Compile the text of a .LT_FILES into a manifest
+ *
+ * Lines are read, stripped and sectioned exactly as parse_config_file()
+ * always has; entries outside a section are dropped.
+ *
+ * @param text Config text (need not be NUL-terminated)
+ * @param size Length of the text
+ * @param manifest Manifest (output, free with manifest_free())
+ * @return SUCCESS on success, error code on failure
+ */
+int compile_config_text(const char *text, size_t size, Manifest_t *manifest);
+
+/**
+ * @brief Read a .LT_FILES and compile it, or load its compiled form from
+ *        the manifest cache
  *
  * @param config_path Path to the .LT_FILES config file
- * @param file_list Array to store file paths to archive (output)
- * @param max_files Maximum number of files
- * @param file_count Number of files found (output)
+ * @param manifest Manifest (output, free with manifest_free())
+ * @param cached Set to whether the manifest came from the cache (may be NULL)
  * @return SUCCESS on success, error code on failure
  */
-int parse_config_file(const char *config_path, const char *base_dir, char **file_list, int max_files,
-                      int *file_count);
+int load_config_manifest(const char *config_path, Manifest_t *manifest, bool *cached);
 
 /**
- * @brief Free memory allocated for the file list
+ * @brief Add the files a manifest names under base_dir to a list
+ *
+ * Required paths must exist (directories are listed recursively); optional
+ * paths are added if they exist, directories listed recursively like
+ * required ones with or without a trailing /, and the optional glob
+ * patterns are all matched in one walk of base_dir (see glob_set.h).
  *
- * @param file_list Array of file paths to free
- * @param file_count Number of files in the list
+ * @param manifest Compiled config
+ * @param base_dir Directory the paths are relative to
+ * @param file_list List to add the files to (input/output)
+ * @return SUCCESS on success, error code on failure
+ */
+int apply_config_manifest(const Manifest_t *manifest, const char *base_dir,
+                          FileList_t *file_list);
+
+/**
+ * @brief Parse a .LT_FILES configuration file
+ *
+ * @param config_path Path to the .LT_FILES config file
+ * @param file_list List to add the files to archive to, from file_list_init()
+ *                  (output)
+ * @return SUCCESS on success, error code on failure
  */
-void free_file_list(char **file_list, int file_count);
+int parse_config_file(const char *config_path, const char *base_dir, FileList_t *file_list);
 
 #endif // CONFIG_H
@@ -0,0 +1,49 @@
+/**
+ * @file crc32.h
+ * @brief CRC-32 for ZIP entries with hardware acceleration
+ *
+ * miniz is built with USE_EXTERNAL_MZCRC, so its mz_crc32() comes from
+ * crc32.c. The first call picks the fastest variant the CPU supports:
+ * PCLMULQDQ folding on x86-64, the CRC32 instructions on ARMv8, or the
+ * portable table loop everywhere else. All variants produce the same
+ * value and use the zlib convention (start from 0, no extra inversion).
+ */
+
+#ifndef CRC32_H
+#define CRC32_H
+
+#include "common.h"
+#include <stdint.h>
+
+/**
+ * @brief A CRC-32 implementation
+ */
+typedef uint32_t (*crc32_fn)(uint32_t crc, const unsigned char *data, size_t len);
+
+/**
+ * @brief Named CRC-32 implementation, as listed by crc32_variants()
+ */
+typedef struct {
+    const char *name;
+    crc32_fn    fn;
+} Crc32Variant_t;
+
+/**
+ * @brief List the implementations this CPU can run
+ *
+ * The portable variant is always first; the last entry is the one
+ * mz_crc32() uses.
+ *
+ * @param variants Set to the array of usable variants (output)
+ * @return Number of entries in the array
+ */
+int crc32_variants(const Crc32Variant_t **variants);
+
+/**
+ * @brief Name of the variant mz_crc32() dispatches to
+ *
+ * @return "portable", "pclmul" or "armv8"
+ */
+const char *crc32_active_variant(void);
+
+#endif // CRC32_H
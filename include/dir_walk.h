@@ -0,0 +1,97 @@
+/**
+ * @file dir_walk.h
+ * @brief Recursive directory listing on directory file descriptors
+ *
+ * walk_directory() opens each directory relative to its parent's
+ * descriptor with openat() and reads it with getdents64() into a
+ * DIR_WALK_BUFFER_SIZE buffer, so no full path is resolved again per
+ * entry. Directories are recognised from the entry type the filesystem
+ * reports (d_type) without a stat; files, links and entries of unknown
+ * type get one statx() relative to the directory, which captures the
+ * metadata the list keeps for them (FileMeta_t). Regular files (also behind a link) are added to the list
+ * in the order the directory returns them, depth first, exactly as a
+ * readdir() + stat() walk would.
+ *
+ * walk_directory_parallel() lists directories on several threads, for
+ * trees large enough (or storage slow enough) that one round trip at a
+ * time is the bottleneck. Each thread keeps a deque of directories to
+ * list: it pushes the subdirectories it finds and pops the newest, and a
+ * thread whose deque runs dry steals the oldest directory from another.
+ * A directory is listed long after its parent's descriptor is closed,
+ * often on another thread, so it is opened by its full path; keeping a
+ * descriptor open for every queued directory could run out of them. Every
+ * directory keeps its entries in the order they were read, and the
+ * results are merged into the list depth first once all threads are
+ * done, so the list is identical to walk_directory()'s whatever the
+ * scheduling.
+ */
+
+#ifndef DIR_WALK_H
+#define DIR_WALK_H
+
+#include "common.h"
+#include "file_list.h"
+
+/* Bytes of directory entries fetched per getdents64() call */
+#define DIR_WALK_BUFFER_SIZE (64 * 1024)
+
+/**
+ * @brief System calls a walk made
+ */
+typedef struct {
+    long directories; /* Directories listed */
+    long entries;     /* Entries seen, "." and ".." excluded */
+    long opens;       /* openat() calls */
+    long getdents;    /* getdents64() calls */
+    long stats;       /* statx() calls */
+    long closes;      /* close() calls */
+} WalkStats_t;
+
+/**
+ * @brief Add every regular file under a directory to a list
+ *
+ * @param dir_path Directory to walk; paths are built as dir_path/name
+ * @param file_list List to add the files to (input/output)
+ * @param stats System calls made (output, may be NULL)
+ * @return SUCCESS on success, ERROR_IO if a directory cannot be read, or
+ *         another error code
+ */
+int walk_directory(const char *dir_path, FileList_t *file_list, WalkStats_t *stats);
+
+/**
+ * @brief Add every regular file under a directory to a list, listing
+ *        directories on several threads
+ *
+ * @param dir_path Directory to walk; paths are built as dir_path/name
+ * @param file_list List to add the files to (input/output)
+ * @param threads Threads to list directories on (1 or less walks serially)
+ * @param stats System calls made, summed over all threads (output, may be
+ *              NULL)
+ * @return Same result and list as walk_directory()
+ */
+int walk_directory_parallel(const char *dir_path, FileList_t *file_list, int threads,
+                            WalkStats_t *stats);
+
+/**
+ * @brief Set the threads list_directory_files() walks with
+ *
+ * @param threads Threads for walk_directory_parallel() (default 1)
+ */
+void dir_walk_use_threads(int threads);
+
+/**
+ * @brief Threads list_directory_files() walks with
+ *
+ * @return Value set by dir_walk_use_threads()
+ */
+int dir_walk_threads(void);
+
+/**
+ * @brief Total system calls of a walk
+ *
+ * @param stats Counts from walk_directory()
+ * @return opens + getdents + stats + closes
+ */
+long walk_syscalls(const WalkStats_t *stats);
+
+#endif // DIR_WALK_H
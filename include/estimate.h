@@ -0,0 +1,68 @@
+/**
+ * @file estimate.h
+ * @brief Dry-run prediction of archive size and time (--estimate)
+ *
+ * Files are grouped by extension and a few files of each type are
+ * sample-compressed with the codec, level and store rules the archive
+ * would use, a few evenly spaced windows of each. Each type's ratio and
+ * CPU cost per byte are extrapolated to all of its bytes, with 95% bounds
+ * from the spread between the windows of each file and between files.
+ * Nothing is written.
+ */
+
+#ifndef ESTIMATE_H
+#define ESTIMATE_H
+
+#include "archiver.h"
+
+/* Files sampled per file type */
+#define ESTIMATE_FILES_PER_TYPE 8
+
+/* Windows compressed from each sampled file, spread evenly from its start
+ * to its end */
+#define ESTIMATE_WINDOWS 4
+
+/* Bytes compressed per window */
+#define ESTIMATE_SAMPLE_SIZE (128 * 1024)
+
+/* z-score of the reported bounds (two-sided 95%) */
+#define ESTIMATE_Z 1.96
+
+/**
+ * @brief Predicted archive size and time, each with 95% bounds
+ */
+typedef struct {
+    int       files;         /* Files that would be archived */
+    int       types;         /* Distinct extensions among them */
+    mz_uint64 input_bytes;   /* Total size of the files */
+    int       sampled_files; /* Files sample-compressed */
+    mz_uint64 sampled_bytes; /* Bytes sample-compressed */
+    int       workers;       /* Threads the wall time assumes */
+    double    size, size_low, size_high;          /* Archive bytes */
+    double    cpu_seconds, cpu_low, cpu_high;     /* Compression CPU time */
+    double    io_seconds;                         /* Reading the inputs */
+    double    wall_seconds, wall_low, wall_high;  /* Elapsed time */
+} ArchiveEstimate_t;
+
+/**
+ * @brief Predict what archiving a file list would produce
+ *
+ * @param file_list Files as parse_config_file() lists them
+ * @param options Codec, level, store fallback and jobs to assume
+ * @param estimate Prediction (output)
+ * @return SUCCESS on success, error code on failure
+ */
+int estimate_archive(const FileList_t *file_list, const ArchiveOptions_t *options,
+                     ArchiveEstimate_t *estimate);
+
+/**
+ * @brief Print an estimate
+ *
+ * @param out Stream to print to
+ * @param estimate Estimate from estimate_archive()
+ * @param options Options the estimate was made with
+ */
+void print_archive_estimate(FILE *out, const ArchiveEstimate_t *estimate,
+                            const ArchiveOptions_t *options);
+
+#endif // ESTIMATE_H
@@ -0,0 +1,47 @@
+/**
+ * @file file_input.h
+ * @brief Access to the contents of files being archived
+ *
+ * Regular files are memory-mapped so the compressor reads straight from
+ * the page cache without an intermediate copy. Anything that cannot be
+ * mapped (pipes, procfs entries, empty files, or when mapping is turned
+ * off) is read into a heap buffer instead.
+ */
+
+#ifndef FILE_INPUT_H
+#define FILE_INPUT_H
+
+#include "common.h"
+#include <time.h>
+
+/* Read size used when a file has to be copied into memory */
+#define FILE_INPUT_READ_SIZE (256 * 1024)
+
+/**
+ * @brief Contents of an opened input file
+ */
+typedef struct {
+    const unsigned char *data;     /* File contents */
+    size_t               size;     /* Number of bytes in data */
+    time_t               modified; /* Last modification time */
+    bool                 mapped;   /* true = mmap, false = heap buffer */
+} FileInput_t;
+
+/**
+ * @brief Open a file and make its contents available in memory
+ *
+ * @param path Path to the file
+ * @param use_mmap Try to map the file before falling back to read()
+ * @param input Opened file (output)
+ * @return SUCCESS on success, error code on failure
+ */
+int open_file_input(const char *path, bool use_mmap, FileInput_t *input);
+
+/**
+ * @brief Unmap or free the contents of an opened file
+ *
+ * @param input File to close (may already be closed)
+ */
+void close_file_input(FileInput_t *input);
+
+#endif // FILE_INPUT_H
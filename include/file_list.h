@@ -0,0 +1,202 @@
+/**
+ * @file file_list.h
+ * @brief Compact storage for the list of files to archive
+ *
+ * Large submissions put hundreds of thousands of files under one deep
+ * input directory; keeping every full path as its own malloc'd string
+ * repeats that prefix for each file and leaves the heap full of small
+ * blocks. Here each directory is interned once, and a file is a pointer
+ * to its directory plus its name. All strings live in an arena that grows
+ * FILE_LIST_ARENA_CHUNK bytes at a time, so building the list takes a
+ * handful of allocations however many files it holds.
+ *
+ * A full path is the directory (kept with its trailing '/') followed by
+ * the name, put together on demand with file_list_path().
+ *
+ * The list has no size limit; its entries grow by doubling, and a hash
+ * index over them keeps every path in it once at O(1) per file.
+ *
+ * Each entry also carries the file's metadata (FileMeta_t) from the one
+ * statx() made when the file was found. Validation, sizing, --update,
+ * --solid, --estimate and the entry timestamps all read it from there
+ * instead of stat()ing the path again; file_list_entry_stat() falls back
+ * to a statx() only for entries added without it.
+ */
+
+#ifndef FILE_LIST_H
+#define FILE_LIST_H
+
+#include "common.h"
+
+/* Bytes the string arena grows by */
+#define FILE_LIST_ARENA_CHUNK (64 * 1024)
+
+/* Initial size of the directory and entry hash tables (powers of two) */
+#define FILE_LIST_DIR_SLOTS   256
+#define FILE_LIST_ENTRY_SLOTS 128
+
+/**
+ * @brief What statx() said about a file when it was found
+ */
+typedef struct {
+    long long          size;
+    long long          mtime; /* Seconds since the epoch */
+    unsigned int       mode;  /* st_mode; 0 = not captured */
+    unsigned long long dev;
+    unsigned long long ino;
+} FileMeta_t;
+
+/**
+ * @brief One file: its interned directory, its name and its metadata
+ */
+typedef struct {
+    const char *dir;  /* Directory with trailing '/', or "" for none */
+    const char *name; /* Last path component (the name inside the archive) */
+    FileMeta_t  meta;
+} FileListEntry_t;
+
+/**
+ * @brief Strings and directory table shared by a list and its subsets
+ */
+typedef struct {
+    char        *chunk;       /* Arena block being filled */
+    size_t       chunk_used;
+    size_t       chunk_size;
+    const char **dirs;        /* Interned directories, by hash slot */
+    size_t       dir_slots;   /* Size of dirs (a power of two) */
+    size_t       dir_count;
+    const char  *last_dir;    /* Directory interned last */
+    size_t       last_dir_length;
+    size_t       bytes;       /* Bytes allocated, entry arrays included */
+    size_t       allocations; /* Allocations made, entry arrays included */
+    int          users;       /* Lists sharing the store */
+} FileListStore_t;
+
+/**
+ * @brief Ordered list of files, each at most once
+ */
+typedef struct {
+    FileListStore_t *store;
+    FileListEntry_t *entries;
+    int              count;
+    int              capacity;
+    int             *slots;      /* Hash index: entry index + 1, 0 = empty */
+    size_t           slot_count; /* Size of slots (a power of two) */
+} FileList_t;
+
+/**
+ * @brief Start an empty list with a store of its own
+ *
+ * @param list List to initialize
+ * @return SUCCESS on success, error code on failure
+ */
+int file_list_init(FileList_t *list);
+
+/**
+ * @brief Start an empty list that shares another list's store
+ *
+ * Entries can then be copied over with file_list_append().
+ *
+ * @param subset List to initialize
+ * @param list List whose store to share
+ */
+void file_list_init_subset(FileList_t *subset, const FileList_t *list);
+
+/**
+ * @brief Append a path unless it is in the list already
+ *
+ * Paths are stored with repeated slashes collapsed and no trailing slash,
+ * so dir//x and dir/x are the same entry.
+ *
+ * @param list List to append to
+ * @param path Path of the file, shorter than MAX_PATH_LENGTH
+ * @return SUCCESS on success, error code on failure
+ */
+int file_list_add(FileList_t *list, const char *path);
+
+/**
+ * @brief Append a path with its metadata unless it is in the list already;
+ *        an entry added without metadata gets it
+ *
+ * @param list List to append to
+ * @param path Path of the file, shorter than MAX_PATH_LENGTH
+ * @param meta Metadata from file_meta_read() (may be NULL)
+ * @return SUCCESS on success, error code on failure
+ */
+int file_list_add_meta(FileList_t *list, const char *path, const FileMeta_t *meta);
+
+/**
+ * @brief Append an entry of a list sharing the same store, unless it is
+ *        in the list already
+ *
+ * @param list List to append to
+ * @param entry Entry to copy
+ * @return SUCCESS on success, error code on failure
+ */
+int file_list_append(FileList_t *list, const FileListEntry_t *entry);
+
+/**
+ * @brief Find a path in the list
+ *
+ * @param list List to search
+ * @param path Path to look for
+ * @return Index of the path, or -1 if it is not in the list
+ */
+int file_list_find(const FileList_t *list, const char *path);
+
+/**
+ * @brief Full path of an entry
+ *
+ * @param entry Entry of a list
+ * @param buffer Buffer of MAX_PATH_LENGTH bytes to put the path in
+ * @return buffer
+ */
+const char *file_list_entry_path(const FileListEntry_t *entry, char *buffer);
+
+/**
+ * @brief Full path of the file at index
+ *
+ * @param list List of files
+ * @param index Index in the list
+ * @param buffer Buffer of MAX_PATH_LENGTH bytes to put the path in
+ * @return buffer
+ */
+const char *file_list_path(const FileList_t *list, int index, char *buffer);
+
+/**
+ * @brief Metadata of a file, with one statx() that follows links
+ *
+ * @param dir_fd Directory path is relative to, or AT_FDCWD
+ * @param path Path of the file
+ * @param meta Metadata (output)
+ * @return SUCCESS on success, ERROR_FILE_NOT_FOUND if it cannot be read
+ */
+int file_meta_read(int dir_fd, const char *path, FileMeta_t *meta);
+
+/**
+ * @brief Metadata of an entry: the one captured when it was found, or a
+ *        fresh file_meta_read() if it was added without
+ *
+ * @param entry Entry of a list
+ * @param meta Metadata (output)
+ * @return SUCCESS on success, ERROR_FILE_NOT_FOUND if it cannot be read
+ */
+int file_list_entry_stat(const FileListEntry_t *entry, FileMeta_t *meta);
+
+/**
+ * @brief Compare two entries' full paths as strcmp() would
+ *
+ * @param a First entry
+ * @param b Second entry
+ * @return Negative, zero or positive like strcmp()
+ */
+int file_list_entry_compare(const FileListEntry_t *a, const FileListEntry_t *b);
+
+/**
+ * @brief Free the list, and its store once no subset uses it
+ *
+ * @param list List to free (may be empty or already freed)
+ */
+void file_list_free(FileList_t *list);
+
+#endif // FILE_LIST_H
@@ -0,0 +1,150 @@
+/**
+ * @file glob_set.h
+ * @brief Matching many glob patterns in one walk of a directory tree
+ *
+ * The optional section of a .LT_FILES used to call glob() once per
+ * pattern, reading the same directories once per pattern. A glob set
+ * compiles all the patterns into one prefix tree over path segments
+ * (patterns sharing leading segments share nodes) and matches every
+ * pattern in a single walk of the base directory: each directory is read
+ * once with getdents64(), and each entry is tested against the segments
+ * that can follow where the walk is, a binary search among the literal
+ * segments and fnmatch() for the wildcard ones. Directories no pattern can
+ * reach are never opened.
+ *
+ * Segments match as glob() matches them (fnmatch() with FNM_PERIOD: a
+ * leading dot must be matched explicitly, * and ? never match /), and each
+ * pattern's matches are kept in strcmp() order, as glob() sorts them in
+ * the C locale, so the files added for a pattern are the ones
+ * expand_glob_pattern() would add, in the same order.
+ *
+ * One extension: a segment that is exactly GLOB_SET_ANY_DIRS (**) matches
+ * zero or more directories, so the segments src, ** and *.c find .c
+ * files at any depth under src. Like a shell's globstar it does not
+ * descend into hidden directories or through links to directories, and a
+ * trailing ** matches every entry below that is not hidden. Elsewhere in a
+ * segment ** is just *.
+ *
+ * Patterns glob_set_supports() turns down (backslash escapes, trailing or
+ * doubled slashes, a base directory that itself contains wildcards) are
+ * left to glob().
+ */
+
+#ifndef GLOB_SET_H
+#define GLOB_SET_H
+
+#include "common.h"
+#include "file_list.h"
+
+/* Segment that matches any number of directories */
+#define GLOB_SET_ANY_DIRS "**"
+
+/**
+ * @brief One segment of a pattern, shared by the patterns that have the
+ *        same leading segments
+ */
+typedef struct {
+    char         *segment;       /* Segment text */
+    unsigned char kind;          /* Literal, wildcard or any directories */
+    size_t        suffix_length; /* Literal tail every match ends with */
+    int          *children;      /* Next segments: literals (sorted) first */
+    int           child_count;
+    int           child_capacity;
+    int           literal_count; /* children[0..literal_count) are literal */
+    int          *patterns;      /* Patterns that end with this segment */
+    int           pattern_count;
+    int           pattern_capacity;
+} GlobNode_t;
+
+/**
+ * @brief A path that matched a pattern
+ */
+typedef struct {
+    int         pattern;
+    size_t      offset; /* Path below the base directory, in the set's paths */
+    const char *path;   /* The same path, once the walk is over */
+    FileMeta_t  meta;
+    bool        found;  /* meta could be read */
+} GlobMatch_t;
+
+/**
+ * @brief Compiled patterns and, after glob_set_match(), their matches
+ */
+typedef struct {
+    GlobNode_t  *nodes; /* nodes[0] is the base directory */
+    int          node_count;
+    int          node_capacity;
+    int          pattern_count;
+
+    GlobMatch_t *matches;       /* By pattern, then path */
+    int          match_count;
+    int          match_capacity;
+    int         *first_match;   /* Each pattern's matches start here */
+    char        *paths;         /* NUL-terminated matched paths */
+    size_t       paths_size;
+    size_t       paths_capacity;
+
+    long         directories; /* Directories read by glob_set_match() */
+    long         entries;     /* Entries they held */
+} GlobSet_t;
+
+/**
+ * @brief Start an empty set
+ *
+ * @param set Set to initialize
+ * @return SUCCESS on success, error code on failure
+ */
+int glob_set_init(GlobSet_t *set);
+
+/**
+ * @brief Whether a set matches a pattern exactly as glob() would
+ *
+ * @param base_dir Directory the pattern is relative to
+ * @param pattern Pattern
+ * @return true if glob_set_add() takes the pattern, false to use glob()
+ */
+bool glob_set_supports(const char *base_dir, const char *pattern);
+
+/**
+ * @brief Compile a pattern into the set
+ *
+ * @param set Set to add to (before glob_set_match())
+ * @param pattern Pattern relative to the base directory, one that
+ *                glob_set_supports()
+ * @param index Index of the pattern in the set (output)
+ * @return SUCCESS on success, error code on failure
+ */
+int glob_set_add(GlobSet_t *set, const char *pattern, int *index);
+
+/**
+ * @brief Match every pattern in one walk of a directory
+ *
+ * Directories that cannot be read are skipped, as glob() skips them.
+ *
+ * @param set Compiled patterns
+ * @param base_dir Directory the patterns are relative to
+ * @return SUCCESS on success, error code on failure
+ */
+int glob_set_match(GlobSet_t *set, const char *base_dir);
+
+/**
+ * @brief Add a pattern's matches to a list, in glob() order
+ *
+ * @param set Set after glob_set_match()
+ * @param index Pattern index from glob_set_add()
+ * @param base_dir Directory given to glob_set_match(); paths are added as
+ *                 base_dir/path
+ * @param file_list List to add the matches to (input/output)
+ * @return SUCCESS on success, error code on failure
+ */
+int glob_set_add_matches(const GlobSet_t *set, int index, const char *base_dir,
+                         FileList_t *file_list);
+
+/**
+ * @brief Free a set
+ *
+ * @param set Set to free
+ */
+void glob_set_free(GlobSet_t *set);
+
+#endif // GLOB_SET_H
@@ -0,0 +1,144 @@
+/**
+ * @file manifest.h
+ * @brief Compiled form of a .LT_FILES config
+ *
+ * A manifest is what parsing a .LT_FILES leaves once comments, section
+ * headers and indentation are gone: the entries in file order, each with
+ * its section, its path or pattern relative to the submission, and flags
+ * worked out once (glob, trailing slash). compile_config_text() in
+ * config.h builds one from the text.
+ *
+ * Batch and watch runs parse the same config over and over, so a manifest
+ * can be saved to a cache directory under a hash of the config text
+ * (MANIFEST_EXTENSION) and loaded from there the next time the same text
+ * comes along, which skips the text parser. The key is the SHA-256 of the
+ * text (sha256.h). The file layout is:
+ *
+ *   header   MANIFEST_MAGIC, version, key of the text, entry count, size
+ *            of the string table (little-endian 32-bit integers)
+ *   entries  section (1 byte), flags (1 byte), 2 bytes of padding,
+ *            offset of the path in the string table (32-bit)
+ *   strings  the paths, each terminated by a NUL
+ *
+ * A cache file that does not match the layout or the key is ignored and
+ * written again.
+ */
+
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include "common.h"
+#include "sha256.h"
+#include <stdint.h>
+
+#define MANIFEST_MAGIC     "LTM1"
+#define MANIFEST_VERSION   2
+#define MANIFEST_EXTENSION ".ltm"
+#define MANIFEST_KEY_SIZE  SHA256_DIGEST_SIZE
+
+/* Sections, as identify_section() numbers them */
+#define MANIFEST_REQUIRED 1
+#define MANIFEST_OPTIONAL 2
+
+/* Entry flags */
+#define MANIFEST_GLOB           0x01 /* Path contains * or ? */
+#define MANIFEST_TRAILING_SLASH 0x02 /* Path ends in / */
+
+/**
+ * @brief One path or pattern from a section
+ */
+typedef struct {
+    unsigned char section; /* MANIFEST_REQUIRED or MANIFEST_OPTIONAL */
+    unsigned char flags;   /* MANIFEST_GLOB, MANIFEST_TRAILING_SLASH */
+    uint32_t      offset;  /* Path in the string table */
+} ManifestEntry_t;
+
+/**
+ * @brief A compiled config
+ */
+typedef struct {
+    unsigned char    key[MANIFEST_KEY_SIZE]; /* manifest_key() of the config text */
+    ManifestEntry_t *entries;
+    int              count;
+    int              capacity;
+    char            *strings;     /* NUL-terminated paths */
+    size_t           strings_size;
+    size_t           strings_capacity;
+} Manifest_t;
+
+/**
+ * @brief Start an empty manifest
+ *
+ * @param manifest Manifest to initialize
+ */
+void manifest_init(Manifest_t *manifest);
+
+/**
+ * @brief Append an entry
+ *
+ * @param manifest Manifest to add to
+ * @param section MANIFEST_REQUIRED or MANIFEST_OPTIONAL
+ * @param flags Entry flags
+ * @param path Path or pattern, relative to the submission
+ * @return SUCCESS on success, error code on failure
+ */
+int manifest_add(Manifest_t *manifest, int section, unsigned flags, const char *path);
+
+/**
+ * @brief Path or pattern of an entry
+ *
+ * @param manifest Manifest the entry belongs to
+ * @param index Entry index
+ * @return NUL-terminated path inside the manifest
+ */
+const char *manifest_entry_path(const Manifest_t *manifest, int index);
+
+/**
+ * @brief Cache key of a config text: its SHA-256
+ *
+ * @param text Config text
+ * @param size Length of the text
+ * @param key Key (output)
+ */
+void manifest_key(const void *text, size_t size, unsigned char key[MANIFEST_KEY_SIZE]);
+
+/**
+ * @brief Write a manifest to a file, atomically (temporary file + rename)
+ *
+ * @param manifest Manifest to write
+ * @param path File to create or replace
+ * @return SUCCESS on success, error code on failure
+ */
+int manifest_save(const Manifest_t *manifest, const char *path);
+
+/**
+ * @brief Read a manifest written by manifest_save()
+ *
+ * @param path File to read
+ * @param key Key of the text the manifest must have been compiled from
+ * @param manifest Manifest (output, free with manifest_free())
+ * @return SUCCESS on success, ERROR_FILE_NOT_FOUND if there is no such
+ *         file, ERROR_IO if it is damaged or for another config text
+ */
+int manifest_load(const char *path, const unsigned char key[MANIFEST_KEY_SIZE],
+                  Manifest_t *manifest);
+
+/**
+ * @brief Path of the cache file for a config text
+ *
+ * @param cache_dir Cache directory
+ * @param key Key of the config text
+ * @param path Buffer for the path
+ * @param size Size of the buffer
+ */
+void manifest_cache_path(const char *cache_dir, const unsigned char key[MANIFEST_KEY_SIZE],
+                         char *path, size_t size);
+
+/**
+ * @brief Free a manifest's entries and strings
+ *
+ * @param manifest Manifest to free (may be empty)
+ */
+void manifest_free(Manifest_t *manifest);
+
+#endif // MANIFEST_H
@@ -0,0 +1,63 @@
+/**
+ * @file match_len.h
+ * @brief SIMD match extension for miniz's deflate match finder
+ *
+ * miniz is built with USE_EXTERNAL_MZ_MATCH_LEN (a local modification,
+ * see lib/README.md), so tdefl_find_match() asks match_len.c how far a
+ * candidate match extends instead of comparing one byte at a time. AVX2
+ * (32-byte compares) or SSE2 (16-byte compares) is picked once at program
+ * start on x86-64, and the byte loop is used elsewhere. Every variant
+ * returns the same length, so compressed output does not depend on the
+ * CPU.
+ */
+
+#ifndef MATCH_LEN_H
+#define MATCH_LEN_H
+
+#include "common.h"
+
+/**
+ * @brief A match-extension kernel
+ *
+ * Returns the number of leading bytes p and q have in common, at most
+ * max_len. Never reads past p[max_len - 1] or q[max_len - 1].
+ */
+typedef unsigned int (*match_len_fn)(const unsigned char *p, const unsigned char *q,
+                                     unsigned int max_len);
+
+/**
+ * @brief Named match-extension kernel, as listed by match_len_variants()
+ */
+typedef struct {
+    const char  *name;
+    match_len_fn fn;
+} MatchLenVariant_t;
+
+/**
+ * @brief List the kernels this CPU can run
+ *
+ * The portable byte loop is always first; the last entry is the default.
+ *
+ * @param variants Set to the array of usable variants (output)
+ * @return Number of entries in the array
+ */
+int match_len_variants(const MatchLenVariant_t **variants);
+
+/**
+ * @brief Name of the kernel the match finder is using
+ *
+ * @return "portable", "sse2" or "avx2"
+ */
+const char *match_len_active_variant(void);
+
+/**
+ * @brief Switch the match finder to a named kernel (for benchmarks)
+ *
+ * Not safe to call while another thread is compressing.
+ *
+ * @param name Name from match_len_variants()
+ * @return true if the kernel exists and this CPU supports it
+ */
+bool match_len_use_variant(const char *name);
+
+#endif // MATCH_LEN_H
@@ -0,0 +1,151 @@
+/**
+ * @file memory_budget.h
+ * @brief Cap on the memory an archive run works with (--max-memory)
+ *
+ * The budget starts out holding what the process already has resident
+ * (the program and the file list) and counts against the same cap:
+ *
+ * - miniz's own allocations (writer state, central directory, I/O
+ *   buffers), which go through memory_budget_attach()'s m_pAlloc /
+ *   m_pFree / m_pRealloc hooks. These come from a pool: blocks of 4 KB
+ *   and up are rounded to a power of two and a few freed blocks of each
+ *   size are kept for the next entry instead of going back to malloc.
+ * - Reservations for the contents, output and compressor state of the
+ *   entries and solid blocks being worked on, taken before the work
+ *   starts.
+ *
+ * The cap is never a reason to fail; the archiver does less at once to
+ * stay under it. Work that does not fit waits until earlier work has
+ * released its reservation, the output buffer is cut down to
+ * MIN_OUTPUT_BUFFER, solid blocks get smaller, and a file that does not
+ * fit even alone is deflated into the archive in blocks, which takes a
+ * fixed MEMORY_STREAM_BYTES or so. Only what cannot be cut down (the
+ * program and file list themselves, the smallest output buffer) goes over.
+ *
+ * Freed buffers of MEMORY_MMAP_THRESHOLD and up go straight back to the
+ * system, so the process's resident size follows the count. A reservation
+ * is what the work could hold at worst, so the peak resident size stays
+ * at or below the reported peak plus MEMORY_RSS_MARGIN and
+ * MEMORY_RSS_MARGIN_PER_THREAD per worker thread (stacks and malloc
+ * arenas, which are not counted), and is often well below it.
+ */
+
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include "common.h"
+#include "../lib/miniz/miniz.h"
+#include <pthread.h>
+
+/* Freed pool blocks of 2^12 bytes and up are kept for reuse */
+#define MEMORY_POOL_MIN_CLASS 12
+#define MEMORY_POOL_CLASSES   40
+
+/* Freed blocks kept per size */
+#define MEMORY_POOL_CACHED_PER_CLASS 4
+
+/* Under a budget, the C library maps allocations this large and unmaps
+ * them when freed, instead of keeping them in its heap */
+#define MEMORY_MMAP_THRESHOLD (128 * 1024)
+
+/* Memory an entry deflated in blocks holds besides miniz's allocations:
+ * the trial sample, its output and the trial's compressor */
+#define MEMORY_STREAM_BYTES (2 * 64 * 1024 + 512 * 1024)
+
+/* How far the peak resident size may go over the counted peak */
+#define MEMORY_RSS_MARGIN            (1024 * 1024)
+#define MEMORY_RSS_MARGIN_PER_THREAD (256 * 1024)
+
+/**
+ * @brief Memory counted against a limit
+ */
+typedef struct {
+    size_t          limit;    /* Bytes allowed (0 = no limit) */
+    size_t          in_use;   /* Bytes allocated, cached or reserved */
+    size_t          peak;     /* Highest in_use seen */
+    size_t          cached;   /* Part of in_use sitting in the pool */
+    int             waits;    /* Times work was held back for memory */
+    int             overruns; /* Reservations let through over the limit */
+    int             streamed; /* Files deflated in blocks to stay under it */
+    size_t          baseline; /* Resident size when counting started */
+    void           *pool[MEMORY_POOL_CLASSES]; /* Freed blocks per size */
+    int             pool_count[MEMORY_POOL_CLASSES];
+    pthread_mutex_t lock;
+} MemoryBudget_t;
+
+/**
+ * @brief Start counting memory, from what the process holds already
+ *
+ * @param budget Budget to initialize
+ * @param limit Bytes allowed (0 = count only)
+ */
+void memory_budget_init(MemoryBudget_t *budget, size_t limit);
+
+/**
+ * @brief Release the pool
+ *
+ * Every block handed to miniz must have been freed already.
+ *
+ * @param budget Budget to tear down
+ */
+void memory_budget_destroy(MemoryBudget_t *budget);
+
+/**
+ * @brief Make a ZIP archive allocate through the budget
+ *
+ * Must be called before the archive is initialized.
+ *
+ * @param budget Budget to allocate from
+ * @param zip Archive to set m_pAlloc, m_pFree and m_pRealloc on
+ */
+void memory_budget_attach(MemoryBudget_t *budget, mz_zip_archive *zip);
+
+/**
+ * @brief Reserve memory for work about to start
+ *
+ * Cached pool blocks are dropped first if that makes room.
+ *
+ * @param budget Budget to reserve from (NULL = no budget, always succeeds)
+ * @param bytes Bytes the work will need
+ * @param force Grant the reservation even over the limit
+ * @return true if reserved, false if it does not fit (nothing is reserved)
+ */
+bool memory_budget_reserve(MemoryBudget_t *budget, size_t bytes, bool force);
+
+/**
+ * @brief Bytes that can still be reserved without going over the limit
+ *
+ * Cached pool blocks count as free, since reserving drops them.
+ *
+ * @param budget Budget to ask (NULL = no budget)
+ * @return Bytes left, SIZE_MAX without a budget or limit
+ */
+size_t memory_budget_available(MemoryBudget_t *budget);
+
+/**
+ * @brief Count a file deflated in blocks because it did not fit
+ *
+ * @param budget Budget it did not fit in (may be NULL)
+ */
+void memory_budget_note_streamed(MemoryBudget_t *budget);
+
+/**
+ * @brief Return a reservation
+ *
+ * @param budget Budget the reservation came from (may be NULL)
+ * @param bytes Bytes reserved
+ */
+void memory_budget_release(MemoryBudget_t *budget, size_t bytes);
+
+/**
+ * @brief Print the peak and what was done to stay under the limit
+ *
+ * The process's resident high-water mark (getrusage() ru_maxrss) is
+ * printed next to the counted peak.
+ *
+ * @param budget Budget to report on
+ * @param out Stream to print to
+ */
+void memory_budget_report(const MemoryBudget_t *budget, FILE *out);
+
+#endif // MEMORY_BUDGET_H
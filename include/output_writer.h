@@ -0,0 +1,139 @@
+/**
+ * @file output_writer.h
+ * @brief Buffered, preallocating writer for archive output
+ *
+ * Archive bytes are collected in a large aligned buffer and written to the
+ * file in OUTPUT_BUFFER_SIZE pieces. When the final size can be estimated
+ * the file is preallocated up front so the filesystem can lay it out in
+ * one piece; the file is truncated to the real size when it is closed.
+ * Batch jobs can ask for O_DIRECT so archives do not push other data out
+ * of the page cache.
+ *
+ * With output_writer_start_async(), a full buffer is handed to async_io.h
+ * (io_uring, or an I/O thread) and the next one is filled while it is
+ * written; a buffer is waited for only when its turn to be filled comes
+ * round again, so at most OUTPUT_WRITE_BUFFERS writes are outstanding.
+ */
+
+#ifndef OUTPUT_WRITER_H
+#define OUTPUT_WRITER_H
+
+#include "common.h"
+#include "async_io.h"
+#include <stdint.h>
+
+/* Default size of the write-behind buffer */
+#define OUTPUT_BUFFER_SIZE (4 * 1024 * 1024)
+
+/* Alignment of the buffer and of every write made with O_DIRECT */
+#define OUTPUT_ALIGNMENT 4096
+
+/* Buffers taken in turn when writing behind (one is filled while the
+ * others are written) */
+#define OUTPUT_WRITE_BUFFERS 2
+
+/**
+ * @brief Output writer state
+ */
+typedef struct {
+    int              fd;
+    bool             owns_fd;      /* Close fd when the writer is closed */
+    bool             direct;       /* fd was opened with O_DIRECT */
+    bool             failed;       /* A write failed; later writes are refused */
+    bool             seekable;     /* Written bytes can be replaced (output_writer_rewind) */
+    unsigned char   *buffer;       /* OUTPUT_ALIGNMENT-aligned buffer being filled */
+    size_t           capacity;     /* Size of each buffer */
+    size_t           buffered;     /* Bytes waiting in buffer */
+    uint64_t         written;      /* Bytes already written to fd */
+    uint64_t         submitted;    /* Bytes written or being written behind */
+    int              buffer_count; /* 1, or OUTPUT_WRITE_BUFFERS when writing behind */
+    int              current;      /* Buffer being filled */
+    unsigned char   *buffers[OUTPUT_WRITE_BUFFERS];
+    bool             pending[OUTPUT_WRITE_BUFFERS]; /* Buffer is being written */
+    AsyncIoRequest_t requests[OUTPUT_WRITE_BUFFERS];
+    AsyncIo_t        io;           /* Writes behind (unused while buffer_count is 1) */
+} OutputWriter_t;
+
+/**
+ * @brief Create (or truncate) a file and open a writer on it
+ *
+ * @param path Path of the file to write
+ * @param size_estimate Expected final size for preallocation (0 = unknown)
+ * @param direct_io Bypass the page cache with O_DIRECT if supported
+ * @return Pointer to the writer, or NULL on failure
+ */
+OutputWriter_t *output_writer_open(const char *path, uint64_t size_estimate,
+                                   bool direct_io);
+
+/**
+ * @brief Open a writer on an already open descriptor (e.g. stdout)
+ *
+ * The descriptor is not preallocated, truncated or closed.
+ *
+ * @param fd Descriptor to write to
+ * @return Pointer to the writer, or NULL on failure
+ */
+OutputWriter_t *output_writer_wrap_fd(int fd);
+
+/**
+ * @brief Write full buffers behind, while the next one is filled
+ *
+ * Only regular files are written behind; a pipe or terminal needs its
+ * bytes in write() order and stays synchronous.
+ *
+ * @param writer Writer to change
+ * @param backend How to write (ASYNC_IO_URING falls back to threads)
+ * @return SUCCESS if writes now go behind, error code if the writer stays
+ *         synchronous
+ */
+int output_writer_start_async(OutputWriter_t *writer, AsyncIoBackend_t backend);
+
+/**
+ * @brief Append bytes to the output
+ *
+ * Matches archive_write_fn so it can be passed to
+ * create_archive_with_writer() with the writer as opaque.
+ *
+ * @param opaque Writer to append to
+ * @param buf Bytes to write
+ * @param n Number of bytes
+ * @return n on success, 0 on failure
+ */
+size_t output_writer_write(void *opaque, const void *buf, size_t n);
+
+/**
+ * @brief Discard everything from an offset on, so writing resumes there
+ *
+ * Bytes still in the buffer are simply dropped. Bytes already written can
+ * only be replaced in a regular file; the writer then leaves O_DIRECT,
+ * as the rewound offset need not be aligned.
+ *
+ * @param writer Writer to rewind
+ * @param offset Offset from the start of the output, at most what was written
+ * @return SUCCESS on success, ERROR_IO if the bytes are gone (pipe) or a
+ *         write failed
+ */
+int output_writer_rewind(OutputWriter_t *writer, uint64_t offset);
+
+/**
+ * @brief Change the size of the write-behind buffer
+ *
+ * Anything buffered is flushed first. The size is rounded down to a
+ * multiple of OUTPUT_ALIGNMENT (at least one), and applies to each of the
+ * buffers taken in turn.
+ *
+ * @param writer Writer to change
+ * @param capacity New buffer size in bytes
+ * @return SUCCESS on success, error code on failure (the old buffer is kept)
+ */
+int output_writer_resize(OutputWriter_t *writer, size_t capacity);
+
+/**
+ * @brief Flush buffered bytes, trim any preallocation and free the writer
+ *
+ * @param writer Writer to close (may be NULL)
+ * @return SUCCESS if every byte reached the file, ERROR_IO otherwise
+ */
+int output_writer_close(OutputWriter_t *writer);
+
+#endif // OUTPUT_WRITER_H
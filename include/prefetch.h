@@ -0,0 +1,184 @@
+/**
+ * @file prefetch.h
+ * @brief Read-ahead of the entries about to be compressed
+ *
+ * Without it the disk sits idle while an entry is compressed, and the next
+ * file only starts coming in once it is opened; on spinning disks and
+ * network mounts every file's read latency then adds to the CPU time.
+ * Before an entry is read, prefetch_advance() asks the kernel to start
+ * reading the entries after it (posix_fadvise(POSIX_FADV_WILLNEED)), so
+ * their pages arrive while the CPU works.
+ *
+ * The window starts at PREFETCH_MIN_ENTRIES files ahead. It doubles
+ * whenever a read still stalls (see PREFETCH_STALL_SHARE), and shrinks by
+ * one after PREFETCH_CALM_ENTRIES reads in a row that did not. The bytes
+ * it covers are capped at what compression gets through in
+ * PREFETCH_LEAD_SECONDS at the measured throughput (at least
+ * PREFETCH_MIN_BYTES), so read-ahead does not push files out of the page
+ * cache before they are used.
+ *
+ * With a read backend other than ASYNC_IO_SYNC, entries of up to
+ * PREFETCH_READ_LIMIT bytes are not just advised but read into buffers
+ * through async_io.h (io_uring, or an I/O thread), so the compressor is
+ * handed their contents by prefetch_take_read() without a system call.
+ * Larger entries are still advised and mapped when their turn comes.
+ *
+ * A read stall is the time from opening a file until all its contents are
+ * in memory; mapped files are touched page by page (up to
+ * PREFETCH_TOUCH_LIMIT bytes) so the faults happen here rather than inside
+ * the compressor. For a buffered read it is the time spent waiting for the
+ * read to complete.
+ */
+
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include "common.h"
+#include "async_io.h"
+#include "file_input.h"
+#include "file_list.h"
+#include "../lib/miniz/miniz.h"
+
+/* Bounds of the window, in files */
+#define PREFETCH_MIN_ENTRIES 2
+#define PREFETCH_MAX_ENTRIES 64
+
+/* A read stalled if it took more than this share of the compression time,
+ * and more than PREFETCH_MIN_STALL seconds (what opening a cached file
+ * costs anyway) */
+#define PREFETCH_STALL_SHARE 0.05
+#define PREFETCH_MIN_STALL   0.0002
+
+/* Stall-free reads in a row after which the window shrinks by one */
+#define PREFETCH_CALM_ENTRIES 16
+
+/* Seconds of compression the bytes read ahead should cover */
+#define PREFETCH_LEAD_SECONDS 0.5
+
+/* Bytes the window may always cover, before throughput is known */
+#define PREFETCH_MIN_BYTES (8 * 1024 * 1024)
+
+/* Bytes of a mapped file touched to measure its stall */
+#define PREFETCH_TOUCH_LIMIT (64 * 1024 * 1024)
+
+/* Largest entry read into a buffer ahead of time; larger ones are mapped */
+#define PREFETCH_READ_LIMIT (16 * 1024 * 1024)
+
+/* Reads that can be outstanding: the window, plus the entry being read */
+#define PREFETCH_SLOTS (PREFETCH_MAX_ENTRIES + 1)
+
+/**
+ * @brief An entry being read into a buffer ahead of time
+ */
+typedef struct {
+    int              index;    /* Entry, or -1 if the slot is free */
+    int              fd;
+    unsigned char   *buffer;   /* size + 1 bytes, to notice a file that grew */
+    size_t           size;     /* Size the entry was listed with */
+    time_t           modified;
+    AsyncIoRequest_t request;
+} PrefetchRead_t;
+
+/**
+ * @brief Read-ahead state and read-stall accounting for one archive
+ */
+typedef struct {
+    const FileList_t *list;
+    const int        *skip;          /* Entries with skip[i] >= 0 are not read (may be NULL) */
+    bool              enabled;       /* false = only account for stalls */
+    int               next;          /* First entry not advised yet */
+    int               window;        /* Files to keep advised ahead */
+    int               min_window;    /* Range of windows used */
+    int               max_window;
+    int               calm;          /* Stall-free reads in a row */
+    mz_uint64         ahead_bytes;   /* Bytes advised and not read yet */
+    double            compress_rate; /* Bytes per second of compression (0 = unknown) */
+    long              advised_files;
+    mz_uint64         advised_bytes;
+    int               read_files;    /* Reads accounted for */
+    int               stalled_files; /* Reads that stalled */
+    double            stall_seconds; /* Time spent waiting for contents */
+    AsyncIo_t         io;            /* Reads entries into buffers (sync = advise only) */
+    PrefetchRead_t    reads[PREFETCH_SLOTS]; /* Slot index % PREFETCH_SLOTS */
+    AsyncIoBackend_t  read_backend;  /* io.backend, kept for the stats */
+    long              buffered_files; /* Entries handed over from a buffer */
+} Prefetch_t;
+
+/**
+ * @brief Start read-ahead over a list
+ *
+ * @param prefetch State to initialize
+ * @param list Entries in the order they will be read
+ * @param enabled Issue read-ahead (false only measures stalls)
+ * @param reads How to read entries into buffers (ASYNC_IO_SYNC = advise only)
+ */
+void prefetch_init(Prefetch_t *prefetch, const FileList_t *list, bool enabled,
+                   AsyncIoBackend_t reads);
+
+/**
+ * @brief Note that an entry is about to be read, and advise the entries
+ *        after it up to the window
+ *
+ * @param prefetch Read-ahead state
+ * @param index Entry about to be read (in increasing order)
+ */
+void prefetch_advance(Prefetch_t *prefetch, int index);
+
+/**
+ * @brief open_file_input(), waiting for all of the contents
+ *
+ * Safe to call from any thread.
+ *
+ * @param path Path to the file
+ * @param use_mmap Try to map the file before falling back to read()
+ * @param input Opened file (output)
+ * @param stall_seconds Time until the contents were in memory (output)
+ * @return Result of open_file_input()
+ */
+int prefetch_open_input(const char *path, bool use_mmap, FileInput_t *input,
+                        double *stall_seconds);
+
+/**
+ * @brief Take an entry's contents from its read-ahead buffer
+ *
+ * Called by the thread that calls prefetch_advance(), in the same order.
+ *
+ * @param prefetch Read-ahead state
+ * @param index Entry to take
+ * @param input Contents in a heap buffer (output, when true is returned)
+ * @param stall_seconds Time waiting for the read (output)
+ * @return true if input holds the contents, false if the entry was not
+ *         read ahead (or the read failed) and has to be opened
+ */
+bool prefetch_take_read(Prefetch_t *prefetch, int index, FileInput_t *input,
+                        double *stall_seconds);
+
+/**
+ * @brief Account for one read and adjust the window
+ *
+ * Called by the thread that calls prefetch_advance().
+ *
+ * @param prefetch Read-ahead state
+ * @param bytes Size of the entry
+ * @param stall_seconds Stall from prefetch_open_input()
+ * @param compress_seconds Time the entry took to compress
+ */
+void prefetch_record(Prefetch_t *prefetch, size_t bytes, double stall_seconds,
+                     double compress_seconds);
+
+/**
+ * @brief Print the read stalls and the read-ahead done
+ *
+ * @param out Stream to print to
+ * @param prefetch Read-ahead state
+ */
+void print_prefetch_stats(FILE *out, const Prefetch_t *prefetch);
+
+/**
+ * @brief Drop the reads no entry was taken from and stop the read backend
+ *
+ * @param prefetch Read-ahead state
+ */
+void prefetch_finish(Prefetch_t *prefetch);
+
+#endif // PREFETCH_H
@@ -0,0 +1,59 @@
+/**
+ * @file sha256.h
+ * @brief SHA-256 (FIPS 180-4) for content addressing
+ *
+ * On x86-64 CPUs with the SHA extensions, blocks are hashed with them
+ * (picked once at program start); elsewhere in portable C.
+ */
+
+#ifndef SHA256_H
+#define SHA256_H
+
+#include "common.h"
+#include <stdint.h>
+
+#define SHA256_DIGEST_SIZE 32
+
+/* Length of a digest as lowercase hex, without the terminator */
+#define SHA256_HEX_LENGTH (SHA256_DIGEST_SIZE * 2)
+
+/**
+ * @brief Incremental SHA-256 state
+ */
+typedef struct {
+    uint32_t      state[8];
+    uint64_t      length;     /* Bytes hashed so far */
+    unsigned char block[64];  /* Partial input block */
+    size_t        block_used; /* Bytes in block */
+} Sha256_t;
+
+/**
+ * @brief Start a new hash
+ * @param ctx Hash state to initialize
+ */
+void sha256_init(Sha256_t *ctx);
+
+/**
+ * @brief Add data to the hash
+ * @param ctx Hash state
+ * @param data Bytes to hash
+ * @param len Number of bytes
+ */
+void sha256_update(Sha256_t *ctx, const void *data, size_t len);
+
+/**
+ * @brief Finish the hash
+ * @param ctx Hash state (must be re-initialized before reuse)
+ * @param digest Resulting digest (output)
+ */
+void sha256_final(Sha256_t *ctx, unsigned char digest[SHA256_DIGEST_SIZE]);
+
+/**
+ * @brief Hash a buffer and format the digest as lowercase hex
+ * @param data Bytes to hash
+ * @param len Number of bytes
+ * @param hex Buffer of at least SHA256_HEX_LENGTH + 1 bytes (output)
+ */
+void sha256_hex(const void *data, size_t len, char *hex);
+
+#endif // SHA256_H
@@ -0,0 +1,92 @@
+/**
+ * @file solid.h
+ * @brief Solid blocks for submissions made of many small files (--solid)
+ *
+ * Compressing each 1-4 KB source file as its own entry restarts the LZ
+ * window and Huffman tables every time, and the per-entry headers cost as
+ * much as the data. In solid mode, files of at most SOLID_FILE_LIMIT bytes
+ * are sorted by extension (so similar files sit next to each other),
+ * concatenated into blocks of up to SOLID_BLOCK_SIZE, and each block is
+ * compressed as one ZIP entry with the archive's codec. An index entry
+ * records where every file lives:
+ *
+ *   labtest-solid/index       SOLID_INDEX_HEADER, then one line per file:
+ *                             block offset size crc32 mtime name
+ *   labtest-solid/block-NNNN  the concatenated files
+ *
+ * Larger files are still written as ordinary entries, and
+ * solid_extract_file() reads a single file back through the index.
+ */
+
+#ifndef SOLID_H
+#define SOLID_H
+
+#include "archiver.h"
+
+#define SOLID_DIR          "labtest-solid/"
+#define SOLID_INDEX_NAME   SOLID_DIR "index"
+#define SOLID_BLOCK_FORMAT SOLID_DIR "block-%04d"
+#define SOLID_INDEX_HEADER "# labtest solid index 1"
+
+/* Files up to this size go into solid blocks */
+#define SOLID_FILE_LIMIT (64 * 1024)
+
+/* Uncompressed size a block is filled to; bounds the work of extracting
+ * one file and lets blocks be compressed in parallel */
+#define SOLID_BLOCK_SIZE (4 * 1024 * 1024)
+
+/**
+ * @brief What packing the small files did
+ */
+typedef struct {
+    int       files;            /* Files packed into blocks */
+    int       blocks;           /* Block entries written */
+    mz_uint64 input_bytes;      /* Size of the packed files */
+    mz_uint64 compressed_bytes; /* Size of the block entries' payloads */
+} SolidStats_t;
+
+/**
+ * @brief Split a file list into files for solid blocks and the rest
+ *
+ * Both outputs share file_list's store, keep its order, and must be
+ * released with file_list_free() (before or after file_list).
+ *
+ * @param file_list Files to split
+ * @param solid_list Files of at most SOLID_FILE_LIMIT bytes (output)
+ * @param entry_list Files to add as ordinary entries (output)
+ * @return SUCCESS on success, error code on failure
+ */
+int partition_solid_files(const FileList_t *file_list, FileList_t *solid_list,
+                          FileList_t *entry_list);
+
+/**
+ * @brief Pack files into solid blocks and add them and the index
+ *
+ * With options->jobs > 1 the blocks are compressed on a pool
+ * (options->pool if set) while later blocks are being read.
+ *
+ * @param archive Archive to add the entries to
+ * @param file_list Files to pack (from partition_solid_files())
+ * @param options Archive options (codec, level, jobs, verbose, etc.)
+ * @param stats What was done (output, may be NULL)
+ * @return SUCCESS on success, error code on failure
+ */
+int add_solid_blocks(archive_state *archive, const FileList_t *file_list,
+                     const ArchiveOptions_t *options, SolidStats_t *stats);
+
+/**
+ * @brief Read one file out of a solid archive
+ *
+ * Only the block that holds the file is decompressed.
+ *
+ * @param zip_path Archive written with --solid
+ * @param name Name of the file in the index
+ * @param data Contents of the file (output, release with free())
+ * @param size Size of the file (output)
+ * @return SUCCESS on success, ERROR_FILE_NOT_FOUND if the archive has no
+ *         such file, another error code on failure
+ */
+int solid_extract_file(const char *zip_path, const char *name, unsigned char **data,
+                       size_t *size);
+
+#endif // SOLID_H
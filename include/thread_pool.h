@@ -0,0 +1,85 @@
+/**
+ * @file thread_pool.h
+ * @brief Fixed-size worker pool used to run archiving work concurrently
+ *
+ * Tasks are plain function pointers queued in FIFO order. Each task belongs
+ * to a task group so a caller can wait for "its" tasks without caring about
+ * work submitted by anyone else. A thread that waits on a group helps run
+ * queued tasks in the meantime, so a task may itself submit and wait on
+ * subtasks without deadlocking the pool.
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include "common.h"
+#include <pthread.h>
+
+/**
+ * @brief Counter of outstanding tasks that a caller can wait on
+ */
+typedef struct {
+    int pending; /* Tasks submitted but not yet finished */
+} TaskGroup_t;
+
+typedef struct ThreadPoolTask ThreadPoolTask_t;
+
+/**
+ * @brief Worker pool state
+ */
+typedef struct {
+    pthread_mutex_t   lock;
+    pthread_cond_t    task_ready; /* Signalled when a task is queued */
+    pthread_cond_t    task_done;  /* Broadcast when any task finishes */
+    ThreadPoolTask_t *head;
+    ThreadPoolTask_t *tail;
+    pthread_t        *threads;
+    int               thread_count;
+    bool              shutting_down;
+} ThreadPool_t;
+
+/**
+ * @brief Start a pool with the given number of worker threads
+ *
+ * @param thread_count Number of workers (must be at least 1)
+ * @return Pointer to the pool, or NULL on failure
+ */
+ThreadPool_t *thread_pool_create(int thread_count);
+
+/**
+ * @brief Queue a task on the pool
+ *
+ * @param pool Pool to run the task on
+ * @param group Group the task is accounted to
+ * @param fn Function to run
+ * @param arg Argument passed to fn
+ * @return SUCCESS on success, error code on failure
+ */
+int thread_pool_submit(ThreadPool_t *pool, TaskGroup_t *group,
+                       void (*fn)(void *), void *arg);
+
+/**
+ * @brief Block until every task in the group has finished
+ *
+ * While waiting, the calling thread runs queued tasks itself.
+ *
+ * @param pool Pool the group's tasks were submitted to
+ * @param group Group to wait for
+ */
+void thread_pool_wait(ThreadPool_t *pool, TaskGroup_t *group);
+
+/**
+ * @brief Stop all workers and free the pool
+ *
+ * Tasks still queued are run before the workers exit.
+ *
+ * @param pool Pool to destroy (may be NULL)
+ */
+void thread_pool_destroy(ThreadPool_t *pool);
+
+/**
+ * @brief Number of CPUs currently online, at least 1
+ */
+int thread_pool_cpu_count(void);
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,85 @@
+/**
+ * @file time_budget.h
+ * @brief Per-entry compression level chosen to meet a deadline (--time-budget)
+ *
+ * The controller starts at the requested level and measures how fast each
+ * level actually compresses as entries finish. After every entry it
+ * projects the time the remaining bytes need: when that overruns the time
+ * left it steps the level down, and when one level higher would still
+ * finish with TIME_BUDGET_HEADROOM to spare it steps up. A level is only
+ * acted on once it has compressed TIME_BUDGET_MIN_BYTES; levels without
+ * that much are extrapolated from the nearest one that has.
+ */
+
+#ifndef TIME_BUDGET_H
+#define TIME_BUDGET_H
+
+#include "common.h"
+#include "../lib/miniz/miniz.h"
+
+/* Levels 0-22 (zstd's full range) */
+#define TIME_BUDGET_LEVELS 23
+
+/* Step up only if the next level is projected to use at most this share
+ * of the time left */
+#define TIME_BUDGET_HEADROOM 0.8
+
+/* Bytes a level must have compressed before its speed is trusted; small
+ * files take about as long at any level, so they say little */
+#define TIME_BUDGET_MIN_BYTES (256 * 1024)
+
+/* Assumed slowdown per level for levels without measurements */
+#define TIME_BUDGET_LEVEL_COST 1.4
+
+/**
+ * @brief State of the level controller for one archive
+ */
+typedef struct {
+    double    budget;    /* Seconds the archive may take */
+    double    start;     /* When archiving began (monotonic seconds) */
+    int       level;     /* Level for the next entry */
+    int       max_level; /* Highest level the codec accepts */
+    int       min_used, max_used; /* Range of levels handed out */
+    int       workers;   /* Entries compressed at once */
+    mz_uint64 remaining; /* Bytes not yet compressed */
+    double    bytes[TIME_BUDGET_LEVELS];   /* Bytes compressed per level */
+    double    seconds[TIME_BUDGET_LEVELS]; /* Time spent per level */
+} TimeBudget_t;
+
+/**
+ * @brief Monotonic clock in seconds
+ */
+double time_budget_now(void);
+
+/**
+ * @brief Start a controller; the clock starts now
+ *
+ * @param budget Control state (output)
+ * @param seconds Time the archive may take
+ * @param start_level Level for the first entries
+ * @param max_level Highest level the codec accepts
+ * @param workers Entries compressed at once
+ * @param total_bytes Bytes that will be compressed
+ */
+void time_budget_init(TimeBudget_t *budget, double seconds, int start_level, int max_level,
+                      int workers, mz_uint64 total_bytes);
+
+/**
+ * @brief Level to compress the next entry at
+ *
+ * @param budget Control state
+ * @return Compression level
+ */
+int time_budget_level(TimeBudget_t *budget);
+
+/**
+ * @brief Record a finished entry and adjust the level
+ *
+ * @param budget Control state
+ * @param level Level the entry was compressed at
+ * @param bytes Uncompressed size of the entry
+ * @param seconds Time compressing it took
+ */
+void time_budget_record(TimeBudget_t *budget, int level, mz_uint64 bytes, double seconds);
+
+#endif // TIME_BUDGET_H
@@ -1473,6 +1473,14 @@ static mz_bool tdefl_compress_lz_codes(tdefl_compressor *d)
         }
     }
 #else
+#ifdef USE_EXTERNAL_MZ_MATCH_LEN
+/* Local modification (labtest-archiver): if USE_EXTERNAL_MZ_MATCH_LEN is
+ * defined, an external module exports tdefl_match_len(), which returns the
+ * length of the common prefix of p and q, at most max_len bytes, e.g. with
+ * SIMD compares. It must return exactly what the byte loop below would.
+ */
+mz_uint tdefl_match_len(const mz_uint8 *p, const mz_uint8 *q, mz_uint max_len);
+#endif
 static MZ_FORCEINLINE void tdefl_find_match(tdefl_compressor *d, mz_uint lookahead_pos, mz_uint max_dist, mz_uint max_match_len, mz_uint *pMatch_dist, mz_uint *pMatch_len)
 {
     mz_uint dist, pos = lookahead_pos & TDEFL_LZ_DICT_SIZE_MASK, match_len = *pMatch_len, probe_pos = pos, next_probe_pos, probe_len;
@@ -1503,9 +1511,13 @@ static MZ_FORCEINLINE void tdefl_find_match(tdefl_compressor *d, mz_uint lookahe
             break;
         p = s;
         q = d->m_dict + probe_pos;
+#ifdef USE_EXTERNAL_MZ_MATCH_LEN
+        probe_len = tdefl_match_len(p, q, max_match_len);
+#else
         for (probe_len = 0; probe_len < max_match_len; probe_len++)
             if (*p++ != *q++)
                 break;
+#endif
         if (probe_len > match_len)
         {
             *pMatch_dist = dist;
@@ -3455,6 +3467,18 @@ static int mz_stat64(const char *path, struct __stat64 *buffer)
             *pDOS_time = 0;
             return;
         }
+#elif defined(_POSIX_C_SOURCE) && _POSIX_C_SOURCE >= 199506L
+        /* Local modification (labtest-archiver): several archives may be
+           written at once in batch mode, and localtime() shares one buffer
+           between threads. */
+        struct tm tm_struct;
+        struct tm *tm = localtime_r(&time, &tm_struct);
+        if (tm == NULL)
+        {
+            *pDOS_date = 0;
+            *pDOS_time = 0;
+            return;
+        }
 #else
         struct tm *tm = localtime(&time);
 #endif /* #ifdef _MSC_VER */
@@ -6157,7 +6181,8 @@ static int mz_stat64(const char *path, struct __stat64 *buffer)
         (void)pZip;
         memset(pDst, 0, MZ_ZIP_LOCAL_DIR_HEADER_SIZE);
         MZ_WRITE_LE32(pDst + MZ_ZIP_LDH_SIG_OFS, MZ_ZIP_LOCAL_DIR_HEADER_SIG);
-        MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_VERSION_NEEDED_OFS, method ? 20 : 0);
+        /* Local modification (labtest-archiver): Zstandard (method 93) needs version 6.3 */
+        MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_VERSION_NEEDED_OFS, method == 93 ? 63 : method ? 20 : 0);
         MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_BIT_FLAG_OFS, bit_flags);
         MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_METHOD_OFS, method);
         MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_FILE_TIME_OFS, dos_time);
@@ -6179,7 +6204,8 @@ static int mz_stat64(const char *path, struct __stat64 *buffer)
         (void)pZip;
         memset(pDst, 0, MZ_ZIP_CENTRAL_DIR_HEADER_SIZE);
         MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_SIG_OFS, MZ_ZIP_CENTRAL_DIR_HEADER_SIG);
-        MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_VERSION_NEEDED_OFS, method ? 20 : 0);
+        /* Local modification (labtest-archiver): Zstandard (method 93) needs version 6.3 */
+        MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_VERSION_NEEDED_OFS, method == 93 ? 63 : method ? 20 : 0);
         MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_BIT_FLAG_OFS, bit_flags);
         MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_METHOD_OFS, method);
         MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_FILE_TIME_OFS, dos_time);
@@ -6280,6 +6306,16 @@ static int mz_stat64(const char *path, struct __stat64 *buffer)
     mz_bool mz_zip_writer_add_mem_ex_v2(mz_zip_archive *pZip, const char *pArchive_name, const void *pBuf, size_t buf_size, const void *pComment, mz_uint16 comment_size,
                                         mz_uint level_and_flags, mz_uint64 uncomp_size, mz_uint32 uncomp_crc32, MZ_TIME_T *last_modified,
                                         const char *user_extra_data, mz_uint user_extra_data_len, const char *user_extra_data_central, mz_uint user_extra_data_central_len)
+    {
+        return mz_zip_writer_add_mem_ex_v3(pZip, pArchive_name, pBuf, buf_size, pComment, comment_size, level_and_flags, uncomp_size, uncomp_crc32, last_modified,
+                                           user_extra_data, user_extra_data_len, user_extra_data_central, user_extra_data_central_len, MZ_DEFLATED);
+    }
+
+    /* Local modification (labtest-archiver): v2 with the method of pre-compressed data passed in */
+    mz_bool mz_zip_writer_add_mem_ex_v3(mz_zip_archive *pZip, const char *pArchive_name, const void *pBuf, size_t buf_size, const void *pComment, mz_uint16 comment_size,
+                                        mz_uint level_and_flags, mz_uint64 uncomp_size, mz_uint32 uncomp_crc32, MZ_TIME_T *last_modified,
+                                        const char *user_extra_data, mz_uint user_extra_data_len, const char *user_extra_data_central, mz_uint user_extra_data_central_len,
+                                        mz_uint16 compressed_method)
     {
         mz_uint16 method = 0, dos_time = 0, dos_date = 0;
         mz_uint level, ext_attributes = 0, num_alignment_padding_bytes;
@@ -6420,7 +6456,7 @@ static int mz_stat64(const char *path, struct __stat64 *buffer)
 
         if (!store_data_uncompressed || (level_and_flags & MZ_ZIP_FLAG_COMPRESSED_DATA))
         {
-            method = MZ_DEFLATED;
+            method = (level_and_flags & MZ_ZIP_FLAG_COMPRESSED_DATA) ? compressed_method : MZ_DEFLATED;
         }
 
         if (pState->m_zip64)
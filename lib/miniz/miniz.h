@@ -1447,6 +1447,12 @@ extern "C"
                                                      mz_uint64 uncomp_size, mz_uint32 uncomp_crc32, MZ_TIME_T *last_modified, const char *user_extra_data_local, mz_uint user_extra_data_local_len,
                                                      const char *user_extra_data_central, mz_uint user_extra_data_central_len);
 
+    /* Local modification (labtest-archiver): same as mz_zip_writer_add_mem_ex_v2(), but data added with MZ_ZIP_FLAG_COMPRESSED_DATA */
+    /* is recorded with the given ZIP compression method (e.g. 93 for Zstandard) instead of always MZ_DEFLATED. */
+    MINIZ_EXPORT mz_bool mz_zip_writer_add_mem_ex_v3(mz_zip_archive *pZip, const char *pArchive_name, const void *pBuf, size_t buf_size, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags,
+                                                     mz_uint64 uncomp_size, mz_uint32 uncomp_crc32, MZ_TIME_T *last_modified, const char *user_extra_data_local, mz_uint user_extra_data_local_len,
+                                                     const char *user_extra_data_central, mz_uint user_extra_data_central_len, mz_uint16 compressed_method);
+
     /* Adds the contents of a file to an archive. This function also records the disk file's modified time into the archive. */
     /* File data is supplied via a read callback function. User mz_zip_writer_add_(c)file to add a file directly.*/
     MINIZ_EXPORT mz_bool mz_zip_writer_add_read_buf_callback(mz_zip_archive *pZip, const char *pArchive_name, mz_file_read_func read_callback, void *callback_opaque, mz_uint64 max_size,
@@ -0,0 +1,110 @@
+/**
+ * @file archive_update.c
+ * @brief Implementation of --update comparison against a previous archive
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "archive_update.h"
+#include "archiver.h"
+#include "file_input.h"
+#include <sys/stat.h>
+#include <time.h>
+
+/* ZIP stores local time with 2-second resolution; put a file's mtime
+ * through the same conversion miniz does so the two can be compared */
+static time_t zip_time_round_trip(time_t t) {
+    struct tm tm;
+    if (localtime_r(&t, &tm) == NULL) {
+        return t;
+    }
+    tm.tm_sec &= ~1;
+    tm.tm_isdst = -1;
+    return mktime(&tm);
+}
+
+/* Whether the file on disk has the same size, mtime and CRC-32 as the entry,
+ * and the entry is stored or compressed with the method asked for */
+static bool entry_unchanged(mz_zip_archive *reader, int index, const FileListEntry_t *file,
+                            mz_uint16 method, bool use_mmap) {
+    mz_zip_archive_file_stat entry;
+    FileMeta_t               meta;
+
+    // Size and time come from the metadata the file was listed with
+    if (!mz_zip_reader_file_stat(reader, (mz_uint)index, &entry) || entry.m_is_directory
+        || entry.m_is_encrypted
+        || (entry.m_method != ZIP_METHOD_STORE && entry.m_method != method)
+        || file_list_entry_stat(file, &meta) != SUCCESS
+        || (mz_uint64)meta.size != entry.m_uncomp_size
+        || zip_time_round_trip((time_t)meta.mtime) != entry.m_time) {
+        return false;
+    }
+
+    // Size and time agree; only now is it worth reading the file
+    FileInput_t input;
+    char        file_path[MAX_PATH_LENGTH];
+    if (open_file_input(file_list_entry_path(file, file_path), use_mmap, &input) != SUCCESS) {
+        return false;
+    }
+    mz_uint32 crc = (mz_uint32)mz_crc32(MZ_CRC32_INIT, input.data, input.size);
+    bool      same = input.size == entry.m_uncomp_size && crc == entry.m_crc32;
+    close_file_input(&input);
+    return same;
+}
+
+int open_archive_update(const char *previous_path, const FileList_t *file_list,
+                        mz_uint16 method, bool use_mmap, ArchiveUpdate_t *update) {
+    int file_count = file_list->count;
+    if (previous_path == NULL || update == NULL) {
+        return ERROR_INVALID_ARGS;
+    }
+    memset(update, 0, sizeof(ArchiveUpdate_t));
+
+    if (!mz_zip_reader_init_file(&update->reader, previous_path, 0)) {
+        fprintf(stderr, "Cannot read previous archive: %s\n", previous_path);
+        return ERROR_FILE_NOT_FOUND;
+    }
+
+    update->reuse = malloc(sizeof(int) * (file_count > 0 ? (size_t)file_count : 1));
+    if (update->reuse == NULL) {
+        mz_zip_reader_end(&update->reader);
+        return ERROR_MEMORY_ALLOCATION;
+    }
+
+    // miniz cannot copy entries out of a zip64 archive into a new one that
+    // has not switched to zip64 yet; compress everything again instead
+    bool can_copy = !mz_zip_is_zip64(&update->reader);
+
+    update->same_names = mz_zip_reader_get_num_files(&update->reader) == (mz_uint)file_count;
+    for (int i = 0; i < file_count; i++) {
+        const char *name = file_list->entries[i].name;
+        int index = mz_zip_reader_locate_file(&update->reader, name, NULL,
+                                              MZ_ZIP_FLAG_CASE_SENSITIVE);
+
+        update->reuse[i] = -1;
+        if (can_copy && index >= 0
+            && entry_unchanged(&update->reader, index, &file_list->entries[i], method,
+                               use_mmap)) {
+            update->reuse[i] = index;
+            update->unchanged++;
+        }
+        if (index != i) {
+            update->same_names = false;
+        }
+    }
+
+    return SUCCESS;
+}
+
+bool archive_update_is_noop(const ArchiveUpdate_t *update, int file_count) {
+    return update->same_names && update->unchanged == file_count;
+}
+
+void close_archive_update(ArchiveUpdate_t *update) {
+    if (update == NULL || update->reuse == NULL) {
+        return;
+    }
+    mz_zip_reader_end(&update->reader);
+    free(update->reuse);
+    update->reuse = NULL;
+}
@@ -3,8 +3,19 @@
  * @brief Implementation of archive functionality
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "archiver.h"
+#include "archive_update.h"
+#include "cohort_store.h"
+#include "compress.h"
+#include "file_input.h"
+#include "output_writer.h"
+#include "solid.h"
+#include "thread_pool.h"
 #include "../lib/miniz/miniz.h"
+#include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <unistd.h>
 #include <sys/stat.h>
@@ -22,6 +33,25 @@ void init_archive_options(ArchiveOptions_t *options) {
     options -> verbose = false;
     options -> input_path = NULL;
     options -> output_path = NULL;
+    options -> jobs = 1;
+    options -> chunk_threshold = DEFAULT_CHUNK_THRESHOLD;
+    options -> store_fallback = true;
+    options -> use_mmap = true;
+    options -> direct_io = false;
+    options -> store_path = NULL;
+    options -> student_id = NULL;
+    options -> export_student = NULL;
+    options -> update_path = NULL;
+    options -> batch_path = NULL;
+    options -> pool = NULL;
+    options -> codec = default_codec();
+    options -> solid = false;
+    options -> estimate = false;
+    options -> time_budget = 0;
+    options -> max_memory = 0;
+    options -> prefetch = true;
+    options -> io = ASYNC_IO_URING;
+    options -> manifest_cache = NULL;
 }
 
 void print_archiver_usage(void) {
@@ -29,11 +59,53 @@ void print_archiver_usage(void) {
     printf(
         "Archive student lab test submissions into compressed packages.\n\n");
     printf("Options:\n");
-    printf("  -l, --level LEVEL      Compression level 0-9 (default: %d)\n",
+    printf("  -l, --level LEVEL      Compression level, 0 = store (deflate: 0-9, default %d;\n"
+           "                         zstd: 0-19, default 3)\n",
            DEFAULT_COMPRESSION_LEVEL);
+    printf("      --codec NAME       deflate (default) or zstd (ZIP method 93, faster to\n"
+           "                         compress at high levels and to extract)\n");
+    printf("      --time-budget SECONDS\n"
+           "                         Adjust the level per file, starting from -l, so the\n"
+           "                         archive is done within SECONDS at the best ratio\n");
+    printf("      --max-memory MB    Keep the process's memory under MB megabytes by\n"
+           "                         compressing fewer files at once, using smaller buffers\n"
+           "                         and deflating files that do not fit in blocks, and\n"
+           "                         report the peak\n");
+    printf("      --solid            Pack files of up to %d KB into solid blocks grouped by\n"
+           "                         extension, with an index to extract them by offset\n",
+           SOLID_FILE_LIMIT / 1024);
+    printf("      --estimate         Predict the archive size, CPU and wall time from\n"
+           "                         sample-compressing each file type; writes nothing\n"
+           "                         (-o not needed)\n");
     printf("  -v, --verbose          Enable verbose output\n");
     printf("  -i, --input            Path to input file directories\n");
-    printf("  -o, --output           Path to output ZIP file\n");
+    printf("  -o, --output           Path to output ZIP file (- for stdout)\n");
+    printf("  -j, --jobs N           Compress N files in parallel (0 = one per CPU, default: 1);\n"
+           "                         input directories are listed on N threads too\n");
+    printf("      --chunk-threshold MB\n"
+           "                         With --jobs, split files of at least MB megabytes\n"
+           "                         across threads (0 = never, default: %d)\n",
+           DEFAULT_CHUNK_THRESHOLD / (1024 * 1024));
+    printf("      --no-store-fallback\n"
+           "                         Deflate every file, even ones that do not shrink\n");
+    printf("      --no-mmap          Read files with read() instead of mapping them\n");
+    printf("      --no-prefetch      Do not read upcoming files ahead while compressing\n");
+    printf("      --io MODE          Read files ahead and write the archive behind with\n"
+           "                         uring (default; threads where io_uring is unavailable),\n"
+           "                         threads, or sync (only advise the kernel)\n");
+    printf("      --direct-io        Write the archive with O_DIRECT, bypassing the page cache\n");
+    printf("      --update ZIP       Reuse entries of a previous archive for files that\n"
+           "                         have not changed (ZIP may be the -o path)\n");
+    printf("      --store DIR        Add the submission to a deduplicating cohort store\n"
+           "                         instead of writing a ZIP (-o not needed)\n");
+    printf("      --student ID       Manifest name in the store (default: input directory name)\n");
+    printf("      --export ID        With --store, write student ID's ZIP to -o (-i not needed)\n");
+    printf("      --batch ROSTER     Archive every submission in ROSTER (a directory of\n"
+           "                         submission directories, or a file listing one per\n"
+           "                         line) into -o DIR, or into --store, on -j workers\n");
+    printf("      --manifest-cache DIR\n"
+           "                         Keep compiled .LT_FILES in DIR, keyed by their content,\n"
+           "                         so configs seen before are not parsed again\n");
     printf("  -h, --help             Display this help message\n");
     printf("  -V, --version          Display version information\n\n");
 }
@@ -48,25 +120,40 @@ int parse_archive_args(int argc, char **argv, ArchiveOptions_t *options) {
     static struct option long_options[] = {{"level", required_argument, 0, 'l'},
                                            {"verbose", no_argument, 0, 'v'},
                                            {"input", required_argument, 0, 'i'},
-                                           {"output", required_argument, 0, '0'},
+                                           {"output", required_argument, 0, 'o'},
+                                           {"jobs", required_argument, 0, 'j'},
+                                           {"chunk-threshold", required_argument, 0, 'T'},
+                                           {"no-store-fallback", no_argument, 0, 'S'},
+                                           {"no-mmap", no_argument, 0, 'M'},
+                                           {"no-prefetch", no_argument, 0, 'R'},
+                                           {"io", required_argument, 0, 'I'},
+                                           {"direct-io", no_argument, 0, 'D'},
+                                           {"update", required_argument, 0, 'P'},
+                                           {"store", required_argument, 0, 'C'},
+                                           {"student", required_argument, 0, 'U'},
+                                           {"export", required_argument, 0, 'E'},
+                                           {"batch", required_argument, 0, 'B'},
+                                           {"codec", required_argument, 0, 'Z'},
+                                           {"solid", no_argument, 0, 'O'},
+                                           {"estimate", no_argument, 0, 'X'},
+                                           {"time-budget", required_argument, 0, 'G'},
+                                           {"max-memory", required_argument, 0, 'Y'},
+                                           {"manifest-cache", required_argument, 0, 'K'},
                                            {"help", no_argument, 0, 'h'},
                                            {"version", no_argument, 0, 'V'},
                                            {0, 0, 0, 0}};
 
-    int opt;
-    int option_index = 0;
+    int  opt;
+    int  option_index = 0;
+    bool level_given = false;
 
-    while ((opt = getopt_long(argc, argv, "l:i:o:vhV", long_options, &option_index))
+    while ((opt = getopt_long(argc, argv, "l:i:o:j:vhV", long_options, &option_index))
            != -1) {
         switch (opt) {
             case 'l':
+                // Checked once the codec is known
                 options->compression_level = atoi(optarg);
-                if (options->compression_level < 0
-                    || options->compression_level > MAX_COMPRESSION_LEVEL) {
-                    fprintf(stderr, "Invalid compression level. Must be 0-%d\n",
-                            MAX_COMPRESSION_LEVEL);
-                    return ERROR_INVALID_ARGS;
-                }
+                level_given = true;
                 break;
             case 'v':
                 options->verbose = true;
@@ -77,6 +164,86 @@ int parse_archive_args(int argc, char **argv, ArchiveOptions_t *options) {
             case 'o':
                 options->output_path = optarg;
                 break;
+            case 'j':
+                options->jobs = atoi(optarg);
+                if (options->jobs < 0) {
+                    fprintf(stderr, "Invalid job count. Must be 0 or more\n");
+                    return ERROR_INVALID_ARGS;
+                }
+                if (options->jobs == 0) {
+                    options->jobs = thread_pool_cpu_count();
+                }
+                break;
+            case 'T':
+                if (atoi(optarg) < 0) {
+                    fprintf(stderr, "Invalid chunk threshold. Must be 0 or more\n");
+                    return ERROR_INVALID_ARGS;
+                }
+                options->chunk_threshold = (size_t)atoi(optarg) * 1024 * 1024;
+                break;
+            case 'S':
+                options->store_fallback = false;
+                break;
+            case 'M':
+                options->use_mmap = false;
+                break;
+            case 'R':
+                options->prefetch = false;
+                break;
+            case 'I':
+                if (async_io_backend_by_name(optarg, &options->io) != SUCCESS) {
+                    fprintf(stderr, "Unknown I/O mode: %s (uring, threads or sync)\n", optarg);
+                    return ERROR_INVALID_ARGS;
+                }
+                break;
+            case 'D':
+                options->direct_io = true;
+                break;
+            case 'P':
+                options->update_path = optarg;
+                break;
+            case 'C':
+                options->store_path = optarg;
+                break;
+            case 'U':
+                options->student_id = optarg;
+                break;
+            case 'E':
+                options->export_student = optarg;
+                break;
+            case 'B':
+                options->batch_path = optarg;
+                break;
+            case 'Z':
+                options->codec = codec_by_name(optarg);
+                if (options->codec == NULL) {
+                    fprintf(stderr, "Unknown codec: %s\n", optarg);
+                    return ERROR_INVALID_ARGS;
+                }
+                break;
+            case 'O':
+                options->solid = true;
+                break;
+            case 'X':
+                options->estimate = true;
+                break;
+            case 'G':
+                options->time_budget = atof(optarg);
+                if (options->time_budget <= 0) {
+                    fprintf(stderr, "Invalid time budget. Must be more than 0 seconds\n");
+                    return ERROR_INVALID_ARGS;
+                }
+                break;
+            case 'Y':
+                if (atoi(optarg) <= 0) {
+                    fprintf(stderr, "Invalid memory cap. Must be at least 1 MB\n");
+                    return ERROR_INVALID_ARGS;
+                }
+                options->max_memory = (size_t)atoi(optarg) * 1024 * 1024;
+                break;
+            case 'K':
+                options->manifest_cache = optarg;
+                break;
             case 'h':
                 print_archiver_usage();
                 exit(SUCCESS);
@@ -89,6 +256,83 @@ int parse_archive_args(int argc, char **argv, ArchiveOptions_t *options) {
         }
     }
 
+    if (!level_given) {
+        options->compression_level = options->codec->default_level;
+    }
+    if (options->compression_level < 0
+        || options->compression_level > options->codec->max_level) {
+        fprintf(stderr, "Invalid compression level for %s. Must be 0-%d\n",
+                options->codec->name, options->codec->max_level);
+        return ERROR_INVALID_ARGS;
+    }
+
+    if (options->solid && (options->update_path != NULL || options->store_path != NULL)) {
+        printf("--solid cannot be combined with --update or --store\n");
+        return ERROR_INVALID_ARGS;
+    }
+
+    if (options->time_budget > 0
+        && (options->batch_path != NULL || options->store_path != NULL
+            || options->estimate)) {
+        printf("--time-budget cannot be combined with --batch, --store or --estimate\n");
+        return ERROR_INVALID_ARGS;
+    }
+
+    if (options->max_memory > 0
+        && (options->batch_path != NULL || options->store_path != NULL)) {
+        printf("--max-memory cannot be combined with --batch or --store\n");
+        return ERROR_INVALID_ARGS;
+    }
+
+    if (options->estimate) {
+        if (options->batch_path != NULL || options->export_student != NULL
+            || options->store_path != NULL || options->update_path != NULL
+            || options->solid) {
+            printf("--estimate cannot be combined with --batch, --export, --store, --update "
+                   "or --solid\n");
+            return ERROR_INVALID_ARGS;
+        }
+        if (options->input_path == NULL) {
+            printf("--estimate needs -i <input>\n");
+            return ERROR_INVALID_ARGS;
+        }
+        return SUCCESS;
+    }
+
+    if (options->batch_path != NULL) {
+        if (options->input_path != NULL || options->export_student != NULL
+            || options->student_id != NULL || options->update_path != NULL) {
+            printf("--batch cannot be combined with -i, --export, --student or --update\n");
+            return ERROR_INVALID_ARGS;
+        }
+        if (options->output_path == NULL && options->store_path == NULL) {
+            printf("--batch needs -o <directory> or --store <dir>\n");
+            return ERROR_INVALID_ARGS;
+        }
+        if (options->output_path != NULL
+            && strcmp(options->output_path, STDOUT_OUTPUT_PATH) == 0) {
+            printf("--batch writes one archive per student; -o must be a directory\n");
+            return ERROR_INVALID_ARGS;
+        }
+        return SUCCESS;
+    }
+
+    if (options->export_student != NULL) {
+        if (options->store_path == NULL || options->output_path == NULL) {
+            printf("--export needs --store <dir> and -o <output>\n");
+            return ERROR_INVALID_ARGS;
+        }
+        return SUCCESS;
+    }
+
+    if (options->store_path != NULL) {
+        if (options->input_path == NULL) {
+            printf("--store needs -i <input>\n");
+            return ERROR_INVALID_ARGS;
+        }
+        return SUCCESS;
+    }
+
     if (options->output_path == NULL || options->input_path == NULL) {
         printf("Both -i <input> and -o <output> must be specified\n");
         return ERROR_INVALID_ARGS;
@@ -97,22 +341,240 @@ int parse_archive_args(int argc, char **argv, ArchiveOptions_t *options) {
     return SUCCESS;
 }
 
-archive_state *create_archive(const char *output_path, int compression_level) {
-    // Create a new ZIP archive using miniz
-    mz_zip_archive *zip = malloc(sizeof(mz_zip_archive));
-    memset(zip, 0, sizeof(mz_zip_archive));
-    
-    // Allocate memory for an archive state structure
-    // Initialize the miniz ZIP writer
-    if (!mz_zip_writer_init_file(zip, output_path, 0)) {
-        free(zip);
-        return NULL;
+/**
+ * Work item for one file when compressing in parallel. A worker fills in
+ * everything after chunk_threshold; the archive writer then consumes the
+ * jobs strictly in file list order.
+ */
+typedef struct {
+    const FileListEntry_t *file;
+    const Codec_t    *codec;
+    int               compression_level;
+    bool              store_fallback;  /* Store entries that do not compress */
+    bool              use_mmap;        /* Map the file instead of reading it */
+    ThreadPool_t     *pool;            /* Pool to split large entries on */
+    size_t            chunk_threshold; /* Minimum size for splitting */
+    double            seconds;         /* Time compressing took */
+    double            stall;           /* Time waiting for the file's contents */
+    size_t            reserved;        /* Memory reserved for the job */
+    bool              streamed;        /* Too large for the memory limit: the
+                                          writer deflates it in blocks */
+    FileInput_t       input;    /* File contents, kept only for stored entries */
+    CompressedEntry_t entry;
+    int               status;
+    TaskGroup_t       group;
+} ArchiveJob_t;
+
+/* Source buffer for miniz's read callback when storing an entry */
+typedef struct {
+    const unsigned char *data;
+    mz_uint64            size;
+} MemoryReader_t;
+
+/* Source file for miniz's read callback when an entry is deflated into
+ * the archive as it is read */
+typedef struct {
+    archive_state *archive;
+    int            fd;
+    mz_uint64      size;         /* Bytes to read (the size when opened) */
+    bool           watch;        /* Give up on deflate after poor blocks */
+    bool           gave_up;      /* Deflate was abandoned part way */
+    int            poor_blocks;  /* Poor blocks in a row */
+    mz_uint64      block_start;  /* Input offset the current block began at */
+    mz_uint64      block_output; /* Archive offset the current block began at */
+} StreamReader_t;
+
+const char *archive_name_for(const char *file_path) {
+    const char *archive_name = strrchr(file_path, '/'); // TODO: Support for windows directories....
+    if (archive_name) {
+        return archive_name + 1;
     }
+    return file_path;
+}
+
+void submission_name(const char *input_path, char *name, size_t size) {
+    size_t end = strlen(input_path);
+    while (end > 1 && input_path[end - 1] == '/') {
+        end--;
+    }
+    size_t start = end;
+    while (start > 0 && input_path[start - 1] != '/') {
+        start--;
+    }
+    snprintf(name, size, "%.*s", (int)(end - start), input_path + start);
+}
+
+static size_t read_from_memory(void *opaque, mz_uint64 file_ofs, void *buf,
+                               size_t n) {
+    MemoryReader_t *reader = opaque;
+    if (file_ofs >= reader->size) {
+        return 0;
+    }
+    if (n > reader->size - file_ofs) {
+        n = (size_t)(reader->size - file_ofs);
+    }
+    memcpy(buf, reader->data + file_ofs, n);
+    return n;
+}
+
+int add_compressed_entry_to_archive(archive_state *archive,
+                                    const char *archive_name,
+                                    const unsigned char *input,
+                                    const CompressedEntry_t *entry,
+                                    MZ_TIME_T *modified) {
+    mz_bool ok;
 
-    archive_state *archive = malloc(sizeof(archive_state));
+    if (entry->compressed) {
+        // The level only matters to miniz when it compresses; zstd levels
+        // are out of its range, so none is passed
+        ok = mz_zip_writer_add_mem_ex_v3(
+            archive->zip, archive_name, entry->data, entry->comp_size, NULL, 0,
+            MZ_ZIP_FLAG_COMPRESSED_DATA, entry->uncomp_size, entry->crc32, modified,
+            NULL, 0, NULL, 0, entry->method);
+    } else {
+        // Stored entries go through the same callback writer that
+        // mz_zip_writer_add_file uses, so the headers match byte for byte
+        MemoryReader_t reader = {input, entry->uncomp_size};
+        ok = mz_zip_writer_add_read_buf_callback(
+            archive->zip, archive_name, read_from_memory, &reader,
+            entry->uncomp_size, modified, NULL, 0, 0, NULL, 0, NULL, 0);
+    }
+    if (!ok) {
+        return ERROR_COMPRESSION;
+    }
+
+    if (entry->store_fallback) {
+        archive->stored_fallback_files++;
+        archive->stored_fallback_bytes += entry->uncomp_size;
+    }
+    return SUCCESS;
+}
+
+/* Adapter from miniz's positional writes to an archive_write_fn sink */
+static size_t write_to_sink(void *opaque, mz_uint64 file_ofs, const void *buf,
+                            size_t n) {
+    archive_state *archive = opaque;
+
+    // A sink cannot seek, so anything but the next byte is an error
+    if (file_ofs != archive->write_offset) {
+        return 0;
+    }
+
+    size_t written = archive->write_fn(archive->write_opaque, buf, n);
+    archive->write_offset += written;
+    return written;
+}
+
+static archive_state *new_archive_state(mz_zip_archive *zip,
+                                        int compression_level) {
+    archive_state *archive = calloc(1, sizeof(archive_state));
+    if (archive == NULL) {
+        return NULL;
+    }
     archive -> zip = zip;
     // Store the compression level
     archive -> compression_level = compression_level;
+    archive -> codec = default_codec();
+    archive -> store_fallback = true;
+    archive -> use_mmap = true;
+    archive -> log = stdout;
+    return archive;
+}
+
+static archive_state *init_archive_writer(archive_write_fn write_fn, void *opaque,
+                                          int compression_level,
+                                          MemoryBudget_t *memory) {
+    if (write_fn == NULL) {
+        return NULL;
+    }
+
+    mz_zip_archive *zip = calloc(1, sizeof(mz_zip_archive));
+    archive_state  *archive = new_archive_state(zip, compression_level);
+    if (zip == NULL || archive == NULL) {
+        free(zip);
+        free(archive);
+        return NULL;
+    }
+    archive -> write_fn = write_fn;
+    archive -> write_opaque = opaque;
+    archive -> memory = memory;
+
+    zip -> m_pWrite = write_to_sink;
+    zip -> m_pIO_opaque = archive;
+    if (memory != NULL) {
+        memory_budget_attach(memory, zip);
+    }
+    if (!mz_zip_writer_init_v2(zip, 0, 0)) {
+        free_archive(archive);
+        return NULL;
+    }
+
+    return archive;
+}
+
+archive_state *create_archive_with_writer(archive_write_fn write_fn,
+                                          void *opaque, int compression_level) {
+    return init_archive_writer(write_fn, opaque, compression_level, NULL);
+}
+
+FILE *archive_log_stream(const ArchiveOptions_t *options) {
+    if (options -> output_path != NULL
+        && strcmp(options -> output_path, STDOUT_OUTPUT_PATH) == 0) {
+        return stderr;
+    }
+    return stdout;
+}
+
+archive_state *create_archive(const char *output_path, int compression_level) {
+    return create_archive_file(output_path, compression_level, 0, false, NULL);
+}
+
+archive_state *create_archive_file(const char *output_path, int compression_level,
+                                   mz_uint64 size_estimate, bool direct_io,
+                                   MemoryBudget_t *memory) {
+    OutputWriter_t *output;
+    bool            to_stdout = strcmp(output_path, STDOUT_OUTPUT_PATH) == 0;
+
+    if (to_stdout) {
+        if (isatty(STDOUT_FILENO)) {
+            print_error("Refusing to write a ZIP archive to a terminal");
+            return NULL;
+        }
+        output = output_writer_wrap_fd(STDOUT_FILENO);
+    } else {
+        output = output_writer_open(output_path, size_estimate, direct_io);
+    }
+    if (output == NULL) {
+        return NULL;
+    }
+
+    // Under a memory limit the write-behind buffer takes a share of it; a
+    // smaller buffer only means more, smaller writes
+    if (memory != NULL && memory -> limit > 0) {
+        size_t capacity = memory -> limit / OUTPUT_BUFFER_SHARE;
+        capacity = capacity < MIN_OUTPUT_BUFFER ? MIN_OUTPUT_BUFFER : capacity;
+        if (capacity < OUTPUT_BUFFER_SIZE) {
+            output_writer_resize(output, capacity);
+        }
+    }
+
+    // Create a new ZIP archive using miniz, writing through the buffered
+    // output instead of miniz's own FILE * backend
+    archive_state *archive = init_archive_writer(
+        output_writer_write, output, compression_level, memory);
+    if (archive == NULL) {
+        output_writer_close(output);
+        return NULL;
+    }
+    archive -> output = output;
+    if (memory != NULL) {
+        archive -> output_reserved = output -> capacity;
+        memory_budget_reserve(memory, archive -> output_reserved, true);
+    }
+    if (to_stdout) {
+        archive -> log = stderr;
+    }
+
     // Return the archive state pointer
     return archive;
     //
@@ -130,53 +592,291 @@ archive_state *create_archive(const char *output_path, int compression_level) {
     //   }
 }
 
-int add_file_to_archive(archive_state *archive, const char *file_path,
-                        const char *archive_name, bool verbose) {
-    
+/* Size of an entry from the metadata captured when it was listed, 0 if
+ * there is none to be had */
+static mz_uint64 entry_size(const FileListEntry_t *entry) {
+    FileMeta_t meta;
+    if (file_list_entry_stat(entry, &meta) != SUCCESS || meta.size <= 0) {
+        return 0;
+    }
+    return (mz_uint64)meta.size;
+}
+
+static size_t read_from_stream(void *opaque, mz_uint64 file_ofs, void *buf,
+                               size_t n) {
+    StreamReader_t *reader = opaque;
+
+    // miniz asks for the next bytes only once it has deflated the ones
+    // before, so what reached the sink since a block began is that block's
+    // output, give or take what the compressor still holds; give up the
+    // way compress_entry_data() does
+    if (reader->watch) {
+        mz_uint64 written = reader->archive->write_offset;
+        mz_uint64 block = file_ofs - reader->block_start;
+        if (file_ofs == 0) {
+            reader->block_output = written;
+        } else if (block >= COMPRESS_BLOCK_SIZE) {
+            if ((written - reader->block_output) * 100 >= block * STORE_RATIO_PERCENT) {
+                reader->poor_blocks++;
+            } else {
+                reader->poor_blocks = 0;
+            }
+            if (reader->poor_blocks >= STORE_BAILOUT_BLOCKS) {
+                reader->gave_up = true;
+                return (size_t)-1;
+            }
+            reader->block_start = file_ofs;
+            reader->block_output = written;
+        }
+    }
+
+    // A file that grew since it was opened is cut at its old size
+    if (file_ofs >= reader->size) {
+        return 0;
+    }
+    if (n > reader->size - file_ofs) {
+        n = (size_t)(reader->size - file_ofs);
+    }
+    for (;;) {
+        ssize_t got = pread(reader->fd, buf, n, (off_t)file_ofs);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        return got < 0 ? (size_t)-1 : (size_t)got;
+    }
+}
+
+/* Whether an entry of size bytes is deflated into the archive as it is
+ * read; miniz's writer only deflates, so other codecs stream stored
+ * entries alone unless memory is short */
+static bool streams_entry(const archive_state *archive, mz_uint64 size) {
+    return size >= STREAM_ENTRY_SIZE
+           && (archive -> compression_level == 0
+               || archive -> codec -> method == ZIP_METHOD_DEFLATE);
+}
+
+/* Whether bytes more fit under the memory limit, cutting the output
+ * buffer down to MIN_OUTPUT_BUFFER first if that is what it takes */
+static bool fits_within_limit(archive_state *archive, size_t bytes) {
+    if (bytes <= memory_budget_available(archive -> memory)) {
+        return true;
+    }
+
+    OutputWriter_t *output = archive -> output;
+    if (output == NULL || output -> capacity <= MIN_OUTPUT_BUFFER) {
+        return false;
+    }
+    size_t before = output -> capacity * (size_t)output -> buffer_count;
+    if (output_writer_resize(output, MIN_OUTPUT_BUFFER) != SUCCESS) {
+        return false;
+    }
+    size_t freed = before - output -> capacity * (size_t)output -> buffer_count;
+    memory_budget_release(archive -> memory, freed);
+    archive -> output_reserved -= freed;
+    return bytes <= memory_budget_available(archive -> memory);
+}
+
+/**
+ * Add a file by having miniz deflate it straight into the archive, so
+ * neither its contents nor its compressed form is held in memory. The
+ * STORE_SAMPLE_SIZE trial decides up front whether to store it. If the
+ * blocks after that stop shrinking, and the output can be rewound, the
+ * entry is written again stored.
+ */
+static int add_streamed_input(archive_state *archive, const char *file_path,
+                              const char *archive_name, const FileMeta_t *meta,
+                              int level) {
+    int fd = open(file_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return ERROR_FILE_NOT_FOUND;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return ERROR_IO;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    MZ_TIME_T modified = meta != NULL && meta -> mode != 0 ? (MZ_TIME_T)meta -> mtime
+                                                           : st.st_mtime;
+    StreamReader_t reader = {archive, fd, (mz_uint64)st.st_size, false, false, 0, 0, 0};
+    bool           stored = false;
+
+    // Only deflate can be written this way; a file too large to compress
+    // with another codec under the memory limit is deflated instead
+    if (level > 0 && archive -> codec -> method != ZIP_METHOD_DEFLATE) {
+        level = MZ_DEFAULT_LEVEL;
+    }
+
+    if (level > 0 && archive -> store_fallback) {
+        memory_budget_reserve(archive -> memory, MEMORY_STREAM_BYTES, true);
+        unsigned char *sample = malloc(STORE_SAMPLE_SIZE);
+        size_t         n = sample != NULL
+                               ? read_from_stream(&reader, 0, sample, STORE_SAMPLE_SIZE)
+                               : 0;
+        if (n != (size_t)-1 && looks_incompressible(sample, n)) {
+            level = 0;
+            stored = true;
+        }
+        free(sample);
+        memory_budget_release(archive -> memory, MEMORY_STREAM_BYTES);
+        reader.watch = archive -> output != NULL && archive -> output -> seekable;
+    }
+
+    mz_uint64 entry_start = archive -> write_offset;
+    mz_bool   ok = mz_zip_writer_add_read_buf_callback(
+        archive -> zip, archive_name, read_from_stream, &reader, reader.size, &modified,
+        NULL, 0, (mz_uint)level, NULL, 0, NULL, 0);
+    if (!ok && reader.gave_up
+        && output_writer_rewind(archive -> output, entry_start) == SUCCESS) {
+        // miniz only moves its offset on once an entry is complete, so
+        // the stored copy simply takes the abandoned one's place
+        archive -> write_offset = entry_start;
+        reader.watch = false;
+        stored = true;
+        ok = mz_zip_writer_add_read_buf_callback(
+            archive -> zip, archive_name, read_from_stream, &reader, reader.size,
+            &modified, NULL, 0, 0, NULL, 0, NULL, 0);
+    }
+    close(fd);
+    if (!ok) {
+        return ERROR_COMPRESSION;
+    }
+
+    if (stored) {
+        archive -> stored_fallback_files++;
+        archive -> stored_fallback_bytes += reader.size;
+    }
+    return SUCCESS;
+}
+
+/* add_file_to_archive(), dating the entry from meta when it was captured;
+ * index is the entry's place in the read-ahead list, or -1 */
+static int add_input_to_archive(archive_state *archive, const char *file_path,
+                                const char *archive_name, const FileMeta_t *meta,
+                                int index, bool verbose) {
+    FileInput_t       input;
+    CompressedEntry_t entry;
+
     // Add a file to the ZIP archive
-    // Read the file from disk
-    // Compress it and add to the archive
-    int archive_err_state = mz_zip_writer_add_file(archive -> zip, 
-                        archive_name, 
-                        file_path, 
-                        NULL, 
-                        0, 
-                        archive -> compression_level);
+    // Take it from its read-ahead buffer, or map (or read) it from disk;
+    // a large file is deflated into the archive as it is read instead
+    double    stall = 0;
+    int       status = SUCCESS;
+    bool      taken = archive -> prefetch != NULL && index >= 0
+                      && prefetch_take_read(archive -> prefetch, index, &input, &stall);
+    long long size = meta != NULL && meta -> mode != 0 ? meta -> size
+                                                       : get_file_size(file_path);
+    bool      stream = !taken && size > 0 && streams_entry(archive, (mz_uint64)size);
+    if (!stream && !taken && size > 0 && archive -> memory != NULL
+        && !fits_within_limit(archive,
+                              entry_working_memory(archive -> codec,
+                                                   archive -> compression_level,
+                                                   (size_t)size))) {
+        // Its contents, output and compressor state would not fit under
+        // the memory limit even alone
+        stream = true;
+        memory_budget_note_streamed(archive -> memory);
+    }
+    if (stream) {
+        status = add_streamed_input(archive, file_path, archive_name, meta,
+                                    archive -> compression_level);
+    } else {
+        if (!taken && archive -> prefetch == NULL) {
+            status = open_file_input(file_path, archive -> use_mmap, &input);
+        } else if (!taken) {
+            status = prefetch_open_input(file_path, archive -> use_mmap, &input, &stall);
+        }
+        if (status == SUCCESS && meta != NULL && meta -> mode != 0) {
+            input.modified = (time_t)meta -> mtime;
+        }
+
+        // Compress it and add to the archive
+        if (status == SUCCESS) {
+            // It fits (or its size was not known), so this only counts
+            size_t reserved = 0;
+            if (archive -> memory != NULL) {
+                reserved = entry_working_memory(archive -> codec,
+                                                archive -> compression_level, input.size);
+                memory_budget_reserve(archive -> memory, reserved, true);
+            }
+            double start = time_budget_now();
+            status = archive -> codec -> compress(input.data, input.size,
+                                                  archive -> compression_level,
+                                                  archive -> store_fallback, &entry);
+            if (archive -> prefetch != NULL) {
+                prefetch_record(archive -> prefetch, input.size, stall,
+                                time_budget_now() - start);
+            }
+            if (status == SUCCESS) {
+                status = add_compressed_entry_to_archive(archive, archive_name, input.data,
+                                                         &entry, &input.modified);
+                free_compressed_entry(&entry);
+            }
+            memory_budget_release(archive -> memory, reserved);
+            close_file_input(&input);
+        }
+    }
 
     // Error handling
-    if (!archive_err_state) {
+    if (status != SUCCESS) {
         if (verbose) {
-            printf("Error adding: %s\n", file_path);
+            fprintf(archive -> log, "Error adding: %s\n", file_path);
         }
         return ERROR_COMPRESSION;
     }
 
     // Print progress if verbose is true
     if (verbose) {
-        printf("Adding: %s\n", file_path);
+        fprintf(archive -> log, "Adding: %s\n", file_path);
     }
-    //
-    // Hints:
-    // - Cast archive back to your archive state struct
-    // - Use mz_zip_writer_add_file() from miniz
-    // - Parameters: zip, archive_name, file_path, NULL, 0, compression_level
-    // - Check the return value - false means error
-    // - Print: "Adding: %s\n" if verbose
-    // - Handle errors gracefully
 
     return SUCCESS;
 }
 
+int add_file_to_archive(archive_state *archive, const char *file_path,
+                        const char *archive_name, bool verbose) {
+    return add_input_to_archive(archive, file_path, archive_name, NULL, -1, verbose);
+}
+
 int finalize_archive(archive_state *archive, bool verbose) {
+    if (verbose && archive -> stored_fallback_files > 0) {
+        fprintf(archive -> log, "Stored without compression: %d files, %llu bytes\n",
+               archive -> stored_fallback_files,
+               (unsigned long long)archive -> stored_fallback_bytes);
+    }
+
+    if (verbose && archive -> reused_files > 0) {
+        fprintf(archive -> log, "Reused from previous archive: %d files\n",
+                archive -> reused_files);
+    }
+
+    if (verbose && archive -> prefetch != NULL && archive -> prefetch -> read_files > 0) {
+        print_prefetch_stats(archive -> log, archive -> prefetch);
+    }
+
+    FILE *log = archive -> log;
+
     // Finalize the ZIP archive
     // Close the file
-    mz_zip_writer_finalize_archive(archive -> zip);
+    int status = SUCCESS;
+    if (!mz_zip_writer_finalize_archive(archive -> zip)) {
+        status = ERROR_IO;
+    }
     mz_zip_writer_end(archive -> zip);
+    if (output_writer_close(archive -> output) != SUCCESS) {
+        status = ERROR_IO;
+    }
+    archive -> output = NULL;
     // Free allocated memory
     free_archive(archive);
+    if (status != SUCCESS) {
+        print_error("Failed to write archive");
+        return status;
+    }
     // Print summary if verbose
     if (verbose) {
-        printf("Files zipped successfully\n");
+        fprintf(log, "Files zipped successfully\n");
     }
     //
     // Hints:
@@ -188,15 +888,17 @@ int finalize_archive(archive_state *archive, bool verbose) {
     return SUCCESS;
 }
 
-int validate_file_list(char **file_list, int file_count) {
+int validate_file_list(const FileList_t *file_list) {
     // Check that all files in the list exist
     bool file_missing = false;
-    for (int i = 0; i < file_count; i++) {
-        char * file = file_list[i];
-        struct stat st;
-        if (stat(file, &st) != 0) {
+    for (int i = 0; i < file_list -> count; i++) {
+        // Files found by the walk or the config carry their statx() result
+        char       file[MAX_PATH_LENGTH];
+        FileMeta_t meta;
+        if (file_list_entry_stat(&file_list -> entries[i], &meta) != SUCCESS) {
+            file_list_path(file_list, i, file);
             // Print error messages for missing files
-            printf("Missing file; %s\n", file);
+            fprintf(stderr, "Missing file; %s\n", file);
             file_missing = true;
         }
     }
@@ -216,44 +918,474 @@ int validate_file_list(char **file_list, int file_count) {
     // - Return SUCCESS if all files exist
 }
 
-int create_archive_from_file_list(char **file_list, int file_count,
+/* Copy entry i's compressed bytes from the previous archive as they are */
+static int copy_unchanged_entry(archive_state *archive, ArchiveUpdate_t *update, int i,
+                                const char *file_path, bool verbose) {
+    if (!mz_zip_writer_add_from_zip_reader(archive->zip, &update->reader,
+                                           (mz_uint)update->reuse[i])) {
+        if (verbose) {
+            fprintf(archive->log, "Error adding: %s\n", file_path);
+        }
+        return ERROR_COMPRESSION;
+    }
+    archive->reused_files++;
+    if (verbose) {
+        fprintf(archive->log, "Unchanged: %s\n", file_path);
+    }
+    return SUCCESS;
+}
+
+size_t entry_working_memory(const Codec_t *codec, int level, size_t size) {
+    // The output can come to the input's size before the store fallback
+    // gives up on it
+    return 2 * size + codec -> working_memory(level, size);
+}
+
+/**
+ * Reserve what a job will hold before it is submitted. A file that would
+ * be split across workers is compressed in one piece if the split does not
+ * fit; force is set when nothing ahead of the job holds memory that could
+ * be waited for, and a file that does not fit even then is left to the
+ * writer to deflate in blocks.
+ */
+static bool reserve_job_memory(archive_state *archive, ArchiveJob_t *job, int workers,
+                               bool force) {
+    if (archive -> memory == NULL) {
+        return true;
+    }
+
+    size_t size = (size_t)entry_size(job -> file);
+    size_t bytes = entry_working_memory(job -> codec, job -> compression_level, size);
+    if (job -> chunk_threshold > 0 && size > 0 && size >= job -> chunk_threshold
+        && job -> compression_level > 0 && job -> codec -> compress_parallel != NULL) {
+        // Each worker has its own compressor, and the chunks' output is
+        // copied into one buffer once they are done
+        size_t split = bytes + size
+                       + (size_t)workers
+                             * job -> codec -> working_memory(job -> compression_level, size);
+        if (split <= memory_budget_available(archive -> memory)
+            && memory_budget_reserve(archive -> memory, split, false)) {
+            job -> reserved = split;
+            return true;
+        }
+        job -> chunk_threshold = 0;
+    }
+
+    if (!fits_within_limit(archive, bytes) && force && size > 0) {
+        job -> streamed = true;
+        memory_budget_note_streamed(archive -> memory);
+        return true;
+    }
+    if (!memory_budget_reserve(archive -> memory, bytes, force)) {
+        return false;
+    }
+    job -> reserved = bytes;
+    return true;
+}
+
+static void compress_job(void *arg) {
+    ArchiveJob_t *job = arg;
+    char          file_path[MAX_PATH_LENGTH];
+
+    // Entries read ahead into a buffer arrive with their contents
+    if (job->input.data == NULL) {
+        job->status = prefetch_open_input(file_list_entry_path(job->file, file_path),
+                                          job->use_mmap, &job->input, &job->stall);
+    }
+    if (job->status != SUCCESS) {
+        return;
+    }
+    if (job->file->meta.mode != 0) {
+        job->input.modified = (time_t)job->file->meta.mtime;
+    }
+
+    double start = time_budget_now();
+    if (job->chunk_threshold > 0 && job->input.size >= job->chunk_threshold
+        && job->compression_level > 0 && job->codec->compress_parallel != NULL) {
+        job->status = job->codec->compress_parallel(
+            job->input.data, job->input.size, job->compression_level,
+            job->store_fallback, job->pool, &job->entry);
+    } else {
+        job->status = job->codec->compress(job->input.data, job->input.size,
+                                           job->compression_level,
+                                           job->store_fallback, &job->entry);
+    }
+    job->seconds = time_budget_now() - start;
+    if (job->status == SUCCESS && job->entry.compressed) {
+        // Only stored entries need the original bytes when writing; the
+        // modification time survives closing the input
+        close_file_input(&job->input);
+    }
+}
+
+/**
+ * Deflate files on a worker pool and append them in list order, producing
+ * the same archive as adding them one by one with add_file_to_archive().
+ */
+static int add_files_in_parallel(archive_state *archive, const FileList_t *file_list,
+                                 const ArchiveOptions_t *options,
+                                 ArchiveUpdate_t *update) {
+    int file_count = file_list->count;
+    // In batch mode every student's entries go to the one shared pool
+    ThreadPool_t *pool = options->pool;
+    if (pool == NULL) {
+        pool = thread_pool_create(options->jobs);
+    }
+    if (pool == NULL) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+
+    ArchiveJob_t *jobs = calloc(file_count > 0 ? (size_t)file_count : 1,
+                                sizeof(ArchiveJob_t));
+    if (jobs == NULL) {
+        if (pool != options->pool) {
+            thread_pool_destroy(pool);
+        }
+        return ERROR_MEMORY_ALLOCATION;
+    }
+
+    // Bound the number of entries held in memory at once
+    int window = options->jobs * JOB_WINDOW_PER_WORKER;
+    int submitted = 0;
+    int status = SUCCESS;
+
+    for (int i = 0; i < file_count; i++) {
+        while (status == SUCCESS && submitted < file_count
+               && submitted < i + window) {
+            ArchiveJob_t *job = &jobs[submitted++];
+            job->file = &file_list->entries[submitted - 1];
+            if (update != NULL && update->reuse[submitted - 1] >= 0) {
+                continue;
+            }
+            job->codec = archive->codec;
+            job->compression_level = archive->budget != NULL
+                                         ? time_budget_level(archive->budget)
+                                         : archive->compression_level;
+            job->store_fallback = archive->store_fallback;
+            job->use_mmap = archive->use_mmap;
+            job->pool = pool;
+            job->chunk_threshold = options->chunk_threshold;
+            // Short on memory: hold the job back until the entries ahead
+            // of it have been written
+            if (!reserve_job_memory(archive, job, options->jobs, submitted - 1 == i)) {
+                submitted--;
+                break;
+            }
+            if (archive->prefetch != NULL) {
+                prefetch_advance(archive->prefetch, submitted - 1);
+            }
+            if (job->streamed) {
+                continue;
+            }
+            if (archive->prefetch != NULL) {
+                prefetch_take_read(archive->prefetch, submitted - 1, &job->input,
+                                   &job->stall);
+            }
+            if (thread_pool_submit(pool, &job->group, compress_job, job)
+                != SUCCESS) {
+                compress_job(job);
+            }
+        }
+        if (i >= submitted) {
+            break;
+        }
+
+        ArchiveJob_t *job = &jobs[i];
+        char          file_path[MAX_PATH_LENGTH];
+        file_list_entry_path(job->file, file_path);
+        if (update != NULL && update->reuse[i] >= 0) {
+            if (status == SUCCESS) {
+                status = copy_unchanged_entry(archive, update, i, file_path,
+                                              options->verbose);
+            }
+            continue;
+        }
+        thread_pool_wait(pool, &job->group);
+
+        if (status == SUCCESS && job->streamed) {
+            double start = time_budget_now();
+            job->status = add_streamed_input(archive, file_path, job->file->name,
+                                             &job->file->meta, job->compression_level);
+            job->seconds = time_budget_now() - start;
+            job->entry.uncomp_size = entry_size(job->file);
+        }
+        if (status == SUCCESS) {
+            status = job->status;
+            if (status == SUCCESS && !job->streamed) {
+                status = add_compressed_entry_to_archive(
+                    archive, job->file->name, job->input.data,
+                    &job->entry, &job->input.modified);
+            }
+            if (status == SUCCESS && archive->budget != NULL) {
+                time_budget_record(archive->budget, job->compression_level,
+                                   job->entry.uncomp_size, job->seconds);
+            }
+            if (status == SUCCESS && archive->prefetch != NULL) {
+                prefetch_record(archive->prefetch, job->entry.uncomp_size, job->stall,
+                                job->seconds);
+            }
+            if (options->verbose && archive->budget != NULL) {
+                fprintf(archive->log, "%s: %s (level %d)\n",
+                        status == SUCCESS ? "Adding" : "Error adding",
+                        file_path, job->compression_level);
+            } else if (options->verbose) {
+                fprintf(archive->log, "%s: %s\n",
+                        status == SUCCESS ? "Adding" : "Error adding",
+                        file_path);
+            }
+        }
+
+        close_file_input(&job->input);
+        free_compressed_entry(&job->entry);
+        memory_budget_release(archive->memory, job->reserved);
+    }
+
+    free(jobs);
+    if (pool != options->pool) {
+        thread_pool_destroy(pool);
+    }
+    return status;
+}
+
+/* add_file_to_archive() at the level the time budget picks, timed */
+static int add_file_within_budget(archive_state *archive, const FileListEntry_t *entry,
+                                  int index, const char *file_path, bool verbose) {
+    archive->compression_level = time_budget_level(archive->budget);
+    double start = time_budget_now();
+    int status = add_input_to_archive(archive, file_path, entry->name, &entry->meta, index,
+                                      false);
+    if (status == SUCCESS) {
+        time_budget_record(archive->budget, archive->compression_level, entry_size(entry),
+                           time_budget_now() - start);
+    }
+    if (verbose) {
+        fprintf(archive->log, "%s: %s (level %d)\n",
+                status == SUCCESS ? "Adding" : "Error adding", file_path,
+                archive->compression_level);
+    }
+    return status;
+}
+
+/* Whether two paths name the same existing file */
+static bool same_file(const char *a, const char *b) {
+    struct stat sa, sb;
+    return stat(a, &sa) == 0 && stat(b, &sb) == 0 && sa.st_dev == sb.st_dev
+           && sa.st_ino == sb.st_ino;
+}
+
+/* Upper bound on the archive size: every file stored, plus a local header,
+ * data descriptor and central directory record per entry. Used only to
+ * preallocate the output, which is trimmed to the real size at the end. */
+static mz_uint64 estimate_archive_size(const FileList_t *file_list) {
+    mz_uint64 estimate = ZIP_END_RECORD_SIZE;
+    for (int i = 0; i < file_list->count; i++) {
+        estimate += entry_size(&file_list->entries[i]);
+        estimate += ZIP_ENTRY_OVERHEAD + 2 * strlen(file_list->entries[i].name);
+    }
+    return estimate;
+}
+
+int create_archive_from_file_list(const FileList_t       *file_list,
                                   const char             *output_path,
                                   const ArchiveOptions_t *options) {
     // This is the main function that creates a ZIP from a file list
     // Steps:
     //       1. Validate all files exist using validate_file_list()
     int status; // status variable storing return values
-    status = validate_file_list(file_list, file_count);
+    status = validate_file_list(file_list);
     if (status != SUCCESS) return status;
 
+    if (options -> store_path != NULL) {
+        return cohort_store_add(options -> store_path, options -> student_id,
+                                file_list, options, NULL);
+    }
+
+    // With --update, find the entries of the previous archive that can be
+    // copied over instead of compressed again
+    ArchiveUpdate_t  update_state;
+    ArchiveUpdate_t *update = NULL;
+    char             update_tmp_path[MAX_PATH_LENGTH + 32];
+    const char      *write_path = output_path;
+    if (options -> update_path != NULL) {
+        status = open_archive_update(options -> update_path, file_list,
+                                     options -> codec -> method, options -> use_mmap,
+                                     &update_state);
+        if (status != SUCCESS) return status;
+        update = &update_state;
+
+        if (same_file(options -> update_path, output_path)) {
+            if (archive_update_is_noop(update, file_list -> count)) {
+                if (options -> verbose) {
+                    fprintf(archive_log_stream(options),
+                            "Archive is up to date: %s\n", output_path);
+                }
+                close_archive_update(update);
+                return SUCCESS;
+            }
+            // The previous archive is still being read from, so build the
+            // new one next to it and swap it in at the end
+            snprintf(update_tmp_path, sizeof(update_tmp_path), "%s.tmp.%ld",
+                     output_path, (long)getpid());
+            write_path = update_tmp_path;
+        }
+    }
+
+    // With --max-memory, miniz allocates from the budget and entries
+    // reserve their buffers from it before they are compressed
+    MemoryBudget_t  memory_state;
+    MemoryBudget_t *memory = NULL;
+    if (options -> max_memory > 0) {
+        memory_budget_init(&memory_state, options -> max_memory);
+        memory = &memory_state;
+    }
+
     //       2. Create the archive using create_archive()
-    archive_state * archive = create_archive(output_path, options -> compression_level);
+    archive_state * archive = create_archive_file(
+        write_path, options -> compression_level,
+        estimate_archive_size(file_list), options -> direct_io, memory);
     if (archive == NULL) {
-        free_archive(archive);
+        close_archive_update(update);
+        if (memory != NULL) {
+            memory_budget_destroy(memory);
+        }
         return ERROR_IO;
     }
-    //       3. Loop through each file and add it using add_file_to_archive()
-    for (int i = 0; i < file_count; i++) {
-        const char *file_path = file_list[i];
-
-        const char *archive_name = strrchr(file_path, '/'); // TODO: Support for windows directories....
-        if (archive_name) {
-            archive_name++;
-        } else {
-            archive_name = file_path;
-        }
-        
-        status = add_file_to_archive(archive, 
-                                    file_path, 
-                                    archive_name, 
-                                    options -> verbose);
+    archive -> codec = options -> codec;
+    archive -> store_fallback = options -> store_fallback;
+    archive -> use_mmap = options -> use_mmap;
+
+    // Write full output buffers behind while the next one is filled
+    if (output_writer_start_async(archive -> output, options -> io) == SUCCESS
+        && memory != NULL) {
+        size_t spare = archive -> output -> capacity * (OUTPUT_WRITE_BUFFERS - 1);
+        memory_budget_reserve(memory, spare, true);
+        archive -> output_reserved += spare;
+    }
+
+    // In solid mode only the files too large for a block get entries of
+    // their own; the rest are packed after them
+    const FileList_t *entry_list = file_list;
+    FileList_t        solid_list = {0};
+    FileList_t        solid_entries = {0};
+    if (options -> solid) {
+        status = partition_solid_files(file_list, &solid_list, &solid_entries);
+        entry_list = &solid_entries;
         if (status != SUCCESS) {
             free_archive(archive);
+            if (memory != NULL) {
+                memory_budget_destroy(memory);
+            }
             return status;
         }
     }
+
+    // With --time-budget, each entry's level is picked as the run goes
+    TimeBudget_t budget;
+    if (options -> time_budget > 0) {
+        mz_uint64 total_bytes = 0;
+        for (int i = 0; i < entry_list -> count; i++) {
+            if (update == NULL || update -> reuse[i] < 0) {
+                total_bytes += entry_size(&entry_list -> entries[i]);
+            }
+        }
+        for (int i = 0; i < solid_list.count; i++) {
+            total_bytes += entry_size(&solid_list.entries[i]);
+        }
+        // Workers beyond the CPU count add no throughput
+        int workers = options -> jobs > 1 ? options -> jobs : 1;
+        if (workers > thread_pool_cpu_count()) {
+            workers = thread_pool_cpu_count();
+        }
+        time_budget_init(&budget, options -> time_budget, options -> compression_level,
+                         options -> codec -> max_level, workers, total_bytes);
+        archive -> budget = &budget;
+    }
+
+    // Read each entry's successors ahead while it is compressed. Buffers
+    // read ahead are not counted against --max-memory, so under a limit
+    // the kernel is only advised
+    Prefetch_t prefetch;
+    prefetch_init(&prefetch, entry_list, options -> prefetch,
+                  memory != NULL ? ASYNC_IO_SYNC : options -> io);
+    prefetch.skip = update != NULL ? update -> reuse : NULL;
+    archive -> prefetch = &prefetch;
+
+    //       3. Loop through each file and add it using add_file_to_archive()
+    if (options -> jobs > 1) {
+        status = add_files_in_parallel(archive, entry_list, options, update);
+    }
+    for (int i = 0; i < entry_list -> count && options -> jobs <= 1 && status == SUCCESS;
+         i++) {
+        char file_path[MAX_PATH_LENGTH];
+        file_list_path(entry_list, i, file_path);
+
+        if (update != NULL && update -> reuse[i] >= 0) {
+            status = copy_unchanged_entry(archive, update, i, file_path,
+                                          options -> verbose);
+            continue;
+        }
+        prefetch_advance(&prefetch, i);
+        if (archive -> budget != NULL) {
+            status = add_file_within_budget(archive, &entry_list -> entries[i], i,
+                                            file_path, options -> verbose);
+            continue;
+        }
+        status = add_input_to_archive(archive,
+                                      file_path,
+                                      entry_list -> entries[i].name,
+                                      &entry_list -> entries[i].meta,
+                                      i,
+                                      options -> verbose);
+    }
+    if (status == SUCCESS && solid_list.count > 0) {
+        if (archive -> budget != NULL) {
+            archive -> compression_level = time_budget_level(archive -> budget);
+        }
+        status = add_solid_blocks(archive, &solid_list, options, NULL);
+    }
+    if (options -> solid) {
+        file_list_free(&solid_list);
+        file_list_free(&solid_entries);
+    }
+    if (status != SUCCESS) {
+        prefetch_finish(&prefetch);
+        free_archive(archive);
+        close_archive_update(update);
+        if (memory != NULL) {
+            memory_budget_destroy(memory);
+        }
+        if (write_path != output_path) {
+            unlink(write_path);
+        }
+        return status;
+    }
     //       4. Finalize the archive using finalize_archive()
-    finalize_archive(archive, options -> verbose);
+    bool budgeted = archive -> budget != NULL;
+    status = finalize_archive(archive, options -> verbose);
+    prefetch_finish(&prefetch);
+    if (status == SUCCESS && budgeted && options -> verbose) {
+        fprintf(archive_log_stream(options),
+                "Time budget: %.1f s, used %.1f s, levels %d-%d\n", budget.budget,
+                time_budget_now() - budget.start, budget.min_used, budget.max_used);
+    }
+    close_archive_update(update);
+    if (memory != NULL) {
+        if (status == SUCCESS) {
+            memory_budget_report(memory, archive_log_stream(options));
+        }
+        memory_budget_destroy(memory);
+    }
+    if (write_path != output_path) {
+        if (status == SUCCESS && rename(write_path, output_path) != 0) {
+            status = ERROR_IO;
+        }
+        if (status != SUCCESS) {
+            unlink(write_path);
+        }
+    }
+    if (status != SUCCESS) {
+        return status;
+    }
 
     //       5. Handle errors at each step
     //
@@ -280,6 +1412,13 @@ int create_archive_from_file_list(char **file_list, int file_count,
 }
 
 void free_archive(archive_state * archive) {
+    if (archive == NULL) {
+        return;
+    }
+    // Releases the output if the archive was abandoned before finalizing
+    mz_zip_writer_end(archive -> zip);
+    output_writer_close(archive -> output);
+    memory_budget_release(archive -> memory, archive -> output_reserved);
     free(archive -> zip);
     free(archive);
 }
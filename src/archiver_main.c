@@ -12,7 +12,11 @@
  */
 
 #include "../include/archiver.h"
+#include "../include/batch.h"
+#include "../include/cohort_store.h"
 #include "../include/config.h"
+#include "../include/dir_walk.h"
+#include "../include/estimate.h"
 
 int main(int argc, char **argv) {
     ArchiveOptions_t options;
@@ -24,32 +28,53 @@ int main(int argc, char **argv) {
         return result;
     }
 
+    // Every .LT_FILES parsed from here on, in a batch too, goes through the cache
+    config_use_manifest_cache(options.manifest_cache);
+
+    if (options.batch_path != NULL) {
+        return run_batch(options.batch_path, &options);
+    }
+
+    if (options.export_student != NULL) {
+        return cohort_store_export(options.store_path, options.export_student,
+                                   options.output_path, &options);
+    }
+
     ArchiverFILES files;
     char LT_FILE_path[MAX_PATH_LENGTH];
     strcpy(LT_FILE_path, options.input_path);
     strcat(LT_FILE_path, "/.LT_FILES");
     files.LT_FILES_path = LT_FILE_path;
 
-    char *file_list[MAX_CONFIG_FILES];
-    int file_count = 0;
-    files.file_list = file_list;
-    files.file_count = &file_count;
+    FileList_t file_list;
+    if (file_list_init(&file_list) != SUCCESS) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    files.file_list = &file_list;
     // TODO: Step 2: Get config file path from command line
-    printf(
+    fprintf(archive_log_stream(&options),
         "%s\n", files.LT_FILES_path
     );
 
-    parse_config_file(files.LT_FILES_path, options.input_path, files.file_list, MAX_CONFIG_FILES, files.file_count);
+    // Large trees are listed on the -j threads too
+    dir_walk_use_threads(options.jobs);
+    parse_config_file(files.LT_FILES_path, options.input_path, files.file_list);
         
-    // printf("%i\n", *(files.file_count));
-    // for (int i = 0; i < *(files.file_count); i++) {
-    //     printf("%s\n", (files.file_list)[i]);
-    // }
+    if (options.estimate) {
+        ArchiveEstimate_t estimate;
+        result = estimate_archive(files.file_list, &options, &estimate);
+        if (result == SUCCESS) {
+            print_archive_estimate(stdout, &estimate, &options);
+        }
+        file_list_free(&file_list);
+        return result;
+    }
+
     // TODO: Step 3: Parse the config file to get file list
-    create_archive_from_file_list(files.file_list, 
-                                    *(files.file_count), 
+    result = create_archive_from_file_list(files.file_list, 
                                     options.output_path, 
                                     &options);
+    file_list_free(&file_list);
     
     
     // TODO: Step 4: Get output path using student ID (prompt them)
@@ -58,5 +83,5 @@ int main(int argc, char **argv) {
 
     // TODO: Step 6: Clean up
 
-    return SUCCESS;
+    return result;
 }
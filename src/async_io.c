@@ -0,0 +1,405 @@
+/**
+ * @file async_io.c
+ * @brief Implementation of the io_uring / I/O thread request queue
+ */
+
+#define _GNU_SOURCE
+
+#include "async_io.h"
+#include <errno.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/io_uring.h>
+#endif
+
+/* Move the rest of a request from byte done on, with plain system calls.
+ * Returns the bytes transferred in all, or -errno. */
+static long transfer(const AsyncIoRequest_t *request, size_t done) {
+    unsigned char *buf = request->iov.iov_base;
+    size_t         length = request->iov.iov_len;
+    while (done < length) {
+        ssize_t n = request->write
+                        ? pwrite(request->fd, buf + done, length - done,
+                                 request->offset + (off_t)done)
+                        : pread(request->fd, buf + done, length - done,
+                                request->offset + (off_t)done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -errno;
+        }
+        if (n == 0) {
+            if (request->write) {
+                return -EIO;
+            }
+            break; // end of file
+        }
+        done += (size_t)n;
+    }
+    return (long)done;
+}
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+
+static int ring_init(AsyncIo_t *io, unsigned depth) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = (int)syscall(__NR_io_uring_setup, depth, &params);
+    if (fd < 0) {
+        return ERROR_IO;
+    }
+    io->ring_fd = fd;
+
+    io->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    io->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+        // Both queues live in one mapping, sized for the larger
+        if (io->cq_ring_size > io->sq_ring_size) {
+            io->sq_ring_size = io->cq_ring_size;
+        }
+        io->cq_ring_size = io->sq_ring_size;
+    }
+
+    io->sq_ring = mmap(NULL, io->sq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (io->sq_ring == MAP_FAILED) {
+        io->sq_ring = NULL;
+        close(fd);
+        return ERROR_IO;
+    }
+    io->cq_ring = single_mmap ? io->sq_ring
+                              : mmap(NULL, io->cq_ring_size, PROT_READ | PROT_WRITE,
+                                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    io->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    io->sqes = mmap(NULL, io->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    fd, IORING_OFF_SQES);
+    if (io->cq_ring == MAP_FAILED || io->sqes == MAP_FAILED) {
+        if (io->sqes != MAP_FAILED) {
+            munmap(io->sqes, io->sqes_size);
+        }
+        if (io->cq_ring != MAP_FAILED && io->cq_ring != io->sq_ring) {
+            munmap(io->cq_ring, io->cq_ring_size);
+        }
+        munmap(io->sq_ring, io->sq_ring_size);
+        io->sq_ring = io->cq_ring = io->sqes = NULL;
+        close(fd);
+        return ERROR_IO;
+    }
+
+    unsigned char *sq = io->sq_ring;
+    unsigned char *cq = io->cq_ring;
+    io->sq_head = (unsigned *)(sq + params.sq_off.head);
+    io->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    io->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    io->sq_array = (unsigned *)(sq + params.sq_off.array);
+    io->cq_head = (unsigned *)(cq + params.cq_off.head);
+    io->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    io->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    io->cqes = cq + params.cq_off.cqes;
+
+    // The completion queue is twice the submission queue, so bounding the
+    // requests in flight by the latter means completions never overflow
+    io->depth = depth < params.sq_entries ? depth : params.sq_entries;
+    return SUCCESS;
+}
+
+static void ring_queue(AsyncIo_t *io, AsyncIoRequest_t *request) {
+    unsigned             tail = *io->sq_tail;
+    unsigned             index = tail & *io->sq_mask;
+    struct io_uring_sqe *sqe = &((struct io_uring_sqe *)io->sqes)[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = request->write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd = request->fd;
+    sqe->addr = (uintptr_t)&request->iov;
+    sqe->len = 1;
+    sqe->off = (uint64_t)request->offset;
+    sqe->user_data = (uintptr_t)request;
+    io->sq_array[index] = index;
+    // The kernel must see the entry before the new tail
+    __atomic_store_n(io->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    io->unsubmitted++;
+}
+
+/* Submit what is queued and, with min_complete, wait for completions */
+static int ring_enter(AsyncIo_t *io, unsigned min_complete) {
+    unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    for (;;) {
+        long n = syscall(__NR_io_uring_enter, io->ring_fd, io->unsubmitted, min_complete,
+                         flags, NULL, 0);
+        if (n >= 0) {
+            io->enters++;
+            io->unsubmitted -= (unsigned)n < io->unsubmitted ? (unsigned)n : io->unsubmitted;
+            return SUCCESS;
+        }
+        if (errno != EINTR) {
+            return ERROR_IO;
+        }
+    }
+}
+
+static void ring_reap(AsyncIo_t *io) {
+    unsigned             head = *io->cq_head;
+    unsigned             tail = __atomic_load_n(io->cq_tail, __ATOMIC_ACQUIRE);
+    struct io_uring_cqe *cqes = io->cqes;
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &cqes[head & *io->cq_mask];
+        AsyncIoRequest_t    *request = (AsyncIoRequest_t *)(uintptr_t)cqe->user_data;
+        request->result = cqe->res;
+        request->done = true;
+        io->in_flight--;
+        head++;
+    }
+    __atomic_store_n(io->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static void ring_destroy(AsyncIo_t *io) {
+    munmap(io->sqes, io->sqes_size);
+    if (io->cq_ring != io->sq_ring) {
+        munmap(io->cq_ring, io->cq_ring_size);
+    }
+    munmap(io->sq_ring, io->sq_ring_size);
+    close(io->ring_fd);
+}
+
+#else
+
+static int ring_init(AsyncIo_t *io, unsigned depth) {
+    (void)io;
+    (void)depth;
+    return ERROR_IO;
+}
+
+static void ring_queue(AsyncIo_t *io, AsyncIoRequest_t *request) {
+    (void)io;
+    (void)request;
+}
+
+static int ring_enter(AsyncIo_t *io, unsigned min_complete) {
+    (void)io;
+    (void)min_complete;
+    return ERROR_IO;
+}
+
+static void ring_reap(AsyncIo_t *io) {
+    (void)io;
+}
+
+static void ring_destroy(AsyncIo_t *io) {
+    (void)io;
+}
+
+#endif
+
+/* Wait for at least one request in flight to complete */
+static int ring_wait_one(AsyncIo_t *io) {
+    ring_reap(io);
+    while (io->in_flight > 0) {
+        unsigned in_flight = io->in_flight;
+        if (ring_enter(io, 1) != SUCCESS) {
+            return ERROR_IO;
+        }
+        ring_reap(io);
+        if (io->in_flight < in_flight) {
+            break;
+        }
+    }
+    return SUCCESS;
+}
+
+static void *io_thread_main(void *arg) {
+    AsyncIo_t *io = arg;
+
+    pthread_mutex_lock(&io->lock);
+    for (;;) {
+        AsyncIoRequest_t *request = io->head;
+        if (request != NULL) {
+            io->head = request->next;
+            if (io->head == NULL) {
+                io->tail = NULL;
+            }
+            pthread_mutex_unlock(&io->lock);
+            long result = transfer(request, 0);
+            pthread_mutex_lock(&io->lock);
+
+            request->result = result;
+            request->done = true;
+            io->in_flight--;
+            pthread_cond_broadcast(&io->work_done);
+            continue;
+        }
+        if (io->shutting_down) {
+            break;
+        }
+        pthread_cond_wait(&io->work_ready, &io->lock);
+    }
+    pthread_mutex_unlock(&io->lock);
+
+    return NULL;
+}
+
+static int thread_init(AsyncIo_t *io) {
+    pthread_mutex_init(&io->lock, NULL);
+    pthread_cond_init(&io->work_ready, NULL);
+    pthread_cond_init(&io->work_done, NULL);
+    if (pthread_create(&io->thread, NULL, io_thread_main, io) != 0) {
+        pthread_mutex_destroy(&io->lock);
+        pthread_cond_destroy(&io->work_ready);
+        pthread_cond_destroy(&io->work_done);
+        return ERROR_IO;
+    }
+    return SUCCESS;
+}
+
+int async_io_init(AsyncIo_t *io, AsyncIoBackend_t backend, unsigned depth) {
+    if (io == NULL || depth < 1) {
+        return ERROR_INVALID_ARGS;
+    }
+    memset(io, 0, sizeof(AsyncIo_t));
+    io->ring_fd = -1;
+    io->depth = depth;
+
+    if (backend == ASYNC_IO_URING && ring_init(io, depth) == SUCCESS) {
+        io->backend = ASYNC_IO_URING;
+        return SUCCESS;
+    }
+    if (backend != ASYNC_IO_SYNC && thread_init(io) == SUCCESS) {
+        io->backend = ASYNC_IO_THREADS;
+        return SUCCESS;
+    }
+    io->backend = ASYNC_IO_SYNC;
+    return SUCCESS;
+}
+
+int async_io_submit(AsyncIo_t *io, AsyncIoRequest_t *request, int fd, bool write,
+                    void *buf, size_t length, off_t offset) {
+    if (io == NULL || request == NULL) {
+        return ERROR_INVALID_ARGS;
+    }
+    request->fd = fd;
+    request->write = write;
+    request->iov.iov_base = buf;
+    request->iov.iov_len = length;
+    request->offset = offset;
+    request->result = 0;
+    request->done = false;
+    request->next = NULL;
+    io->requests++;
+
+    switch (io->backend) {
+        case ASYNC_IO_URING:
+            if (io->in_flight >= io->depth
+                && (async_io_flush(io) != SUCCESS || ring_wait_one(io) != SUCCESS)) {
+                return ERROR_IO;
+            }
+            ring_queue(io, request);
+            io->in_flight++;
+            return SUCCESS;
+        case ASYNC_IO_THREADS:
+            pthread_mutex_lock(&io->lock);
+            while (io->in_flight >= io->depth) {
+                pthread_cond_wait(&io->work_done, &io->lock);
+            }
+            if (io->tail != NULL) {
+                io->tail->next = request;
+            } else {
+                io->head = request;
+            }
+            io->tail = request;
+            io->in_flight++;
+            pthread_cond_signal(&io->work_ready);
+            pthread_mutex_unlock(&io->lock);
+            return SUCCESS;
+        default:
+            request->result = transfer(request, 0);
+            request->done = true;
+            return SUCCESS;
+    }
+}
+
+int async_io_flush(AsyncIo_t *io) {
+    if (io->backend != ASYNC_IO_URING || io->unsubmitted == 0) {
+        return SUCCESS;
+    }
+    return ring_enter(io, 0);
+}
+
+int async_io_wait(AsyncIo_t *io, AsyncIoRequest_t *request) {
+    if (io->backend == ASYNC_IO_URING) {
+        if (async_io_flush(io) != SUCCESS) {
+            return ERROR_IO;
+        }
+        ring_reap(io);
+        while (!request->done) {
+            if (ring_wait_one(io) != SUCCESS) {
+                return ERROR_IO;
+            }
+        }
+    } else if (io->backend == ASYNC_IO_THREADS) {
+        pthread_mutex_lock(&io->lock);
+        while (!request->done) {
+            pthread_cond_wait(&io->work_done, &io->lock);
+        }
+        pthread_mutex_unlock(&io->lock);
+    }
+
+    // The kernel may stop a transfer early (signals, some filesystems)
+    if (request->result > 0 && (size_t)request->result < request->iov.iov_len) {
+        request->result = transfer(request, (size_t)request->result);
+    }
+    return request->result < 0 ? ERROR_IO : SUCCESS;
+}
+
+void async_io_destroy(AsyncIo_t *io) {
+    if (io == NULL) {
+        return;
+    }
+    if (io->backend == ASYNC_IO_URING) {
+        // The kernel may still be filling buffers; they must outlive the ring
+        if (async_io_flush(io) == SUCCESS) {
+            while (io->in_flight > 0 && ring_wait_one(io) == SUCCESS) {
+            }
+        }
+        ring_destroy(io);
+    } else if (io->backend == ASYNC_IO_THREADS) {
+        pthread_mutex_lock(&io->lock);
+        io->shutting_down = true;
+        pthread_cond_signal(&io->work_ready);
+        pthread_mutex_unlock(&io->lock);
+        pthread_join(io->thread, NULL);
+        pthread_mutex_destroy(&io->lock);
+        pthread_cond_destroy(&io->work_ready);
+        pthread_cond_destroy(&io->work_done);
+    }
+    io->backend = ASYNC_IO_SYNC;
+    io->in_flight = 0;
+}
+
+const char *async_io_backend_name(AsyncIoBackend_t backend) {
+    switch (backend) {
+        case ASYNC_IO_URING:
+            return "io_uring";
+        case ASYNC_IO_THREADS:
+            return "threads";
+        default:
+            return "sync";
+    }
+}
+
+int async_io_backend_by_name(const char *name, AsyncIoBackend_t *backend) {
+    if (strcmp(name, "uring") == 0 || strcmp(name, "io_uring") == 0) {
+        *backend = ASYNC_IO_URING;
+    } else if (strcmp(name, "threads") == 0) {
+        *backend = ASYNC_IO_THREADS;
+    } else if (strcmp(name, "sync") == 0) {
+        *backend = ASYNC_IO_SYNC;
+    } else {
+        return ERROR_INVALID_ARGS;
+    }
+    return SUCCESS;
+}
@@ -0,0 +1,359 @@
+/**
+ * @file batch.c
+ * @brief Implementation of --batch
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "batch.h"
+#include "cohort_store.h"
+#include "config.h"
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Work item for one submission on the shared pool */
+typedef struct {
+    BatchEntry_t           *entry;
+    const ArchiveOptions_t *options;
+    TaskGroup_t             group;
+} BatchJob_t;
+
+static const char *status_name(int status) {
+    switch (status) {
+        case SUCCESS:
+            return "ok";
+        case ERROR_INVALID_ARGS:
+            return "invalid";
+        case ERROR_FILE_NOT_FOUND:
+            return "missing";
+        case ERROR_MEMORY_ALLOCATION:
+            return "memory";
+        case ERROR_COMPRESSION:
+            return "compression";
+        case ERROR_IO:
+            return "io";
+        default:
+            return "error";
+    }
+}
+
+static double seconds_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int add_roster_entry(BatchEntry_t **entries, int *count, int *capacity,
+                            const char *input_path) {
+    if (*count == *capacity) {
+        int           grown = *capacity > 0 ? *capacity * 2 : 64;
+        BatchEntry_t *resized = realloc(*entries, sizeof(BatchEntry_t) * (size_t)grown);
+        if (resized == NULL) {
+            return ERROR_MEMORY_ALLOCATION;
+        }
+        *entries = resized;
+        *capacity = grown;
+    }
+
+    BatchEntry_t *entry = &(*entries)[*count];
+    memset(entry, 0, sizeof(BatchEntry_t));
+    entry->input_path = strdup(input_path);
+    if (entry->input_path == NULL) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    submission_name(input_path, entry->student, sizeof(entry->student));
+    (*count)++;
+    return SUCCESS;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(((const BatchEntry_t *)a)->student, ((const BatchEntry_t *)b)->student);
+}
+
+/* Every subdirectory of the roster, in name order */
+static int load_roster_directory(const char *roster_path, const char *skip_path,
+                                 BatchEntry_t **entries, int *count, int *capacity) {
+    struct stat skip;
+    bool        have_skip = skip_path != NULL && stat(skip_path, &skip) == 0;
+
+    DIR *dir = opendir(roster_path);
+    if (dir == NULL) {
+        return ERROR_FILE_NOT_FOUND;
+    }
+
+    int            status = SUCCESS;
+    struct dirent *dirent;
+    while (status == SUCCESS && (dirent = readdir(dir)) != NULL) {
+        char        path[MAX_PATH_LENGTH];
+        struct stat st;
+
+        if (dirent->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", roster_path, dirent->d_name);
+        if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+            continue;
+        }
+        if (have_skip && st.st_dev == skip.st_dev && st.st_ino == skip.st_ino) {
+            continue;
+        }
+        status = add_roster_entry(entries, count, capacity, path);
+    }
+    closedir(dir);
+
+    if (status == SUCCESS) {
+        qsort(*entries, (size_t)*count, sizeof(BatchEntry_t), compare_entries);
+    }
+    return status;
+}
+
+/* One submission directory per line; blank lines and '#' comments skipped */
+static int load_roster_file(const char *roster_path, BatchEntry_t **entries, int *count,
+                            int *capacity) {
+    char  line[MAX_PATH_LENGTH];
+    FILE *fp = fopen(roster_path, "r");
+    if (fp == NULL) {
+        return ERROR_FILE_NOT_FOUND;
+    }
+
+    int status = SUCCESS;
+    while (status == SUCCESS && fgets(line, sizeof(line), fp) != NULL) {
+        char  *start = line + strspn(line, " \t");
+        size_t len = strcspn(start, "\r\n");
+        while (len > 0 && (start[len - 1] == ' ' || start[len - 1] == '\t')) {
+            len--;
+        }
+        start[len] = '\0';
+        if (start[0] == '\0' || start[0] == '#') {
+            continue;
+        }
+        status = add_roster_entry(entries, count, capacity, start);
+    }
+    fclose(fp);
+    return status;
+}
+
+int load_batch_roster(const char *roster_path, const char *skip_path,
+                      BatchEntry_t **entries, int *count) {
+    int capacity = 0;
+    int status;
+
+    if (roster_path == NULL || entries == NULL || count == NULL) {
+        return ERROR_INVALID_ARGS;
+    }
+    *entries = NULL;
+    *count = 0;
+
+    if (is_directory(roster_path)) {
+        status = load_roster_directory(roster_path, skip_path, entries, count, &capacity);
+    } else {
+        status = load_roster_file(roster_path, entries, count, &capacity);
+    }
+    if (status != SUCCESS) {
+        free_batch_roster(*entries, *count);
+        *entries = NULL;
+        *count = 0;
+        return status;
+    }
+
+    // Archives and manifests are named after the student, so two
+    // submissions with the same name would overwrite each other
+    for (int i = 0; i < *count; i++) {
+        BatchEntry_t *entry = &(*entries)[i];
+        if (entry->student[0] == '\0' || entry->student[0] == '.') {
+            fprintf(stderr, "Cannot name submission: %s\n", entry->input_path);
+            entry->status = ERROR_INVALID_ARGS;
+            continue;
+        }
+        for (int j = 0; j < i; j++) {
+            if (strcmp((*entries)[j].student, entry->student) == 0) {
+                fprintf(stderr, "Duplicate submission name %s: %s\n", entry->student,
+                        entry->input_path);
+                entry->status = ERROR_INVALID_ARGS;
+                break;
+            }
+        }
+    }
+    return SUCCESS;
+}
+
+void free_batch_roster(BatchEntry_t *entries, int count) {
+    if (entries == NULL) {
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        free(entries[i].input_path);
+    }
+    free(entries);
+}
+
+/* Parse one submission's .LT_FILES and archive it; runs on the pool */
+static void archive_submission(BatchEntry_t *entry, const ArchiveOptions_t *batch_options) {
+    char            config_path[MAX_PATH_LENGTH];
+    char            output_path[MAX_PATH_LENGTH];
+    struct timespec start;
+
+    if (entry->status != SUCCESS) {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    ArchiveOptions_t options = *batch_options;
+    options.input_path = entry->input_path;
+    options.batch_path = NULL;
+
+    FileList_t file_list;
+    if (file_list_init(&file_list) != SUCCESS) {
+        entry->status = ERROR_MEMORY_ALLOCATION;
+        return;
+    }
+
+    snprintf(config_path, sizeof(config_path), "%s/.LT_FILES", entry->input_path);
+    entry->status = parse_config_file(config_path, entry->input_path, &file_list);
+    entry->files = file_list.count;
+    for (int i = 0; i < file_list.count; i++) {
+        FileMeta_t meta;
+        if (file_list_entry_stat(&file_list.entries[i], &meta) == SUCCESS && meta.size > 0) {
+            entry->input_bytes += (mz_uint64)meta.size;
+        }
+    }
+
+    if (entry->status == SUCCESS && options.store_path != NULL) {
+        CohortStats_t stats = {0};
+        entry->status = validate_file_list(&file_list);
+        if (entry->status == SUCCESS) {
+            entry->status = cohort_store_add(options.store_path, entry->student, &file_list,
+                                             &options, &stats);
+        }
+        entry->output_bytes = stats.written_bytes;
+    } else if (entry->status == SUCCESS) {
+        struct stat st;
+        snprintf(output_path, sizeof(output_path), "%s/%s" BATCH_ARCHIVE_EXTENSION,
+                 options.output_path, entry->student);
+        entry->status = create_archive_from_file_list(&file_list, output_path, &options);
+        if (entry->status == SUCCESS && stat(output_path, &st) == 0) {
+            entry->output_bytes = (mz_uint64)st.st_size;
+        } else if (entry->status != SUCCESS) {
+            // Leave no partial (or stale) archive that looks like a result
+            unlink(output_path);
+        }
+    }
+
+    file_list_free(&file_list);
+    entry->seconds = seconds_since(&start);
+}
+
+static void batch_job(void *arg) {
+    BatchJob_t *job = arg;
+    archive_submission(job->entry, job->options);
+}
+
+static int write_batch_summary(const char *path, const BatchEntry_t *entries, int count) {
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        return ERROR_IO;
+    }
+    fprintf(fp, "student\tstatus\tfiles\tinput_bytes\toutput_bytes\tseconds\tinput_path\n");
+    for (int i = 0; i < count; i++) {
+        const BatchEntry_t *entry = &entries[i];
+        fprintf(fp, "%s\t%s\t%d\t%llu\t%llu\t%.3f\t%s\n", entry->student,
+                status_name(entry->status), entry->files,
+                (unsigned long long)entry->input_bytes,
+                (unsigned long long)entry->output_bytes, entry->seconds, entry->input_path);
+    }
+    return fclose(fp) == 0 ? SUCCESS : ERROR_IO;
+}
+
+int run_batch(const char *roster_path, const ArchiveOptions_t *options) {
+    char            summary_path[MAX_PATH_LENGTH];
+    struct timespec start;
+    FILE           *log = archive_log_stream(options);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (options->output_path != NULL && mkdir(options->output_path, 0755) != 0
+        && errno != EEXIST) {
+        print_error("Cannot create output directory");
+        return ERROR_IO;
+    }
+
+    BatchEntry_t *entries;
+    int           count;
+    int           status = load_batch_roster(roster_path, options->output_path, &entries,
+                                             &count);
+    if (status != SUCCESS) {
+        fprintf(stderr, "Cannot read roster: %s\n", roster_path);
+        return status;
+    }
+    if (count == 0) {
+        fprintf(stderr, "No submissions in roster: %s\n", roster_path);
+        free_batch_roster(entries, count);
+        return ERROR_FILE_NOT_FOUND;
+    }
+
+    BatchJob_t *jobs = calloc((size_t)count, sizeof(BatchJob_t));
+    if (jobs == NULL) {
+        free_batch_roster(entries, count);
+        return ERROR_MEMORY_ALLOCATION;
+    }
+
+    // One pool for everything: submissions are tasks on it, and so are the
+    // entries each submission compresses
+    ArchiveOptions_t shared = *options;
+    ThreadPool_t    *pool = NULL;
+    if (options->jobs > 1) {
+        pool = thread_pool_create(options->jobs);
+        shared.pool = pool;
+    }
+
+    // Keep about one submission per worker in flight. A thread waiting on
+    // its entries helps run queued tasks, which may be other submissions;
+    // the window bounds how deep that can nest.
+    int window = options->jobs > 1 ? options->jobs : 1;
+    int submitted = 0;
+    int archived = 0;
+    int first_failure = SUCCESS;
+
+    for (int i = 0; i < count; i++) {
+        while (submitted < count && submitted < i + window) {
+            BatchJob_t *job = &jobs[submitted];
+            job->entry = &entries[submitted];
+            job->options = &shared;
+            submitted++;
+            if (pool == NULL || thread_pool_submit(pool, &job->group, batch_job, job)
+                                    != SUCCESS) {
+                batch_job(job);
+            }
+        }
+        if (pool != NULL) {
+            thread_pool_wait(pool, &jobs[i].group);
+        }
+
+        const BatchEntry_t *entry = &entries[i];
+        fprintf(log, "[%s] %s: %d files, %llu -> %llu bytes in %.2f s\n",
+                status_name(entry->status), entry->student, entry->files,
+                (unsigned long long)entry->input_bytes,
+                (unsigned long long)entry->output_bytes, entry->seconds);
+        if (entry->status == SUCCESS) {
+            archived++;
+        } else if (first_failure == SUCCESS) {
+            first_failure = entry->status;
+        }
+    }
+    thread_pool_destroy(pool);
+    free(jobs);
+
+    snprintf(summary_path, sizeof(summary_path), "%s/" BATCH_SUMMARY_NAME,
+             options->output_path != NULL ? options->output_path : options->store_path);
+    status = write_batch_summary(summary_path, entries, count);
+    if (status != SUCCESS) {
+        print_error("Cannot write batch summary");
+    }
+
+    fprintf(log, "Batch: %d of %d submissions archived in %.2f s, summary in %s\n", archived,
+            count, seconds_since(&start), summary_path);
+    free_batch_roster(entries, count);
+    return first_failure != SUCCESS ? first_failure : status;
+}
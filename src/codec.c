@@ -0,0 +1,185 @@
+/**
+ * @file codec.c
+ * @brief Implementation of the deflate and Zstandard codecs
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "codec.h"
+#define ZSTD_STATIC_LINKING_ONLY /* ZSTD_estimateCCtxSize_usingCParams */
+#include "../lib/zstd/zstd.h"
+#include <pthread.h>
+
+/* zstd accepts up to 22, but levels past 19 need windows of 64 MB and
+ * more, which other ZIP readers are not required to accept */
+#define ZSTD_MAX_ZIP_LEVEL 19
+
+/* Setting up a zstd context allocates its whole workspace (tens of MB at
+ * high levels), so each thread keeps one of each and reuses them */
+typedef struct {
+    ZSTD_CCtx *cctx;
+    ZSTD_DCtx *dctx;
+} ZstdContexts_t;
+
+static pthread_key_t  zstd_key;
+static pthread_once_t zstd_key_once = PTHREAD_ONCE_INIT;
+
+static void free_zstd_contexts(void *arg) {
+    ZstdContexts_t *contexts = arg;
+    ZSTD_freeCCtx(contexts->cctx);
+    ZSTD_freeDCtx(contexts->dctx);
+    free(contexts);
+}
+
+static void create_zstd_key(void) {
+    pthread_key_create(&zstd_key, free_zstd_contexts);
+}
+
+static ZstdContexts_t *zstd_contexts(void) {
+    pthread_once(&zstd_key_once, create_zstd_key);
+
+    ZstdContexts_t *contexts = pthread_getspecific(zstd_key);
+    if (contexts == NULL) {
+        contexts = calloc(1, sizeof(ZstdContexts_t));
+        if (contexts == NULL || pthread_setspecific(zstd_key, contexts) != 0) {
+            free(contexts);
+            return NULL;
+        }
+    }
+    return contexts;
+}
+
+static void store_entry(CompressedEntry_t *entry, bool store_fallback) {
+    entry->comp_size = (size_t)entry->uncomp_size;
+    entry->store_fallback = store_fallback;
+}
+
+static int zstd_compress_entry(const unsigned char *data, size_t size, int level,
+                               bool allow_store, CompressedEntry_t *entry) {
+    if (entry == NULL || (size > 0 && data == NULL)) {
+        return ERROR_INVALID_ARGS;
+    }
+
+    memset(entry, 0, sizeof(CompressedEntry_t));
+    entry->uncomp_size = size;
+    entry->crc32 = (mz_uint32)mz_crc32(MZ_CRC32_INIT, data, size);
+
+    // Same store rules as deflate, so -l 0 and --no-store-fallback mean
+    // the same thing whichever codec is used
+    if (level == 0 || size <= 3) {
+        store_entry(entry, false);
+        return SUCCESS;
+    }
+    if (allow_store && size > STORE_SAMPLE_SIZE && looks_incompressible(data, size)) {
+        store_entry(entry, true);
+        return SUCCESS;
+    }
+
+    ZstdContexts_t *contexts = zstd_contexts();
+    if (contexts == NULL) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    if (contexts->cctx == NULL && (contexts->cctx = ZSTD_createCCtx()) == NULL) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+
+    size_t         bound = ZSTD_compressBound(size);
+    unsigned char *out = malloc(bound);
+    if (out == NULL) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+
+    // One frame with the content size in its header; the ZIP entry already
+    // carries a CRC-32, so zstd's own checksum stays off
+    size_t written = ZSTD_compressCCtx(contexts->cctx, out, bound, data, size, level);
+    if (ZSTD_isError(written)) {
+        free(out);
+        return ERROR_COMPRESSION;
+    }
+    if (allow_store && written >= size) {
+        free(out);
+        store_entry(entry, true);
+        return SUCCESS;
+    }
+
+    unsigned char *fitted = realloc(out, written > 0 ? written : 1);
+    entry->data = fitted != NULL ? fitted : out;
+    entry->comp_size = written;
+    entry->compressed = true;
+    entry->method = ZIP_METHOD_ZSTD;
+    return SUCCESS;
+}
+
+static int zstd_decompress_entry(const unsigned char *data, size_t size,
+                                 unsigned char *out, size_t out_size) {
+    ZstdContexts_t *contexts = zstd_contexts();
+    if (contexts == NULL) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    if (contexts->dctx == NULL && (contexts->dctx = ZSTD_createDCtx()) == NULL) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+
+    size_t produced = ZSTD_decompressDCtx(contexts->dctx, out, out_size, data, size);
+    if (ZSTD_isError(produced) || produced != out_size) {
+        return ERROR_COMPRESSION;
+    }
+    return SUCCESS;
+}
+
+static int inflate_entry(const unsigned char *data, size_t size, unsigned char *out,
+                         size_t out_size) {
+    size_t produced = tinfl_decompress_mem_to_mem(out, out_size, data, size, 0);
+    if (produced == TINFL_DECOMPRESS_MEM_TO_MEM_FAILED || produced != out_size) {
+        return ERROR_COMPRESSION;
+    }
+    return SUCCESS;
+}
+
+static size_t deflate_working_memory(int level, size_t size) {
+    (void)size;
+    return level > 0 ? sizeof(tdefl_compressor) : 0;
+}
+
+static size_t zstd_working_memory(int level, size_t size) {
+    // The context is sized for the entry, so small files need far less
+    // than the level's worst case
+    return level > 0
+               ? ZSTD_estimateCCtxSize_usingCParams(ZSTD_getCParams(level, size, 0))
+               : 0;
+}
+
+static const Codec_t codecs[] = {
+    {DEFAULT_CODEC_NAME, ZIP_METHOD_DEFLATE, MZ_DEFAULT_LEVEL, MZ_BEST_COMPRESSION,
+     compress_entry_data, compress_entry_data_parallel, inflate_entry,
+     deflate_working_memory},
+    {"zstd", ZIP_METHOD_ZSTD, ZSTD_CLEVEL_DEFAULT, ZSTD_MAX_ZIP_LEVEL, zstd_compress_entry,
+     NULL, zstd_decompress_entry, zstd_working_memory},
+};
+
+int codec_list(const Codec_t **list) {
+    *list = codecs;
+    return (int)(sizeof(codecs) / sizeof(codecs[0]));
+}
+
+const Codec_t *codec_by_name(const char *name) {
+    for (size_t i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++) {
+        if (strcmp(codecs[i].name, name) == 0) {
+            return &codecs[i];
+        }
+    }
+    return NULL;
+}
+
+const Codec_t *codec_for_method(mz_uint16 method) {
+    for (size_t i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++) {
+        if (codecs[i].method == method) {
+            return &codecs[i];
+        }
+    }
+    return NULL;
+}
+
+const Codec_t *default_codec(void) {
+    return &codecs[0];
+}
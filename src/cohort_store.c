@@ -0,0 +1,311 @@
+/**
+ * @file cohort_store.c
+ * @brief Implementation of the deduplicating cohort store
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "cohort_store.h"
+#include "file_input.h"
+#include "sha256.h"
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int make_directory(const char *path) {
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+        return ERROR_IO;
+    }
+    return SUCCESS;
+}
+
+/* Manifest names become file names, so keep them to one path component */
+static bool valid_student_name(const char *student) {
+    return student[0] != '\0' && student[0] != '.' && strchr(student, '/') == NULL;
+}
+
+static void blob_path(const char *store_dir, const char *hash, char *path, size_t size) {
+    snprintf(path, size, "%s/" COHORT_BLOB_DIR "/%.2s/%s", store_dir, hash, hash + 2);
+}
+
+static void manifest_path(const char *store_dir, const char *student, char *path,
+                          size_t size) {
+    snprintf(path, size, "%s/" COHORT_MANIFEST_DIR "/%s" COHORT_MANIFEST_EXTENSION,
+             store_dir, student);
+}
+
+static void put_le32(unsigned char *p, mz_uint32 v) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (unsigned char)(v >> (i * 8));
+    }
+}
+
+static void put_le64(unsigned char *p, mz_uint64 v) {
+    for (int i = 0; i < 8; i++) {
+        p[i] = (unsigned char)(v >> (i * 8));
+    }
+}
+
+static mz_uint32 get_le32(const unsigned char *p) {
+    return (mz_uint32)p[0] | (mz_uint32)p[1] << 8 | (mz_uint32)p[2] << 16
+           | (mz_uint32)p[3] << 24;
+}
+
+static mz_uint64 get_le64(const unsigned char *p) {
+    return (mz_uint64)get_le32(p) | (mz_uint64)get_le32(p + 4) << 32;
+}
+
+/* Compress a body and write it under its hash. The blob is written to a
+ * temporary name and renamed so concurrent writers never see half a blob. */
+static int write_blob(const char *store_dir, const char *hash, const FileInput_t *input,
+                      const ArchiveOptions_t *options, mz_uint64 *written) {
+    char path[MAX_PATH_LENGTH];
+    char tmp_path[MAX_PATH_LENGTH + 32];
+
+    snprintf(path, sizeof(path), "%s/" COHORT_BLOB_DIR "/%.2s", store_dir, hash);
+    if (make_directory(path) != SUCCESS) {
+        return ERROR_IO;
+    }
+    blob_path(store_dir, hash, path, sizeof(path));
+    // Unique per writer: in batch mode two students in this process may
+    // add the same new body at the same time
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.XXXXXX", path);
+
+    CompressedEntry_t entry;
+    int status = options->codec->compress(input->data, input->size,
+                                          options->compression_level,
+                                          options->store_fallback, &entry);
+    if (status != SUCCESS) {
+        return status;
+    }
+
+    unsigned char header[COHORT_BLOB_HEADER_SIZE] = {0};
+    memcpy(header, COHORT_BLOB_MAGIC, sizeof(COHORT_BLOB_MAGIC));
+    header[8] = entry.compressed ? (unsigned char)entry.method : ZIP_METHOD_STORE;
+    header[9] = entry.store_fallback ? COHORT_BLOB_STORE_FALLBACK : 0;
+    put_le32(header + 12, entry.crc32);
+    put_le64(header + 16, entry.uncomp_size);
+    put_le64(header + 24, entry.comp_size);
+
+    // Stored entries have no payload of their own; the body is the input
+    const unsigned char *payload = entry.compressed ? entry.data : input->data;
+    size_t               payload_size = entry.comp_size;
+
+    int   fd = mkstemp(tmp_path);
+    FILE *fp = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    if (fp == NULL) {
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp_path);
+        }
+        free_compressed_entry(&entry);
+        return ERROR_IO;
+    }
+    fchmod(fd, 0644);
+    bool ok = fwrite(header, 1, sizeof(header), fp) == sizeof(header)
+              && fwrite(payload, 1, payload_size, fp) == payload_size;
+    ok = (fclose(fp) == 0) && ok;
+    free_compressed_entry(&entry);
+
+    if (!ok || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return ERROR_IO;
+    }
+    *written += sizeof(header) + payload_size;
+    return SUCCESS;
+}
+
+int cohort_store_add(const char *store_dir, const char *student,
+                     const FileList_t *file_list, const ArchiveOptions_t *options,
+                     CohortStats_t *stats) {
+    char          derived[MAX_FILENAME_LENGTH];
+    char          path[MAX_PATH_LENGTH];
+    char          manifest[MAX_PATH_LENGTH];
+    char          tmp_manifest[MAX_PATH_LENGTH + 32];
+    CohortStats_t local_stats;
+    FILE         *log = archive_log_stream(options);
+
+    if (stats == NULL) {
+        stats = &local_stats;
+    }
+    memset(stats, 0, sizeof(CohortStats_t));
+
+    if (student == NULL) {
+        submission_name(options->input_path, derived, sizeof(derived));
+        student = derived;
+    }
+    if (!valid_student_name(student)) {
+        fprintf(stderr, "Invalid student name for the cohort store: '%s'\n", student);
+        return ERROR_INVALID_ARGS;
+    }
+
+    snprintf(path, sizeof(path), "%s/" COHORT_BLOB_DIR, store_dir);
+    if (make_directory(store_dir) != SUCCESS || make_directory(path) != SUCCESS) {
+        print_error("Cannot create cohort store");
+        return ERROR_IO;
+    }
+    snprintf(path, sizeof(path), "%s/" COHORT_MANIFEST_DIR, store_dir);
+    if (make_directory(path) != SUCCESS) {
+        print_error("Cannot create cohort store");
+        return ERROR_IO;
+    }
+
+    manifest_path(store_dir, student, manifest, sizeof(manifest));
+    snprintf(tmp_manifest, sizeof(tmp_manifest), "%s.tmp.%ld", manifest, (long)getpid());
+    FILE *out = fopen(tmp_manifest, "w");
+    if (out == NULL) {
+        return ERROR_IO;
+    }
+    fprintf(out, COHORT_MANIFEST_HEADER "\n");
+
+    int status = SUCCESS;
+    for (int i = 0; i < file_list->count && status == SUCCESS; i++) {
+        FileInput_t input;
+        char        hash[SHA256_HEX_LENGTH + 1];
+        char        file_path[MAX_PATH_LENGTH];
+        struct stat st;
+
+        file_list_path(file_list, i, file_path);
+        status = open_file_input(file_path, options->use_mmap, &input);
+        if (status != SUCCESS) {
+            break;
+        }
+        if (file_list->entries[i].meta.mode != 0) {
+            input.modified = (time_t)file_list->entries[i].meta.mtime;
+        }
+        sha256_hex(input.data, input.size, hash);
+
+        // Same body already stored (by this or any other student): only
+        // the manifest line is needed
+        blob_path(store_dir, hash, path, sizeof(path));
+        bool reused = stat(path, &st) == 0;
+        if (reused) {
+            stats->reused_blobs++;
+            stats->deduplicated_bytes += input.size;
+        } else {
+            status = write_blob(store_dir, hash, &input, options, &stats->written_bytes);
+            stats->new_blobs++;
+        }
+
+        if (status == SUCCESS) {
+            fprintf(out, "%s %lld %s\n", hash, (long long)input.modified,
+                    file_list->entries[i].name);
+            stats->files++;
+            stats->input_bytes += input.size;
+        }
+        if (options->verbose) {
+            fprintf(log, "%s: %s%s\n", status == SUCCESS ? "Adding" : "Error adding",
+                    file_path, reused ? " (already stored)" : "");
+        }
+        close_file_input(&input);
+    }
+
+    if (fclose(out) != 0 && status == SUCCESS) {
+        status = ERROR_IO;
+    }
+    if (status != SUCCESS || rename(tmp_manifest, manifest) != 0) {
+        unlink(tmp_manifest);
+        return status != SUCCESS ? status : ERROR_IO;
+    }
+
+    if (options->verbose) {
+        fprintf(log, "Cohort store: %d files, %d new blobs (%llu bytes), %d reused "
+                     "(%llu bytes deduplicated)\n",
+                stats->files, stats->new_blobs, (unsigned long long)stats->written_bytes,
+                stats->reused_blobs, (unsigned long long)stats->deduplicated_bytes);
+    }
+    return SUCCESS;
+}
+
+/* Append one manifest entry's blob to the archive */
+static int export_entry(archive_state *archive, const char *store_dir, const char *hash,
+                        MZ_TIME_T modified, const char *name, bool use_mmap) {
+    char        path[MAX_PATH_LENGTH];
+    FileInput_t blob;
+
+    blob_path(store_dir, hash, path, sizeof(path));
+    int status = open_file_input(path, use_mmap, &blob);
+    if (status != SUCCESS) {
+        return status;
+    }
+
+    const unsigned char *header = blob.data;
+    if (blob.size < COHORT_BLOB_HEADER_SIZE
+        || memcmp(header, COHORT_BLOB_MAGIC, sizeof(COHORT_BLOB_MAGIC)) != 0
+        || get_le64(header + 24) != blob.size - COHORT_BLOB_HEADER_SIZE) {
+        close_file_input(&blob);
+        return ERROR_IO;
+    }
+
+    const unsigned char *payload = blob.data + COHORT_BLOB_HEADER_SIZE;
+    CompressedEntry_t    entry = {
+        .data = header[8] != ZIP_METHOD_STORE ? (unsigned char *)payload : NULL,
+        .comp_size = (size_t)get_le64(header + 24),
+        .uncomp_size = get_le64(header + 16),
+        .crc32 = get_le32(header + 12),
+        .compressed = header[8] != ZIP_METHOD_STORE,
+        .method = header[8],
+        .store_fallback = (header[9] & COHORT_BLOB_STORE_FALLBACK) != 0,
+    };
+    status = add_compressed_entry_to_archive(archive, name, payload, &entry, &modified);
+    close_file_input(&blob);
+    return status;
+}
+
+int cohort_store_export(const char *store_dir, const char *student,
+                        const char *output_path, const ArchiveOptions_t *options) {
+    char manifest[MAX_PATH_LENGTH];
+    char line[MAX_PATH_LENGTH + SHA256_HEX_LENGTH + 32];
+
+    if (!valid_student_name(student)) {
+        fprintf(stderr, "Invalid student name for the cohort store: '%s'\n", student);
+        return ERROR_INVALID_ARGS;
+    }
+
+    manifest_path(store_dir, student, manifest, sizeof(manifest));
+    FILE *in = fopen(manifest, "r");
+    if (in == NULL) {
+        fprintf(stderr, "No manifest for %s in %s\n", student, store_dir);
+        return ERROR_FILE_NOT_FOUND;
+    }
+
+    archive_state *archive = create_archive_file(output_path, options->compression_level,
+                                                 0, options->direct_io, NULL);
+    if (archive == NULL) {
+        fclose(in);
+        return ERROR_IO;
+    }
+
+    int status = SUCCESS;
+    while (status == SUCCESS && fgets(line, sizeof(line), in) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        if (line[0] == '#' || line[0] == '\0') {
+            continue;
+        }
+
+        // sha256 mtime name; the name is the rest of the line
+        char      hash[SHA256_HEX_LENGTH + 1];
+        long long modified;
+        int       name_offset = 0;
+        if (sscanf(line, "%64s %lld %n", hash, &modified, &name_offset) != 2
+            || name_offset == 0 || strlen(hash) != SHA256_HEX_LENGTH) {
+            fprintf(stderr, "Malformed manifest line in %s\n", manifest);
+            status = ERROR_IO;
+            break;
+        }
+
+        status = export_entry(archive, store_dir, hash, (MZ_TIME_T)modified,
+                              line + name_offset, options->use_mmap);
+        if (options->verbose) {
+            fprintf(archive->log, "%s: %s\n",
+                    status == SUCCESS ? "Adding" : "Error adding", line + name_offset);
+        }
+    }
+    fclose(in);
+
+    if (status != SUCCESS) {
+        free_archive(archive);
+        return status;
+    }
+    return finalize_archive(archive, options->verbose);
+}
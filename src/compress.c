@@ -0,0 +1,363 @@
+/**
+ * @file compress.c
+ * @brief Implementation of in-memory entry compression
+ */
+
+#include "compress.h"
+
+/* Growable output buffer filled by tdefl's put_buf callback */
+typedef struct {
+    unsigned char *data;
+    size_t         size;
+    size_t         capacity;
+} OutputBuffer_t;
+
+/* One slice of a large entry, deflated on its own thread */
+typedef struct {
+    const unsigned char *dictionary; /* Data preceding the chunk */
+    size_t               dictionary_size;
+    const unsigned char *data;
+    size_t               size;
+    bool                 last;
+    mz_uint              flags;
+    OutputBuffer_t       output;
+    mz_uint32            crc32;
+    int                  status;
+} DeflateChunk_t;
+
+static mz_bool append_output(const void *buf, int len, void *user) {
+    OutputBuffer_t *output = user;
+    size_t          needed = output->size + (size_t)len;
+
+    if (needed > output->capacity) {
+        size_t capacity = output->capacity > 0 ? output->capacity : 4096;
+        while (capacity < needed) {
+            capacity *= 2;
+        }
+        unsigned char *grown = realloc(output->data, capacity);
+        if (grown == NULL) {
+            return MZ_FALSE;
+        }
+        output->data = grown;
+        output->capacity = capacity;
+    }
+
+    memcpy(output->data + output->size, buf, (size_t)len);
+    output->size = needed;
+    return MZ_TRUE;
+}
+
+static void deflate_chunk(void *arg) {
+    DeflateChunk_t *chunk = arg;
+
+    chunk->status = ERROR_COMPRESSION;
+    chunk->crc32 = (mz_uint32)mz_crc32(MZ_CRC32_INIT, chunk->data, chunk->size);
+
+    tdefl_compressor *comp = malloc(sizeof(tdefl_compressor));
+    if (comp == NULL) {
+        chunk->status = ERROR_MEMORY_ALLOCATION;
+        return;
+    }
+    if (tdefl_init(comp, append_output, &chunk->output, (int)chunk->flags)
+        != TDEFL_STATUS_OKAY) {
+        free(comp);
+        return;
+    }
+
+    // Prime the window by compressing the preceding bytes and throwing the
+    // output away. The sync flush leaves the stream byte aligned and keeps
+    // the dictionary, so the real chunk starts on a fresh block whose
+    // matches may reach into the previous chunk's tail.
+    if (chunk->dictionary_size > 0) {
+        if (tdefl_compress_buffer(comp, chunk->dictionary,
+                                  chunk->dictionary_size, TDEFL_SYNC_FLUSH)
+            != TDEFL_STATUS_OKAY) {
+            free(comp);
+            return;
+        }
+        chunk->output.size = 0;
+    }
+
+    // Every chunk but the last ends on a sync flush so the pieces can be
+    // concatenated; only the last one sets the final-block bit
+    tdefl_status expected = chunk->last ? TDEFL_STATUS_DONE : TDEFL_STATUS_OKAY;
+    if (tdefl_compress_buffer(comp, chunk->data, chunk->size,
+                              chunk->last ? TDEFL_FINISH : TDEFL_SYNC_FLUSH)
+        == expected) {
+        chunk->status = SUCCESS;
+    }
+    free(comp);
+}
+
+static mz_uint32 gf2_matrix_times(const mz_uint32 *mat, mz_uint32 vec) {
+    mz_uint32 sum = 0;
+    while (vec) {
+        if (vec & 1) {
+            sum ^= *mat;
+        }
+        vec >>= 1;
+        mat++;
+    }
+    return sum;
+}
+
+static void gf2_matrix_square(mz_uint32 *square, const mz_uint32 *mat) {
+    for (int n = 0; n < 32; n++) {
+        square[n] = gf2_matrix_times(mat, mat[n]);
+    }
+}
+
+bool looks_incompressible(const unsigned char *data, size_t size) {
+    size_t sample = MZ_MIN(size, STORE_SAMPLE_SIZE);
+    size_t limit = sample * STORE_RATIO_PERCENT / 100;
+    if (limit == 0) {
+        return false;
+    }
+
+    unsigned char *scratch = malloc(limit);
+    if (scratch == NULL) {
+        return false;
+    }
+
+    // tdefl_compress_mem_to_mem fails once the output no longer fits, so
+    // any failure here means the sample did not shrink enough
+    mz_uint flags = tdefl_create_comp_flags_from_zip_params(
+        MZ_BEST_SPEED, -MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY);
+    size_t compressed = tdefl_compress_mem_to_mem(scratch, limit, data, sample,
+                                                  (int)flags);
+    free(scratch);
+
+    return compressed == 0;
+}
+
+/* Mark an entry as stored because deflating it did not pay off */
+static void fall_back_to_store(CompressedEntry_t *entry) {
+    free(entry->data);
+    entry->data = NULL;
+    entry->comp_size = (size_t)entry->uncomp_size;
+    entry->compressed = false;
+    entry->store_fallback = true;
+}
+
+int compress_entry_data(const unsigned char *data, size_t size, int level,
+                        bool allow_store, CompressedEntry_t *entry) {
+    if (entry == NULL || (size > 0 && data == NULL)) {
+        return ERROR_INVALID_ARGS;
+    }
+
+    memset(entry, 0, sizeof(CompressedEntry_t));
+    entry->uncomp_size = size;
+    entry->crc32 = (mz_uint32)mz_crc32(MZ_CRC32_INIT, data, size);
+
+    // miniz stores tiny entries rather than deflating them; keep the same
+    // rule so the archive matches what mz_zip_writer_add_file produces
+    if (level == 0 || size <= 3) {
+        entry->comp_size = size;
+        return SUCCESS;
+    }
+
+    if (allow_store && size > STORE_SAMPLE_SIZE
+        && looks_incompressible(data, size)) {
+        fall_back_to_store(entry);
+        return SUCCESS;
+    }
+
+    tdefl_compressor *comp = malloc(sizeof(tdefl_compressor));
+    if (comp == NULL) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+
+    OutputBuffer_t output = {0};
+    mz_uint        flags = tdefl_create_comp_flags_from_zip_params(
+        level, -MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY);
+    int    status = SUCCESS;
+    int    poor_blocks = 0;
+    size_t consumed = 0;
+    size_t block_start = 0; /* Output size when the current block began */
+
+    tdefl_init(comp, append_output, &output, (int)flags);
+    while (consumed < size) {
+        size_t n = MZ_MIN(COMPRESS_BLOCK_SIZE, size - consumed);
+        bool   last = (consumed + n == size);
+
+        tdefl_status result = tdefl_compress_buffer(
+            comp, data + consumed, n, last ? TDEFL_FINISH : TDEFL_NO_FLUSH);
+        consumed += n;
+        if (result != (last ? TDEFL_STATUS_DONE : TDEFL_STATUS_OKAY)) {
+            status = ERROR_COMPRESSION;
+            break;
+        }
+
+        // Give up on deflate once the ratio of each block has stayed poor
+        // several times in a row; the sample at the start can miss media
+        // appended after a compressible header
+        if (allow_store && !last) {
+            if ((output.size - block_start) * 100 >= n * STORE_RATIO_PERCENT) {
+                poor_blocks++;
+            } else {
+                poor_blocks = 0;
+            }
+            if (poor_blocks >= STORE_BAILOUT_BLOCKS) {
+                break;
+            }
+            block_start = output.size;
+        }
+    }
+    free(comp);
+
+    if (status != SUCCESS) {
+        free(output.data);
+        return status;
+    }
+
+    entry->data = output.data;
+    entry->comp_size = output.size;
+    entry->compressed = true;
+    entry->method = MZ_DEFLATED;
+    if (allow_store
+        && (consumed < size || (mz_uint64)output.size >= entry->uncomp_size)) {
+        fall_back_to_store(entry);
+    }
+
+    return SUCCESS;
+}
+
+int compress_entry_data_parallel(const unsigned char *data, size_t size,
+                                 int level, bool allow_store, ThreadPool_t *pool,
+                                 CompressedEntry_t *entry) {
+    if (entry == NULL || pool == NULL || data == NULL || level <= 0) {
+        return ERROR_INVALID_ARGS;
+    }
+
+    size_t chunk_count = (size + PARALLEL_CHUNK_SIZE - 1) / PARALLEL_CHUNK_SIZE;
+    if (chunk_count < 2) {
+        return compress_entry_data(data, size, level, allow_store, entry);
+    }
+
+    if (allow_store && looks_incompressible(data, size)) {
+        memset(entry, 0, sizeof(CompressedEntry_t));
+        entry->uncomp_size = size;
+        entry->crc32 = (mz_uint32)mz_crc32(MZ_CRC32_INIT, data, size);
+        fall_back_to_store(entry);
+        return SUCCESS;
+    }
+
+    DeflateChunk_t *chunks = calloc(chunk_count, sizeof(DeflateChunk_t));
+    if (chunks == NULL) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+
+    mz_uint     flags = tdefl_create_comp_flags_from_zip_params(
+        level, -MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY);
+    TaskGroup_t group = {0};
+
+    for (size_t i = 0; i < chunk_count; i++) {
+        DeflateChunk_t *chunk = &chunks[i];
+        size_t          start = i * PARALLEL_CHUNK_SIZE;
+        size_t          dictionary_size = start < DEFLATE_WINDOW_SIZE
+                                              ? start
+                                              : DEFLATE_WINDOW_SIZE;
+
+        chunk->dictionary = data + start - dictionary_size;
+        chunk->dictionary_size = dictionary_size;
+        chunk->data = data + start;
+        chunk->size = MZ_MIN(PARALLEL_CHUNK_SIZE, size - start);
+        chunk->last = (i == chunk_count - 1);
+        chunk->flags = flags;
+        if (thread_pool_submit(pool, &group, deflate_chunk, chunk) != SUCCESS) {
+            deflate_chunk(chunk);
+        }
+    }
+    thread_pool_wait(pool, &group);
+
+    // Stitch the chunk streams together and fold the CRCs in order
+    int    status = SUCCESS;
+    size_t total = 0;
+    for (size_t i = 0; i < chunk_count; i++) {
+        if (chunks[i].status != SUCCESS) {
+            status = chunks[i].status;
+        }
+        total += chunks[i].output.size;
+    }
+
+    memset(entry, 0, sizeof(CompressedEntry_t));
+    if (status == SUCCESS) {
+        entry->data = malloc(total > 0 ? total : 1);
+        if (entry->data == NULL) {
+            status = ERROR_MEMORY_ALLOCATION;
+        }
+    }
+    if (status == SUCCESS) {
+        entry->crc32 = chunks[0].crc32;
+        for (size_t i = 0; i < chunk_count; i++) {
+            memcpy(entry->data + entry->comp_size, chunks[i].output.data,
+                   chunks[i].output.size);
+            entry->comp_size += chunks[i].output.size;
+            if (i > 0) {
+                entry->crc32 = crc32_combine(entry->crc32, chunks[i].crc32,
+                                             chunks[i].size);
+            }
+        }
+        entry->uncomp_size = size;
+        entry->compressed = true;
+        entry->method = MZ_DEFLATED;
+        if (allow_store && (mz_uint64)entry->comp_size >= entry->uncomp_size) {
+            fall_back_to_store(entry);
+        }
+    }
+
+    for (size_t i = 0; i < chunk_count; i++) {
+        free(chunks[i].output.data);
+    }
+    free(chunks);
+    return status;
+}
+
+mz_uint32 crc32_combine(mz_uint32 crc1, mz_uint32 crc2, mz_uint64 len2) {
+    mz_uint32 even[32]; /* Operator for an even power of two zero bits */
+    mz_uint32 odd[32];  /* Operator for an odd power of two zero bits */
+
+    if (len2 == 0) {
+        return crc1;
+    }
+
+    // Operator for one zero bit: the reflected CRC-32 polynomial
+    odd[0] = 0xEDB88320UL;
+    mz_uint32 row = 1;
+    for (int n = 1; n < 32; n++) {
+        odd[n] = row;
+        row <<= 1;
+    }
+
+    gf2_matrix_square(even, odd); /* two zero bits */
+    gf2_matrix_square(odd, even); /* four zero bits */
+
+    // Apply len2 zero bytes to crc1, squaring the operator for each bit
+    // of len2 (the first square gives the operator for one zero byte)
+    do {
+        gf2_matrix_square(even, odd);
+        if (len2 & 1) {
+            crc1 = gf2_matrix_times(even, crc1);
+        }
+        len2 >>= 1;
+        if (len2 == 0) {
+            break;
+        }
+
+        gf2_matrix_square(odd, even);
+        if (len2 & 1) {
+            crc1 = gf2_matrix_times(odd, crc1);
+        }
+        len2 >>= 1;
+    } while (len2 != 0);
+
+    return crc1 ^ crc2;
+}
+
+void free_compressed_entry(CompressedEntry_t *entry) {
+    if (entry == NULL) {
+        return;
+    }
+    free(entry->data);
+    entry->data = NULL;
+}
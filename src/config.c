@@ -3,9 +3,14 @@
  * @brief Implementation of configuration file parsing
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "config.h"
+#include "dir_walk.h"
+#include "glob_set.h"
 #include <ctype.h>
-#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <glob.h>
 #include <limits.h>
 #include <sys/stat.h>
@@ -193,89 +198,14 @@ bool validate_required_path(const char *path) {
     //(void)path; // Remove this line when implementing
 }
 
-int list_directory_files(const char *dir_path, char **file_list, int max_files,
-                         int *file_count) {
-    // Open the directory using opendir()
-    DIR           *dir = opendir(dir_path);
-    struct dirent *entry;
-    // Read each entry using readdir()
-    // For each entry:
-    //       - Skip "." and ".."
-    //       - Build the full path (dir_path + "/" + entry name)
-    //       - If it's a file, add it to file_list using add_file_to_list()
-    //       - If it's a directory, recursively call list_directory_files()
-    while ((entry = readdir(dir)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0
-            || strcmp(entry->d_name, "..") == 0) {
-            continue;
-        }
-
-        char full_path[MAX_PATH_LENGTH];
-        // strcpy (full_path,dir_path);
-        // strcat (full_path,"/");
-        // strcat (full_path,entry ->d_name);
-        // unsafe, may cause buffer overflow !
-        snprintf(full_path, sizeof(full_path), "%s/%s", dir_path,
-                 entry->d_name);
-
-        if (is_file(full_path)) {
-            if (add_file_to_list(file_list, file_count, max_files, full_path)
-                != SUCCESS) {
-                return ERROR_IO;
-            }
-        } else {
-            if (list_directory_files(full_path, file_list, max_files,
-                                     file_count)
-                != SUCCESS) {
-                return ERROR_IO;
-            }
-        }
-    }
-    // Close the directory using closedir()
-    closedir(dir);
-    return SUCCESS;
-    //
-    // Hints:
-    // - Include <dirent.h>
-    // - DIR *dir = opendir(dir_path);
-    // - struct dirent *entry;
-    // - while ((entry = readdir(dir)) != NULL) { ... }
-    // - Use stat() to check if entry is a file or directory
-    // - Be careful with buffer sizes when building paths
-
-    (void)dir_path;
-    (void)file_list;
-    (void)max_files;
-    (void)file_count;
+int list_directory_files(const char *dir_path, FileList_t *file_list) {
+    // openat() + getdents64() walk, on -j threads; see dir_walk.h
+    return walk_directory_parallel(dir_path, file_list, dir_walk_threads(), NULL);
 }
 
-int add_file_to_list(char **file_list, int *file_count, int max_files,
-                     const char *file_path) {
-
-    /* Deduplication: check if file already exists in list */
-    for (int i = 0; i < *file_count; i++) {
-        if (strcmp(file_list[i], file_path) == 0) {
-            return SUCCESS; // already added, silently ignore
-        }
-    }
-
-    // Check if file_count < max_files (don't overflow the array)
-    if (*file_count >= max_files) {
-        return ERROR_IO;
-    }
-
-    // Allocate memory for the file path string
-    char *copy = malloc(strlen(file_path) + 1);
-    if (copy == NULL) {
-        return ERROR_MEMORY_ALLOCATION;
-    }
-
-    strcpy(copy, file_path);
-
-    file_list[*file_count] = copy;
-    (*file_count)++;
-
-    return SUCCESS;
+int add_file_to_list(FileList_t *file_list, const char *file_path) {
+    // The list's hash index skips paths it already holds
+    return file_list_add(file_list, file_path);
 }
 
 bool is_glob_pattern(const char *path) {
@@ -293,8 +223,7 @@ bool is_glob_pattern(const char *path) {
     return false;
 }
 
-int expand_glob_pattern(const char *pattern, char **file_list, int max_files,
-                        int *file_count) {
+int expand_glob_pattern(const char *pattern, FileList_t *file_list) {
     // Use glob() function to expand the pattern
     glob_t results;
 
@@ -306,8 +235,10 @@ int expand_glob_pattern(const char *pattern, char **file_list, int max_files,
     // For each matching file:
     //       - Add it to file_list using add_file_to_list()
     for (size_t i = 0; i < results.gl_pathc; i++){
-        char *match = results.gl_pathv[i];
-        if (add_file_to_list(file_list, file_count, max_files, match) != SUCCESS) {
+        char      *match = results.gl_pathv[i];
+        FileMeta_t meta;
+        bool       found = file_meta_read(AT_FDCWD, match, &meta) == SUCCESS;
+        if (file_list_add_meta(file_list, match, found ? &meta : NULL) != SUCCESS) {
             globfree(&results);
             return ERROR_IO;
         }
@@ -328,137 +259,243 @@ int expand_glob_pattern(const char *pattern, char **file_list, int max_files,
     return SUCCESS;
 }
 
-int parse_config_file(const char *config_path, const char *base_dir, char **file_list, int max_files,
-                      int *file_count) {
-    // Open the config file using fopen()
-    FILE *fp = fopen(config_path, "r");
+static const char *manifest_cache_dir = NULL;
+
+void config_use_manifest_cache(const char *cache_dir) {
+    manifest_cache_dir = cache_dir;
+}
+
+int compile_config_text(const char *text, size_t size, Manifest_t *manifest) {
+    manifest_init(manifest);
+    if (size == 0) {
+        return SUCCESS;
+    }
+    // The same line reader as the file, so both forms split, strip and
+    // section lines identically
+    FILE *fp = fmemopen((void *)text, size, "r");
     if (fp == NULL) {
-        perror("Failed to open config file");
-        return ERROR_FILE_NOT_FOUND;
-    }  
-    // Initialize current_section to track if we're in required/optional
+        return ERROR_MEMORY_ALLOCATION;
+    }
     char buffer[MAX_PATH_LENGTH];
     int  current_section = 0;
-    // Read the file line by line using read_config_line()
-    // int read_config_line(FILE *fp, char *buffer, size_t buffer_size)
-    // For each line:
-    //       - Check if it's a section header using identify_section()
-    //       - If it's a section header, update current_section
-    //       - If it's an indented line:
-    //         * Extract the filename using extract_filename()
-    //         * If in required section:
-    //           - Validate the path exists using validate_required_path()
-    //           - If it fails validation, return error
-    //           - If it's a directory, use list_directory_files()
-    //           - If it's a file, use add_file_to_list()
-    //         * If in optional section:
-    //           - Check if it's a glob pattern using is_glob_pattern()
-    //           - If glob, use expand_glob_pattern()
-    //           - If not glob and exists, add to list
-    //           - If doesn't exist, skip (no error)
-
-    while (read_config_line(fp, buffer, sizeof(buffer)) != -1) {
-        
+    int  status = SUCCESS;
+    while (status == SUCCESS && read_config_line(fp, buffer, sizeof(buffer)) != -1) {
         if (identify_section(buffer) != 0) {
             current_section = identify_section(buffer);
             continue;
         }
-        if (is_indented_line(buffer)) {
-            char filename[MAX_PATH_LENGTH];
-            char full_path[MAX_PATH_LENGTH];
-            if (extract_filename(buffer, filename, sizeof(filename))
-                != SUCCESS) {
-                print_error("Warning: Invalid filename format");
-                continue;
-            }
-            snprintf(full_path, sizeof(full_path), "%s/%s", base_dir, filename);
-            if (current_section == 1) {//If in required section:
-                if (!validate_required_path(full_path)) {
-                    print_error("Error: fails validation");
-                    return ERROR_INVALID_ARGS;
-                }
-                if (is_file(full_path)) {
-                    if (add_file_to_list(file_list, file_count, max_files, full_path)!= SUCCESS) {
-                        print_error("fail to add file to list");
-                        fclose(fp);
-                        return ERROR_IO;
-                    } 
-                }else {
-                    if (list_directory_files(full_path, file_list, max_files, file_count) != SUCCESS) {
-                        print_error("fail to list directory files");
-                        fclose(fp);
-                        return ERROR_IO;
-                    }
-                }
-            }
-            if (current_section == 2) { // optional section
-
-                /* IMPORTANT:
-                 * 1. Detect glob on the *filename*, not full_path
-                 * 2. Do NOT call validate_required_path() for optional files
-                 */
-
-                if (is_glob_pattern(filename)) {
-                    char glob_pattern[MAX_PATH_LENGTH];
-                    snprintf(glob_pattern, sizeof(glob_pattern), "%s/%s", base_dir, filename);
-
-                    if (expand_glob_pattern(glob_pattern, file_list, max_files, file_count)
-                        != SUCCESS) {
-                        print_error("fail to expand glob pattern");
-                    }
-
-                } else {
-                    /* Optional non-glob file: only add if it exists */
-                    if (access(full_path, F_OK) == 0) {
-                        if (add_file_to_list(file_list, file_count, max_files, full_path)
-                            != SUCCESS) {
-                            print_error("fail to add file to list");
-                            fclose(fp);
-                            return ERROR_IO;
-                        }
-                    }
-                    /* If it doesn't exist, silently ignore */
-                }
-            }
+        if (!is_indented_line(buffer)) {
+            continue;
+        }
+        char filename[MAX_PATH_LENGTH];
+        if (extract_filename(buffer, filename, sizeof(filename)) != SUCCESS) {
+            print_error("Warning: Invalid filename format");
+            continue;
+        }
+        if (current_section != MANIFEST_REQUIRED && current_section != MANIFEST_OPTIONAL) {
+            continue;
         }
+        unsigned flags = (is_glob_pattern(filename) ? MANIFEST_GLOB : 0)
+                         | (has_trailing_slash(filename) ? MANIFEST_TRAILING_SLASH : 0);
+        status = manifest_add(manifest, current_section, flags, filename);
     }
+    fclose(fp);
+    if (status != SUCCESS) {
+        manifest_free(manifest);
+    }
+    return status;
+}
 
-    // Close the file using fclose()
+/* Read a whole config file into memory */
+static int read_config_text(const char *config_path, char **text, size_t *size) {
+    FILE *fp = fopen(config_path, "r");
+    if (fp == NULL) {
+        perror("Failed to open config file");
+        return ERROR_FILE_NOT_FOUND;
+    }
+    size_t capacity = 4096;
+    char  *data = malloc(capacity);
+    size_t used = 0;
+    while (data != NULL) {
+        used += fread(data + used, 1, capacity - used, fp);
+        if (used < capacity) {
+            break;
+        }
+        char *grown = realloc(data, capacity * 2);
+        if (grown == NULL) {
+            free(data);
+        }
+        data = grown;
+        capacity *= 2;
+    }
+    bool failed = ferror(fp) != 0;
     fclose(fp);
-    //  Return SUCCESS if everything worked
+    if (data == NULL) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    if (failed) {
+        free(data);
+        return ERROR_IO;
+    }
+    *text = data;
+    *size = used;
     return SUCCESS;
-    //
-    // This is the main function that coordinates all the other functions!
-    //
-    // Hints:
-    // - FILE *fp = fopen(config_path, "r");
-    // - Use a char buffer[MAX_PATH_LENGTH] for reading lines
-    // - Keep track of which section you're in (0=none, 1=required, 2=optional)
-    // - Handle errors at each step and clean up properly
-    // - Print helpful error messages when things go wrong
-
-    (void)config_path;
-    (void)file_list;
-    (void)max_files;
-    (void)file_count;
-    return ERROR_FILE_NOT_FOUND;
 }
 
-void free_file_list(char **file_list, int file_count) {
-    // Loop through the file_list array
-    // Free each string using free()
-    // Set each pointer to NULL after freeing (good practice)
-    for (int i = 0; i < file_count; i++) {
-        free(file_list[i]);
-        file_list[i] = NULL;
+int load_config_manifest(const char *config_path, Manifest_t *manifest, bool *cached) {
+    char  *text;
+    size_t size;
+    int    status = read_config_text(config_path, &text, &size);
+    if (status != SUCCESS) {
+        return status;
+    }
+    if (cached != NULL) {
+        *cached = false;
+    }
+    if (manifest_cache_dir == NULL) {
+        status = compile_config_text(text, size, manifest);
+        free(text);
+        return status;
     }
 
-    //
-    // Hints:
-    // - for (int i = 0; i < file_count; i++) { ... }
-    // - free(file_list[i]);
-    // - file_list[i] = NULL;
+    // Keyed by the text alone: the same .LT_FILES in every submission of a
+    // batch compiles once
+    unsigned char key[MANIFEST_KEY_SIZE];
+    char          cache_path[MAX_PATH_LENGTH];
+    manifest_key(text, size, key);
+    manifest_cache_path(manifest_cache_dir, key, cache_path, sizeof(cache_path));
+
+    if (manifest_load(cache_path, key, manifest) == SUCCESS) {
+        free(text);
+        if (cached != NULL) {
+            *cached = true;
+        }
+        return SUCCESS;
+    }
+    status = compile_config_text(text, size, manifest);
+    free(text);
+    if (status == SUCCESS) {
+        memcpy(manifest->key, key, MANIFEST_KEY_SIZE);
+        // A cache that cannot be written only costs the next run a parse
+        if (mkdir(manifest_cache_dir, 0755) != 0 && errno != EEXIST) {
+            return SUCCESS;
+        }
+        manifest_save(manifest, cache_path);
+    }
+    return status;
+}
 
-    (void)file_list;
-    (void)file_count;
+/* Compile the optional glob patterns into one set and match them all in
+ * one walk of base_dir. pattern_of[i] is entry i's pattern in the set, or
+ * -1 where the entry is left to glob(). */
+static int match_optional_globs(const Manifest_t *manifest, const char *base_dir,
+                                GlobSet_t *set, int **pattern_of) {
+    int *index = malloc((manifest->count > 0 ? (size_t)manifest->count : 1) * sizeof(int));
+    int  status = index != NULL ? glob_set_init(set) : ERROR_MEMORY_ALLOCATION;
+    if (status != SUCCESS) {
+        free(index);
+        return status;
+    }
+    for (int i = 0; i < manifest->count && status == SUCCESS; i++) {
+        const char *pattern = manifest_entry_path(manifest, i);
+        index[i] = -1;
+        if (manifest->entries[i].section == MANIFEST_OPTIONAL
+            && (manifest->entries[i].flags & MANIFEST_GLOB)
+            && glob_set_supports(base_dir, pattern)) {
+            status = glob_set_add(set, pattern, &index[i]);
+        }
+    }
+    if (status == SUCCESS) {
+        status = glob_set_match(set, base_dir);
+    }
+    if (status != SUCCESS) {
+        glob_set_free(set);
+        free(index);
+        return status;
+    }
+    *pattern_of = index;
+    return SUCCESS;
+}
+
+int apply_config_manifest(const Manifest_t *manifest, const char *base_dir,
+                          FileList_t *file_list) {
+    GlobSet_t globs;
+    int      *pattern_of = NULL; // Set up at the first glob entry
+    bool      globs_matched = false;
+    int       status = SUCCESS;
+
+    for (int i = 0; i < manifest->count && status == SUCCESS; i++) {
+        const ManifestEntry_t *entry = &manifest->entries[i];
+        char                   full_path[MAX_PATH_LENGTH];
+        snprintf(full_path, sizeof(full_path), "%s/%s", base_dir,
+                 manifest_entry_path(manifest, i));
+        if (entry->section == MANIFEST_REQUIRED) {
+            // One statx() both validates the path and is kept with the
+            // file, instead of access() + stat() + later stat()s
+            FileMeta_t meta;
+            if (file_meta_read(AT_FDCWD, full_path, &meta) != SUCCESS) {
+                print_error("the path doesn't exist");
+                print_error("Error: fails validation");
+                status = ERROR_INVALID_ARGS;
+            } else if (S_ISREG(meta.mode)) {
+                if (file_list_add_meta(file_list, full_path, &meta) != SUCCESS) {
+                    print_error("fail to add file to list");
+                    status = ERROR_IO;
+                }
+            } else if (list_directory_files(full_path, file_list) != SUCCESS) {
+                print_error("fail to list directory files");
+                status = ERROR_IO;
+            }
+        } else if (entry->flags & MANIFEST_GLOB) {
+            // Every pattern is matched in the one walk, each one's files
+            // are added here in turn; glob() when the set cannot be built
+            if (!globs_matched) {
+                globs_matched = true;
+                if (match_optional_globs(manifest, base_dir, &globs, &pattern_of) != SUCCESS) {
+                    pattern_of = NULL;
+                }
+            }
+            int expanded = pattern_of != NULL && pattern_of[i] >= 0
+                               ? glob_set_add_matches(&globs, pattern_of[i], base_dir,
+                                                      file_list)
+                               : expand_glob_pattern(full_path, file_list);
+            if (expanded != SUCCESS) {
+                print_error("fail to expand glob pattern");
+            }
+        } else {
+            // Optional path: only added if it exists, never validated; a
+            // directory is walked like a required one, trailing / or not
+            FileMeta_t meta;
+            if (file_meta_read(AT_FDCWD, full_path, &meta) != SUCCESS) {
+                continue;
+            }
+            if (S_ISDIR(meta.mode)) {
+                if (list_directory_files(full_path, file_list) != SUCCESS) {
+                    print_error("fail to list directory files");
+                }
+            } else if (S_ISREG(meta.mode)
+                       && file_list_add_meta(file_list, full_path, &meta) != SUCCESS) {
+                print_error("fail to add file to list");
+                status = ERROR_IO;
+            }
+        }
+    }
+    if (pattern_of != NULL) {
+        glob_set_free(&globs);
+        free(pattern_of);
+    }
+    return status;
+}
+
+int parse_config_file(const char *config_path, const char *base_dir, FileList_t *file_list) {
+    // The text is compiled (or its compiled form loaded from the manifest
+    // cache) first, then each entry is resolved against base_dir
+    Manifest_t manifest;
+    int        status = load_config_manifest(config_path, &manifest, NULL);
+    if (status != SUCCESS) {
+        return status;
+    }
+    status = apply_config_manifest(&manifest, base_dir, file_list);
+    manifest_free(&manifest);
+    return status;
 }
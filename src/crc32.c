@@ -0,0 +1,219 @@
+/**
+ * @file crc32.c
+ * @brief CRC-32 implementations and the mz_crc32() used by miniz
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "crc32.h"
+#include "../lib/miniz/miniz.h"
+#include <pthread.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CRC32_HAVE_PCLMUL 1
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__GNUC__)
+#define CRC32_HAVE_ARMV8 1
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+
+/* Reflected CRC-32 polynomial used by ZIP, gzip and PNG */
+#define CRC32_POLYNOMIAL 0xEDB88320u
+
+static uint32_t crc_table[256];
+
+/* Byte-at-a-time update of a raw (pre-inverted) CRC state */
+static uint32_t table_update(uint32_t state, const unsigned char *data, size_t len) {
+    while (len >= 4) {
+        state = (state >> 8) ^ crc_table[(state ^ data[0]) & 0xFF];
+        state = (state >> 8) ^ crc_table[(state ^ data[1]) & 0xFF];
+        state = (state >> 8) ^ crc_table[(state ^ data[2]) & 0xFF];
+        state = (state >> 8) ^ crc_table[(state ^ data[3]) & 0xFF];
+        data += 4;
+        len -= 4;
+    }
+    while (len > 0) {
+        state = (state >> 8) ^ crc_table[(state ^ *data++) & 0xFF];
+        len--;
+    }
+    return state;
+}
+
+static uint32_t crc32_portable(uint32_t crc, const unsigned char *data, size_t len) {
+    return ~table_update(~crc, data, len);
+}
+
+#ifdef CRC32_HAVE_PCLMUL
+/*
+ * Carry-less multiplication folding from Intel's "Fast CRC Computation for
+ * Generic Polynomials Using PCLMULQDQ Instruction". Four 128-bit lanes are
+ * folded 64 bytes at a time, reduced to one lane, then to 32 bits with a
+ * Barrett reduction. len must be at least 64 and a multiple of 16.
+ */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t fold_pclmul(const unsigned char *data, size_t len, uint32_t state) {
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    const __m128i k5k0 = _mm_set_epi64x(0x0000000000, 0x0163cd6124);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+    const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+    x1 = _mm_loadu_si128((const __m128i *)(data + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *)(data + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *)(data + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *)(data + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)state));
+    data += 64;
+    len -= 64;
+
+    // Fold 64 bytes at a time into the four lanes
+    x0 = k1k2;
+    while (len >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+                           _mm_loadu_si128((const __m128i *)(data + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+                           _mm_loadu_si128((const __m128i *)(data + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+                           _mm_loadu_si128((const __m128i *)(data + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+                           _mm_loadu_si128((const __m128i *)(data + 0x30)));
+        data += 64;
+        len -= 64;
+    }
+
+    // Fold the four lanes into one
+    x0 = k3k4;
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    // Remaining 16-byte blocks
+    while (len >= 16) {
+        x2 = _mm_loadu_si128((const __m128i *)data);
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+        data += 16;
+        len -= 16;
+    }
+
+    // 128 bits down to 64
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask32);
+    x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction to 32 bits
+    x2 = _mm_and_si128(x1, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+    x2 = _mm_and_si128(x2, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+static uint32_t crc32_pclmul(uint32_t crc, const unsigned char *data, size_t len) {
+    uint32_t state = ~crc;
+    if (len >= 64) {
+        size_t folded = len & ~(size_t)15;
+        state = fold_pclmul(data, folded, state);
+        data += folded;
+        len -= folded;
+    }
+    return ~table_update(state, data, len);
+}
+#endif
+
+#ifdef CRC32_HAVE_ARMV8
+__attribute__((target("+crc")))
+static uint32_t crc32_armv8(uint32_t crc, const unsigned char *data, size_t len) {
+    uint32_t state = ~crc;
+    while (len > 0 && ((uintptr_t)data & 7) != 0) {
+        state = __crc32b(state, *data++);
+        len--;
+    }
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        state = __crc32d(state, word);
+        data += 8;
+        len -= 8;
+    }
+    while (len > 0) {
+        state = __crc32b(state, *data++);
+        len--;
+    }
+    return ~state;
+}
+#endif
+
+static Crc32Variant_t usable_variants[3];
+static int            usable_count;
+static crc32_fn       active_crc32 = crc32_portable;
+static pthread_once_t crc32_once = PTHREAD_ONCE_INIT;
+
+static void select_crc32(void) {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? (c >> 1) ^ CRC32_POLYNOMIAL : c >> 1;
+        }
+        crc_table[n] = c;
+    }
+
+    usable_variants[usable_count++] = (Crc32Variant_t){"portable", crc32_portable};
+#ifdef CRC32_HAVE_PCLMUL
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1")) {
+        usable_variants[usable_count++] = (Crc32Variant_t){"pclmul", crc32_pclmul};
+    }
+#endif
+#ifdef CRC32_HAVE_ARMV8
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+        usable_variants[usable_count++] = (Crc32Variant_t){"armv8", crc32_armv8};
+    }
+#endif
+    active_crc32 = usable_variants[usable_count - 1].fn;
+}
+
+int crc32_variants(const Crc32Variant_t **variants) {
+    pthread_once(&crc32_once, select_crc32);
+    *variants = usable_variants;
+    return usable_count;
+}
+
+const char *crc32_active_variant(void) {
+    pthread_once(&crc32_once, select_crc32);
+    return usable_variants[usable_count - 1].name;
+}
+
+/* Replaces miniz's table-driven version (built with USE_EXTERNAL_MZCRC) */
+mz_ulong mz_crc32(mz_ulong crc, const mz_uint8 *ptr, size_t buf_len) {
+    if (ptr == NULL) {
+        return MZ_CRC32_INIT;
+    }
+    pthread_once(&crc32_once, select_crc32);
+    return active_crc32((uint32_t)crc, ptr, buf_len);
+}
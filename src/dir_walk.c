@@ -0,0 +1,559 @@
+/**
+ * @file dir_walk.c
+ * @brief Implementation of the descriptor-based directory walk
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "dir_walk.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Record layout getdents64() fills the buffer with */
+typedef struct {
+    uint64_t       d_ino;
+    int64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+} LinuxDirent64_t;
+
+/* Threads list_directory_files() walks with */
+static int walk_threads = 1;
+
+/* Type of an entry, DT_REG, DT_DIR or anything else to skip. Directories
+ * are taken from d_type; files (and links, which are followed as stat()
+ * would) get the one statx() that captures their metadata. */
+static unsigned char entry_type(int dir_fd, const LinuxDirent64_t *entry,
+                                WalkStats_t *stats, FileMeta_t *meta) {
+    unsigned char type = entry->d_type;
+    if (type == DT_REG || type == DT_UNKNOWN || type == DT_LNK) {
+        stats->stats++;
+        if (file_meta_read(dir_fd, entry->d_name, meta) != SUCCESS) {
+            return DT_UNKNOWN; // dangling link or gone since it was listed
+        }
+        type = S_ISREG(meta->mode) ? DT_REG : S_ISDIR(meta->mode) ? DT_DIR : DT_UNKNOWN;
+    }
+    return type;
+}
+
+/* State shared by every level of one walk */
+typedef struct {
+    FileList_t  *list;
+    WalkStats_t *stats;
+    char         path[MAX_PATH_LENGTH]; /* Directory being listed, then /name */
+    char       **buffers;               /* One getdents64() buffer per depth */
+    int          depth_count;
+} WalkContext_t;
+
+/* getdents64() buffer for a depth, kept for the rest of the walk */
+static char *depth_buffer(WalkContext_t *context, int depth) {
+    if (depth >= context->depth_count) {
+        int    count = depth + 8;
+        char **buffers = realloc(context->buffers, (size_t)count * sizeof(char *));
+        if (buffers == NULL) {
+            return NULL;
+        }
+        for (int i = context->depth_count; i < count; i++) {
+            buffers[i] = NULL;
+        }
+        context->buffers = buffers;
+        context->depth_count = count;
+    }
+    if (context->buffers[depth] == NULL) {
+        context->buffers[depth] = malloc(DIR_WALK_BUFFER_SIZE);
+    }
+    return context->buffers[depth];
+}
+
+/* List the open directory dir_fd, whose path is context->path[0..length) */
+static int walk_fd(WalkContext_t *context, int dir_fd, size_t length, int depth) {
+    char *buffer = depth_buffer(context, depth);
+    if (buffer == NULL) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    context->stats->directories++;
+
+    int status = SUCCESS;
+    for (;;) {
+        long got = syscall(SYS_getdents64, dir_fd, buffer, DIR_WALK_BUFFER_SIZE);
+        context->stats->getdents++;
+        if (got < 0) {
+            return ERROR_IO;
+        }
+        if (got == 0) {
+            return status;
+        }
+
+        for (long offset = 0; offset < got && status == SUCCESS;) {
+            LinuxDirent64_t *entry = (LinuxDirent64_t *)(buffer + offset);
+            offset += entry->d_reclen;
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+                continue;
+            }
+            context->stats->entries++;
+
+            size_t name_length = strlen(entry->d_name);
+            if (length + 1 + name_length >= MAX_PATH_LENGTH) {
+                return ERROR_IO;
+            }
+            context->path[length] = '/';
+            memcpy(context->path + length + 1, entry->d_name, name_length + 1);
+
+            FileMeta_t    meta;
+            unsigned char type = entry_type(dir_fd, entry, context->stats, &meta);
+            if (type == DT_REG) {
+                status = file_list_add_meta(context->list, context->path, &meta);
+            } else if (type == DT_DIR) {
+                context->stats->opens++;
+                int child = openat(dir_fd, entry->d_name,
+                                   O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if (child < 0) {
+                    return ERROR_IO;
+                }
+                status = walk_fd(context, child, length + 1 + name_length, depth + 1);
+                context->stats->closes++;
+                close(child);
+            }
+        }
+        if (status != SUCCESS) {
+            return status;
+        }
+    }
+}
+
+int walk_directory(const char *dir_path, FileList_t *file_list, WalkStats_t *stats) {
+    WalkStats_t   local_stats;
+    WalkContext_t context;
+    size_t        length = strlen(dir_path);
+
+    if (length >= MAX_PATH_LENGTH) {
+        return ERROR_INVALID_ARGS;
+    }
+    if (stats == NULL) {
+        stats = &local_stats;
+    }
+    memset(stats, 0, sizeof(WalkStats_t));
+    memset(&context, 0, sizeof(WalkContext_t));
+    context.list = file_list;
+    context.stats = stats;
+    memcpy(context.path, dir_path, length + 1);
+
+    stats->opens++;
+    int fd = open(dir_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return ERROR_IO;
+    }
+    int status = walk_fd(&context, fd, length, 0);
+    stats->closes++;
+    close(fd);
+
+    for (int i = 0; i < context.depth_count; i++) {
+        free(context.buffers[i]);
+    }
+    free(context.buffers);
+    return status;
+}
+
+/* One item of a listed directory: a file, or a subdirectory */
+typedef struct {
+    size_t           name;  /* Offset of the file's name in the node's names */
+    struct WalkNode *child; /* Subdirectory, or NULL for a file */
+    FileMeta_t       meta;  /* The file's metadata */
+} WalkItem_t;
+
+/* A directory of a parallel walk and what listing it found */
+typedef struct WalkNode {
+    char       *path;   /* Built as the serial walk builds it */
+    size_t      length;
+    WalkItem_t *items;  /* In the order the directory returned them */
+    int         item_count;
+    int         item_capacity;
+    char       *names;  /* File names, each '\0'-terminated */
+    size_t      names_used;
+    size_t      names_size;
+    int         status; /* What walk_fd() would return for it */
+} WalkNode_t;
+
+/* Directories waiting to be listed: the owner pushes and pops at the
+ * bottom, other threads steal from the top */
+typedef struct {
+    pthread_mutex_t lock;
+    WalkNode_t    **nodes;
+    size_t          top;
+    size_t          bottom;
+    size_t          capacity;
+} WalkDeque_t;
+
+typedef struct ParallelWalk ParallelWalk_t;
+
+typedef struct {
+    ParallelWalk_t *walk;
+    int             index;
+    WalkDeque_t     deque;
+    WalkStats_t     stats;
+    char           *buffer; /* getdents64() buffer */
+} WalkWorker_t;
+
+struct ParallelWalk {
+    pthread_mutex_t lock;
+    pthread_cond_t  work_ready; /* Signalled when a node is queued or all are done */
+    int             queued;     /* Nodes in a deque */
+    int             pending;    /* Nodes queued or being listed */
+    WalkWorker_t   *workers;
+    int             worker_count;
+};
+
+static WalkNode_t *create_node(const char *parent, size_t parent_length, const char *name) {
+    size_t      name_length = strlen(name);
+    WalkNode_t *node = calloc(1, sizeof(WalkNode_t));
+    if (node == NULL) {
+        return NULL;
+    }
+    node->length = parent_length + (parent != NULL ? 1 + name_length : 0);
+    node->path = malloc(node->length + 1);
+    if (node->path == NULL) {
+        free(node);
+        return NULL;
+    }
+    if (parent != NULL) {
+        memcpy(node->path, parent, parent_length);
+        node->path[parent_length] = '/';
+        memcpy(node->path + parent_length + 1, name, name_length + 1);
+    } else {
+        memcpy(node->path, name, name_length + 1);
+    }
+    return node;
+}
+
+static void free_node(WalkNode_t *node) {
+    for (int i = 0; i < node->item_count; i++) {
+        if (node->items[i].child != NULL) {
+            free_node(node->items[i].child);
+        }
+    }
+    free(node->items);
+    free(node->names);
+    free(node->path);
+    free(node);
+}
+
+/* Append a file (name, meta) or a subdirectory (child) to a node's items */
+static int add_item(WalkNode_t *node, const char *name, size_t name_length,
+                    WalkNode_t *child, const FileMeta_t *meta) {
+    if (node->item_count == node->item_capacity) {
+        int         capacity = node->item_capacity > 0 ? node->item_capacity * 2 : 16;
+        WalkItem_t *items = realloc(node->items, (size_t)capacity * sizeof(WalkItem_t));
+        if (items == NULL) {
+            return ERROR_MEMORY_ALLOCATION;
+        }
+        node->items = items;
+        node->item_capacity = capacity;
+    }
+
+    WalkItem_t *item = &node->items[node->item_count];
+    item->child = child;
+    if (child == NULL) {
+        if (node->names_size - node->names_used < name_length + 1) {
+            size_t size = node->names_size > 0 ? node->names_size : 256;
+            while (size - node->names_used < name_length + 1) {
+                size *= 2;
+            }
+            char *names = realloc(node->names, size);
+            if (names == NULL) {
+                return ERROR_MEMORY_ALLOCATION;
+            }
+            node->names = names;
+            node->names_size = size;
+        }
+        item->name = node->names_used;
+        item->meta = *meta;
+        memcpy(node->names + node->names_used, name, name_length + 1);
+        node->names_used += name_length + 1;
+    }
+    node->item_count++;
+    return SUCCESS;
+}
+
+static int push_node(WalkWorker_t *worker, WalkNode_t *node) {
+    // Count the node before it can be seen: a thief that took and listed
+    // it first would otherwise drop pending to 0 and end the walk early
+    ParallelWalk_t *walk = worker->walk;
+    pthread_mutex_lock(&walk->lock);
+    walk->queued++;
+    walk->pending++;
+    pthread_mutex_unlock(&walk->lock);
+
+    WalkDeque_t *deque = &worker->deque;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom == deque->capacity) {
+        // Reuse the stolen slots at the top before growing
+        if (deque->top > 0) {
+            memmove(deque->nodes, deque->nodes + deque->top,
+                    (deque->bottom - deque->top) * sizeof(WalkNode_t *));
+            deque->bottom -= deque->top;
+            deque->top = 0;
+        }
+        if (deque->bottom == deque->capacity) {
+            size_t       capacity = deque->capacity > 0 ? deque->capacity * 2 : 64;
+            WalkNode_t **nodes = realloc(deque->nodes, capacity * sizeof(WalkNode_t *));
+            if (nodes == NULL) {
+                pthread_mutex_unlock(&deque->lock);
+                pthread_mutex_lock(&walk->lock);
+                walk->queued--;
+                walk->pending--;
+                pthread_mutex_unlock(&walk->lock);
+                return ERROR_MEMORY_ALLOCATION;
+            }
+            deque->nodes = nodes;
+            deque->capacity = capacity;
+        }
+    }
+    deque->nodes[deque->bottom++] = node;
+    pthread_mutex_unlock(&deque->lock);
+
+    pthread_mutex_lock(&walk->lock);
+    pthread_cond_signal(&walk->work_ready);
+    pthread_mutex_unlock(&walk->lock);
+    return SUCCESS;
+}
+
+/* Newest node of the deque (own = true), or the oldest (stealing) */
+static WalkNode_t *take_from(WalkDeque_t *deque, bool own) {
+    WalkNode_t *node = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->top < deque->bottom) {
+        node = own ? deque->nodes[--deque->bottom] : deque->nodes[deque->top++];
+        if (deque->top == deque->bottom) {
+            deque->top = deque->bottom = 0;
+        }
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return node;
+}
+
+/* A node from the worker's own deque, or stolen from the next one that
+ * has any; NULL when all are empty */
+static WalkNode_t *take_node(WalkWorker_t *worker) {
+    ParallelWalk_t *walk = worker->walk;
+    WalkNode_t     *node = take_from(&worker->deque, true);
+    for (int i = 1; node == NULL && i < walk->worker_count; i++) {
+        node = take_from(&walk->workers[(worker->index + i) % walk->worker_count].deque, false);
+    }
+    if (node != NULL) {
+        pthread_mutex_lock(&walk->lock);
+        walk->queued--;
+        pthread_mutex_unlock(&walk->lock);
+    }
+    return node;
+}
+
+/* Read the open directory dir_fd into node, queueing its subdirectories */
+static int read_node(WalkWorker_t *worker, WalkNode_t *node, int dir_fd) {
+    for (;;) {
+        long got = syscall(SYS_getdents64, dir_fd, worker->buffer, DIR_WALK_BUFFER_SIZE);
+        worker->stats.getdents++;
+        if (got < 0) {
+            return ERROR_IO;
+        }
+        if (got == 0) {
+            return SUCCESS;
+        }
+
+        for (long offset = 0; offset < got;) {
+            LinuxDirent64_t *entry = (LinuxDirent64_t *)(worker->buffer + offset);
+            offset += entry->d_reclen;
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+                continue;
+            }
+            worker->stats.entries++;
+
+            size_t name_length = strlen(entry->d_name);
+            if (node->length + 1 + name_length >= MAX_PATH_LENGTH) {
+                return ERROR_IO;
+            }
+
+            int           status = SUCCESS;
+            FileMeta_t    meta;
+            unsigned char type = entry_type(dir_fd, entry, &worker->stats, &meta);
+            if (type == DT_REG) {
+                status = add_item(node, entry->d_name, name_length, NULL, &meta);
+            } else if (type == DT_DIR) {
+                WalkNode_t *child = create_node(node->path, node->length, entry->d_name);
+                if (child == NULL) {
+                    return ERROR_MEMORY_ALLOCATION;
+                }
+                status = add_item(node, NULL, 0, child, NULL);
+                if (status != SUCCESS) {
+                    free_node(child);
+                } else if (push_node(worker, child) != SUCCESS) {
+                    child->status = ERROR_MEMORY_ALLOCATION;
+                    status = ERROR_MEMORY_ALLOCATION;
+                }
+            }
+            if (status != SUCCESS) {
+                return status;
+            }
+        }
+    }
+}
+
+static void list_node(WalkWorker_t *worker, WalkNode_t *node) {
+    worker->stats.opens++;
+    int fd = open(node->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        node->status = ERROR_IO;
+        return;
+    }
+    worker->stats.directories++;
+    node->status = read_node(worker, node, fd);
+    worker->stats.closes++;
+    close(fd);
+}
+
+static void *walk_worker(void *arg) {
+    WalkWorker_t   *worker = arg;
+    ParallelWalk_t *walk = worker->walk;
+    for (;;) {
+        WalkNode_t *node = take_node(worker);
+        if (node != NULL) {
+            list_node(worker, node);
+            pthread_mutex_lock(&walk->lock);
+            if (--walk->pending == 0) {
+                pthread_cond_broadcast(&walk->work_ready);
+            }
+            pthread_mutex_unlock(&walk->lock);
+            continue;
+        }
+
+        pthread_mutex_lock(&walk->lock);
+        while (walk->queued == 0 && walk->pending > 0) {
+            pthread_cond_wait(&walk->work_ready, &walk->lock);
+        }
+        bool done = walk->pending == 0;
+        pthread_mutex_unlock(&walk->lock);
+        if (done) {
+            return NULL;
+        }
+    }
+}
+
+/* Add a node's files to the list depth first, stopping where the serial
+ * walk would have stopped */
+static int merge_node(const WalkNode_t *node, FileList_t *file_list, char *path) {
+    for (int i = 0; i < node->item_count; i++) {
+        const WalkItem_t *item = &node->items[i];
+        int               status;
+        if (item->child != NULL) {
+            status = merge_node(item->child, file_list, path);
+        } else {
+            // read_node() checked that the path fits
+            memcpy(path, node->path, node->length);
+            path[node->length] = '/';
+            strcpy(path + node->length + 1, node->names + item->name);
+            status = file_list_add_meta(file_list, path, &item->meta);
+        }
+        if (status != SUCCESS) {
+            return status;
+        }
+    }
+    return node->status;
+}
+
+int walk_directory_parallel(const char *dir_path, FileList_t *file_list, int threads,
+                            WalkStats_t *stats) {
+    if (threads <= 1) {
+        return walk_directory(dir_path, file_list, stats);
+    }
+    if (strlen(dir_path) >= MAX_PATH_LENGTH) {
+        return ERROR_INVALID_ARGS;
+    }
+
+    ParallelWalk_t walk;
+    memset(&walk, 0, sizeof(ParallelWalk_t));
+    walk.workers = calloc((size_t)threads, sizeof(WalkWorker_t));
+    WalkNode_t *root = create_node(NULL, strlen(dir_path), dir_path);
+    if (walk.workers == NULL || root == NULL) {
+        free(walk.workers);
+        if (root != NULL) {
+            free_node(root);
+        }
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    walk.worker_count = threads;
+    pthread_mutex_init(&walk.lock, NULL);
+    pthread_cond_init(&walk.work_ready, NULL);
+
+    int status = SUCCESS;
+    for (int i = 0; i < threads; i++) {
+        walk.workers[i].walk = &walk;
+        walk.workers[i].index = i;
+        pthread_mutex_init(&walk.workers[i].deque.lock, NULL);
+        walk.workers[i].buffer = malloc(DIR_WALK_BUFFER_SIZE);
+        if (walk.workers[i].buffer == NULL) {
+            status = ERROR_MEMORY_ALLOCATION;
+        }
+    }
+
+    pthread_t *ids = calloc((size_t)threads, sizeof(pthread_t));
+    int        started = 0;
+    if (status == SUCCESS && ids != NULL && push_node(&walk.workers[0], root) == SUCCESS) {
+        // The calling thread is worker 0; a thread that fails to start
+        // leaves its (empty) deque to the others
+        for (int i = 1; i < threads; i++) {
+            if (pthread_create(&ids[started], NULL, walk_worker, &walk.workers[i]) == 0) {
+                started++;
+            }
+        }
+        walk_worker(&walk.workers[0]);
+        for (int i = 0; i < started; i++) {
+            pthread_join(ids[i], NULL);
+        }
+
+        char path[MAX_PATH_LENGTH];
+        status = merge_node(root, file_list, path);
+    } else if (status == SUCCESS) {
+        status = ERROR_MEMORY_ALLOCATION;
+    }
+
+    if (stats != NULL) {
+        memset(stats, 0, sizeof(WalkStats_t));
+    }
+    for (int i = 0; i < threads; i++) {
+        WalkWorker_t *worker = &walk.workers[i];
+        if (stats != NULL) {
+            stats->directories += worker->stats.directories;
+            stats->entries += worker->stats.entries;
+            stats->opens += worker->stats.opens;
+            stats->getdents += worker->stats.getdents;
+            stats->stats += worker->stats.stats;
+            stats->closes += worker->stats.closes;
+        }
+        pthread_mutex_destroy(&worker->deque.lock);
+        free(worker->deque.nodes);
+        free(worker->buffer);
+    }
+    free(ids);
+    free(walk.workers);
+    free_node(root);
+    pthread_cond_destroy(&walk.work_ready);
+    pthread_mutex_destroy(&walk.lock);
+    return status;
+}
+
+void dir_walk_use_threads(int threads) {
+    walk_threads = threads > 1 ? threads : 1;
+}
+
+int dir_walk_threads(void) {
+    return walk_threads;
+}
+
+long walk_syscalls(const WalkStats_t *stats) {
+    return stats->opens + stats->getdents + stats->stats + stats->closes;
+}
@@ -0,0 +1,394 @@
+/**
+ * @file estimate.c
+ * @brief Implementation of --estimate
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "estimate.h"
+#include <fcntl.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Spread between files assumed for a type with a single sample, which
+ * says nothing about it: compressed/original ratio, and CPU cost relative
+ * to its mean */
+#define ESTIMATE_DEFAULT_RATIO_SD 0.25
+#define ESTIMATE_DEFAULT_CPU_SD   0.5
+
+typedef struct {
+    const FileListEntry_t *file;
+    const char *extension;
+    size_t      size;
+} EstimateFile_t;
+
+/* What the windows of one file measured */
+typedef struct {
+    double sampled;       /* Bytes compressed */
+    double ratio;         /* Compressed / original, mean of the windows */
+    double cpu_per_byte;
+    double io;            /* Seconds reading the windows */
+    double ratio_var;     /* Variance of ratio from the spread of the windows */
+    double cpu_var;       /* Same for CPU per byte */
+} FileSample_t;
+
+/* What the samples of one file type measured */
+typedef struct {
+    const char *extension;
+    int         files;
+    int         samples;
+    double      bytes;         /* All files of the type */
+    double      sampled;       /* Bytes compressed */
+    double      covered;       /* Full size of the sampled files */
+    double      ratio;         /* Compressed / original, by size */
+    double      cpu_per_byte;
+    double      io_per_byte;
+    double      ratio_dev;     /* Sum of w * (ratio_i - ratio)^2 */
+    double      cpu_dev;       /* Same for CPU per byte, relative to the mean */
+    double      ratio_within;  /* Variance of ratio left inside the sampled files */
+    double      cpu_within;    /* Same for CPU per byte, relative to the mean */
+} EstimateType_t;
+
+static double clock_seconds(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char *extension_of(const char *name) {
+    const char *dot = strrchr(name, '.');
+    return dot != NULL && dot != name ? dot + 1 : "";
+}
+
+static int compare_estimate_files(const void *a, const void *b) {
+    const EstimateFile_t *fa = a;
+    const EstimateFile_t *fb = b;
+
+    // Within a type, by size: ratio depends on it, and evenly spaced
+    // samples then cover small and large files alike
+    int order = strcmp(fa->extension, fb->extension);
+    if (order == 0 && fa->size != fb->size) {
+        order = fa->size < fb->size ? -1 : 1;
+    }
+    return order != 0 ? order : file_list_entry_compare(fa->file, fb->file);
+}
+
+/* Sample variance of the mean of n values, less the share already
+ * compressed out of the population they were drawn from */
+static double window_variance(const double *values, int n, double mean, double share) {
+    double deviation = 0;
+    if (n < 2 || share >= 1) {
+        return 0;
+    }
+    for (int k = 0; k < n; k++) {
+        deviation += (values[k] - mean) * (values[k] - mean);
+    }
+    return deviation / (n - 1) / n * (1 - share);
+}
+
+/* Compress ESTIMATE_WINDOWS windows spread evenly over one file, first and
+ * last included, so content that changes along the file is seen */
+static int sample_file(const EstimateFile_t *file, const ArchiveOptions_t *options,
+                       unsigned char *buffer, FileSample_t *sample) {
+    char path[MAX_PATH_LENGTH];
+    memset(sample, 0, sizeof(FileSample_t));
+    int fd = open(file_list_entry_path(file->file, path), O_RDONLY);
+    if (fd < 0) {
+        return ERROR_FILE_NOT_FOUND;
+    }
+
+    size_t window = file->size < ESTIMATE_SAMPLE_SIZE ? file->size : ESTIMATE_SAMPLE_SIZE;
+    int    windows = 0;
+    if (window > 0) {
+        size_t fit = (file->size + window - 1) / window;
+        windows = fit < ESTIMATE_WINDOWS ? (int)fit : ESTIMATE_WINDOWS;
+    }
+
+    double ratios[ESTIMATE_WINDOWS], cpus[ESTIMATE_WINDOWS];
+    bool   stored = false, poor = false;
+    int    measured = 0, status = SUCCESS;
+    for (int k = 0; k < windows && !stored; k++) {
+        off_t  offset = windows > 1 ? (off_t)((file->size - window) * k / (windows - 1)) : 0;
+        size_t size = 0;
+        double start = clock_seconds(CLOCK_MONOTONIC);
+        while (size < window) {
+            ssize_t n = pread(fd, buffer + size, window - size, offset + (off_t)size);
+            if (n <= 0) {
+                break;
+            }
+            size += (size_t)n;
+        }
+        sample->io += clock_seconds(CLOCK_MONOTONIC) - start;
+        if (size == 0) {
+            break;
+        }
+
+        // Only the start decides whether the whole file is stored up front;
+        // later windows are deflated through so their real ratio shows
+        CompressedEntry_t entry;
+        start = clock_seconds(CLOCK_THREAD_CPUTIME_ID);
+        status = options->codec->compress(buffer, size, options->compression_level,
+                                          options->store_fallback && offset == 0, &entry);
+        double cpu = clock_seconds(CLOCK_THREAD_CPUTIME_ID) - start;
+        if (status != SUCCESS) {
+            break;
+        }
+        stored = entry.store_fallback;
+        ratios[measured] = (double)entry.comp_size / (double)size;
+        cpus[measured] = cpu / (double)size;
+        poor = poor || ratios[measured] * 100 >= STORE_RATIO_PERCENT;
+        sample->sampled += (double)size;
+        measured++;
+        free_compressed_entry(&entry);
+    }
+    close(fd);
+    if (status != SUCCESS || measured == 0) {
+        return status;
+    }
+
+    for (int k = 0; k < measured; k++) {
+        sample->ratio += ratios[k] / measured;
+        sample->cpu_per_byte += cpus[k] / measured;
+    }
+    double share = sample->sampled / (double)file->size;
+    sample->ratio_var = window_variance(ratios, measured, sample->ratio, share);
+    sample->cpu_var = window_variance(cpus, measured, sample->cpu_per_byte, share);
+    if (stored) {
+        sample->ratio = 1;
+        sample->ratio_var = 0;
+    } else if (poor && options->store_fallback && options->compression_level > 0
+               && options->codec->method == ZIP_METHOD_DEFLATE
+               && file->size > STORE_SAMPLE_SIZE + STORE_BAILOUT_BLOCKS * COMPRESS_BLOCK_SIZE) {
+        // Deflate stores the file after STORE_BAILOUT_BLOCKS poor blocks in
+        // a row; whether a poor window is part of such a run is unknown, so
+        // either outcome is as likely
+        double spread = (1 - sample->ratio) / 2;
+        sample->ratio += spread;
+        sample->ratio_var = spread * spread;
+    }
+    return SUCCESS;
+}
+
+/* Sample up to ESTIMATE_FILES_PER_TYPE files spread evenly over a type's
+ * sizes, smallest and largest included. Each sample stands for its whole
+ * file, so the type's ratio and cost are means weighted by file size, and
+ * what the windows left unknown about a file counts by its weight. */
+static int sample_type(const EstimateFile_t *files, int count,
+                       const ArchiveOptions_t *options, unsigned char *buffer,
+                       EstimateType_t *type) {
+    int    samples = count < ESTIMATE_FILES_PER_TYPE ? count : ESTIMATE_FILES_PER_TYPE;
+    double ratios[ESTIMATE_FILES_PER_TYPE], cpus[ESTIMATE_FILES_PER_TYPE];
+    double weights[ESTIMATE_FILES_PER_TYPE];
+    double ratio_sum = 0, cpu_sum = 0, io_sum = 0, cpu_within = 0;
+
+    memset(type, 0, sizeof(EstimateType_t));
+    type->extension = files[0].extension;
+    type->files = count;
+    for (int i = 0; i < count; i++) {
+        type->bytes += (double)files[i].size;
+    }
+
+    for (int k = 0; k < samples; k++) {
+        const EstimateFile_t *file =
+            &files[samples > 1 ? (long)k * (count - 1) / (samples - 1) : count - 1];
+        FileSample_t sample;
+        int          status = sample_file(file, options, buffer, &sample);
+        if (status != SUCCESS) {
+            return status;
+        }
+        // Empty files compress to nothing and cost nothing
+        if (sample.sampled == 0) {
+            continue;
+        }
+        double weight = (double)file->size;
+        weights[type->samples] = weight;
+        ratios[type->samples] = sample.ratio;
+        cpus[type->samples] = sample.cpu_per_byte;
+        ratio_sum += weight * sample.ratio;
+        cpu_sum += weight * sample.cpu_per_byte;
+        io_sum += weight * sample.io / sample.sampled;
+        type->ratio_within += weight * weight * sample.ratio_var;
+        cpu_within += weight * weight * sample.cpu_var;
+        type->covered += weight;
+        type->sampled += sample.sampled;
+        type->samples++;
+    }
+
+    if (type->covered == 0) {
+        return SUCCESS;
+    }
+    type->ratio = ratio_sum / type->covered;
+    type->cpu_per_byte = cpu_sum / type->covered;
+    type->io_per_byte = io_sum / type->covered;
+    type->ratio_within /= type->covered * type->covered;
+    if (type->cpu_per_byte > 0) {
+        type->cpu_within = cpu_within / (type->covered * type->covered)
+                           / (type->cpu_per_byte * type->cpu_per_byte);
+    }
+    for (int k = 0; k < type->samples; k++) {
+        double ratio_error = ratios[k] - type->ratio;
+        double cpu_error = type->cpu_per_byte > 0
+                               ? (cpus[k] - type->cpu_per_byte) / type->cpu_per_byte
+                               : 0;
+        type->ratio_dev += weights[k] * ratio_error * ratio_error;
+        type->cpu_dev += weights[k] * cpu_error * cpu_error;
+    }
+    return SUCCESS;
+}
+
+/* Variance of a type's mean: the spread between its sampled files, for
+ * the share of its bytes in files that were not sampled, plus what the
+ * windows left unknown inside the sampled ones. One sample says nothing
+ * about the spread between files, so the default stands in for it. */
+static double mean_variance(double deviation, double default_variance, double within,
+                            const EstimateType_t *type) {
+    double between = type->samples >= 2
+                         ? deviation / type->covered * type->samples / (type->samples - 1)
+                         : default_variance;
+    double unsampled = type->bytes > 0 ? 1.0 - type->covered / type->bytes : 0;
+    return between / type->samples * (unsampled > 0 ? unsampled : 0) + within;
+}
+
+int estimate_archive(const FileList_t *file_list, const ArchiveOptions_t *options,
+                     ArchiveEstimate_t *estimate) {
+    if (file_list == NULL || options == NULL || estimate == NULL) {
+        return ERROR_INVALID_ARGS;
+    }
+    int file_count = file_list->count;
+    memset(estimate, 0, sizeof(ArchiveEstimate_t));
+    estimate->files = file_count;
+
+    EstimateFile_t *files = calloc(file_count > 0 ? (size_t)file_count : 1,
+                                   sizeof(EstimateFile_t));
+    EstimateType_t *types = calloc(file_count > 0 ? (size_t)file_count : 1,
+                                   sizeof(EstimateType_t));
+    unsigned char  *buffer = malloc(ESTIMATE_SAMPLE_SIZE);
+    if (files == NULL || types == NULL || buffer == NULL) {
+        free(files);
+        free(types);
+        free(buffer);
+        return ERROR_MEMORY_ALLOCATION;
+    }
+
+    double overhead = ZIP_END_RECORD_SIZE;
+    int    status = SUCCESS;
+    for (int i = 0; i < file_count; i++) {
+        FileMeta_t  meta;
+        const char *name = file_list->entries[i].name;
+        if (file_list_entry_stat(&file_list->entries[i], &meta) != SUCCESS) {
+            status = ERROR_FILE_NOT_FOUND;
+            break;
+        }
+        files[i].file = &file_list->entries[i];
+        files[i].extension = extension_of(name);
+        files[i].size = (size_t)meta.size;
+        estimate->input_bytes += (mz_uint64)meta.size;
+        overhead += ZIP_ENTRY_OVERHEAD + 2 * strlen(name);
+    }
+    if (status == SUCCESS) {
+        qsort(files, (size_t)file_count, sizeof(EstimateFile_t), compare_estimate_files);
+    }
+
+    // A codec's first call sets up its state; keep that out of the samples
+    CompressedEntry_t warmup;
+    memset(buffer, 'x', 4096);
+    if (status == SUCCESS
+        && options->codec->compress(buffer, 4096, options->compression_level, false,
+                                    &warmup)
+               == SUCCESS) {
+        free_compressed_entry(&warmup);
+    }
+
+    for (int start = 0, end; start < file_count && status == SUCCESS; start = end) {
+        for (end = start + 1;
+             end < file_count && strcmp(files[end].extension, files[start].extension) == 0;
+             end++) {
+        }
+        status = sample_type(&files[start], end - start, options, buffer,
+                             &types[estimate->types]);
+        estimate->sampled_files += types[estimate->types].samples;
+        estimate->sampled_bytes += (mz_uint64)types[estimate->types].sampled;
+        estimate->types++;
+    }
+    if (status != SUCCESS) {
+        free(files);
+        free(types);
+        free(buffer);
+        return status;
+    }
+
+    double ratio_variance = ESTIMATE_DEFAULT_RATIO_SD * ESTIMATE_DEFAULT_RATIO_SD;
+    double cpu_variance = ESTIMATE_DEFAULT_CPU_SD * ESTIMATE_DEFAULT_CPU_SD;
+    double size_variance = 0, cpu_seconds_variance = 0;
+    FILE  *log = archive_log_stream(options);
+    for (int t = 0; t < estimate->types; t++) {
+        const EstimateType_t *type = &types[t];
+        double                compressed = type->ratio * type->bytes;
+        double                cpu = type->cpu_per_byte * type->bytes;
+
+        estimate->size += compressed;
+        estimate->cpu_seconds += cpu;
+        estimate->io_seconds += type->io_per_byte * type->bytes;
+        if (type->covered > 0) {
+            size_variance += type->bytes * type->bytes
+                             * mean_variance(type->ratio_dev, ratio_variance,
+                                             type->ratio_within, type);
+            cpu_seconds_variance += cpu * cpu
+                                    * mean_variance(type->cpu_dev, cpu_variance,
+                                                    type->cpu_within, type);
+        }
+        if (options->verbose) {
+            fprintf(log, "  %s%s: %d files, %.0f bytes, %d sampled, ratio %.1f%%\n",
+                    type->extension[0] != '\0' ? "." : "",
+                    type->extension[0] != '\0' ? type->extension : "(no extension)",
+                    type->files, type->bytes, type->samples, 100.0 * type->ratio);
+        }
+    }
+
+    // Nothing grows past its original size when stores are allowed
+    double size_margin = ESTIMATE_Z * sqrt(size_variance);
+    double size_cap = options->store_fallback ? (double)estimate->input_bytes : INFINITY;
+    estimate->size_low = fmax(0, estimate->size - size_margin) + overhead;
+    estimate->size_high = fmin(size_cap, estimate->size + size_margin) + overhead;
+    estimate->size += overhead;
+
+    double cpu_margin = ESTIMATE_Z * sqrt(cpu_seconds_variance);
+    estimate->cpu_low = fmax(0, estimate->cpu_seconds - cpu_margin);
+    estimate->cpu_high = estimate->cpu_seconds + cpu_margin;
+
+    // Files are compressed one per worker; reading is not assumed to scale
+    int workers = options->jobs > 1 ? options->jobs : 1;
+    if (workers > thread_pool_cpu_count()) {
+        workers = thread_pool_cpu_count();
+    }
+    if (workers > file_count) {
+        workers = file_count > 0 ? file_count : 1;
+    }
+    estimate->workers = workers;
+    estimate->wall_seconds = estimate->io_seconds + estimate->cpu_seconds / workers;
+    estimate->wall_low = estimate->io_seconds + estimate->cpu_low / workers;
+    estimate->wall_high = estimate->io_seconds + estimate->cpu_high / workers;
+
+    free(files);
+    free(types);
+    free(buffer);
+    return SUCCESS;
+}
+
+void print_archive_estimate(FILE *out, const ArchiveEstimate_t *estimate,
+                            const ArchiveOptions_t *options) {
+    fprintf(out, "Estimate: %d files, %llu bytes in %d file types (%s level %d)\n",
+            estimate->files, (unsigned long long)estimate->input_bytes, estimate->types,
+            options->codec->name, options->compression_level);
+    fprintf(out, "Sampled %d files, %llu bytes\n", estimate->sampled_files,
+            (unsigned long long)estimate->sampled_bytes);
+    fprintf(out, "Archive size: %.0f bytes (%.0f - %.0f, 95%%)\n", estimate->size,
+            estimate->size_low, estimate->size_high);
+    fprintf(out, "CPU time:     %.2f s (%.2f - %.2f)\n", estimate->cpu_seconds,
+            estimate->cpu_low, estimate->cpu_high);
+    fprintf(out, "Wall time:    %.2f s (%.2f - %.2f) on %d worker%s, %.2f s of it reading\n",
+            estimate->wall_seconds, estimate->wall_low, estimate->wall_high,
+            estimate->workers, estimate->workers == 1 ? "" : "s", estimate->io_seconds);
+}
@@ -0,0 +1,106 @@
+/**
+ * @file file_input.c
+ * @brief Implementation of file input for the archiver
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "file_input.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Copy everything readable from fd into a heap buffer. st_size is only a
+ * hint since pipes and procfs files report 0 or a made-up size. */
+static int read_into_memory(int fd, size_t size_hint, FileInput_t *input) {
+    size_t         capacity = size_hint > 0 ? size_hint + 1 : FILE_INPUT_READ_SIZE;
+    size_t         length = 0;
+    unsigned char *buffer = malloc(capacity);
+    if (buffer == NULL) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+
+    for (;;) {
+        if (length == capacity) {
+            unsigned char *grown = realloc(buffer, capacity * 2);
+            if (grown == NULL) {
+                free(buffer);
+                return ERROR_MEMORY_ALLOCATION;
+            }
+            buffer = grown;
+            capacity *= 2;
+        }
+
+        ssize_t n = read(fd, buffer + length, capacity - length);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            free(buffer);
+            return ERROR_IO;
+        }
+        if (n == 0) {
+            break;
+        }
+        length += (size_t)n;
+    }
+
+    input->data = buffer;
+    input->size = length;
+    input->mapped = false;
+    return SUCCESS;
+}
+
+int open_file_input(const char *path, bool use_mmap, FileInput_t *input) {
+    if (path == NULL || input == NULL) {
+        return ERROR_INVALID_ARGS;
+    }
+    memset(input, 0, sizeof(FileInput_t));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return errno == ENOENT ? ERROR_FILE_NOT_FOUND : ERROR_IO;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return ERROR_IO;
+    }
+    input->modified = st.st_mtime;
+
+    // Only regular, non-empty files can be mapped; the mapping stays valid
+    // after the descriptor is closed
+    if (use_mmap && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+            close(fd);
+            input->data = map;
+            input->size = (size_t)st.st_size;
+            input->mapped = true;
+            return SUCCESS;
+        }
+    }
+
+    int status = read_into_memory(fd, S_ISREG(st.st_mode) ? (size_t)st.st_size : 0,
+                                  input);
+    close(fd);
+    return status;
+}
+
+void close_file_input(FileInput_t *input) {
+    if (input == NULL || input->data == NULL) {
+        return;
+    }
+
+    if (input->mapped) {
+        munmap((void *)input->data, input->size);
+    } else {
+        free((void *)input->data);
+    }
+    input->data = NULL;
+    input->size = 0;
+}
@@ -0,0 +1,398 @@
+/**
+ * @file file_list.c
+ * @brief Implementation of the interned file list
+ */
+
+#define _GNU_SOURCE
+
+#include "file_list.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+/* Entries allocated for the first file */
+#define FILE_LIST_MIN_ENTRIES 64
+
+/* Each arena block starts with a pointer to the block before it */
+typedef struct ArenaHeader {
+    struct ArenaHeader *previous;
+} ArenaHeader_t;
+
+static uint64_t hash_bytes(const char *bytes, size_t length) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)bytes[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/* Copy length bytes of text into the arena as a C string */
+static const char *arena_copy(FileListStore_t *store, const char *text, size_t length) {
+    if (store->chunk == NULL || store->chunk_size - store->chunk_used < length + 1) {
+        size_t size = FILE_LIST_ARENA_CHUNK;
+        if (size < sizeof(ArenaHeader_t) + length + 1) {
+            size = sizeof(ArenaHeader_t) + length + 1;
+        }
+        char *chunk = malloc(size);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        ((ArenaHeader_t *)chunk)->previous = (ArenaHeader_t *)store->chunk;
+        store->chunk = chunk;
+        store->chunk_used = sizeof(ArenaHeader_t);
+        store->chunk_size = size;
+        store->bytes += size;
+        store->allocations++;
+    }
+
+    char *copy = store->chunk + store->chunk_used;
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    store->chunk_used += length + 1;
+    return copy;
+}
+
+/* Slot holding dir (of length bytes), or the empty slot where it would go */
+static size_t dir_slot(const FileListStore_t *store, const char *dir, size_t length) {
+    size_t mask = store->dir_slots - 1;
+    size_t slot = (size_t)hash_bytes(dir, length) & mask;
+    while (store->dirs[slot] != NULL
+           && (strncmp(store->dirs[slot], dir, length) != 0
+               || store->dirs[slot][length] != '\0')) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+static int grow_dirs(FileListStore_t *store) {
+    size_t       slots = store->dir_slots * 2;
+    const char **dirs = calloc(slots, sizeof(char *));
+    if (dirs == NULL) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+
+    const char **old = store->dirs;
+    size_t       old_slots = store->dir_slots;
+    store->dirs = dirs;
+    store->dir_slots = slots;
+    for (size_t i = 0; i < old_slots; i++) {
+        if (old[i] != NULL) {
+            store->dirs[dir_slot(store, old[i], strlen(old[i]))] = old[i];
+        }
+    }
+    free(old);
+    store->bytes += (slots - old_slots) * sizeof(char *);
+    store->allocations++;
+    return SUCCESS;
+}
+
+/* The interned copy of dir, added if insert is set; NULL if absent */
+static const char *intern_dir(FileListStore_t *store, const char *dir, size_t length,
+                              bool insert) {
+    if (length == 0) {
+        return "";
+    }
+    // Files come a directory at a time, so this is usually the last one
+    if (store->last_dir != NULL && store->last_dir_length == length
+        && memcmp(store->last_dir, dir, length) == 0) {
+        return store->last_dir;
+    }
+    size_t slot = dir_slot(store, dir, length);
+    if (store->dirs[slot] != NULL || !insert) {
+        if (store->dirs[slot] != NULL) {
+            store->last_dir = store->dirs[slot];
+            store->last_dir_length = length;
+        }
+        return store->dirs[slot];
+    }
+
+    // Keep the table at most half full
+    if (2 * (store->dir_count + 1) > store->dir_slots) {
+        if (grow_dirs(store) != SUCCESS) {
+            return NULL;
+        }
+        slot = dir_slot(store, dir, length);
+    }
+    store->dirs[slot] = arena_copy(store, dir, length);
+    if (store->dirs[slot] != NULL) {
+        store->dir_count++;
+        store->last_dir = store->dirs[slot];
+        store->last_dir_length = length;
+    }
+    return store->dirs[slot];
+}
+
+int file_list_init(FileList_t *list) {
+    memset(list, 0, sizeof(FileList_t));
+
+    FileListStore_t *store = calloc(1, sizeof(FileListStore_t));
+    if (store == NULL) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    store->dirs = calloc(FILE_LIST_DIR_SLOTS, sizeof(char *));
+    if (store->dirs == NULL) {
+        free(store);
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    store->dir_slots = FILE_LIST_DIR_SLOTS;
+    store->bytes = sizeof(FileListStore_t) + FILE_LIST_DIR_SLOTS * sizeof(char *);
+    store->allocations = 2;
+    store->users = 1;
+    list->store = store;
+    return SUCCESS;
+}
+
+void file_list_init_subset(FileList_t *subset, const FileList_t *list) {
+    memset(subset, 0, sizeof(FileList_t));
+    subset->store = list->store;
+    subset->store->users++;
+}
+
+/* Hash of an entry; directories are interned, so their address will do */
+static uint64_t entry_hash(const char *dir, const char *name) {
+    uint64_t hash = hash_bytes(name, strlen(name));
+    return hash ^ ((uint64_t)(uintptr_t)dir * 0x9E3779B97F4A7C15ULL);
+}
+
+/* Slot holding the entry (dir, name), or the empty slot where it would go */
+static size_t entry_slot(const FileList_t *list, const char *dir, const char *name) {
+    size_t mask = list->slot_count - 1;
+    size_t slot = (size_t)entry_hash(dir, name) & mask;
+    while (list->slots[slot] != 0) {
+        const FileListEntry_t *entry = &list->entries[list->slots[slot] - 1];
+        if (entry->dir == dir && strcmp(entry->name, name) == 0) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/* Double the entry index (or create it) and re-insert every entry */
+static int grow_slots(FileList_t *list) {
+    size_t slots = list->slot_count > 0 ? list->slot_count * 2 : FILE_LIST_ENTRY_SLOTS;
+    int   *table = calloc(slots, sizeof(int));
+    if (table == NULL) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+
+    free(list->slots);
+    list->store->bytes += (slots - list->slot_count) * sizeof(int);
+    list->store->allocations++;
+    list->slots = table;
+    list->slot_count = slots;
+    for (int i = 0; i < list->count; i++) {
+        list->slots[entry_slot(list, list->entries[i].dir, list->entries[i].name)] = i + 1;
+    }
+    return SUCCESS;
+}
+
+/* Make room for one more entry in the index, keeping it at most half full */
+static int reserve_slot(FileList_t *list) {
+    if (2 * ((size_t)list->count + 1) > list->slot_count) {
+        return grow_slots(list);
+    }
+    return SUCCESS;
+}
+
+/* Append an entry not in the list yet; slot is its empty index slot */
+static int push_entry(FileList_t *list, const FileListEntry_t *entry, size_t slot) {
+    if (list->count == list->capacity) {
+        int capacity = list->capacity > 0 ? list->capacity * 2 : FILE_LIST_MIN_ENTRIES;
+        FileListEntry_t *entries = realloc(list->entries,
+                                           (size_t)capacity * sizeof(FileListEntry_t));
+        if (entries == NULL) {
+            return ERROR_MEMORY_ALLOCATION;
+        }
+        list->store->bytes += (size_t)(capacity - list->capacity) * sizeof(FileListEntry_t);
+        list->store->allocations++;
+        list->entries = entries;
+        list->capacity = capacity;
+    }
+    list->entries[list->count++] = *entry;
+    list->slots[slot] = list->count;
+    return SUCCESS;
+}
+
+int file_list_append(FileList_t *list, const FileListEntry_t *entry) {
+    if (reserve_slot(list) != SUCCESS) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    size_t slot = entry_slot(list, entry->dir, entry->name);
+    if (list->slots[slot] != 0) {
+        return SUCCESS; // already in the list
+    }
+    return push_entry(list, entry, slot);
+}
+
+int file_list_add(FileList_t *list, const char *path) {
+    return file_list_add_meta(list, path, NULL);
+}
+
+/* Copy path with each run of slashes collapsed to one and no trailing
+ * slash, so base/dir//x (a walk from a dir/ entry) and base/dir/x are the
+ * same entry; returns the length, 0 if it does not fit */
+static size_t normalize_path(const char *path, char *buffer) {
+    size_t length = 0;
+    for (const char *p = path; *p != '\0'; p++) {
+        if (*p == '/' && length > 0 && buffer[length - 1] == '/') {
+            continue;
+        }
+        if (length + 1 >= MAX_PATH_LENGTH) {
+            return 0;
+        }
+        buffer[length++] = *p;
+    }
+    if (length > 1 && buffer[length - 1] == '/') {
+        length--;
+    }
+    buffer[length] = '\0';
+    return length;
+}
+
+int file_list_add_meta(FileList_t *list, const char *path, const FileMeta_t *meta) {
+    char   normalized[MAX_PATH_LENGTH];
+    size_t length = normalize_path(path, normalized);
+    if (length == 0) {
+        return ERROR_INVALID_ARGS;
+    }
+    path = normalized;
+
+    const char     *slash = strrchr(path, '/');
+    size_t          dir_length = slash != NULL ? (size_t)(slash - path) + 1 : 0;
+    FileListEntry_t entry;
+    memset(&entry, 0, sizeof(FileListEntry_t));
+    entry.dir = intern_dir(list->store, path, dir_length, true);
+    if (entry.dir == NULL || reserve_slot(list) != SUCCESS) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+
+    // Look the name up before copying it, so duplicates cost nothing
+    size_t slot = entry_slot(list, entry.dir, path + dir_length);
+    if (list->slots[slot] != 0) {
+        FileListEntry_t *found = &list->entries[list->slots[slot] - 1];
+        if (meta != NULL && found->meta.mode == 0) {
+            found->meta = *meta;
+        }
+        return SUCCESS; // already in the list
+    }
+    if (meta != NULL) {
+        entry.meta = *meta;
+    }
+    entry.name = arena_copy(list->store, path + dir_length, length - dir_length);
+    if (entry.name == NULL) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    return push_entry(list, &entry, slot);
+}
+
+int file_list_find(const FileList_t *list, const char *path) {
+    char normalized[MAX_PATH_LENGTH];
+    if (normalize_path(path, normalized) == 0) {
+        return -1;
+    }
+    path = normalized;
+    const char *slash = strrchr(path, '/');
+    size_t      dir_length = slash != NULL ? (size_t)(slash - path) + 1 : 0;
+    const char *dir = intern_dir(list->store, path, dir_length, false);
+    if (dir == NULL || list->slot_count == 0) {
+        return -1;
+    }
+    return list->slots[entry_slot(list, dir, path + dir_length)] - 1;
+}
+
+const char *file_list_entry_path(const FileListEntry_t *entry, char *buffer) {
+    // file_list_add() only takes paths that fit
+    size_t dir_length = strlen(entry->dir);
+    memcpy(buffer, entry->dir, dir_length);
+    strcpy(buffer + dir_length, entry->name);
+    return buffer;
+}
+
+const char *file_list_path(const FileList_t *list, int index, char *buffer) {
+    return file_list_entry_path(&list->entries[index], buffer);
+}
+
+int file_meta_read(int dir_fd, const char *path, FileMeta_t *meta) {
+    memset(meta, 0, sizeof(FileMeta_t));
+#ifdef STATX_BASIC_STATS
+    struct statx stx;
+    if (statx(dir_fd, path, AT_STATX_SYNC_AS_STAT,
+              STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME | STATX_INO, &stx) == 0) {
+        meta->size = (long long)stx.stx_size;
+        meta->mtime = (long long)stx.stx_mtime.tv_sec;
+        meta->mode = stx.stx_mode;
+        meta->dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+        meta->ino = stx.stx_ino;
+        return SUCCESS;
+    }
+    if (errno != ENOSYS) {
+        return ERROR_FILE_NOT_FOUND;
+    }
+#endif
+    // Kernels before 4.11
+    struct stat st;
+    if (fstatat(dir_fd, path, &st, 0) != 0) {
+        return ERROR_FILE_NOT_FOUND;
+    }
+    meta->size = (long long)st.st_size;
+    meta->mtime = (long long)st.st_mtime;
+    meta->mode = st.st_mode;
+    meta->dev = st.st_dev;
+    meta->ino = st.st_ino;
+    return SUCCESS;
+}
+
+int file_list_entry_stat(const FileListEntry_t *entry, FileMeta_t *meta) {
+    if (entry->meta.mode != 0) {
+        *meta = entry->meta;
+        return SUCCESS;
+    }
+    char path[MAX_PATH_LENGTH];
+    return file_meta_read(AT_FDCWD, file_list_entry_path(entry, path), meta);
+}
+
+/* Next character of an entry's full path, walking the directory and then
+ * the name; '\0' at the end */
+static char next_path_char(const FileListEntry_t *entry, size_t *position,
+                           bool *in_name) {
+    const char *part = *in_name ? entry->name : entry->dir;
+    if (!*in_name && part[*position] == '\0') {
+        *in_name = true;
+        *position = 0;
+        part = entry->name;
+    }
+    return part[*position] == '\0' ? '\0' : part[(*position)++];
+}
+
+int file_list_entry_compare(const FileListEntry_t *a, const FileListEntry_t *b) {
+    size_t pa = 0, pb = 0;
+    bool   na = false, nb = false;
+    for (;;) {
+        unsigned char ca = (unsigned char)next_path_char(a, &pa, &na);
+        unsigned char cb = (unsigned char)next_path_char(b, &pb, &nb);
+        if (ca != cb || ca == '\0') {
+            return (int)ca - (int)cb;
+        }
+    }
+}
+
+void file_list_free(FileList_t *list) {
+    FileListStore_t *store = list->store;
+    if (store != NULL && --store->users == 0) {
+        ArenaHeader_t *chunk = (ArenaHeader_t *)store->chunk;
+        while (chunk != NULL) {
+            ArenaHeader_t *previous = chunk->previous;
+            free(chunk);
+            chunk = previous;
+        }
+        free(store->dirs);
+        free(store);
+    }
+    free(list->entries);
+    free(list->slots);
+    memset(list, 0, sizeof(FileList_t));
+}
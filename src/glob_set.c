@@ -0,0 +1,516 @@
+/**
+ * @file glob_set.c
+ * @brief Implementation of single-walk multi-pattern globbing
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "glob_set.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Segment kinds, in the order children are kept */
+#define GLOB_LITERAL  0
+#define GLOB_WILDCARD 1
+#define GLOB_ANY_DIRS 2
+
+/* Bytes of directory entries fetched per getdents64() call */
+#define GLOB_SET_BUFFER_SIZE (64 * 1024)
+
+/* Record layout getdents64() fills the buffer with */
+typedef struct {
+    uint64_t       d_ino;
+    int64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+} LinuxDirent64_t;
+
+int glob_set_init(GlobSet_t *set) {
+    memset(set, 0, sizeof(*set));
+    set->nodes = calloc(16, sizeof(GlobNode_t));
+    if (set->nodes == NULL) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    set->node_capacity = 16;
+    set->node_count = 1; // The base directory
+    return SUCCESS;
+}
+
+bool glob_set_supports(const char *base_dir, const char *pattern) {
+    size_t base_length = strlen(base_dir);
+    size_t length = strlen(pattern);
+    // glob() would treat wildcards in the base directory as a pattern too,
+    // and keeps doubled slashes and escapes in the paths it returns
+    return base_length > 0 && base_dir[base_length - 1] != '/'
+           && strpbrk(base_dir, "*?[\\") == NULL && length > 0 && pattern[0] != '/'
+           && pattern[length - 1] != '/' && strstr(pattern, "//") == NULL
+           && strchr(pattern, '\\') == NULL;
+}
+
+static int push_int(int **items, int *count, int *capacity, int value) {
+    if (*count == *capacity) {
+        int  grown = *capacity > 0 ? *capacity * 2 : 4;
+        int *resized = realloc(*items, (size_t)grown * sizeof(int));
+        if (resized == NULL) {
+            return ERROR_MEMORY_ALLOCATION;
+        }
+        *items = resized;
+        *capacity = grown;
+    }
+    (*items)[(*count)++] = value;
+    return SUCCESS;
+}
+
+/* Length of the literal text every name matching segment ends with: what
+ * follows the last *, ? or closing bracket */
+static size_t literal_suffix(const char *segment) {
+    size_t length = strlen(segment);
+    size_t suffix = 0;
+    while (suffix < length && strchr("*?]", segment[length - 1 - suffix]) == NULL) {
+        suffix++;
+    }
+    return suffix;
+}
+
+/* Child of parent for a segment, created if the set has none yet */
+static int child_node(GlobSet_t *set, int parent, const char *segment, size_t length,
+                      int *child) {
+    unsigned char kind = GLOB_LITERAL;
+    if (length == 2 && memcmp(segment, GLOB_SET_ANY_DIRS, 2) == 0) {
+        kind = GLOB_ANY_DIRS;
+    } else if (memchr(segment, '*', length) != NULL || memchr(segment, '?', length) != NULL
+               || memchr(segment, '[', length) != NULL) {
+        kind = GLOB_WILDCARD;
+    }
+
+    GlobNode_t *node = &set->nodes[parent];
+    int         position = node->child_count;
+    for (int i = 0; i < node->child_count; i++) {
+        GlobNode_t *existing = &set->nodes[node->children[i]];
+        int         order = (int)existing->kind - (int)kind;
+        if (order == 0) {
+            order = strncmp(existing->segment, segment, length);
+            if (order == 0 && existing->segment[length] == '\0') {
+                *child = node->children[i];
+                return SUCCESS;
+            }
+            order = order != 0 ? order : 1; // segment is a prefix of existing
+        }
+        // Literals stay sorted for the binary search; the rest in any order
+        if (order > 0 && kind == GLOB_LITERAL && position == node->child_count) {
+            position = i;
+        }
+    }
+
+    if (set->node_count == set->node_capacity) {
+        int         capacity = set->node_capacity * 2;
+        GlobNode_t *nodes = realloc(set->nodes, (size_t)capacity * sizeof(GlobNode_t));
+        if (nodes == NULL) {
+            return ERROR_MEMORY_ALLOCATION;
+        }
+        set->nodes = nodes;
+        set->node_capacity = capacity;
+    }
+    GlobNode_t *created = &set->nodes[set->node_count];
+    memset(created, 0, sizeof(*created));
+    created->segment = malloc(length + 1);
+    if (created->segment == NULL) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    memcpy(created->segment, segment, length);
+    created->segment[length] = '\0';
+    created->kind = kind;
+    created->suffix_length = kind == GLOB_WILDCARD ? literal_suffix(created->segment) : 0;
+
+    node = &set->nodes[parent];
+    if (push_int(&node->children, &node->child_count, &node->child_capacity, 0) != SUCCESS) {
+        free(created->segment);
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    memmove(node->children + position + 1, node->children + position,
+            (size_t)(node->child_count - 1 - position) * sizeof(int));
+    node->children[position] = set->node_count;
+    node->literal_count += kind == GLOB_LITERAL;
+    *child = set->node_count++;
+    return SUCCESS;
+}
+
+int glob_set_add(GlobSet_t *set, const char *pattern, int *index) {
+    int node = 0;
+    for (const char *segment = pattern; *segment != '\0';) {
+        const char *end = strchr(segment, '/');
+        size_t      length = end != NULL ? (size_t)(end - segment) : strlen(segment);
+        int         status = child_node(set, node, segment, length, &node);
+        if (status != SUCCESS) {
+            return status;
+        }
+        segment += length + (end != NULL);
+    }
+    GlobNode_t *last = &set->nodes[node];
+    if (push_int(&last->patterns, &last->pattern_count, &last->pattern_capacity,
+                 set->pattern_count)
+        != SUCCESS) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    *index = set->pattern_count++;
+    return SUCCESS;
+}
+
+/* What is known about the entry being matched, filled in as needed */
+typedef struct {
+    int           dir_fd;
+    const char   *name;
+    unsigned char type;      /* d_type */
+    bool          meta_read; /* file_meta_read() was tried */
+    bool          found;     /* and succeeded */
+    FileMeta_t    meta;
+    bool          stored;    /* Path copied to the set's paths */
+    size_t        offset;
+} GlobEntry_t;
+
+/* State of one glob_set_match() */
+typedef struct {
+    GlobSet_t *set;
+    char       path[MAX_PATH_LENGTH]; /* Directory below the base, then /name */
+    size_t     base_length;           /* Length of the base directory path */
+    char     **buffers;               /* One getdents64() buffer per depth */
+    int        depth_count;
+    unsigned  *seen;                  /* Generation a node was last queued in */
+    unsigned   generation;
+} GlobWalk_t;
+
+/* getdents64() buffer for a depth, kept for the rest of the walk */
+static char *depth_buffer(GlobWalk_t *walk, int depth) {
+    if (depth >= walk->depth_count) {
+        int    count = depth + 8;
+        char **buffers = realloc(walk->buffers, (size_t)count * sizeof(char *));
+        if (buffers == NULL) {
+            return NULL;
+        }
+        for (int i = walk->depth_count; i < count; i++) {
+            buffers[i] = NULL;
+        }
+        walk->buffers = buffers;
+        walk->depth_count = count;
+    }
+    if (walk->buffers[depth] == NULL) {
+        walk->buffers[depth] = malloc(GLOB_SET_BUFFER_SIZE);
+    }
+    return walk->buffers[depth];
+}
+
+static void read_entry_meta(GlobEntry_t *entry) {
+    if (!entry->meta_read) {
+        entry->meta_read = true;
+        entry->found = file_meta_read(entry->dir_fd, entry->name, &entry->meta) == SUCCESS;
+    }
+}
+
+/* A directory, following links as glob() does for the segments it descends */
+static bool entry_is_directory(GlobEntry_t *entry) {
+    if (entry->type == DT_DIR) {
+        return true;
+    }
+    if (entry->type != DT_LNK && entry->type != DT_UNKNOWN) {
+        return false;
+    }
+    read_entry_meta(entry);
+    return entry->found && S_ISDIR(entry->meta.mode);
+}
+
+/* A directory and not a link to one: what ** descends into */
+static bool entry_is_real_directory(const GlobEntry_t *entry) {
+    struct stat st;
+    if (entry->type != DT_UNKNOWN) {
+        return entry->type == DT_DIR;
+    }
+    return fstatat(entry->dir_fd, entry->name, &st, AT_SYMLINK_NOFOLLOW) == 0
+           && S_ISDIR(st.st_mode);
+}
+
+/* Record the entry (whose path is walk->path[0..length)) as a match of
+ * every pattern ending at node */
+static int record_matches(GlobWalk_t *walk, const GlobNode_t *node, GlobEntry_t *entry,
+                          size_t length) {
+    GlobSet_t *set = walk->set;
+    if (node->pattern_count == 0) {
+        return SUCCESS;
+    }
+    if (!entry->stored) {
+        if (set->paths_size + length + 1 > set->paths_capacity) {
+            size_t capacity = set->paths_capacity > 0 ? set->paths_capacity : 4096;
+            while (capacity < set->paths_size + length + 1) {
+                capacity *= 2;
+            }
+            char *paths = realloc(set->paths, capacity);
+            if (paths == NULL) {
+                return ERROR_MEMORY_ALLOCATION;
+            }
+            set->paths = paths;
+            set->paths_capacity = capacity;
+        }
+        memcpy(set->paths + set->paths_size, walk->path, length);
+        set->paths[set->paths_size + length] = '\0';
+        entry->offset = set->paths_size;
+        entry->stored = true;
+        set->paths_size += length + 1;
+        read_entry_meta(entry);
+    }
+    for (int i = 0; i < node->pattern_count; i++) {
+        if (set->match_count == set->match_capacity) {
+            int          capacity = set->match_capacity > 0 ? set->match_capacity * 2 : 64;
+            GlobMatch_t *matches = realloc(set->matches, (size_t)capacity * sizeof(GlobMatch_t));
+            if (matches == NULL) {
+                return ERROR_MEMORY_ALLOCATION;
+            }
+            set->matches = matches;
+            set->match_capacity = capacity;
+        }
+        GlobMatch_t *match = &set->matches[set->match_count++];
+        match->pattern = node->patterns[i];
+        match->offset = entry->offset;
+        match->path = NULL;
+        match->meta = entry->meta;
+        match->found = entry->found;
+    }
+    return SUCCESS;
+}
+
+/* Queue a node for the directory being entered, with the ** segments that
+ * follow it (they may match zero directories) */
+static void queue_node(GlobWalk_t *walk, int *next, int *count, int node) {
+    int start = *count;
+    if (walk->seen[node] == walk->generation) {
+        return;
+    }
+    walk->seen[node] = walk->generation;
+    next[(*count)++] = node;
+    for (int i = start; i < *count; i++) {
+        const GlobNode_t *queued = &walk->set->nodes[next[i]];
+        for (int c = queued->literal_count; c < queued->child_count; c++) {
+            int child = queued->children[c];
+            if (walk->set->nodes[child].kind == GLOB_ANY_DIRS
+                && walk->seen[child] != walk->generation) {
+                walk->seen[child] = walk->generation;
+                next[(*count)++] = child;
+            }
+        }
+    }
+}
+
+/* Literal child of node named name, or -1 */
+static int literal_child(const GlobSet_t *set, const GlobNode_t *node, const char *name) {
+    int low = 0;
+    int high = node->literal_count - 1;
+    while (low <= high) {
+        int middle = (low + high) / 2;
+        int order = strcmp(set->nodes[node->children[middle]].segment, name);
+        if (order == 0) {
+            return node->children[middle];
+        }
+        if (order < 0) {
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return -1;
+}
+
+/* A segment matched the entry: record it, and queue the segment for the
+ * walk below the entry if the pattern goes on */
+static int matched_segment(GlobWalk_t *walk, int node, GlobEntry_t *entry, size_t length,
+                           int *next, int *count) {
+    const GlobNode_t *matched = &walk->set->nodes[node];
+    int               status = record_matches(walk, matched, entry, length);
+    if (status == SUCCESS && matched->child_count > 0 && entry_is_directory(entry)) {
+        queue_node(walk, next, count, node);
+    }
+    return status;
+}
+
+/* Match the entries of the open directory dir_fd, whose path below the base
+ * is walk->path[0..length), against the segments that follow the active
+ * nodes */
+static int match_directory(GlobWalk_t *walk, int dir_fd, size_t length, const int *active,
+                           int active_count, int depth) {
+    GlobSet_t *set = walk->set;
+    char      *buffer = depth_buffer(walk, depth);
+    int       *next = malloc((size_t)set->node_count * sizeof(int));
+    if (buffer == NULL || next == NULL) {
+        free(next);
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    set->directories++;
+
+    int status = SUCCESS;
+    for (;;) {
+        long got = syscall(SYS_getdents64, dir_fd, buffer, GLOB_SET_BUFFER_SIZE);
+        if (got <= 0) {
+            break; // An unreadable directory matches nothing, as with glob()
+        }
+        for (long offset = 0; offset < got && status == SUCCESS;) {
+            LinuxDirent64_t *dirent = (LinuxDirent64_t *)(buffer + offset);
+            offset += dirent->d_reclen;
+
+            // . and .. are offered to the segments too: glob() matches .* to them
+            size_t name_length = strlen(dirent->d_name);
+            size_t child_length = length + (length > 0) + name_length;
+            if (walk->base_length + 1 + child_length >= MAX_PATH_LENGTH) {
+                continue;
+            }
+            set->entries++;
+            if (length > 0) {
+                walk->path[length] = '/';
+            }
+            memcpy(walk->path + child_length - name_length, dirent->d_name, name_length + 1);
+
+            GlobEntry_t entry = {dir_fd, dirent->d_name, dirent->d_type, false, false,
+                                 {0},    false,          0};
+            int         next_count = 0;
+            walk->generation++;
+            for (int a = 0; a < active_count && status == SUCCESS; a++) {
+                const GlobNode_t *node = &set->nodes[active[a]];
+                if (node->kind == GLOB_ANY_DIRS && dirent->d_name[0] != '.') {
+                    status = record_matches(walk, node, &entry, child_length);
+                    if (status == SUCCESS && entry_is_real_directory(&entry)) {
+                        queue_node(walk, next, &next_count, active[a]);
+                    }
+                }
+                int literal = literal_child(set, node, dirent->d_name);
+                if (literal >= 0 && status == SUCCESS) {
+                    status = matched_segment(walk, literal, &entry, child_length, next,
+                                             &next_count);
+                }
+                for (int c = node->literal_count; c < node->child_count && status == SUCCESS;
+                     c++) {
+                    const GlobNode_t *child = &set->nodes[node->children[c]];
+                    if (child->kind != GLOB_WILDCARD || child->suffix_length > name_length
+                        || memcmp(dirent->d_name + name_length - child->suffix_length,
+                                  child->segment + strlen(child->segment)
+                                      - child->suffix_length,
+                                  child->suffix_length) != 0
+                        || fnmatch(child->segment, dirent->d_name, FNM_PERIOD) != 0) {
+                        continue;
+                    }
+                    status = matched_segment(walk, node->children[c], &entry, child_length,
+                                             next, &next_count);
+                }
+            }
+            if (status != SUCCESS || next_count == 0) {
+                continue;
+            }
+
+            int child = openat(dir_fd, dirent->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (child >= 0) {
+                status = match_directory(walk, child, child_length, next, next_count,
+                                         depth + 1);
+                close(child);
+            }
+        }
+        if (status != SUCCESS) {
+            break;
+        }
+    }
+    free(next);
+    return status;
+}
+
+static int compare_matches(const void *a, const void *b) {
+    const GlobMatch_t *left = a;
+    const GlobMatch_t *right = b;
+    if (left->pattern != right->pattern) {
+        return left->pattern < right->pattern ? -1 : 1;
+    }
+    return strcmp(left->path, right->path);
+}
+
+int glob_set_match(GlobSet_t *set, const char *base_dir) {
+    GlobWalk_t walk = {0};
+    walk.set = set;
+    walk.base_length = strlen(base_dir);
+    walk.seen = calloc((size_t)set->node_count, sizeof(unsigned));
+    int *active = malloc((size_t)set->node_count * sizeof(int));
+    set->first_match = calloc((size_t)set->pattern_count + 1, sizeof(int));
+    if (walk.seen == NULL || active == NULL || set->first_match == NULL) {
+        free(walk.seen);
+        free(active);
+        return ERROR_MEMORY_ALLOCATION;
+    }
+
+    int status = SUCCESS;
+    int dir_fd = open(base_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0) {
+        int active_count = 0;
+        walk.generation++;
+        queue_node(&walk, active, &active_count, 0);
+        status = match_directory(&walk, dir_fd, 0, active, active_count, 0);
+        close(dir_fd);
+    }
+    for (int i = 0; i < walk.depth_count; i++) {
+        free(walk.buffers[i]);
+    }
+    free(walk.buffers);
+    free(walk.seen);
+    free(active);
+    if (status != SUCCESS) {
+        return status;
+    }
+
+    // Each pattern's matches in strcmp() order, a path matched along two
+    // routes (a/**/**/b) kept once
+    for (int i = 0; i < set->match_count; i++) {
+        set->matches[i].path = set->paths + set->matches[i].offset;
+    }
+    if (set->match_count > 1) {
+        qsort(set->matches, (size_t)set->match_count, sizeof(GlobMatch_t), compare_matches);
+    }
+    int kept = 0;
+    for (int i = 0; i < set->match_count; i++) {
+        if (kept > 0 && compare_matches(&set->matches[kept - 1], &set->matches[i]) == 0) {
+            continue;
+        }
+        set->matches[kept++] = set->matches[i];
+    }
+    set->match_count = kept;
+    for (int i = 0; i < kept; i++) {
+        set->first_match[set->matches[i].pattern + 1]++;
+    }
+    for (int p = 0; p < set->pattern_count; p++) {
+        set->first_match[p + 1] += set->first_match[p];
+    }
+    return SUCCESS;
+}
+
+int glob_set_add_matches(const GlobSet_t *set, int index, const char *base_dir,
+                         FileList_t *file_list) {
+    char path[MAX_PATH_LENGTH];
+    for (int i = set->first_match[index]; i < set->first_match[index + 1]; i++) {
+        const GlobMatch_t *match = &set->matches[i];
+        snprintf(path, sizeof(path), "%s/%s", base_dir, match->path);
+        if (file_list_add_meta(file_list, path, match->found ? &match->meta : NULL)
+            != SUCCESS) {
+            return ERROR_IO;
+        }
+    }
+    return SUCCESS;
+}
+
+void glob_set_free(GlobSet_t *set) {
+    for (int i = 0; i < set->node_count; i++) {
+        free(set->nodes[i].segment);
+        free(set->nodes[i].children);
+        free(set->nodes[i].patterns);
+    }
+    free(set->nodes);
+    free(set->matches);
+    free(set->first_match);
+    free(set->paths);
+    memset(set, 0, sizeof(*set));
+}
@@ -0,0 +1,239 @@
+/**
+ * @file manifest.c
+ * @brief Implementation of compiled .LT_FILES manifests
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "manifest.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MANIFEST_HEADER_SIZE (4 + 4 + MANIFEST_KEY_SIZE + 4 + 4)
+#define MANIFEST_ENTRY_SIZE  8
+
+static void put_le32(unsigned char *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (unsigned char)(v >> (i * 8));
+    }
+}
+
+static uint32_t get_le32(const unsigned char *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16
+           | (uint32_t)p[3] << 24;
+}
+
+void manifest_key(const void *text, size_t size, unsigned char key[MANIFEST_KEY_SIZE]) {
+    Sha256_t ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, text, size);
+    sha256_final(&ctx, key);
+}
+
+void manifest_init(Manifest_t *manifest) {
+    memset(manifest, 0, sizeof(*manifest));
+}
+
+int manifest_add(Manifest_t *manifest, int section, unsigned flags, const char *path) {
+    size_t length = strlen(path) + 1;
+    if (manifest->strings_size + length > UINT32_MAX || manifest->count == INT32_MAX) {
+        return ERROR_INVALID_ARGS;
+    }
+    if (manifest->count == manifest->capacity) {
+        int              capacity = manifest->capacity > 0 ? manifest->capacity * 2 : 16;
+        ManifestEntry_t *entries =
+            realloc(manifest->entries, (size_t)capacity * sizeof(*entries));
+        if (entries == NULL) {
+            return ERROR_MEMORY_ALLOCATION;
+        }
+        manifest->entries = entries;
+        manifest->capacity = capacity;
+    }
+    if (manifest->strings_size + length > manifest->strings_capacity) {
+        size_t capacity = manifest->strings_capacity > 0 ? manifest->strings_capacity : 256;
+        while (capacity < manifest->strings_size + length) {
+            capacity *= 2;
+        }
+        char *strings = realloc(manifest->strings, capacity);
+        if (strings == NULL) {
+            return ERROR_MEMORY_ALLOCATION;
+        }
+        manifest->strings = strings;
+        manifest->strings_capacity = capacity;
+    }
+
+    ManifestEntry_t *entry = &manifest->entries[manifest->count++];
+    entry->section = (unsigned char)section;
+    entry->flags = (unsigned char)flags;
+    entry->offset = (uint32_t)manifest->strings_size;
+    memcpy(manifest->strings + manifest->strings_size, path, length);
+    manifest->strings_size += length;
+    return SUCCESS;
+}
+
+const char *manifest_entry_path(const Manifest_t *manifest, int index) {
+    return manifest->strings + manifest->entries[index].offset;
+}
+
+int manifest_save(const Manifest_t *manifest, const char *path) {
+    size_t         size = MANIFEST_HEADER_SIZE + (size_t)manifest->count * MANIFEST_ENTRY_SIZE
+                  + manifest->strings_size;
+    unsigned char *data = calloc(1, size);
+    if (data == NULL) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+
+    unsigned char *p = data;
+    memcpy(p, MANIFEST_MAGIC, 4);
+    put_le32(p + 4, MANIFEST_VERSION);
+    memcpy(p + 8, manifest->key, MANIFEST_KEY_SIZE);
+    put_le32(p + 8 + MANIFEST_KEY_SIZE, (uint32_t)manifest->count);
+    put_le32(p + 12 + MANIFEST_KEY_SIZE, (uint32_t)manifest->strings_size);
+    p += MANIFEST_HEADER_SIZE;
+    for (int i = 0; i < manifest->count; i++, p += MANIFEST_ENTRY_SIZE) {
+        p[0] = manifest->entries[i].section;
+        p[1] = manifest->entries[i].flags;
+        put_le32(p + 4, manifest->entries[i].offset);
+    }
+    if (manifest->strings_size > 0) {
+        memcpy(p, manifest->strings, manifest->strings_size);
+    }
+
+    /* Written under a temporary name and renamed, so a run reading the
+     * cache at the same time never sees half a manifest */
+    char temp_path[MAX_PATH_LENGTH];
+    snprintf(temp_path, sizeof(temp_path), "%s.XXXXXX", path);
+    int fd = mkstemp(temp_path);
+    if (fd < 0) {
+        free(data);
+        return ERROR_IO;
+    }
+    // mkstemp() creates 0600; the cache may be shared by other users' runs
+    bool    ok = fchmod(fd, 0644) == 0;
+    size_t  done = 0;
+    while (ok && done < size) {
+        ssize_t n = write(fd, data + done, size - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        ok = n > 0;
+        done += ok ? (size_t)n : 0;
+    }
+    free(data);
+    if (close(fd) != 0 || !ok || rename(temp_path, path) != 0) {
+        unlink(temp_path);
+        return ERROR_IO;
+    }
+    return SUCCESS;
+}
+
+/* Check a file image against the layout in manifest.h and copy it into
+ * manifest */
+static int decode_manifest(const unsigned char *data, size_t size,
+                           const unsigned char key[MANIFEST_KEY_SIZE],
+                           Manifest_t *manifest) {
+    if (size < MANIFEST_HEADER_SIZE || memcmp(data, MANIFEST_MAGIC, 4) != 0
+        || get_le32(data + 4) != MANIFEST_VERSION
+        || memcmp(data + 8, key, MANIFEST_KEY_SIZE) != 0) {
+        return ERROR_IO;
+    }
+    uint32_t count = get_le32(data + 8 + MANIFEST_KEY_SIZE);
+    uint32_t strings_size = get_le32(data + 12 + MANIFEST_KEY_SIZE);
+    if (count > INT32_MAX
+        || size != MANIFEST_HEADER_SIZE + (size_t)count * MANIFEST_ENTRY_SIZE + strings_size
+        || (count > 0 && strings_size == 0)) {
+        return ERROR_IO;
+    }
+    const unsigned char *strings = data + MANIFEST_HEADER_SIZE
+                                   + (size_t)count * MANIFEST_ENTRY_SIZE;
+    if (strings_size > 0 && strings[strings_size - 1] != '\0') {
+        return ERROR_IO;
+    }
+
+    manifest_init(manifest);
+    memcpy(manifest->key, key, MANIFEST_KEY_SIZE);
+    manifest->entries = malloc((count > 0 ? count : 1) * sizeof(ManifestEntry_t));
+    manifest->strings = malloc(strings_size > 0 ? strings_size : 1);
+    if (manifest->entries == NULL || manifest->strings == NULL) {
+        manifest_free(manifest);
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    manifest->capacity = (int)count;
+    manifest->strings_capacity = strings_size;
+
+    const unsigned char *p = data + MANIFEST_HEADER_SIZE;
+    for (uint32_t i = 0; i < count; i++, p += MANIFEST_ENTRY_SIZE) {
+        ManifestEntry_t entry = {p[0], p[1], get_le32(p + 4)};
+        if ((entry.section != MANIFEST_REQUIRED && entry.section != MANIFEST_OPTIONAL)
+            || (entry.flags & ~(MANIFEST_GLOB | MANIFEST_TRAILING_SLASH)) != 0
+            || entry.offset >= strings_size) {
+            manifest_free(manifest);
+            return ERROR_IO;
+        }
+        manifest->entries[i] = entry;
+    }
+    memcpy(manifest->strings, strings, strings_size);
+    manifest->count = (int)count;
+    manifest->strings_size = strings_size;
+    return SUCCESS;
+}
+
+int manifest_load(const char *path, const unsigned char key[MANIFEST_KEY_SIZE],
+                  Manifest_t *manifest) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return errno == ENOENT ? ERROR_FILE_NOT_FOUND : ERROR_IO;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < MANIFEST_HEADER_SIZE) {
+        close(fd);
+        return ERROR_IO;
+    }
+
+    size_t         size = (size_t)st.st_size;
+    unsigned char *data = malloc(size);
+    if (data == NULL) {
+        close(fd);
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = read(fd, data + done, size - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        done += (size_t)n;
+    }
+    close(fd);
+
+    int status = done == size ? decode_manifest(data, size, key, manifest) : ERROR_IO;
+    free(data);
+    return status;
+}
+
+void manifest_cache_path(const char *cache_dir, const unsigned char key[MANIFEST_KEY_SIZE],
+                         char *path, size_t size) {
+    static const char digits[] = "0123456789abcdef";
+    char              hex[MANIFEST_KEY_SIZE * 2 + 1];
+    for (int i = 0; i < MANIFEST_KEY_SIZE; i++) {
+        hex[i * 2] = digits[key[i] >> 4];
+        hex[i * 2 + 1] = digits[key[i] & 0xF];
+    }
+    hex[MANIFEST_KEY_SIZE * 2] = '\0';
+    snprintf(path, size, "%s/%s" MANIFEST_EXTENSION, cache_dir, hex);
+}
+
+void manifest_free(Manifest_t *manifest) {
+    free(manifest->entries);
+    free(manifest->strings);
+    manifest->entries = NULL;
+    manifest->strings = NULL;
+    manifest->count = manifest->capacity = 0;
+    manifest->strings_size = manifest->strings_capacity = 0;
+}
@@ -0,0 +1,103 @@
+/**
+ * @file match_len.c
+ * @brief Match-extension kernels and the tdefl_match_len() used by miniz
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "match_len.h"
+#include "../lib/miniz/miniz.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define MATCH_LEN_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+/* Same loop miniz uses when built without USE_EXTERNAL_MZ_MATCH_LEN */
+static unsigned int match_len_portable(const unsigned char *p, const unsigned char *q,
+                                       unsigned int max_len) {
+    unsigned int len = 0;
+    while (len < max_len && p[len] == q[len]) {
+        len++;
+    }
+    return len;
+}
+
+#ifdef MATCH_LEN_HAVE_X86
+/* SSE2 is part of x86-64, so this needs no runtime check */
+static unsigned int match_len_sse2(const unsigned char *p, const unsigned char *q,
+                                   unsigned int max_len) {
+    unsigned int len = 0;
+    while (len + 16 <= max_len) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(p + len));
+        __m128i b = _mm_loadu_si128((const __m128i *)(q + len));
+        unsigned int diff = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) ^ 0xFFFF;
+        if (diff != 0) {
+            return len + (unsigned int)__builtin_ctz(diff);
+        }
+        len += 16;
+    }
+    return len + match_len_portable(p + len, q + len, max_len - len);
+}
+
+__attribute__((target("avx2")))
+static unsigned int match_len_avx2(const unsigned char *p, const unsigned char *q,
+                                   unsigned int max_len) {
+    unsigned int len = 0;
+    while (len + 32 <= max_len) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(p + len));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(q + len));
+        unsigned int diff = ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+        if (diff != 0) {
+            return len + (unsigned int)__builtin_ctz(diff);
+        }
+        len += 32;
+    }
+    return len + match_len_sse2(p + len, q + len, max_len - len);
+}
+#endif
+
+static MatchLenVariant_t usable_variants[3] = {{"portable", match_len_portable}};
+static int               usable_count = 1;
+static match_len_fn      active_match_len = match_len_portable;
+static int               active_index;
+
+#ifdef MATCH_LEN_HAVE_X86
+/* Runs before main(), so tdefl_match_len() is a plain call through
+ * active_match_len with no check per probe */
+__attribute__((constructor))
+static void select_match_len(void) {
+    usable_variants[usable_count++] = (MatchLenVariant_t){"sse2", match_len_sse2};
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        usable_variants[usable_count++] = (MatchLenVariant_t){"avx2", match_len_avx2};
+    }
+    active_index = usable_count - 1;
+    active_match_len = usable_variants[active_index].fn;
+}
+#endif
+
+int match_len_variants(const MatchLenVariant_t **variants) {
+    *variants = usable_variants;
+    return usable_count;
+}
+
+const char *match_len_active_variant(void) {
+    return usable_variants[active_index].name;
+}
+
+bool match_len_use_variant(const char *name) {
+    for (int i = 0; i < usable_count; i++) {
+        if (strcmp(usable_variants[i].name, name) == 0) {
+            active_index = i;
+            active_match_len = usable_variants[i].fn;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Called by tdefl_find_match (miniz built with USE_EXTERNAL_MZ_MATCH_LEN) */
+mz_uint tdefl_match_len(const mz_uint8 *p, const mz_uint8 *q, mz_uint max_len) {
+    return active_match_len(p, q, max_len);
+}
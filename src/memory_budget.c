@@ -0,0 +1,239 @@
+/**
+ * @file memory_budget.c
+ * @brief Implementation of the memory budget and miniz pool allocator
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "memory_budget.h"
+#include <stdint.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+/* Placed in front of every block handed to miniz */
+typedef struct PoolBlock {
+    size_t            capacity; /* Usable bytes after the header */
+    struct PoolBlock *next;     /* Next cached block while in the pool */
+} PoolBlock_t;
+
+/* Pool class for a request, or -1 for blocks too small to pool */
+static int pool_class(size_t size) {
+    if (size < ((size_t)1 << MEMORY_POOL_MIN_CLASS)) {
+        return -1;
+    }
+    int c = MEMORY_POOL_MIN_CLASS;
+    while (c < MEMORY_POOL_CLASSES && ((size_t)1 << c) < size) {
+        c++;
+    }
+    return c < MEMORY_POOL_CLASSES ? c : -1;
+}
+
+static void count_locked(MemoryBudget_t *budget, size_t bytes) {
+    budget->in_use += bytes;
+    if (budget->in_use > budget->peak) {
+        budget->peak = budget->in_use;
+    }
+}
+
+/* Hand cached blocks back to malloc */
+static void drain_pool_locked(MemoryBudget_t *budget) {
+    for (int c = 0; c < MEMORY_POOL_CLASSES; c++) {
+        while (budget->pool[c] != NULL) {
+            PoolBlock_t *block = budget->pool[c];
+            budget->pool[c] = block->next;
+            budget->in_use -= sizeof(PoolBlock_t) + block->capacity;
+            free(block);
+        }
+        budget->pool_count[c] = 0;
+    }
+    budget->cached = 0;
+}
+
+/* Bytes the process has resident now, 0 if that cannot be read */
+static size_t resident_bytes(void) {
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm == NULL) {
+        return 0;
+    }
+    unsigned long pages = 0;
+    if (fscanf(statm, "%*s %lu", &pages) != 1) {
+        pages = 0;
+    }
+    fclose(statm);
+    return (size_t)pages * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+void memory_budget_init(MemoryBudget_t *budget, size_t limit) {
+    memset(budget, 0, sizeof(MemoryBudget_t));
+    budget->limit = limit;
+    pthread_mutex_init(&budget->lock, NULL);
+
+#ifdef __GLIBC__
+    // A fixed threshold also stops glibc raising it (and the heap trim
+    // threshold) after large blocks are freed, which would keep them
+    mallopt(M_MMAP_THRESHOLD, MEMORY_MMAP_THRESHOLD);
+#endif
+    budget->baseline = resident_bytes();
+    count_locked(budget, budget->baseline);
+}
+
+void memory_budget_destroy(MemoryBudget_t *budget) {
+    pthread_mutex_lock(&budget->lock);
+    drain_pool_locked(budget);
+    pthread_mutex_unlock(&budget->lock);
+    pthread_mutex_destroy(&budget->lock);
+}
+
+static void *pool_alloc(void *opaque, size_t items, size_t size) {
+    MemoryBudget_t *budget = opaque;
+    if (size != 0 && items > (SIZE_MAX - sizeof(PoolBlock_t)) / size) {
+        return NULL;
+    }
+    size_t request = items * size;
+    int    c = pool_class(request);
+
+    pthread_mutex_lock(&budget->lock);
+    if (c >= 0 && budget->pool[c] != NULL) {
+        PoolBlock_t *block = budget->pool[c];
+        budget->pool[c] = block->next;
+        budget->pool_count[c]--;
+        budget->cached -= sizeof(PoolBlock_t) + block->capacity;
+        pthread_mutex_unlock(&budget->lock);
+        return block + 1;
+    }
+    pthread_mutex_unlock(&budget->lock);
+
+    // miniz cannot be told no, so the limit is not checked here; the
+    // entries' reservations make room for it instead
+    size_t       capacity = c >= 0 ? (size_t)1 << c : request;
+    PoolBlock_t *block = malloc(sizeof(PoolBlock_t) + capacity);
+    if (block == NULL) {
+        return NULL;
+    }
+    block->capacity = capacity;
+    block->next = NULL;
+
+    pthread_mutex_lock(&budget->lock);
+    count_locked(budget, sizeof(PoolBlock_t) + capacity);
+    pthread_mutex_unlock(&budget->lock);
+    return block + 1;
+}
+
+static void pool_free(void *opaque, void *address) {
+    MemoryBudget_t *budget = opaque;
+    if (address == NULL) {
+        return;
+    }
+    PoolBlock_t *block = (PoolBlock_t *)address - 1;
+    int          c = pool_class(block->capacity);
+
+    pthread_mutex_lock(&budget->lock);
+    // Only exact class sizes go back in the pool; they stay counted
+    if (c >= 0 && ((size_t)1 << c) == block->capacity
+        && budget->pool_count[c] < MEMORY_POOL_CACHED_PER_CLASS) {
+        block->next = budget->pool[c];
+        budget->pool[c] = block;
+        budget->pool_count[c]++;
+        budget->cached += sizeof(PoolBlock_t) + block->capacity;
+        pthread_mutex_unlock(&budget->lock);
+        return;
+    }
+    budget->in_use -= sizeof(PoolBlock_t) + block->capacity;
+    pthread_mutex_unlock(&budget->lock);
+    free(block);
+}
+
+static void *pool_realloc(void *opaque, void *address, size_t items, size_t size) {
+    if (address == NULL) {
+        return pool_alloc(opaque, items, size);
+    }
+    PoolBlock_t *block = (PoolBlock_t *)address - 1;
+    if (size != 0 && items <= block->capacity / size) {
+        return address;
+    }
+
+    void *grown = pool_alloc(opaque, items, size);
+    if (grown == NULL) {
+        return NULL;
+    }
+    memcpy(grown, address, block->capacity);
+    pool_free(opaque, address);
+    return grown;
+}
+
+void memory_budget_attach(MemoryBudget_t *budget, mz_zip_archive *zip) {
+    zip->m_pAlloc = pool_alloc;
+    zip->m_pFree = pool_free;
+    zip->m_pRealloc = pool_realloc;
+    zip->m_pAlloc_opaque = budget;
+}
+
+bool memory_budget_reserve(MemoryBudget_t *budget, size_t bytes, bool force) {
+    if (budget == NULL) {
+        return true;
+    }
+
+    pthread_mutex_lock(&budget->lock);
+    bool fits = budget->limit == 0 || budget->in_use + bytes <= budget->limit;
+    if (!fits && budget->cached > 0) {
+        drain_pool_locked(budget);
+        fits = budget->in_use + bytes <= budget->limit;
+    }
+    if (fits || force) {
+        count_locked(budget, bytes);
+        if (!fits) {
+            budget->overruns++;
+        }
+    } else {
+        budget->waits++;
+    }
+    pthread_mutex_unlock(&budget->lock);
+    return fits || force;
+}
+
+size_t memory_budget_available(MemoryBudget_t *budget) {
+    if (budget == NULL || budget->limit == 0) {
+        return SIZE_MAX;
+    }
+    pthread_mutex_lock(&budget->lock);
+    size_t held = budget->in_use - budget->cached;
+    size_t available = held < budget->limit ? budget->limit - held : 0;
+    pthread_mutex_unlock(&budget->lock);
+    return available;
+}
+
+void memory_budget_note_streamed(MemoryBudget_t *budget) {
+    if (budget == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&budget->lock);
+    budget->streamed++;
+    pthread_mutex_unlock(&budget->lock);
+}
+
+void memory_budget_release(MemoryBudget_t *budget, size_t bytes) {
+    if (budget == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&budget->lock);
+    budget->in_use -= bytes < budget->in_use ? bytes : budget->in_use;
+    pthread_mutex_unlock(&budget->lock);
+}
+
+void memory_budget_report(const MemoryBudget_t *budget, FILE *out) {
+    fprintf(out, "Memory: peak %zu bytes", budget->peak);
+    if (budget->limit > 0) {
+        fprintf(out, " of %zu allowed", budget->limit);
+    }
+    // The process's own high-water mark, to check the count against
+    // (ru_maxrss is in kilobytes on Linux)
+    struct rusage usage;
+    long          process_peak = getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+    fprintf(out, " (%zu at start; process peak %ld bytes resident), %d waits for memory, "
+            "%d files streamed in blocks, %d reservations over the limit\n",
+            budget->baseline, process_peak * 1024, budget->waits, budget->streamed,
+            budget->overruns);
+}
@@ -0,0 +1,326 @@
+/**
+ * @file output_writer.c
+ * @brief Implementation of the buffered archive writer
+ */
+
+#define _GNU_SOURCE
+
+#include "output_writer.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static OutputWriter_t *new_writer(int fd, bool owns_fd, bool direct) {
+    OutputWriter_t *writer = calloc(1, sizeof(OutputWriter_t));
+    if (writer == NULL) {
+        return NULL;
+    }
+
+    void *buffer = NULL;
+    if (posix_memalign(&buffer, OUTPUT_ALIGNMENT, OUTPUT_BUFFER_SIZE) != 0) {
+        free(writer);
+        return NULL;
+    }
+
+    writer->fd = fd;
+    writer->owns_fd = owns_fd;
+    writer->direct = direct;
+    writer->buffer = buffer;
+    writer->buffers[0] = buffer;
+    writer->buffer_count = 1;
+    writer->capacity = OUTPUT_BUFFER_SIZE;
+
+    // Offsets count from where the writer starts, so only a file written
+    // from its beginning can be rewound
+    struct stat st;
+    writer->seekable = fstat(fd, &st) == 0 && S_ISREG(st.st_mode)
+                       && lseek(fd, 0, SEEK_CUR) == 0
+                       && (fcntl(fd, F_GETFL) & O_APPEND) == 0;
+    return writer;
+}
+
+static int write_fully(int fd, const unsigned char *buf, size_t n) {
+    while (n > 0) {
+        ssize_t written = write(fd, buf, n);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return ERROR_IO;
+        }
+        buf += written;
+        n -= (size_t)written;
+    }
+    return SUCCESS;
+}
+
+/* Wait until a buffer written behind is on its way to the file */
+static int complete_write(OutputWriter_t *writer, int slot) {
+    if (!writer->pending[slot]) {
+        return SUCCESS;
+    }
+    writer->pending[slot] = false;
+    AsyncIoRequest_t *request = &writer->requests[slot];
+    if (async_io_wait(&writer->io, request) != SUCCESS
+        || (size_t)request->result != request->iov.iov_len) {
+        writer->failed = true;
+        return ERROR_IO;
+    }
+    writer->written += (uint64_t)request->result;
+    return SUCCESS;
+}
+
+/* Wait for every write behind, leaving the file offset at the end so
+ * write() carries on from there */
+static int drain_writes(OutputWriter_t *writer) {
+    if (writer->buffer_count == 1) {
+        return SUCCESS;
+    }
+    int status = SUCCESS;
+    for (int i = 0; i < writer->buffer_count; i++) {
+        if (complete_write(writer, i) != SUCCESS) {
+            status = ERROR_IO;
+        }
+    }
+    if (status == SUCCESS && lseek(writer->fd, (off_t)writer->written, SEEK_SET) < 0) {
+        writer->failed = true;
+        status = ERROR_IO;
+    }
+    return status;
+}
+
+/* Hand the full buffer to the I/O backend and move on to the next one */
+static int write_behind(OutputWriter_t *writer) {
+    int slot = writer->current;
+    if (async_io_submit(&writer->io, &writer->requests[slot], writer->fd, true,
+                        writer->buffer, writer->buffered, (off_t)writer->submitted)
+            != SUCCESS
+        || async_io_flush(&writer->io) != SUCCESS) {
+        writer->failed = true;
+        return ERROR_IO;
+    }
+    writer->pending[slot] = true;
+    writer->submitted += writer->buffered;
+    writer->buffered = 0;
+
+    writer->current = (slot + 1) % writer->buffer_count;
+    writer->buffer = writer->buffers[writer->current];
+    return complete_write(writer, writer->current);
+}
+
+static int flush_buffer(OutputWriter_t *writer) {
+    if (drain_writes(writer) != SUCCESS) {
+        return ERROR_IO;
+    }
+    if (writer->buffered == 0) {
+        return SUCCESS;
+    }
+
+    // O_DIRECT needs aligned lengths; only the final flush can be partial,
+    // so drop the flag for that last write
+    if (writer->direct && writer->buffered % OUTPUT_ALIGNMENT != 0) {
+        int flags = fcntl(writer->fd, F_GETFL);
+        fcntl(writer->fd, F_SETFL, flags & ~O_DIRECT);
+        writer->direct = false;
+    }
+
+    if (write_fully(writer->fd, writer->buffer, writer->buffered) != SUCCESS) {
+        writer->failed = true;
+        return ERROR_IO;
+    }
+    writer->written += writer->buffered;
+    writer->submitted = writer->written;
+    writer->buffered = 0;
+    return SUCCESS;
+}
+
+OutputWriter_t *output_writer_open(const char *path, uint64_t size_estimate,
+                                   bool direct_io) {
+    int  flags = O_WRONLY | O_CREAT | O_TRUNC;
+    int  fd = -1;
+    bool direct = false;
+
+    if (direct_io) {
+        fd = open(path, flags | O_DIRECT, 0644);
+        if (fd >= 0) {
+            direct = true;
+        } else {
+            print_error("O_DIRECT not supported for output, using buffered I/O");
+        }
+    }
+    if (fd < 0) {
+        fd = open(path, flags, 0644);
+    }
+    if (fd < 0) {
+        return NULL;
+    }
+
+    // Reserve the space now so the archive is laid out contiguously; the
+    // apparent size is left alone and trimmed back in output_writer_close
+    if (size_estimate > 0) {
+        fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, (off_t)size_estimate);
+    }
+
+    OutputWriter_t *writer = new_writer(fd, true, direct);
+    if (writer == NULL) {
+        close(fd);
+        unlink(path);
+    }
+    return writer;
+}
+
+OutputWriter_t *output_writer_wrap_fd(int fd) {
+    return new_writer(fd, false, false);
+}
+
+static void free_buffers(unsigned char **buffers, int from, int count) {
+    for (int i = from; i < count; i++) {
+        free(buffers[i]);
+        buffers[i] = NULL;
+    }
+}
+
+int output_writer_start_async(OutputWriter_t *writer, AsyncIoBackend_t backend) {
+    struct stat st;
+    if (writer == NULL || backend == ASYNC_IO_SYNC || writer->buffer_count > 1) {
+        return ERROR_INVALID_ARGS;
+    }
+    if (fstat(writer->fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return ERROR_INVALID_ARGS;
+    }
+
+    for (int i = 1; i < OUTPUT_WRITE_BUFFERS; i++) {
+        void *buffer = NULL;
+        if (posix_memalign(&buffer, OUTPUT_ALIGNMENT, writer->capacity) != 0) {
+            free_buffers(writer->buffers, 1, i);
+            return ERROR_MEMORY_ALLOCATION;
+        }
+        writer->buffers[i] = buffer;
+    }
+    if (async_io_init(&writer->io, backend, OUTPUT_WRITE_BUFFERS) != SUCCESS
+        || writer->io.backend == ASYNC_IO_SYNC) {
+        free_buffers(writer->buffers, 1, OUTPUT_WRITE_BUFFERS);
+        return ERROR_IO;
+    }
+    writer->buffer_count = OUTPUT_WRITE_BUFFERS;
+    writer->submitted = writer->written;
+    return SUCCESS;
+}
+
+size_t output_writer_write(void *opaque, const void *buf, size_t n) {
+    OutputWriter_t      *writer = opaque;
+    const unsigned char *src = buf;
+    size_t               remaining = n;
+
+    if (writer->failed) {
+        return 0;
+    }
+
+    while (remaining > 0) {
+        size_t room = writer->capacity - writer->buffered;
+        size_t chunk = remaining < room ? remaining : room;
+
+        memcpy(writer->buffer + writer->buffered, src, chunk);
+        writer->buffered += chunk;
+        src += chunk;
+        remaining -= chunk;
+
+        if (writer->buffered == writer->capacity
+            && (writer->buffer_count > 1 ? write_behind(writer) : flush_buffer(writer))
+                   != SUCCESS) {
+            return 0;
+        }
+    }
+
+    return n;
+}
+
+int output_writer_rewind(OutputWriter_t *writer, uint64_t offset) {
+    if (writer == NULL || writer->failed
+        || offset > writer->submitted + writer->buffered) {
+        return ERROR_IO;
+    }
+    if (offset >= writer->submitted) {
+        writer->buffered = (size_t)(offset - writer->submitted);
+        return SUCCESS;
+    }
+    if (!writer->seekable) {
+        return ERROR_IO;
+    }
+
+    // Let the writes behind land before the bytes they carry are replaced
+    writer->buffered = 0;
+    if (drain_writes(writer) != SUCCESS) {
+        return ERROR_IO;
+    }
+    if (writer->direct) {
+        int flags = fcntl(writer->fd, F_GETFL);
+        fcntl(writer->fd, F_SETFL, flags & ~O_DIRECT);
+        writer->direct = false;
+    }
+    if (lseek(writer->fd, (off_t)offset, SEEK_SET) < 0) {
+        writer->failed = true;
+        return ERROR_IO;
+    }
+    writer->written = offset;
+    writer->submitted = offset;
+    return SUCCESS;
+}
+
+int output_writer_resize(OutputWriter_t *writer, size_t capacity) {
+    if (writer == NULL) {
+        return ERROR_INVALID_ARGS;
+    }
+    // Keep whole O_DIRECT blocks
+    capacity -= capacity % OUTPUT_ALIGNMENT;
+    if (capacity < OUTPUT_ALIGNMENT) {
+        capacity = OUTPUT_ALIGNMENT;
+    }
+    if (capacity == writer->capacity) {
+        return SUCCESS;
+    }
+
+    if (flush_buffer(writer) != SUCCESS) {
+        return ERROR_IO;
+    }
+    unsigned char *buffers[OUTPUT_WRITE_BUFFERS];
+    for (int i = 0; i < writer->buffer_count; i++) {
+        void *buffer = NULL;
+        if (posix_memalign(&buffer, OUTPUT_ALIGNMENT, capacity) != 0) {
+            free_buffers(buffers, 0, i);
+            return ERROR_MEMORY_ALLOCATION;
+        }
+        buffers[i] = buffer;
+    }
+    free_buffers(writer->buffers, 0, writer->buffer_count);
+    memcpy(writer->buffers, buffers, (size_t)writer->buffer_count * sizeof(buffers[0]));
+    writer->current = 0;
+    writer->buffer = writer->buffers[0];
+    writer->capacity = capacity;
+    return SUCCESS;
+}
+
+int output_writer_close(OutputWriter_t *writer) {
+    if (writer == NULL) {
+        return SUCCESS;
+    }
+
+    int status = writer->failed ? ERROR_IO : flush_buffer(writer);
+    // Buffers still being written must outlive the writes
+    async_io_destroy(&writer->io);
+
+    // Give back whatever the preallocation reserved past the real end
+    struct stat st;
+    if (writer->owns_fd && fstat(writer->fd, &st) == 0 && S_ISREG(st.st_mode)
+        && ftruncate(writer->fd, (off_t)writer->written) != 0) {
+        status = ERROR_IO;
+    }
+    if (writer->owns_fd && close(writer->fd) != 0) {
+        status = ERROR_IO;
+    }
+
+    free_buffers(writer->buffers, 0, writer->buffer_count);
+    free(writer);
+    return status;
+}
@@ -0,0 +1,230 @@
+/**
+ * @file prefetch.c
+ * @brief Implementation of read-ahead of upcoming entries
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "prefetch.h"
+#include "time_budget.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+void prefetch_init(Prefetch_t *prefetch, const FileList_t *list, bool enabled,
+                   AsyncIoBackend_t reads) {
+    memset(prefetch, 0, sizeof(Prefetch_t));
+    prefetch->list = list;
+    prefetch->enabled = enabled;
+    prefetch->window = PREFETCH_MIN_ENTRIES;
+    prefetch->min_window = PREFETCH_MIN_ENTRIES;
+    prefetch->max_window = PREFETCH_MIN_ENTRIES;
+    for (int i = 0; i < PREFETCH_SLOTS; i++) {
+        prefetch->reads[i].index = -1;
+    }
+    if (enabled && reads != ASYNC_IO_SYNC) {
+        async_io_init(&prefetch->io, reads, PREFETCH_SLOTS);
+        prefetch->read_backend = prefetch->io.backend;
+    }
+}
+
+static mz_uint64 entry_bytes(const Prefetch_t *prefetch, int index) {
+    FileMeta_t meta;
+    if (file_list_entry_stat(&prefetch->list->entries[index], &meta) != SUCCESS
+        || meta.size <= 0) {
+        return 0;
+    }
+    return (mz_uint64)meta.size;
+}
+
+/* Start the kernel reading a whole file in the background */
+static void advise_file(const FileListEntry_t *entry) {
+    char path[MAX_PATH_LENGTH];
+    int  fd = open(file_list_entry_path(entry, path), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        close(fd);
+    }
+}
+
+/* Wait out a slot's read and free it */
+static void release_read(Prefetch_t *prefetch, PrefetchRead_t *read) {
+    async_io_wait(&prefetch->io, &read->request);
+    close(read->fd);
+    free(read->buffer);
+    read->buffer = NULL;
+    read->index = -1;
+}
+
+/* Start reading a whole entry into a buffer; false if it has to be advised.
+ * Only regular files listed with their metadata qualify, since the buffer
+ * has to carry the modification time the mapped path gets from fstat(). */
+static bool start_read(Prefetch_t *prefetch, int index, mz_uint64 bytes) {
+    const FileListEntry_t *entry = &prefetch->list->entries[index];
+    PrefetchRead_t        *read = &prefetch->reads[index % PREFETCH_SLOTS];
+    char                   path[MAX_PATH_LENGTH];
+    if (!S_ISREG(entry->meta.mode)) {
+        return false;
+    }
+    if (read->index >= 0) {
+        release_read(prefetch, read);
+    }
+
+    read->fd = open(file_list_entry_path(entry, path), O_RDONLY | O_CLOEXEC);
+    if (read->fd < 0) {
+        return false;
+    }
+    read->buffer = malloc((size_t)bytes + 1);
+    if (read->buffer == NULL
+        || async_io_submit(&prefetch->io, &read->request, read->fd, false, read->buffer,
+                           (size_t)bytes + 1, 0)
+               != SUCCESS) {
+        free(read->buffer);
+        read->buffer = NULL;
+        close(read->fd);
+        return false;
+    }
+    read->index = index;
+    read->size = (size_t)bytes;
+    read->modified = (time_t)entry->meta.mtime;
+    return true;
+}
+
+void prefetch_advance(Prefetch_t *prefetch, int index) {
+    if (!prefetch->enabled) {
+        return;
+    }
+    if (index < prefetch->next) {
+        mz_uint64 bytes = entry_bytes(prefetch, index);
+        prefetch->ahead_bytes -= bytes < prefetch->ahead_bytes ? bytes
+                                                                : prefetch->ahead_bytes;
+    } else {
+        prefetch->next = index + 1; // too late for this one
+    }
+
+    double    lead = prefetch->compress_rate * PREFETCH_LEAD_SECONDS;
+    mz_uint64 cap = lead > PREFETCH_MIN_BYTES ? (mz_uint64)lead : PREFETCH_MIN_BYTES;
+    while (prefetch->next < prefetch->list->count
+           && prefetch->next - index <= prefetch->window && prefetch->ahead_bytes < cap) {
+        int i = prefetch->next++;
+        if (prefetch->skip != NULL && prefetch->skip[i] >= 0) {
+            continue;
+        }
+        mz_uint64 bytes = entry_bytes(prefetch, i);
+        if (bytes > 0) {
+            if (prefetch->io.backend == ASYNC_IO_SYNC || bytes > PREFETCH_READ_LIMIT
+                || !start_read(prefetch, i, bytes)) {
+                advise_file(&prefetch->list->entries[i]);
+            }
+            prefetch->ahead_bytes += bytes;
+            prefetch->advised_files++;
+            prefetch->advised_bytes += bytes;
+        }
+    }
+    // The reads just queued go to the kernel together
+    async_io_flush(&prefetch->io);
+}
+
+bool prefetch_take_read(Prefetch_t *prefetch, int index, FileInput_t *input,
+                        double *stall_seconds) {
+    PrefetchRead_t *read = &prefetch->reads[index % PREFETCH_SLOTS];
+    if (read->index != index) {
+        return false;
+    }
+
+    double start = time_budget_now();
+    int    status = async_io_wait(&prefetch->io, &read->request);
+    *stall_seconds = time_budget_now() - start;
+    close(read->fd);
+    read->index = -1;
+    // A file that grew since it was listed is opened again and read whole
+    if (status != SUCCESS || (size_t)read->request.result > read->size) {
+        free(read->buffer);
+        read->buffer = NULL;
+        return false;
+    }
+
+    memset(input, 0, sizeof(FileInput_t));
+    input->data = read->buffer;
+    input->size = (size_t)read->request.result;
+    input->modified = read->modified;
+    input->mapped = false;
+    read->buffer = NULL;
+    prefetch->buffered_files++;
+    return true;
+}
+
+int prefetch_open_input(const char *path, bool use_mmap, FileInput_t *input,
+                        double *stall_seconds) {
+    double start = time_budget_now();
+    int    status = open_file_input(path, use_mmap, input);
+    if (status == SUCCESS && input->mapped) {
+        // Fault the pages in now; the compressor would wait for them anyway
+        size_t        page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t        limit = input->size < PREFETCH_TOUCH_LIMIT ? input->size
+                                                                 : PREFETCH_TOUCH_LIMIT;
+        unsigned char sum = 0;
+        for (size_t offset = 0; offset < limit; offset += page) {
+            sum ^= ((const volatile unsigned char *)input->data)[offset];
+        }
+        (void)sum;
+    }
+    *stall_seconds = time_budget_now() - start;
+    return status;
+}
+
+void prefetch_record(Prefetch_t *prefetch, size_t bytes, double stall_seconds,
+                     double compress_seconds) {
+    prefetch->read_files++;
+    prefetch->stall_seconds += stall_seconds;
+    if (compress_seconds > 0 && bytes > 0) {
+        double rate = (double)bytes / compress_seconds;
+        prefetch->compress_rate = prefetch->compress_rate > 0
+                                      ? 0.8 * prefetch->compress_rate + 0.2 * rate
+                                      : rate;
+    }
+
+    if (stall_seconds > PREFETCH_MIN_STALL
+        && stall_seconds > PREFETCH_STALL_SHARE * compress_seconds) {
+        prefetch->stalled_files++;
+        prefetch->calm = 0;
+        prefetch->window = prefetch->window * 2 < PREFETCH_MAX_ENTRIES ? prefetch->window * 2
+                                                                       : PREFETCH_MAX_ENTRIES;
+    } else if (++prefetch->calm >= PREFETCH_CALM_ENTRIES) {
+        prefetch->calm = 0;
+        if (prefetch->window > PREFETCH_MIN_ENTRIES) {
+            prefetch->window--;
+        }
+    }
+    if (prefetch->window < prefetch->min_window) {
+        prefetch->min_window = prefetch->window;
+    }
+    if (prefetch->window > prefetch->max_window) {
+        prefetch->max_window = prefetch->window;
+    }
+}
+
+void print_prefetch_stats(FILE *out, const Prefetch_t *prefetch) {
+    fprintf(out, "Read stalls: %.3f s in %d of %d files", prefetch->stall_seconds,
+            prefetch->stalled_files, prefetch->read_files);
+    if (!prefetch->enabled) {
+        fprintf(out, " (read-ahead off)\n");
+        return;
+    }
+    fprintf(out, "; read ahead %ld files, %.1f MB", prefetch->advised_files,
+            prefetch->advised_bytes / 1e6);
+    if (prefetch->read_backend != ASYNC_IO_SYNC) {
+        fprintf(out, " (%ld read into buffers by %s)", prefetch->buffered_files,
+                async_io_backend_name(prefetch->read_backend));
+    }
+    fprintf(out, ", %d-%d files ahead\n", prefetch->min_window, prefetch->max_window);
+}
+
+void prefetch_finish(Prefetch_t *prefetch) {
+    for (int i = 0; i < PREFETCH_SLOTS; i++) {
+        if (prefetch->reads[i].index >= 0) {
+            release_read(prefetch, &prefetch->reads[i]);
+        }
+    }
+    async_io_destroy(&prefetch->io);
+}
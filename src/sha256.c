@@ -0,0 +1,203 @@
+/**
+ * @file sha256.c
+ * @brief Implementation of SHA-256
+ */
+
+#include "sha256.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define SHA256_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+static const uint32_t round_constants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4,
+    0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe,
+    0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f,
+    0x4a7484aa, 0x5cb0a9dc, 0x76f988da, 0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc,
+    0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070, 0x19a4c116,
+    0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7,
+    0xc67178f2};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void process_blocks_portable(uint32_t state[8], const unsigned char *block,
+                                    size_t count) {
+    for (; count > 0; count--, block += 64) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++) {
+            w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16
+                   | (uint32_t)block[i * 4 + 2] << 8 | (uint32_t)block[i * 4 + 3];
+        }
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t s1 = ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25);
+            uint32_t ch = (e & f) ^ (~e & g);
+            uint32_t t1 = h + s1 + ch + round_constants[i] + w[i];
+            uint32_t s0 = ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22);
+            uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+            uint32_t t2 = s0 + maj;
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+#ifdef SHA256_HAVE_X86
+/* The SHA extensions: each sha256rnds2 does two rounds, and sha256msg1 /
+ * sha256msg2 extend the message schedule four words at a time. The state
+ * is kept as the ABEF and CDGH halves the instructions work on. */
+__attribute__((target("sha,sse4.1")))
+static void process_blocks_shani(uint32_t state[8], const unsigned char *block,
+                                 size_t count) {
+    const __m128i byte_swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i       dcba = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1);
+    __m128i       efgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1B);
+    __m128i       abef = _mm_alignr_epi8(dcba, efgh, 8);
+    __m128i       cdgh = _mm_blend_epi16(efgh, dcba, 0xF0);
+
+    for (; count > 0; count--, block += 64) {
+        __m128i abef_start = abef, cdgh_start = cdgh;
+        __m128i w[4]; // w[r % 4] holds words 4r to 4r + 3 of the schedule
+        for (int i = 0; i < 4; i++) {
+            w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(block + i * 16)),
+                                    byte_swap);
+        }
+        for (int r = 0; r < 16; r++) {
+            __m128i k = _mm_add_epi32(w[r % 4],
+                                      _mm_loadu_si128((const __m128i *)&round_constants[r * 4]));
+            cdgh = _mm_sha256rnds2_epu32(cdgh, abef, k);
+            if (r < 12) {
+                __m128i next = _mm_sha256msg1_epu32(w[r % 4], w[(r + 1) % 4]);
+                next = _mm_add_epi32(next, _mm_alignr_epi8(w[(r + 3) % 4], w[(r + 2) % 4], 4));
+                w[r % 4] = _mm_sha256msg2_epu32(next, w[(r + 3) % 4]);
+            }
+            abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(k, 0x0E));
+        }
+        abef = _mm_add_epi32(abef, abef_start);
+        cdgh = _mm_add_epi32(cdgh, cdgh_start);
+    }
+
+    __m128i feba = _mm_shuffle_epi32(abef, 0x1B);
+    __m128i dchg = _mm_shuffle_epi32(cdgh, 0xB1);
+    _mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(feba, dchg, 0xF0));
+    _mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(dchg, feba, 8));
+}
+#endif
+
+static void (*process_blocks)(uint32_t state[8], const unsigned char *block,
+                              size_t count) = process_blocks_portable;
+
+#ifdef SHA256_HAVE_X86
+/* Picked once before main(), as match_len.c picks its kernel */
+__attribute__((constructor))
+static void select_process_blocks(void) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1")) {
+        process_blocks = process_blocks_shani;
+    }
+}
+#endif
+
+void sha256_init(Sha256_t *ctx) {
+    static const uint32_t initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    memcpy(ctx->state, initial, sizeof(initial));
+    ctx->length = 0;
+    ctx->block_used = 0;
+}
+
+void sha256_update(Sha256_t *ctx, const void *data, size_t len) {
+    const unsigned char *bytes = data;
+    ctx->length += len;
+
+    if (ctx->block_used > 0) {
+        size_t take = 64 - ctx->block_used;
+        if (take > len) {
+            take = len;
+        }
+        memcpy(ctx->block + ctx->block_used, bytes, take);
+        ctx->block_used += take;
+        bytes += take;
+        len -= take;
+        if (ctx->block_used < 64) {
+            return;
+        }
+        process_blocks(ctx->state, ctx->block, 1);
+        ctx->block_used = 0;
+    }
+
+    if (len >= 64) {
+        process_blocks(ctx->state, bytes, len / 64);
+        bytes += len / 64 * 64;
+        len %= 64;
+    }
+
+    memcpy(ctx->block, bytes, len);
+    ctx->block_used = len;
+}
+
+void sha256_final(Sha256_t *ctx, unsigned char digest[SHA256_DIGEST_SIZE]) {
+    uint64_t bit_length = ctx->length * 8;
+
+    // Pad with 0x80, zeros, and the message length in bits (big-endian)
+    ctx->block[ctx->block_used++] = 0x80;
+    if (ctx->block_used > 56) {
+        memset(ctx->block + ctx->block_used, 0, 64 - ctx->block_used);
+        process_blocks(ctx->state, ctx->block, 1);
+        ctx->block_used = 0;
+    }
+    memset(ctx->block + ctx->block_used, 0, 56 - ctx->block_used);
+    for (int i = 0; i < 8; i++) {
+        ctx->block[56 + i] = (unsigned char)(bit_length >> (56 - i * 8));
+    }
+    process_blocks(ctx->state, ctx->block, 1);
+
+    for (int i = 0; i < 8; i++) {
+        digest[i * 4] = (unsigned char)(ctx->state[i] >> 24);
+        digest[i * 4 + 1] = (unsigned char)(ctx->state[i] >> 16);
+        digest[i * 4 + 2] = (unsigned char)(ctx->state[i] >> 8);
+        digest[i * 4 + 3] = (unsigned char)ctx->state[i];
+    }
+}
+
+void sha256_hex(const void *data, size_t len, char *hex) {
+    static const char digits[] = "0123456789abcdef";
+    unsigned char     digest[SHA256_DIGEST_SIZE];
+    Sha256_t          ctx;
+
+    sha256_init(&ctx);
+    sha256_update(&ctx, data, len);
+    sha256_final(&ctx, digest);
+
+    for (int i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        hex[i * 2] = digits[digest[i] >> 4];
+        hex[i * 2 + 1] = digits[digest[i] & 0xF];
+    }
+    hex[SHA256_HEX_LENGTH] = '\0';
+}
@@ -0,0 +1,453 @@
+/**
+ * @file solid.c
+ * @brief Implementation of solid blocks
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "solid.h"
+#include "file_input.h"
+#include <sys/stat.h>
+
+/* Blocks held in memory per worker while compressing in parallel */
+#define SOLID_WINDOW_PER_WORKER 2
+
+/* Where one small file goes */
+typedef struct {
+    const FileListEntry_t *file;
+    const char *name;      /* Name inside the archive */
+    const char *extension; /* Sort key, "" for files without one */
+    size_t      size;      /* Size when the list was laid out */
+    int         block;
+    size_t      offset;    /* Offset inside the block */
+    mz_uint32   crc32;
+    time_t      modified;
+} SolidFile_t;
+
+/**
+ * Work item for one block. A worker reads the block's files into data and
+ * compresses it; the archive writer then consumes the blocks in order.
+ */
+typedef struct {
+    SolidFile_t      *files; /* The block's files, in layout order */
+    int               count;
+    size_t            size;  /* Sum of the files' sizes */
+    unsigned char    *data;
+    time_t            modified; /* Newest file in the block */
+    const Codec_t    *codec;
+    int               compression_level;
+    bool              store_fallback;
+    bool              use_mmap;
+    CompressedEntry_t entry;
+    size_t            reserved; /* Memory reserved for the block */
+    int               status;
+    TaskGroup_t       group;
+} SolidBlock_t;
+
+int partition_solid_files(const FileList_t *file_list, FileList_t *solid_list,
+                          FileList_t *entry_list) {
+    file_list_init_subset(solid_list, file_list);
+    file_list_init_subset(entry_list, file_list);
+
+    // Anything that is not a plain small file (pipes, large files) keeps
+    // its own entry
+    int status = SUCCESS;
+    for (int i = 0; i < file_list->count && status == SUCCESS; i++) {
+        const FileListEntry_t *file = &file_list->entries[i];
+        FileMeta_t             meta;
+        if (file_list_entry_stat(file, &meta) == SUCCESS && S_ISREG(meta.mode)
+            && meta.size <= SOLID_FILE_LIMIT) {
+            status = file_list_append(solid_list, file);
+        } else {
+            status = file_list_append(entry_list, file);
+        }
+    }
+    if (status != SUCCESS) {
+        file_list_free(solid_list);
+        file_list_free(entry_list);
+    }
+    return status;
+}
+
+static const char *extension_of(const char *name) {
+    const char *dot = strrchr(name, '.');
+    // A leading dot marks a hidden file, not an extension
+    return dot != NULL && dot != name ? dot + 1 : "";
+}
+
+static int compare_solid_files(const void *a, const void *b) {
+    const SolidFile_t *fa = a;
+    const SolidFile_t *fb = b;
+
+    int order = strcmp(fa->extension, fb->extension);
+    if (order == 0) {
+        order = strcmp(fa->name, fb->name);
+    }
+    if (order == 0) {
+        order = file_list_entry_compare(fa->file, fb->file);
+    }
+    return order;
+}
+
+static void solid_block_job(void *arg) {
+    SolidBlock_t *block = arg;
+
+    block->data = malloc(block->size > 0 ? block->size : 1);
+    if (block->data == NULL) {
+        block->status = ERROR_MEMORY_ALLOCATION;
+        return;
+    }
+
+    for (int i = 0; i < block->count; i++) {
+        SolidFile_t *file = &block->files[i];
+        FileInput_t  input;
+        char         path[MAX_PATH_LENGTH];
+
+        block->status = open_file_input(file_list_entry_path(file->file, path),
+                                        block->use_mmap, &input);
+        if (block->status != SUCCESS) {
+            return;
+        }
+        // The layout was fixed from the listed size; a file that changed size since
+        // would overrun its neighbours
+        if (input.size != file->size) {
+            close_file_input(&input);
+            block->status = ERROR_IO;
+            return;
+        }
+        if (input.size > 0) {
+            memcpy(block->data + file->offset, input.data, input.size);
+        }
+        file->crc32 = (mz_uint32)mz_crc32(MZ_CRC32_INIT, input.data, input.size);
+        // Date it as listed, like entries of their own
+        file->modified = file->file->meta.mode != 0 ? (time_t)file->file->meta.mtime
+                                                    : input.modified;
+        if (i == 0 || file->modified > block->modified) {
+            block->modified = file->modified;
+        }
+        close_file_input(&input);
+    }
+
+    block->status = block->codec->compress(block->data, block->size,
+                                           block->compression_level,
+                                           block->store_fallback, &block->entry);
+}
+
+/* Lay the files out by extension and cut them into blocks of up to
+ * block_size bytes */
+static int plan_solid_blocks(SolidFile_t *files, int file_count, size_t block_size,
+                             SolidBlock_t **blocks, int *block_count) {
+    qsort(files, (size_t)file_count, sizeof(SolidFile_t), compare_solid_files);
+
+    *block_count = 0;
+    *blocks = calloc(file_count > 0 ? (size_t)file_count : 1, sizeof(SolidBlock_t));
+    if (*blocks == NULL) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+
+    SolidBlock_t *block = NULL;
+    for (int i = 0; i < file_count; i++) {
+        if (block == NULL || block->size + files[i].size > block_size) {
+            block = &(*blocks)[(*block_count)++];
+            block->files = &files[i];
+        }
+        files[i].block = *block_count - 1;
+        files[i].offset = block->size;
+        block->size += files[i].size;
+        block->count++;
+    }
+    return SUCCESS;
+}
+
+/* Write the index and add it as the last solid entry */
+static int add_solid_index(archive_state *archive, const SolidFile_t *files,
+                           int file_count, time_t modified) {
+    char  *index = NULL;
+    size_t index_size = 0;
+    FILE  *out = open_memstream(&index, &index_size);
+    if (out == NULL) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+
+    fprintf(out, "%s\n", SOLID_INDEX_HEADER);
+    for (int i = 0; i < file_count; i++) {
+        fprintf(out, "%d %zu %zu %08lx %lld %s\n", files[i].block, files[i].offset,
+                files[i].size, (unsigned long)files[i].crc32, (long long)files[i].modified,
+                files[i].name);
+    }
+    if (fclose(out) != 0) {
+        free(index);
+        return ERROR_MEMORY_ALLOCATION;
+    }
+
+    CompressedEntry_t entry;
+    int status = archive->codec->compress((const unsigned char *)index, index_size,
+                                          archive->compression_level,
+                                          archive->store_fallback, &entry);
+    if (status == SUCCESS) {
+        MZ_TIME_T index_modified = modified;
+        status = add_compressed_entry_to_archive(archive, SOLID_INDEX_NAME,
+                                                 (const unsigned char *)index, &entry,
+                                                 &index_modified);
+        free_compressed_entry(&entry);
+    }
+    free(index);
+    return status;
+}
+
+int add_solid_blocks(archive_state *archive, const FileList_t *file_list,
+                     const ArchiveOptions_t *options, SolidStats_t *stats) {
+    SolidStats_t done = {0, 0, 0, 0};
+    int          file_count = file_list->count;
+    if (file_count == 0) {
+        if (stats != NULL) {
+            *stats = done;
+        }
+        return SUCCESS;
+    }
+
+    SolidFile_t *files = calloc((size_t)file_count, sizeof(SolidFile_t));
+    if (files == NULL) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    for (int i = 0; i < file_count; i++) {
+        FileMeta_t meta;
+        if (file_list_entry_stat(&file_list->entries[i], &meta) != SUCCESS) {
+            free(files);
+            return ERROR_FILE_NOT_FOUND;
+        }
+        files[i].file = &file_list->entries[i];
+        files[i].name = file_list->entries[i].name;
+        files[i].extension = extension_of(files[i].name);
+        files[i].size = (size_t)meta.size;
+    }
+
+    // Under a memory limit a block, its output and its compressor take at
+    // most about half of what is left
+    size_t block_size = MZ_MIN(SOLID_BLOCK_SIZE, memory_budget_available(archive->memory) / 4);
+    block_size = MZ_MAX(block_size, SOLID_FILE_LIMIT);
+
+    SolidBlock_t *blocks;
+    int           block_count;
+    int           status = plan_solid_blocks(files, file_count, block_size, &blocks,
+                                             &block_count);
+    if (status != SUCCESS) {
+        free(files);
+        return status;
+    }
+
+    ThreadPool_t *pool = NULL;
+    if (options->jobs > 1) {
+        pool = options->pool != NULL ? options->pool : thread_pool_create(options->jobs);
+    }
+    int window = options->jobs > 1 ? options->jobs * SOLID_WINDOW_PER_WORKER : 1;
+    int submitted = 0;
+    time_t newest = 0;
+
+    for (int b = 0; b < block_count; b++) {
+        while (status == SUCCESS && submitted < block_count && submitted < b + window) {
+            SolidBlock_t *block = &blocks[submitted];
+            // Under a memory limit, wait for earlier blocks to be written
+            // unless there are none in flight
+            block->reserved = entry_working_memory(archive->codec,
+                                                   archive->compression_level, block->size);
+            if (!memory_budget_reserve(archive->memory, block->reserved, submitted == b)) {
+                break;
+            }
+            submitted++;
+            block->codec = archive->codec;
+            block->compression_level = archive->compression_level;
+            block->store_fallback = archive->store_fallback;
+            block->use_mmap = archive->use_mmap;
+            if (pool == NULL
+                || thread_pool_submit(pool, &block->group, solid_block_job, block)
+                       != SUCCESS) {
+                solid_block_job(block);
+            }
+        }
+        if (b >= submitted) {
+            break;
+        }
+
+        SolidBlock_t *block = &blocks[b];
+        if (pool != NULL) {
+            thread_pool_wait(pool, &block->group);
+        }
+
+        if (status == SUCCESS) {
+            status = block->status;
+        }
+        if (status == SUCCESS) {
+            char      name[64];
+            MZ_TIME_T modified = block->modified;
+            snprintf(name, sizeof(name), SOLID_BLOCK_FORMAT, b);
+            status = add_compressed_entry_to_archive(archive, name, block->data,
+                                                     &block->entry, &modified);
+            if (options->verbose) {
+                fprintf(archive->log, "%s: %s (%d files)\n",
+                        status == SUCCESS ? "Adding" : "Error adding", name,
+                        block->count);
+            }
+            done.files += block->count;
+            done.blocks++;
+            done.input_bytes += block->size;
+            done.compressed_bytes += block->entry.comp_size;
+            if (b == 0 || block->modified > newest) {
+                newest = block->modified;
+            }
+        }
+
+        free(block->data);
+        free_compressed_entry(&block->entry);
+        memory_budget_release(archive->memory, block->reserved);
+    }
+
+    if (pool != NULL && pool != options->pool) {
+        thread_pool_destroy(pool);
+    }
+
+    if (status == SUCCESS) {
+        status = add_solid_index(archive, files, file_count, newest);
+    }
+    if (status == SUCCESS && options->verbose) {
+        fprintf(archive->log, "Solid blocks: %d files in %d blocks, %llu -> %llu bytes\n",
+                done.files, done.blocks, (unsigned long long)done.input_bytes,
+                (unsigned long long)done.compressed_bytes);
+    }
+    if (stats != NULL) {
+        *stats = done;
+    }
+
+    free(blocks);
+    free(files);
+    return status;
+}
+
+/* Extract a whole entry, through the codec for methods miniz cannot inflate */
+static int read_solid_entry(mz_zip_archive *reader, const char *name,
+                            unsigned char **data, size_t *size) {
+    int index = mz_zip_reader_locate_file(reader, name, NULL, MZ_ZIP_FLAG_CASE_SENSITIVE);
+    mz_zip_archive_file_stat stat;
+    if (index < 0 || !mz_zip_reader_file_stat(reader, (mz_uint)index, &stat)) {
+        return ERROR_FILE_NOT_FOUND;
+    }
+
+    size_t raw_size;
+    if (stat.m_method == ZIP_METHOD_STORE || stat.m_method == ZIP_METHOD_DEFLATE) {
+        *data = mz_zip_reader_extract_to_heap(reader, (mz_uint)index, size, 0);
+        return *data != NULL ? SUCCESS : ERROR_COMPRESSION;
+    }
+
+    const Codec_t *codec = codec_for_method(stat.m_method);
+    if (codec == NULL) {
+        return ERROR_COMPRESSION;
+    }
+    unsigned char *raw = mz_zip_reader_extract_to_heap(reader, (mz_uint)index, &raw_size,
+                                                       MZ_ZIP_FLAG_COMPRESSED_DATA);
+    if (raw == NULL) {
+        return ERROR_COMPRESSION;
+    }
+    *size = (size_t)stat.m_uncomp_size;
+    *data = malloc(*size > 0 ? *size : 1);
+    int status = *data != NULL ? codec->decompress(raw, raw_size, *data, *size)
+                               : ERROR_MEMORY_ALLOCATION;
+    mz_free(raw);
+    if (status == SUCCESS
+        && (mz_uint32)mz_crc32(MZ_CRC32_INIT, *data, *size) != stat.m_crc32) {
+        status = ERROR_COMPRESSION;
+    }
+    if (status != SUCCESS) {
+        free(*data);
+        *data = NULL;
+    }
+    return status;
+}
+
+/* Find name in the index; the index is modified in place while parsing */
+static int find_in_index(char *index, const char *name, int *block, size_t *offset,
+                         size_t *size, mz_uint32 *crc32) {
+    char *line = strtok(index, "\n");
+    if (line == NULL || strcmp(line, SOLID_INDEX_HEADER) != 0) {
+        return ERROR_COMPRESSION;
+    }
+
+    while ((line = strtok(NULL, "\n")) != NULL) {
+        unsigned long crc;
+        long long     modified;
+        int           name_start = 0;
+        if (sscanf(line, "%d %zu %zu %lx %lld %n", block, offset, size, &crc, &modified,
+                   &name_start)
+                < 5
+            || name_start == 0) {
+            return ERROR_COMPRESSION;
+        }
+        if (strcmp(line + name_start, name) == 0) {
+            *crc32 = (mz_uint32)crc;
+            return SUCCESS;
+        }
+    }
+    return ERROR_FILE_NOT_FOUND;
+}
+
+int solid_extract_file(const char *zip_path, const char *name, unsigned char **data,
+                       size_t *size) {
+    if (zip_path == NULL || name == NULL || data == NULL || size == NULL) {
+        return ERROR_INVALID_ARGS;
+    }
+    *data = NULL;
+    *size = 0;
+
+    mz_zip_archive reader;
+    memset(&reader, 0, sizeof(reader));
+    if (!mz_zip_reader_init_file(&reader, zip_path, 0)) {
+        return ERROR_FILE_NOT_FOUND;
+    }
+
+    unsigned char *index;
+    size_t         index_size;
+    int            status = read_solid_entry(&reader, SOLID_INDEX_NAME, &index, &index_size);
+    int            block;
+    size_t         offset, file_size;
+    mz_uint32      crc32;
+    if (status == SUCCESS) {
+        // The index has no terminator of its own
+        char *text = malloc(index_size + 1);
+        if (text == NULL) {
+            status = ERROR_MEMORY_ALLOCATION;
+        } else {
+            memcpy(text, index, index_size);
+            text[index_size] = '\0';
+            status = find_in_index(text, name, &block, &offset, &file_size, &crc32);
+            free(text);
+        }
+        free(index);
+    }
+
+    unsigned char *block_data = NULL;
+    size_t         block_size = 0;
+    if (status == SUCCESS) {
+        char block_name[64];
+        snprintf(block_name, sizeof(block_name), SOLID_BLOCK_FORMAT, block);
+        status = read_solid_entry(&reader, block_name, &block_data, &block_size);
+    }
+    if (status == SUCCESS && (offset > block_size || file_size > block_size - offset)) {
+        status = ERROR_COMPRESSION;
+    }
+    if (status == SUCCESS
+        && (mz_uint32)mz_crc32(MZ_CRC32_INIT, block_data + offset, file_size) != crc32) {
+        status = ERROR_COMPRESSION;
+    }
+    if (status == SUCCESS) {
+        *data = malloc(file_size > 0 ? file_size : 1);
+        if (*data == NULL) {
+            status = ERROR_MEMORY_ALLOCATION;
+        } else {
+            memcpy(*data, block_data + offset, file_size);
+            *size = file_size;
+        }
+    }
+
+    free(block_data);
+    mz_zip_reader_end(&reader);
+    return status;
+}
@@ -0,0 +1,162 @@
+/**
+ * @file thread_pool.c
+ * @brief Implementation of the worker pool
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "thread_pool.h"
+#include <unistd.h>
+
+struct ThreadPoolTask {
+    void (*fn)(void *);
+    void             *arg;
+    TaskGroup_t      *group;
+    ThreadPoolTask_t *next;
+};
+
+/* Pop the oldest queued task. Caller must hold pool->lock. */
+static ThreadPoolTask_t *pop_task(ThreadPool_t *pool) {
+    ThreadPoolTask_t *task = pool->head;
+    if (task != NULL) {
+        pool->head = task->next;
+        if (pool->head == NULL) {
+            pool->tail = NULL;
+        }
+    }
+    return task;
+}
+
+/* Run a popped task with the lock released, then account for it.
+ * Caller must hold pool->lock; it is held again on return. */
+static void run_task(ThreadPool_t *pool, ThreadPoolTask_t *task) {
+    pthread_mutex_unlock(&pool->lock);
+    task->fn(task->arg);
+    pthread_mutex_lock(&pool->lock);
+
+    task->group->pending--;
+    pthread_cond_broadcast(&pool->task_done);
+    free(task);
+}
+
+static void *worker_main(void *arg) {
+    ThreadPool_t *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        ThreadPoolTask_t *task = pop_task(pool);
+        if (task != NULL) {
+            run_task(pool, task);
+            continue;
+        }
+        if (pool->shutting_down) {
+            break;
+        }
+        pthread_cond_wait(&pool->task_ready, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+ThreadPool_t *thread_pool_create(int thread_count) {
+    if (thread_count < 1) {
+        return NULL;
+    }
+
+    ThreadPool_t *pool = calloc(1, sizeof(ThreadPool_t));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->threads = calloc((size_t)thread_count, sizeof(pthread_t));
+    if (pool->threads == NULL) {
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->task_ready, NULL);
+    pthread_cond_init(&pool->task_done, NULL);
+
+    for (int i = 0; i < thread_count; i++) {
+        if (pthread_create(&pool->threads[i], NULL, worker_main, pool) != 0) {
+            break;
+        }
+        pool->thread_count++;
+    }
+
+    if (pool->thread_count == 0) {
+        thread_pool_destroy(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+int thread_pool_submit(ThreadPool_t *pool, TaskGroup_t *group,
+                       void (*fn)(void *), void *arg) {
+    if (pool == NULL || group == NULL || fn == NULL) {
+        return ERROR_INVALID_ARGS;
+    }
+
+    ThreadPoolTask_t *task = malloc(sizeof(ThreadPoolTask_t));
+    if (task == NULL) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    task->fn = fn;
+    task->arg = arg;
+    task->group = group;
+    task->next = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    group->pending++;
+    if (pool->tail != NULL) {
+        pool->tail->next = task;
+    } else {
+        pool->head = task;
+    }
+    pool->tail = task;
+    pthread_cond_signal(&pool->task_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    return SUCCESS;
+}
+
+void thread_pool_wait(ThreadPool_t *pool, TaskGroup_t *group) {
+    pthread_mutex_lock(&pool->lock);
+    while (group->pending > 0) {
+        ThreadPoolTask_t *task = pop_task(pool);
+        if (task != NULL) {
+            run_task(pool, task);
+        } else {
+            pthread_cond_wait(&pool->task_done, &pool->lock);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void thread_pool_destroy(ThreadPool_t *pool) {
+    if (pool == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutting_down = true;
+    pthread_cond_broadcast(&pool->task_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->thread_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->task_done);
+    pthread_cond_destroy(&pool->task_ready);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool);
+}
+
+int thread_pool_cpu_count(void) {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+}
@@ -0,0 +1,104 @@
+/**
+ * @file time_budget.c
+ * @brief Implementation of the --time-budget level controller
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "time_budget.h"
+#include <math.h>
+#include <time.h>
+
+double time_budget_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void time_budget_init(TimeBudget_t *budget, double seconds, int start_level, int max_level,
+                      int workers, mz_uint64 total_bytes) {
+    memset(budget, 0, sizeof(TimeBudget_t));
+    if (max_level >= TIME_BUDGET_LEVELS) {
+        max_level = TIME_BUDGET_LEVELS - 1;
+    }
+    budget->budget = seconds;
+    budget->start = time_budget_now();
+    budget->max_level = max_level;
+    budget->level = start_level < max_level ? start_level : max_level;
+    budget->min_used = budget->level;
+    budget->max_used = budget->level;
+    budget->workers = workers > 0 ? workers : 1;
+    budget->remaining = total_bytes;
+}
+
+/* Whether a level has compressed enough to go by */
+static bool level_measured(const TimeBudget_t *budget, int level, double min_bytes) {
+    return budget->seconds[level] > 0 && budget->bytes[level] >= min_bytes;
+}
+
+/* Bytes per second one worker compresses at a level, or 0 if nothing has
+ * been measured at any level yet */
+static double level_rate(const TimeBudget_t *budget, int level) {
+    // Prefer well measured levels, but anything beats nothing
+    double thresholds[] = {TIME_BUDGET_MIN_BYTES, 0};
+
+    for (size_t t = 0; t < sizeof(thresholds) / sizeof(thresholds[0]); t++) {
+        if (level_measured(budget, level, thresholds[t])) {
+            return budget->bytes[level] / budget->seconds[level];
+        }
+
+        // Extrapolate from the nearest measured level
+        for (int distance = 1; distance < TIME_BUDGET_LEVELS; distance++) {
+            int below = level - distance;
+            int above = level + distance;
+            if (below >= 0 && level_measured(budget, below, thresholds[t])) {
+                return budget->bytes[below] / budget->seconds[below]
+                       / pow(TIME_BUDGET_LEVEL_COST, distance);
+            }
+            if (above < TIME_BUDGET_LEVELS && level_measured(budget, above, thresholds[t])) {
+                return budget->bytes[above] / budget->seconds[above]
+                       * pow(TIME_BUDGET_LEVEL_COST, distance);
+            }
+        }
+    }
+    return 0;
+}
+
+int time_budget_level(TimeBudget_t *budget) {
+    if (budget->level < budget->min_used) {
+        budget->min_used = budget->level;
+    }
+    if (budget->level > budget->max_used) {
+        budget->max_used = budget->level;
+    }
+    return budget->level;
+}
+
+void time_budget_record(TimeBudget_t *budget, int level, mz_uint64 bytes, double seconds) {
+    if (level < 0 || level >= TIME_BUDGET_LEVELS) {
+        return;
+    }
+    budget->bytes[level] += (double)bytes;
+    budget->seconds[level] += seconds;
+    budget->remaining = bytes < budget->remaining ? budget->remaining - bytes : 0;
+    // Wait until the current level has a measurement worth acting on
+    if (budget->remaining == 0 || budget->bytes[budget->level] < TIME_BUDGET_MIN_BYTES) {
+        return;
+    }
+
+    double left = budget->budget - (time_budget_now() - budget->start);
+    double rate = level_rate(budget, budget->level) * budget->workers;
+    if (rate <= 0) {
+        return;
+    }
+
+    // One step per entry keeps a single odd file from swinging the level
+    if (budget->level > 0 && budget->remaining / rate > left) {
+        budget->level--;
+    } else if (budget->level < budget->max_level) {
+        double next_rate = level_rate(budget, budget->level + 1) * budget->workers;
+        if (next_rate > 0 && budget->remaining / next_rate < left * TIME_BUDGET_HEADROOM) {
+            budget->level++;
+        }
+    }
+}
@@ -0,0 +1,123 @@
+/**
+* Benchmark for codec.c: compresses a submission corpus with each codec at
+* a few levels, checks every entry decompresses back to its input, and
+* reports the ratio and compress / decompress speed.
+*
+* Usage: ./bench_codec_out FILE...
+*   e.g. ./bench_codec_out $(find ../src ../include ../lib/miniz -type f)
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/codec.h"
+#include "../include/file_input.h"
+#include <time.h>
+
+#define BENCH_ROUNDS 3
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("Usage: %s FILE...\n", argv[0]);
+        return 1;
+    }
+
+    int file_count = argc - 1;
+    FileInput_t *inputs = calloc((size_t)file_count, sizeof(FileInput_t));
+    CompressedEntry_t *entries = calloc((size_t)file_count, sizeof(CompressedEntry_t));
+    unsigned char **outputs = calloc((size_t)file_count, sizeof(unsigned char *));
+    size_t total = 0;
+    for (int i = 0; i < file_count; i++) {
+        if (open_file_input(argv[i + 1], true, &inputs[i]) != SUCCESS) {
+            printf("Cannot read %s\n", argv[i + 1]);
+            return 1;
+        }
+        outputs[i] = malloc(inputs[i].size > 0 ? inputs[i].size : 1);
+        total += inputs[i].size;
+    }
+
+    struct {
+        const char *codec;
+        int         level;
+    } runs[] = {{"deflate", 1}, {"deflate", 6}, {"deflate", 9},
+                {"zstd", 1},    {"zstd", 3},    {"zstd", 9},   {"zstd", 19}};
+    int failures = 0;
+
+    printf("%d files, %zu bytes\n", file_count, total);
+    printf("%-8s %5s %12s %7s %13s %13s\n", "codec", "level", "bytes", "ratio",
+           "compress", "decompress");
+    for (size_t r = 0; r < sizeof(runs) / sizeof(runs[0]); r++) {
+        const Codec_t *codec = codec_by_name(runs[r].codec);
+
+        // Store fallback is off so every entry goes through the codec
+        double compress_best = 0;
+        size_t compressed = 0;
+        for (int round = 0; round < BENCH_ROUNDS; round++) {
+            compressed = 0;
+            double start = now_seconds();
+            for (int i = 0; i < file_count; i++) {
+                if (round > 0) {
+                    free_compressed_entry(&entries[i]);
+                }
+                if (codec->compress(inputs[i].data, inputs[i].size, runs[r].level, false,
+                                    &entries[i])
+                    != SUCCESS) {
+                    printf("%s: cannot compress %s\n", codec->name, argv[i + 1]);
+                    return 1;
+                }
+                compressed += entries[i].comp_size;
+            }
+            double elapsed = now_seconds() - start;
+            if (round == 0 || elapsed < compress_best) {
+                compress_best = elapsed;
+            }
+        }
+
+        double decompress_best = 0;
+        for (int round = 0; round < BENCH_ROUNDS; round++) {
+            double start = now_seconds();
+            for (int i = 0; i < file_count; i++) {
+                if (!entries[i].compressed) {
+                    continue;
+                }
+                if (codec->decompress(entries[i].data, entries[i].comp_size, outputs[i],
+                                      inputs[i].size)
+                    != SUCCESS) {
+                    failures++;
+                }
+            }
+            double elapsed = now_seconds() - start;
+            if (round == 0 || elapsed < decompress_best) {
+                decompress_best = elapsed;
+            }
+        }
+
+        for (int i = 0; i < file_count; i++) {
+            if (entries[i].compressed
+                && memcmp(outputs[i], inputs[i].data, inputs[i].size) != 0) {
+                printf("%s level %d: %s does not round-trip\n", codec->name, runs[r].level,
+                       argv[i + 1]);
+                failures++;
+            }
+            free_compressed_entry(&entries[i]);
+        }
+
+        printf("%-8s %5d %12zu %6.1f%% %8.1f MB/s %8.1f MB/s\n", codec->name, runs[r].level,
+               compressed, 100.0 * compressed / total, total / compress_best / 1e6,
+               total / decompress_best / 1e6);
+    }
+
+    for (int i = 0; i < file_count; i++) {
+        close_file_input(&inputs[i]);
+        free(outputs[i]);
+    }
+    free(inputs);
+    free(entries);
+    free(outputs);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,225 @@
+/**
+* Benchmark for file_list.c: heap, RSS and allocations needed to hold a
+* large file list, comparing one malloc'd string per path (what
+* add_file_to_list() used to do) with the interned directory + name store.
+*
+* The paths are synthetic (nothing is read from disk): file_count files
+* spread over directories of 100 under one deep submission directory. The
+* strings layout is filled without checking for duplicates; the file list
+* checks each path against its hash index as it always does. The last line
+* times adding dedup_count paths, each twice, with the linear strcmp() scan
+* add_file_to_list() used to do and with the hash index.
+*
+* Usage: ./bench_file_list_out [file_count] [dedup_count]
+*/
+
+#define _DEFAULT_SOURCE
+
+#include "../include/file_list.h"
+#include <malloc.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_BASE_DIR "/home/labtest/courses/cs2030s-2026/submissions/e0123456/project"
+#define BENCH_FILES_PER_DIR 100
+
+typedef struct {
+    size_t heap;        /* Bytes allocated on the heap */
+    size_t rss;         /* Resident memory */
+    size_t allocations; /* malloc()/realloc() calls */
+    double build;       /* Seconds to build the list */
+    double walk;        /* Seconds to get every full path back */
+} ListCost_t;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t resident_bytes(void) {
+    long  pages = 0, resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp != NULL) {
+        if (fscanf(fp, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(fp);
+    }
+    return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+/* Heap in use, counting blocks large enough to be mmap()ed */
+static size_t heap_bytes(void) {
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+static void synthetic_path(int i, char *path) {
+    snprintf(path, MAX_PATH_LENGTH,
+             BENCH_BASE_DIR "/src/package%02d/module%04d/Exercise%06d.java",
+             i / (BENCH_FILES_PER_DIR * 1000), i / BENCH_FILES_PER_DIR, i);
+}
+
+/* Every path its own string, as the old fixed char * array held them */
+static int cost_strings(int count, ListCost_t *cost) {
+    size_t heap = heap_bytes();
+    size_t rss = resident_bytes();
+    char   path[MAX_PATH_LENGTH];
+
+    double start = now_seconds();
+    char **list = malloc((size_t)count * sizeof(char *));
+    if (list == NULL) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    for (int i = 0; i < count; i++) {
+        synthetic_path(i, path);
+        list[i] = strdup(path);
+        if (list[i] == NULL) {
+            return ERROR_MEMORY_ALLOCATION;
+        }
+    }
+    cost->build = now_seconds() - start;
+    cost->allocations = (size_t)count + 1;
+    cost->heap = heap_bytes() - heap;
+    cost->rss = resident_bytes() - rss;
+
+    size_t total = 0;
+    start = now_seconds();
+    for (int i = 0; i < count; i++) {
+        total += strlen(list[i]);
+    }
+    cost->walk = now_seconds() - start;
+    return total > 0 ? SUCCESS : ERROR_IO;
+}
+
+static int cost_file_list(int count, ListCost_t *cost) {
+    size_t     heap = heap_bytes();
+    size_t     rss = resident_bytes();
+    char       path[MAX_PATH_LENGTH];
+    FileList_t list;
+
+    double start = now_seconds();
+    if (file_list_init(&list) != SUCCESS) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    for (int i = 0; i < count; i++) {
+        synthetic_path(i, path);
+        if (file_list_add(&list, path) != SUCCESS) {
+            return ERROR_MEMORY_ALLOCATION;
+        }
+    }
+    cost->build = now_seconds() - start;
+    cost->allocations = list.store->allocations;
+    cost->heap = heap_bytes() - heap;
+    cost->rss = resident_bytes() - rss;
+
+    size_t total = 0;
+    start = now_seconds();
+    for (int i = 0; i < count; i++) {
+        total += strlen(file_list_path(&list, i, path));
+    }
+    cost->walk = now_seconds() - start;
+    return total > 0 ? SUCCESS : ERROR_IO;
+}
+
+/* Measure in a fresh process so neither layout inherits the other's heap */
+static int measure(int (*cost_fn)(int, ListCost_t *), int count, ListCost_t *cost) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return ERROR_IO;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        ListCost_t child;
+        int        status = cost_fn(count, &child);
+        if (status == SUCCESS && write(fds[1], &child, sizeof(child)) != sizeof(child)) {
+            status = ERROR_IO;
+        }
+        _exit(status == SUCCESS ? 0 : 1);
+    }
+    close(fds[1]);
+    ssize_t got = pid > 0 ? read(fds[0], cost, sizeof(*cost)) : -1;
+    close(fds[0]);
+    int status = 1;
+    if (pid > 0) {
+        waitpid(pid, &status, 0);
+    }
+    return got == (ssize_t)sizeof(*cost) && status == 0 ? SUCCESS : ERROR_IO;
+}
+
+/* Add count paths twice, skipping duplicates by scanning the whole array */
+static double dedup_linear(int count) {
+    char **list = malloc((size_t)count * sizeof(char *));
+    int    added = 0;
+    char   path[MAX_PATH_LENGTH];
+    double start = now_seconds();
+    for (int i = 0; i < 2 * count && list != NULL; i++) {
+        synthetic_path(i % count, path);
+        bool found = false;
+        for (int j = 0; j < added && !found; j++) {
+            found = strcmp(list[j], path) == 0;
+        }
+        if (!found) {
+            list[added++] = strdup(path);
+        }
+    }
+    double elapsed = now_seconds() - start;
+    for (int i = 0; i < added; i++) {
+        free(list[i]);
+    }
+    free(list);
+    return elapsed;
+}
+
+static double dedup_hashed(int count) {
+    FileList_t list;
+    char       path[MAX_PATH_LENGTH];
+    if (file_list_init(&list) != SUCCESS) {
+        return -1;
+    }
+    double start = now_seconds();
+    for (int i = 0; i < 2 * count; i++) {
+        synthetic_path(i % count, path);
+        file_list_add(&list, path);
+    }
+    double elapsed = list.count == count ? now_seconds() - start : -1;
+    file_list_free(&list);
+    return elapsed;
+}
+
+static void print_cost(const char *layout, const ListCost_t *cost, int count) {
+    printf("%-10s %9.1f MB %9.1f MB %7.1f B %11zu %8.3f s %8.3f s\n", layout,
+           cost->heap / 1e6, cost->rss / 1e6, (double)cost->heap / count, cost->allocations,
+           cost->build, cost->walk);
+}
+
+int main(int argc, char **argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 1000000;
+    int dedup_count = argc > 2 ? atoi(argv[2]) : 20000;
+    if (count <= 0 || dedup_count <= 0) {
+        printf("Usage: %s [file_count] [dedup_count]\n", argv[0]);
+        return 1;
+    }
+
+    ListCost_t strings, interned;
+    if (measure(cost_strings, count, &strings) != SUCCESS
+        || measure(cost_file_list, count, &interned) != SUCCESS) {
+        printf("Benchmark failed\n");
+        return 1;
+    }
+
+    char example[MAX_PATH_LENGTH];
+    synthetic_path(count - 1, example);
+    printf("%d paths in %d directories, e.g. %s\n", count,
+           (count + BENCH_FILES_PER_DIR - 1) / BENCH_FILES_PER_DIR, example);
+    printf("%-10s %12s %12s %9s %11s %10s %10s\n", "layout", "heap", "RSS", "per path",
+           "allocations", "build", "all paths");
+    print_cost("strings", &strings, count);
+    print_cost("interned", &interned, count);
+    printf("Adding %d paths twice: linear scan %.3f s, hash index %.3f s\n", dedup_count,
+           dedup_linear(dedup_count), dedup_hashed(dedup_count));
+    return 0;
+}
@@ -0,0 +1,169 @@
+/**
+* Benchmark for glob_set.c: time to expand pattern_count optional patterns
+* over a tree of dir_count directories of files_per_dir files, one glob()
+* per pattern (expand_glob_pattern(), what the optional section used to
+* do) against all patterns in one walk (glob_set_match()). Pattern K is
+* d*, a slash and *.eK, for K below pattern_count, and the files carry
+* extensions e0 to e63, so every pattern reads every directory and the
+* files matched grow with the patterns. Both must add the same files in
+* the same order.
+*
+* The tree is created under root unless it exists already. Each expansion
+* runs rounds times and the best time is reported.
+*
+* Usage: ./bench_glob_out [root] [dir_count] [files_per_dir] [rounds]
+*/
+
+#define _DEFAULT_SOURCE
+
+#include "../include/config.h"
+#include "../include/glob_set.h"
+#include <sys/stat.h>
+#include <time.h>
+
+#define BENCH_EXTENSIONS 64
+
+static const int PATTERN_COUNTS[] = {1, 4, 16, 64};
+#define PATTERN_RUNS ((int)(sizeof(PATTERN_COUNTS) / sizeof(PATTERN_COUNTS[0])))
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int make_tree(const char *root, int dir_count, int files_per_dir) {
+    char path[MAX_PATH_LENGTH];
+    struct stat st;
+    if (stat(root, &st) == 0) {
+        return SUCCESS;
+    }
+    if (mkdir(root, 0755) != 0) {
+        return ERROR_IO;
+    }
+    for (int d = 0; d < dir_count; d++) {
+        snprintf(path, sizeof(path), "%s/d%d", root, d);
+        if (mkdir(path, 0755) != 0) {
+            return ERROR_IO;
+        }
+        for (int f = 0; f < files_per_dir; f++) {
+            snprintf(path, sizeof(path), "%s/d%d/f%d.e%d", root, d, f, f % BENCH_EXTENSIONS);
+            FILE *fp = fopen(path, "w");
+            if (fp == NULL) {
+                return ERROR_IO;
+            }
+            fclose(fp);
+        }
+    }
+    return SUCCESS;
+}
+
+/* Expand the first count patterns with glob() or in one glob set walk */
+static int expand(const char *root, int count, bool one_walk, FileList_t *list,
+                  long *directories) {
+    char patterns[BENCH_EXTENSIONS][32];
+    for (int k = 0; k < count; k++) {
+        snprintf(patterns[k], sizeof(patterns[k]), "d*/*.e%d", k);
+    }
+    if (!one_walk) {
+        for (int k = 0; k < count; k++) {
+            char full_path[MAX_PATH_LENGTH];
+            snprintf(full_path, sizeof(full_path), "%s/%s", root, patterns[k]);
+            if (expand_glob_pattern(full_path, list) != SUCCESS) {
+                return ERROR_IO;
+            }
+        }
+        return SUCCESS;
+    }
+
+    GlobSet_t set;
+    int       index[BENCH_EXTENSIONS];
+    int       status = glob_set_init(&set);
+    for (int k = 0; k < count && status == SUCCESS; k++) {
+        status = glob_set_add(&set, patterns[k], &index[k]);
+    }
+    if (status == SUCCESS) {
+        status = glob_set_match(&set, root);
+    }
+    for (int k = 0; k < count && status == SUCCESS; k++) {
+        status = glob_set_add_matches(&set, index[k], root, list);
+    }
+    *directories = set.directories;
+    glob_set_free(&set);
+    return status;
+}
+
+/* Best time of rounds expansions; the last list is kept */
+static double time_expand(const char *root, int count, bool one_walk, int rounds,
+                          FileList_t *list, long *directories) {
+    double best = 0;
+    for (int round = 0; round < rounds; round++) {
+        file_list_free(list);
+        if (file_list_init(list) != SUCCESS) {
+            return -1;
+        }
+        double start = now_seconds();
+        if (expand(root, count, one_walk, list, directories) != SUCCESS) {
+            return -1;
+        }
+        double elapsed = now_seconds() - start;
+        if (round == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+static bool same_list(const FileList_t *a, const FileList_t *b) {
+    if (a->count != b->count) {
+        return false;
+    }
+    for (int i = 0; i < a->count; i++) {
+        char left[MAX_PATH_LENGTH], right[MAX_PATH_LENGTH];
+        if (strcmp(file_list_path(a, i, left), file_list_path(b, i, right)) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    const char *root = argc > 1 ? argv[1] : "/tmp/bench_glob";
+    int         dir_count = argc > 2 ? atoi(argv[2]) : 500;
+    int         files_per_dir = argc > 3 ? atoi(argv[3]) : 128;
+    int         rounds = argc > 4 ? atoi(argv[4]) : 3;
+    if (dir_count < 1 || files_per_dir < 1 || rounds < 1) {
+        printf("Usage: %s [root] [dir_count] [files_per_dir] [rounds]\n", argv[0]);
+        return 1;
+    }
+    if (make_tree(root, dir_count, files_per_dir) != SUCCESS) {
+        printf("Cannot create %s\n", root);
+        return 1;
+    }
+
+    printf("%d directories of %d files, best of %d\n", dir_count, files_per_dir, rounds);
+    printf("%-9s %7s %11s %11s %15s\n", "patterns", "files", "glob()", "one walk",
+           "dirs read");
+    for (int run = 0; run < PATTERN_RUNS; run++) {
+        int        count = PATTERN_COUNTS[run];
+        FileList_t per_pattern, one_walk;
+        long       directories = 0;
+        file_list_init(&per_pattern);
+        file_list_init(&one_walk);
+        double globbed = time_expand(root, count, false, rounds, &per_pattern, &directories);
+        double walked = time_expand(root, count, true, rounds, &one_walk, &directories);
+        if (globbed < 0 || walked < 0) {
+            printf("Expanding failed\n");
+            return 1;
+        }
+        if (!same_list(&per_pattern, &one_walk)) {
+            printf("The one-walk list differs from glob()'s for %d patterns\n", count);
+            return 1;
+        }
+        printf("%-9d %7d %8.2f ms %8.2f ms %6ld vs %ld\n", count, one_walk.count,
+               globbed * 1e3, walked * 1e3, directories, (long)count * (dir_count + 1));
+        file_list_free(&per_pattern);
+        file_list_free(&one_walk);
+    }
+    return 0;
+}
@@ -0,0 +1,135 @@
+/**
+* Benchmark for the compiled .LT_FILES manifest (manifest.c): time to turn
+* a generated config of line_count lines into a manifest by parsing the
+* text, against loading the compiled form from the manifest cache. Both
+* times include reading the config file; the cached one also keys it.
+* The generated config mixes section headers, comments, blank lines,
+* required paths and optional globs, and the cached manifest must be entry
+* for entry the parsed one.
+*
+* Usage: ./bench_manifest_out [line_count] [rounds]
+*/
+
+#define _DEFAULT_SOURCE
+
+#include "../include/config.h"
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_DIR       "/tmp/bench_manifest"
+#define BENCH_CONFIG    BENCH_DIR "/.LT_FILES"
+#define BENCH_CACHE_DIR BENCH_DIR "/cache"
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int write_config(int line_count) {
+    FILE *fp = fopen(BENCH_CONFIG, "w");
+    if (fp == NULL) {
+        return ERROR_IO;
+    }
+    fprintf(fp, "# Generated by bench_manifest\n");
+    for (int line = 1; line < line_count; line++) {
+        int block = line / 500;
+        if (line % 500 == 0) {
+            fprintf(fp, block % 2 == 0 ? "required:\n" : "optional:\n");
+        } else if (line % 50 == 0) {
+            fprintf(fp, "  # part %d of the lab\n", line / 50);
+        } else if (line % 97 == 0) {
+            fprintf(fp, "\n");
+        } else if (block % 2 == 0) {
+            fprintf(fp, "  src/module_%d/file_%d.c\n", block, line);
+        } else {
+            fprintf(fp, "\tnotes/week_%d/*_%d.md   # optional notes\n", block, line);
+        }
+    }
+    return fclose(fp) == 0 ? SUCCESS : ERROR_IO;
+}
+
+static bool same_manifest(const Manifest_t *a, const Manifest_t *b) {
+    if (a->count != b->count) {
+        return false;
+    }
+    for (int i = 0; i < a->count; i++) {
+        if (a->entries[i].section != b->entries[i].section
+            || a->entries[i].flags != b->entries[i].flags
+            || strcmp(manifest_entry_path(a, i), manifest_entry_path(b, i)) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Best time of rounds loads, with or without the cache */
+static double time_loads(int rounds, bool cached, Manifest_t *result) {
+    double best = 0;
+    config_use_manifest_cache(cached ? BENCH_CACHE_DIR : NULL);
+    for (int round = 0; round < rounds; round++) {
+        Manifest_t manifest;
+        bool       hit;
+        double     start = now_seconds();
+        if (load_config_manifest(BENCH_CONFIG, &manifest, &hit) != SUCCESS || hit != cached) {
+            return -1;
+        }
+        double elapsed = now_seconds() - start;
+        if (round == 0 || elapsed < best) {
+            best = elapsed;
+        }
+        if (round == rounds - 1) {
+            *result = manifest;
+        } else {
+            manifest_free(&manifest);
+        }
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    int line_count = argc > 1 ? atoi(argv[1]) : 10000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 20;
+    if (line_count < 1 || rounds < 1) {
+        printf("Usage: %s [line_count] [rounds]\n", argv[0]);
+        return 1;
+    }
+
+    mkdir(BENCH_DIR, 0755);
+    if (write_config(line_count) != SUCCESS) {
+        printf("Cannot write %s\n", BENCH_CONFIG);
+        return 1;
+    }
+
+    // Fill the cache once, then time hits only
+    Manifest_t parsed, loaded;
+    config_use_manifest_cache(BENCH_CACHE_DIR);
+    if (load_config_manifest(BENCH_CONFIG, &loaded, NULL) != SUCCESS) {
+        printf("Cannot compile %s\n", BENCH_CONFIG);
+        return 1;
+    }
+    manifest_free(&loaded);
+
+    double text = time_loads(rounds, false, &parsed);
+    double compiled = time_loads(rounds, true, &loaded);
+    if (text < 0 || compiled < 0) {
+        printf("Loading failed\n");
+        return 1;
+    }
+    if (!same_manifest(&parsed, &loaded)) {
+        printf("Cached manifest differs from the parsed one\n");
+        return 1;
+    }
+
+    struct stat config_st;
+    stat(BENCH_CONFIG, &config_st);
+    printf("%d lines (%ld bytes), %d entries, best of %d\n", line_count,
+           (long)config_st.st_size, parsed.count, rounds);
+    printf("%-9s %9.3f ms\n", "text", text * 1e3);
+    printf("%-9s %9.3f ms\n", "compiled", compiled * 1e3);
+    printf("compiled loads %.1fx faster\n", compiled > 0 ? text / compiled : 0);
+    manifest_free(&parsed);
+    manifest_free(&loaded);
+    return 0;
+}
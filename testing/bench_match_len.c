@@ -0,0 +1,117 @@
+/**
+* Benchmark for match_len.c: deflates a source corpus at levels 6 and 9
+* with each match-extension kernel this CPU supports, checks the output is
+* byte-identical to the portable kernel, and reports the time taken.
+* bench_match_stock_out is the same program built without the hook, timing
+* miniz's own inlined byte loop, to compare the kernels against.
+*
+* Usage: ./bench_match_out FILE...
+*        ./bench_match_stock_out FILE...
+*   e.g. ./bench_match_out $(find ../src ../include -name "*.[ch]")
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/file_input.h"
+#include "../include/match_len.h"
+#include "../lib/miniz/miniz.h"
+#include <time.h>
+
+#define BENCH_ROUNDS 10
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("Usage: %s FILE...\n", argv[0]);
+        return 1;
+    }
+
+    int file_count = argc - 1;
+    FileInput_t *inputs = calloc((size_t)file_count, sizeof(FileInput_t));
+    void **reference = calloc((size_t)file_count, sizeof(void *));
+    size_t *reference_size = calloc((size_t)file_count, sizeof(size_t));
+    size_t total = 0;
+    for (int i = 0; i < file_count; i++) {
+        if (open_file_input(argv[i + 1], true, &inputs[i]) != SUCCESS) {
+            printf("Cannot read %s\n", argv[i + 1]);
+            return 1;
+        }
+        total += inputs[i].size;
+    }
+
+#ifdef USE_EXTERNAL_MZ_MATCH_LEN
+    const MatchLenVariant_t *variants;
+    int count = match_len_variants(&variants);
+    const char *active = match_len_active_variant();
+#else
+    // Stock miniz: the byte loop inlined in tdefl_find_match()
+    static const MatchLenVariant_t variants[] = {{"miniz", NULL}};
+    int count = 1;
+    const char *active = variants[0].name;
+#endif
+    int failures = 0;
+    int levels[] = {6, 9};
+
+    printf("%d files, %zu bytes, default kernel: %s\n", file_count, total, active);
+    for (int l = 0; l < 2; l++) {
+        mz_uint flags = tdefl_create_comp_flags_from_zip_params(
+            levels[l], -MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY);
+
+        for (int v = 0; v < count; v++) {
+#ifdef USE_EXTERNAL_MZ_MATCH_LEN
+            match_len_use_variant(variants[v].name);
+#endif
+
+            size_t compressed = 0;
+            double best = 0;
+            for (int r = 0; r < BENCH_ROUNDS; r++) {
+                compressed = 0;
+                double start = now_seconds();
+                for (int i = 0; i < file_count; i++) {
+                    size_t out_size = 0;
+                    void *out = tdefl_compress_mem_to_heap(inputs[i].data, inputs[i].size,
+                                                           &out_size, (int)flags);
+                    compressed += out_size;
+
+                    // The portable kernel's output is the reference
+                    if (v == 0 && r == 0) {
+                        reference[i] = out;
+                        reference_size[i] = out_size;
+                        continue;
+                    }
+                    if (out_size != reference_size[i]
+                        || memcmp(out, reference[i], out_size) != 0) {
+                        printf("%s: level %d output differs for %s\n", variants[v].name,
+                               levels[l], argv[i + 1]);
+                        failures++;
+                    }
+                    mz_free(out);
+                }
+                double elapsed = now_seconds() - start;
+                if (r == 0 || elapsed < best) {
+                    best = elapsed;
+                }
+            }
+
+            printf("level %d %-9s %8.3f s %7.1f MB/s %10zu bytes\n", levels[l],
+                   variants[v].name, best, total / best / 1e6, compressed);
+        }
+
+        for (int i = 0; i < file_count; i++) {
+            mz_free(reference[i]);
+        }
+    }
+
+    for (int i = 0; i < file_count; i++) {
+        close_file_input(&inputs[i]);
+    }
+    free(inputs);
+    free(reference);
+    free(reference_size);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,153 @@
+/**
+* Benchmark for prefetch.c and async_io.c: compresses a list of files one
+* after the other the way the serial archive loop does, writing the
+* compressed bytes through an OutputWriter, and reports the read-stall time
+* and wall time without read-ahead, with posix_fadvise() only, and with
+* reads ahead and writes behind on an I/O thread and on io_uring. The page
+* cache is dropped before every run (needs root; otherwise the files are
+* cached and there is little to save).
+*
+* Usage: ./bench_prefetch_out [-l LEVEL] FILE...
+*   e.g. ./bench_prefetch_out -l 1 $(find /some/submission -type f)
+*/
+
+#define _DEFAULT_SOURCE
+
+#include "../include/codec.h"
+#include "../include/output_writer.h"
+#include "../include/prefetch.h"
+#include "../include/time_budget.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+#define BENCH_ROUNDS 2
+#define BENCH_OUTPUT "/tmp/bench_prefetch.out"
+
+typedef struct {
+    const char      *name;
+    bool             enabled;
+    AsyncIoBackend_t io;
+} BenchMode_t;
+
+static const BenchMode_t MODES[] = {{"off", false, ASYNC_IO_SYNC},
+                                    {"advise", true, ASYNC_IO_SYNC},
+                                    {"threads", true, ASYNC_IO_THREADS},
+                                    {"io_uring", true, ASYNC_IO_URING}};
+#define MODE_COUNT ((int)(sizeof(MODES) / sizeof(MODES[0])))
+
+static bool drop_caches(void) {
+    sync();
+    int  fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+    bool dropped = fd >= 0 && write(fd, "3\n", 2) == 2;
+    if (fd >= 0) {
+        close(fd);
+    }
+    return dropped;
+}
+
+/* Compress every file in order into BENCH_OUTPUT; returns the wall time,
+ * negative on error */
+static double run(const FileList_t *list, int level, const BenchMode_t *mode,
+                  Prefetch_t *prefetch) {
+    const Codec_t  *codec = default_codec();
+    OutputWriter_t *output = output_writer_open(BENCH_OUTPUT, 0, false);
+    if (output == NULL) {
+        return -1;
+    }
+    if (mode->enabled && mode->io != ASYNC_IO_SYNC) {
+        output_writer_start_async(output, mode->io);
+    }
+    prefetch_init(prefetch, list, mode->enabled, mode->io);
+
+    int    status = SUCCESS;
+    double start = time_budget_now();
+    for (int i = 0; i < list->count && status == SUCCESS; i++) {
+        FileInput_t       input;
+        CompressedEntry_t entry;
+        char              path[MAX_PATH_LENGTH];
+        double            stall;
+
+        prefetch_advance(prefetch, i);
+        if (!prefetch_take_read(prefetch, i, &input, &stall)) {
+            status = prefetch_open_input(file_list_path(list, i, path), true, &input,
+                                         &stall);
+        }
+        if (status != SUCCESS) {
+            break;
+        }
+        double compress_start = time_budget_now();
+        status = codec->compress(input.data, input.size, level, true, &entry);
+        prefetch_record(prefetch, input.size, stall, time_budget_now() - compress_start);
+        if (status == SUCCESS) {
+            const unsigned char *data = entry.compressed ? entry.data : input.data;
+            if (output_writer_write(output, data, entry.comp_size) != entry.comp_size) {
+                status = ERROR_IO;
+            }
+            free_compressed_entry(&entry);
+        }
+        close_file_input(&input);
+    }
+    prefetch_finish(prefetch);
+    if (output_writer_close(output) != SUCCESS) {
+        status = ERROR_IO;
+    }
+    double elapsed = time_budget_now() - start;
+    unlink(BENCH_OUTPUT);
+    return status == SUCCESS ? elapsed : -1;
+}
+
+int main(int argc, char **argv) {
+    int level = 6;
+    int first = 1;
+    if (argc > 2 && strcmp(argv[1], "-l") == 0) {
+        level = atoi(argv[2]);
+        first = 3;
+    }
+    if (first >= argc) {
+        printf("Usage: %s [-l LEVEL] FILE...\n", argv[0]);
+        return 1;
+    }
+
+    FileList_t list;
+    if (file_list_init(&list) != SUCCESS) {
+        return 1;
+    }
+    for (int i = first; i < argc; i++) {
+        FileMeta_t meta;
+        if (file_meta_read(AT_FDCWD, argv[i], &meta) != SUCCESS
+            || file_list_add_meta(&list, argv[i], &meta) != SUCCESS) {
+            printf("Cannot read %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    bool   cold = true;
+    double wall[MODE_COUNT] = {0}, stall[MODE_COUNT] = {0};
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        for (int mode = 0; mode < MODE_COUNT; mode++) {
+            Prefetch_t prefetch;
+            cold = drop_caches() && cold;
+            double elapsed = run(&list, level, &MODES[mode], &prefetch);
+            if (elapsed < 0) {
+                printf("Compressing failed\n");
+                return 1;
+            }
+            wall[mode] += elapsed / BENCH_ROUNDS;
+            stall[mode] += prefetch.stall_seconds / BENCH_ROUNDS;
+            if (round == 0) {
+                print_prefetch_stats(stdout, &prefetch);
+            }
+        }
+    }
+
+    printf("%d files, level %d, %s cache, mean of %d\n", list.count, level,
+           cold ? "cold" : "warm (cannot drop caches)", BENCH_ROUNDS);
+    printf("%-11s %9s %9s\n", "read-ahead", "wall", "stalls");
+    for (int mode = 0; mode < MODE_COUNT; mode++) {
+        printf("%-11s %7.3f s %7.3f s\n", MODES[mode].name, wall[mode], stall[mode]);
+    }
+    printf("io_uring saves %.3f s of stalls, %.3f s of wall time over no read-ahead\n",
+           stall[0] - stall[MODE_COUNT - 1], wall[0] - wall[MODE_COUNT - 1]);
+    file_list_free(&list);
+    return 0;
+}
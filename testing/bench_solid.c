@@ -0,0 +1,141 @@
+/**
+* Benchmark for solid.c: archives a submission's files once with an entry
+* per file and once with --solid, reports the size and speed of each, and
+* checks that every packed file extracts back to its input.
+*
+* Usage: ./bench_solid_out [-l LEVEL] [--codec NAME] FILE...
+*   e.g. ./bench_solid_out $(find ../src ../include -type f)
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/archiver.h"
+#include "../include/file_input.h"
+#include "../include/solid.h"
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_ROUNDS 3
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Best of BENCH_ROUNDS runs; returns a negative time if archiving fails */
+static double time_archive(const FileList_t *file_list, const char *output_path,
+                           const ArchiveOptions_t *options) {
+    double best = -1;
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        double start = now_seconds();
+        if (create_archive_from_file_list(file_list, output_path, options)
+            != SUCCESS) {
+            return -1;
+        }
+        double elapsed = now_seconds() - start;
+        if (best < 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    ArchiveOptions_t options;
+    init_archive_options(&options);
+
+    int first = 1;
+    while (first + 1 < argc && argv[first][0] == '-') {
+        if (strcmp(argv[first], "-l") == 0) {
+            options.compression_level = atoi(argv[first + 1]);
+        } else if (strcmp(argv[first], "--codec") == 0) {
+            options.codec = codec_by_name(argv[first + 1]);
+            if (options.codec == NULL) {
+                printf("Unknown codec: %s\n", argv[first + 1]);
+                return 1;
+            }
+        } else {
+            break;
+        }
+        first += 2;
+    }
+    if (first >= argc) {
+        printf("Usage: %s [-l LEVEL] [--codec NAME] FILE...\n", argv[0]);
+        return 1;
+    }
+
+    FileList_t file_list;
+    size_t     total = 0;
+    if (file_list_init(&file_list) != SUCCESS) {
+        return 1;
+    }
+    for (int i = first; i < argc; i++) {
+        long size = get_file_size(argv[i]);
+        if (size < 0 || file_list_add(&file_list, argv[i]) != SUCCESS) {
+            printf("Cannot read %s\n", argv[i]);
+            return 1;
+        }
+        total += (size_t)size;
+    }
+
+    const char *standard_path = "bench_solid_standard.zip";
+    const char *solid_path = "bench_solid_solid.zip";
+    double      standard_time = time_archive(&file_list, standard_path, &options);
+    options.solid = true;
+    double      solid_time = time_archive(&file_list, solid_path, &options);
+    if (standard_time < 0 || solid_time < 0) {
+        printf("Archiving failed\n");
+        return 1;
+    }
+
+    struct stat standard_st, solid_st;
+    stat(standard_path, &standard_st);
+    stat(solid_path, &solid_st);
+
+    printf("%d files, %zu bytes, %s level %d\n", file_list.count, total, options.codec->name,
+           options.compression_level);
+    printf("%-10s %12s %7s %13s\n", "layout", "bytes", "ratio", "archive");
+    printf("%-10s %12lld %6.1f%% %8.1f MB/s\n", "per-entry", (long long)standard_st.st_size,
+           100.0 * standard_st.st_size / total, total / standard_time / 1e6);
+    printf("%-10s %12lld %6.1f%% %8.1f MB/s\n", "solid", (long long)solid_st.st_size,
+           100.0 * solid_st.st_size / total, total / solid_time / 1e6);
+
+    // Every packed file must come back out through the index
+    FileList_t solid_list, entry_list;
+    int        failures = 0;
+    if (partition_solid_files(&file_list, &solid_list, &entry_list) != SUCCESS) {
+        return 1;
+    }
+    double start = now_seconds();
+    for (int i = 0; i < solid_list.count; i++) {
+        unsigned char *data;
+        size_t         size;
+        FileInput_t    input;
+        char           path[MAX_PATH_LENGTH];
+        file_list_path(&solid_list, i, path);
+        if (solid_extract_file(solid_path, solid_list.entries[i].name, &data, &size)
+            != SUCCESS) {
+            printf("%s: not in the solid index\n", path);
+            failures++;
+            continue;
+        }
+        if (open_file_input(path, true, &input) != SUCCESS || input.size != size
+            || (size > 0 && memcmp(input.data, data, size) != 0)) {
+            printf("%s: extracts differently\n", path);
+            failures++;
+        }
+        close_file_input(&input);
+        free(data);
+    }
+    printf("Extracted %d solid files one by one in %.2f s, %d mismatches\n", solid_list.count,
+           now_seconds() - start, failures);
+
+    file_list_free(&solid_list);
+    file_list_free(&entry_list);
+    file_list_free(&file_list);
+    unlink(standard_path);
+    unlink(solid_path);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,33 @@
+/**
+* Testing for compress.c: parallel deflate must inflate back to the input
+* and its combined CRC must match a single pass over the data
+*/
+
+#include "../include/compress.h"
+
+
+int main(void) {
+    size_t size = 3 * PARALLEL_CHUNK_SIZE + 12345;
+    unsigned char *data = malloc(size);
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (unsigned char)((i * 7) ^ (i >> 9));
+    }
+
+    ThreadPool_t *pool = thread_pool_create(2);
+    CompressedEntry_t entry;
+    int stat = compress_entry_data_parallel(data, size, 6, false, pool, &entry);
+    printf("compress_entry_data_parallel %i\n", stat);
+
+    mz_uint32 crc = (mz_uint32)mz_crc32(MZ_CRC32_INIT, data, size);
+    printf("crc32 %s\n", crc == entry.crc32 ? "ok" : "MISMATCH");
+
+    size_t out_size = 0;
+    unsigned char *out = tinfl_decompress_mem_to_heap(entry.data, entry.comp_size, &out_size, 0);
+    printf("round trip %s\n",
+           (out != NULL && out_size == size && memcmp(out, data, size) == 0) ? "ok" : "MISMATCH");
+
+    mz_free(out);
+    free_compressed_entry(&entry);
+    thread_pool_destroy(pool);
+    free(data);
+}
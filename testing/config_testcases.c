@@ -2,8 +2,90 @@
 * Testing for individual config.c functions
 */
 
+#define _DEFAULT_SOURCE
+
 #include "../include/config.h"
+#include <sys/stat.h>
+
+static void write_file(const char *path, const char *text) {
+    FILE *fp = fopen(path, "w");
+    fputs(text, fp);
+    fclose(fp);
+}
 
+/* A required directory and an optional ** pattern that match the same files
+ * must add each file once */
+static int test_required_dir_and_glob_overlap(void) {
+    char base[] = "/tmp/config_test_XXXXXX";
+    char path[MAX_PATH_LENGTH];
+    if (mkdtemp(base) == NULL) {
+        return 1;
+    }
+    snprintf(path, sizeof(path), "%s/deep", base);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/deep/a", base);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/deep/a/x.txt", base);
+    write_file(path, "x\n");
+    snprintf(path, sizeof(path), "%s/deep/y.txt", base);
+    write_file(path, "y\n");
+    snprintf(path, sizeof(path), "%s/.LT_FILES", base);
+    write_file(path, "required:\n  deep/\noptional:\n  **/*.txt\n");
+
+    FileList_t list;
+    file_list_init(&list);
+    int status = parse_config_file(path, base, &list);
+    printf("overlap: %s, %d files (expected 2)\n", status == SUCCESS ? "parsed" : "failed",
+           list.count);
+    int failed = status != SUCCESS || list.count != 2;
+    file_list_free(&list);
+
+    char command[MAX_PATH_LENGTH + 16];
+    snprintf(command, sizeof(command), "rm -rf %s", base);
+    if (system(command) != 0) {
+        failed = 1;
+    }
+    return failed;
+}
+
+/* An optional directory is walked whether or not it ends in /, and
+ * skipped if it does not exist */
+static int test_optional_directory(void) {
+    char base[] = "/tmp/config_test_XXXXXX";
+    char path[MAX_PATH_LENGTH];
+    if (mkdtemp(base) == NULL) {
+        return 1;
+    }
+    snprintf(path, sizeof(path), "%s/data", base);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/data/sub", base);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/data/a.csv", base);
+    write_file(path, "a\n");
+    snprintf(path, sizeof(path), "%s/data/sub/b.csv", base);
+    write_file(path, "b\n");
+    snprintf(path, sizeof(path), "%s/more", base);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/more/c.csv", base);
+    write_file(path, "c\n");
+    snprintf(path, sizeof(path), "%s/.LT_FILES", base);
+    write_file(path, "optional:\n  data/\n  more\n  missing/\n");
+
+    FileList_t list;
+    file_list_init(&list);
+    int status = parse_config_file(path, base, &list);
+    printf("optional directory: %s, %d files (expected 3)\n",
+           status == SUCCESS ? "parsed" : "failed", list.count);
+    int failed = status != SUCCESS || list.count != 3;
+    file_list_free(&list);
+
+    char command[MAX_PATH_LENGTH + 16];
+    snprintf(command, sizeof(command), "rm -rf %s", base);
+    if (system(command) != 0) {
+        failed = 1;
+    }
+    return failed;
+}
 
 int main(void) {
     FILE *fp = fopen("config_test", "rb");
@@ -18,4 +100,8 @@ int main(void) {
 
     fclose(fp);
     free(buffer);
-}
\ No newline at end of file
+
+    int failed = test_required_dir_and_glob_overlap();
+    failed |= test_optional_directory();
+    return failed;
+}
@@ -0,0 +1,169 @@
+/*
+* Testing that --estimate's 95% range holds the size of the real archive
+*/
+
+#define _DEFAULT_SOURCE
+
+#include "../include/estimate.h"
+#include <sys/stat.h>
+
+static unsigned long long seed = 88172645463325252ULL;
+
+/* Deterministic, so the fixture is the same on every run */
+static unsigned int next_random(void) {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return (unsigned int)(seed >> 32);
+}
+
+/* Words from a small vocabulary, like source code and logs */
+static void fill_text(unsigned char *data, size_t size) {
+    static const char *words[] = {"int", "return", "status", "file", "list", "size",
+                                  "for", "if", "buffer", "count", "path", "error"};
+    size_t used = 0;
+    while (used < size) {
+        const char *word = words[next_random() % 12];
+        for (size_t i = 0; word[i] != '\0' && used < size; i++) {
+            data[used++] = (unsigned char)word[i];
+        }
+        if (used < size) {
+            data[used++] = next_random() % 10 == 0 ? '\n' : ' ';
+        }
+    }
+}
+
+static void fill_random(unsigned char *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (unsigned char)next_random();
+    }
+}
+
+/* Letters with no repeats to find: deflate gets only its Huffman codes */
+static void fill_letters(unsigned char *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (unsigned char)('@' + next_random() % 64);
+    }
+}
+
+static void fill_csv(unsigned char *data, size_t size) {
+    size_t used = 0;
+    for (int row = 0; used < size; row++) {
+        char line[64];
+        int  n = snprintf(line, sizeof(line), "%d,%u,0.%04u\n", row, next_random() % 1000,
+                          next_random() % 10000);
+        for (int i = 0; i < n && used < size; i++) {
+            data[used++] = (unsigned char)line[i];
+        }
+    }
+}
+
+/* Write a file whose first head bytes come from one filler and the rest
+ * from another, and add it to the list */
+static int write_fixture(FileList_t *list, const char *base, const char *name, size_t size,
+                         size_t head, void (*first)(unsigned char *, size_t),
+                         void (*rest)(unsigned char *, size_t)) {
+    char           path[MAX_PATH_LENGTH];
+    unsigned char *data = malloc(size);
+    if (data == NULL) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    first(data, head);
+    rest(data + head, size - head);
+
+    snprintf(path, sizeof(path), "%s/%s", base, name);
+    FILE *fp = fopen(path, "wb");
+    int   status = fp != NULL && fwrite(data, 1, size, fp) == size ? SUCCESS : ERROR_IO;
+    if (fp != NULL) {
+        fclose(fp);
+    }
+    free(data);
+    return status == SUCCESS ? file_list_add(list, path) : status;
+}
+
+/* Types whose content changes along their files, incompressible ones, a
+ * type stored after a compressible header and a type with a single file */
+static int build_mixed_fixture(FileList_t *list, const char *base) {
+    char name[64];
+    int  status = SUCCESS;
+    for (int i = 0; i < 20 && status == SUCCESS; i++) {
+        snprintf(name, sizeof(name), "m%d.c", i);
+        status = write_fixture(list, base, name, 2000 + next_random() % 40000, 0, fill_text,
+                               fill_text);
+    }
+    for (int i = 0; i < 3 && status == SUCCESS; i++) {
+        snprintf(name, sizeof(name), "run%d.log", i);
+        status = write_fixture(list, base, name, 2 * 1024 * 1024, 512 * 1024, fill_text,
+                               fill_letters);
+    }
+    for (int i = 0; i < 3 && status == SUCCESS; i++) {
+        snprintf(name, sizeof(name), "r%d.bin", i);
+        status = write_fixture(list, base, name, 300000 + next_random() % 700000, 0,
+                               fill_random, fill_random);
+    }
+    for (int i = 0; i < 2 && status == SUCCESS; i++) {
+        snprintf(name, sizeof(name), "mix%d.dat", i);
+        status = write_fixture(list, base, name, 2560 * 1024, 512 * 1024, fill_text,
+                               fill_random);
+    }
+    for (int i = 0; i < 10 && status == SUCCESS; i++) {
+        snprintf(name, sizeof(name), "t%d.csv", i);
+        status = write_fixture(list, base, name, 10000 + next_random() % 300000, 0, fill_csv,
+                               fill_csv);
+    }
+    if (status == SUCCESS) {
+        status = write_fixture(list, base, "one.pdf", 400000, 200000, fill_text, fill_random);
+    }
+    return status;
+}
+
+/* The archive written from a mixed fixture must land inside the range the
+ * estimate gave for it */
+static int test_estimate_range_holds_archive(void) {
+    char base[] = "/tmp/estimate_test_XXXXXX";
+    char output[MAX_PATH_LENGTH];
+    if (mkdtemp(base) == NULL) {
+        return 1;
+    }
+
+    FileList_t list;
+    file_list_init(&list);
+    ArchiveOptions_t options;
+    init_archive_options(&options);
+    ArchiveEstimate_t estimate;
+    struct stat       st;
+
+    snprintf(output, sizeof(output), "%s/archive.zip", base);
+    int status = build_mixed_fixture(&list, base);
+    if (status == SUCCESS) {
+        status = estimate_archive(&list, &options, &estimate);
+    }
+    if (status == SUCCESS) {
+        status = create_archive_from_file_list(&list, output, &options);
+    }
+    if (status == SUCCESS && stat(output, &st) != 0) {
+        status = ERROR_FILE_NOT_FOUND;
+    }
+
+    int failed = status != SUCCESS;
+    if (!failed) {
+        failed = (double)st.st_size < estimate.size_low
+                 || (double)st.st_size > estimate.size_high;
+        printf("estimate range: %lld bytes written, estimated %.0f (%.0f - %.0f)\n",
+               (long long)st.st_size, estimate.size, estimate.size_low, estimate.size_high);
+    } else {
+        printf("estimate range: failed (%d)\n", status);
+    }
+    file_list_free(&list);
+
+    char command[MAX_PATH_LENGTH + 16];
+    snprintf(command, sizeof(command), "rm -rf %s", base);
+    if (system(command) != 0) {
+        failed = 1;
+    }
+    return failed;
+}
+
+int main(void) {
+    return test_estimate_range_holds_archive();
+}